@@ -0,0 +1,611 @@
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+
+#include "sc_loop.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <pthread.h>
+#endif
+
+static int timer_count;
+static int periodic_count;
+
+static void on_timer(struct sc_loop *l, struct sc_loop_timer *t)
+{
+	(void) l;
+
+	assert(t->data == &timer_count);
+	timer_count++;
+}
+
+static void on_periodic(struct sc_loop *l, struct sc_loop_timer *t)
+{
+	periodic_count++;
+
+	if (periodic_count == 3) {
+		sc_loop_timer_stop(l, t);
+		sc_loop_stop(l);
+	}
+}
+
+void test_timer(void)
+{
+	struct sc_loop l;
+	struct sc_loop_timer t1, t2, t3;
+	uint64_t start;
+
+	assert(sc_loop_init(&l) == 0);
+	start = sc_loop_now(&l);
+
+	assert(sc_loop_timer_start(&l, &t1, 40, 0, on_timer, &timer_count) == 0);
+	// Restart replaces the previous schedule, it fires once.
+	assert(sc_loop_timer_start(&l, &t1, 50, 0, on_timer, &timer_count) == 0);
+	assert(sc_loop_timer_start(&l, &t2, 20, 30, on_periodic, NULL) == 0);
+	assert(sc_loop_timer_start(&l, &t3, 10, 0, on_timer, &timer_count) == 0);
+	sc_loop_timer_stop(&l, &t3);
+	sc_loop_timer_stop(&l, &t3);
+
+	assert(sc_loop_run(&l) == 0);
+
+	assert(periodic_count == 3);
+	assert(timer_count == 1);
+	assert(t1.id == SC_TIMER_INVALID);
+	assert(t2.id == SC_TIMER_INVALID);
+	assert(sc_loop_now(&l) - start >= 80);
+	assert(sc_loop_stats(&l)->timers == 4);
+	assert(sc_loop_stats(&l)->iterations > 0);
+
+	assert(sc_loop_term(&l) == 0);
+
+	// Loop sleeps until the timer, not in ticks.
+	assert(sc_loop_init(&l) == 0);
+	assert(sc_loop_timer_start(&l, &t1, 100, 0, on_timer, &timer_count) ==
+	       0);
+
+	while (timer_count == 1) {
+		assert(sc_loop_run_once(&l, -1) == 0);
+	}
+
+	assert(sc_loop_stats(&l)->iterations <= 3);
+	assert(sc_loop_term(&l) == 0);
+}
+
+static int read_count;
+
+static void on_read(struct sc_loop *l, struct sc_loop_watcher *w,
+		    uint32_t events)
+{
+	char c;
+	struct sc_sock_pipe *pipe = w->data;
+
+	assert(events == SC_SOCK_READ);
+	assert(sc_sock_pipe_read(pipe, &c, 1) == 1);
+	read_count++;
+
+	if (c == 'x') {
+		assert(sc_loop_unwatch(l, w, SC_SOCK_READ) == 0);
+		sc_loop_stop(l);
+	}
+}
+
+void test_watch(void)
+{
+	struct sc_loop l;
+	struct sc_sock_pipe pipe;
+	struct sc_loop_watcher w;
+
+	assert(sc_loop_init(&l) == 0);
+	assert(sc_sock_pipe_init(&pipe, 0) == 0);
+
+	assert(sc_loop_watch(&l, &w, &pipe.fdt, SC_SOCK_READ, on_read, &pipe) ==
+	       0);
+	assert(sc_sock_pipe_write(&pipe, "a", 1) == 1);
+	assert(sc_sock_pipe_write(&pipe, "b", 1) == 1);
+	assert(sc_sock_pipe_write(&pipe, "x", 1) == 1);
+
+	assert(sc_loop_run(&l) == 0);
+	assert(read_count == 3);
+	assert(sc_loop_stats(&l)->events >= 3);
+
+	struct sc_sock_fd bad = {.fd = -1, .op = SC_SOCK_NONE};
+	assert(sc_loop_watch(&l, &w, &bad, SC_SOCK_READ, on_read, NULL) != 0);
+	assert(*sc_loop_err(&l) != '\0');
+
+	assert(sc_sock_pipe_term(&pipe) == 0);
+	assert(sc_loop_term(&l) == 0);
+}
+
+static int defer_order[4];
+static int defer_count;
+static int idle_count;
+
+static void on_defer(struct sc_loop *l, struct sc_loop_task *t)
+{
+	(void) l;
+
+	defer_order[defer_count++] = *(int *) t->data;
+}
+
+static void on_defer_again(struct sc_loop *l, struct sc_loop_task *t)
+{
+	static int v = 3;
+
+	on_defer(l, t);
+	sc_loop_defer(l, t, on_defer, &v);
+}
+
+static void on_idle(struct sc_loop *l, struct sc_loop_task *t)
+{
+	idle_count++;
+
+	if (idle_count == 5) {
+		sc_loop_idle_stop(l, t);
+		sc_loop_stop(l);
+	}
+}
+
+void test_defer_idle(void)
+{
+	int v1 = 1, v2 = 2;
+	struct sc_loop l;
+	struct sc_loop_task t1, t2, idle, idle2;
+
+	assert(sc_loop_init(&l) == 0);
+
+	sc_loop_defer(&l, &t1, on_defer, &v1);
+	sc_loop_defer(&l, &t2, on_defer_again, &v2);
+
+	assert(sc_loop_run_once(&l, 1000) == 0);
+	assert(defer_count == 2);
+	assert(defer_order[0] == 1 && defer_order[1] == 2);
+
+	// Deferred from a deferred callback, runs on the next iteration
+	// without blocking.
+	assert(sc_loop_run_once(&l, 1000) == 0);
+	assert(defer_count == 3);
+	assert(defer_order[2] == 3);
+
+	sc_loop_idle_start(&l, &idle2, on_idle, NULL);
+	sc_loop_idle_start(&l, &idle, on_idle, NULL);
+	sc_loop_idle_stop(&l, &idle2);
+	sc_loop_idle_stop(&l, &idle2);
+
+	assert(sc_loop_run(&l) == 0);
+	assert(idle_count == 5);
+	assert(l.idle == NULL);
+
+	assert(sc_loop_term(&l) == 0);
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+
+enum
+{
+	POST_THREADS = 4,
+	POST_COUNT = 10000
+};
+
+static int post_count;
+static struct sc_loop_task post_tasks[POST_THREADS][POST_COUNT];
+static struct sc_loop_task stop_tasks[POST_THREADS];
+
+static void on_post(struct sc_loop *l, struct sc_loop_task *t)
+{
+	(void) l;
+	(void) t;
+
+	post_count++;
+}
+
+static void on_post_stop(struct sc_loop *l, struct sc_loop_task *t)
+{
+	static int done;
+
+	(void) t;
+
+	if (++done == POST_THREADS) {
+		sc_loop_stop(l);
+	}
+}
+
+static struct sc_loop post_loop;
+
+static void *post_thread(void *arg)
+{
+	int id = *(int *) arg;
+
+	for (int i = 0; i < POST_COUNT; i++) {
+		assert(sc_loop_post(&post_loop, &post_tasks[id][i], on_post,
+				    NULL) == 0);
+	}
+
+	assert(sc_loop_post(&post_loop, &stop_tasks[id], on_post_stop, NULL) ==
+	       0);
+
+	return NULL;
+}
+
+void test_post(void)
+{
+	int ids[POST_THREADS];
+	pthread_t threads[POST_THREADS];
+	struct sc_loop_stats *st;
+
+	assert(sc_loop_init(&post_loop) == 0);
+
+	for (int i = 0; i < POST_THREADS; i++) {
+		ids[i] = i;
+		assert(pthread_create(&threads[i], NULL, post_thread, &ids[i]) ==
+		       0);
+	}
+
+	assert(sc_loop_run(&post_loop) == 0);
+
+	for (int i = 0; i < POST_THREADS; i++) {
+		assert(pthread_join(threads[i], NULL) == 0);
+	}
+
+	assert(post_count == POST_THREADS * POST_COUNT);
+
+	st = sc_loop_stats(&post_loop);
+	assert(st->posts == POST_THREADS * POST_COUNT + POST_THREADS);
+
+	// Posts are batched, wakeups are far less than posts.
+	printf("posts : %llu, iterations : %llu \n",
+	       (unsigned long long) st->posts,
+	       (unsigned long long) st->iterations);
+
+	assert(sc_loop_term(&post_loop) == 0);
+}
+
+#else
+void test_post(void)
+{
+}
+#endif
+
+void test_stats(void)
+{
+	uint64_t total = 0;
+	struct sc_loop l;
+	struct sc_loop_stats *st;
+
+	assert(sc_loop_init(&l) == 0);
+
+	for (int i = 0; i < 10; i++) {
+		assert(sc_loop_run_once(&l, 1) == 0);
+	}
+
+	st = sc_loop_stats(&l);
+	assert(st->iterations == 10);
+	assert(st->wait_ns > 0);
+	assert(st->max_busy_ns >= st->last_busy_ns);
+
+	for (int i = 0; i < 40; i++) {
+		total += st->busy_hist[i];
+	}
+	assert(total == 10);
+
+	assert(sc_loop_term(&l) == 0);
+}
+
+static int pool_accepted;
+static struct sc_sock pool_srv[16];
+static int pool_cb_count;
+
+static void on_pool_accept(struct sc_loop *l, struct sc_loop_watcher *w,
+			   uint32_t events)
+{
+	(void) l;
+	(void) events;
+
+	assert(sc_sock_accept(w->data, &pool_srv[pool_accepted]) == 0);
+	pool_accepted++;
+}
+
+static void on_pool_conn(struct sc_loop_pool *p, struct sc_loop_pool_waiter *w,
+			 struct sc_loop_conn *c)
+{
+	(void) p;
+
+	pool_cb_count++;
+	*(struct sc_loop_conn **) w->data = c;
+}
+
+static void pool_run(struct sc_loop *l, int ms)
+{
+	uint64_t end = sc_loop_now(l) + (uint64_t) ms;
+
+	while (sc_loop_now(l) < end) {
+		assert(sc_loop_run_once(l, 5) == 0);
+	}
+}
+
+static void pool_wait(struct sc_loop *l, int *counter, int val)
+{
+	for (int i = 0; i < 1000 && *counter < val; i++) {
+		assert(sc_loop_run_once(l, 5) == 0);
+	}
+
+	assert(*counter == val);
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+
+static int hr_count;
+
+static void on_hrtimer(struct sc_loop *l, struct sc_loop_timer *t)
+{
+	if (++hr_count == 10) {
+		sc_loop_hrtimer_stop(l, t);
+		sc_loop_stop(l);
+	}
+}
+
+void test_hrtimer(void)
+{
+	struct sc_loop l;
+	struct sc_loop_timer t1, t2;
+	uint64_t start, elapsed;
+	struct timespec ts;
+
+	assert(sc_loop_init(&l) == 0);
+
+	assert(sc_loop_hrtimer_start(&l, &t2, 1000000000, 0, on_hrtimer, NULL) ==
+	       0);
+	sc_loop_hrtimer_stop(&l, &t2);
+	sc_loop_hrtimer_stop(&l, &t2);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	start = (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+
+	// 250 microseconds period.
+	assert(sc_loop_hrtimer_start(&l, &t1, 250000, 250000, on_hrtimer,
+				     NULL) == 0);
+	assert(sc_loop_run(&l) == 0);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	elapsed = (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec -
+		  start;
+
+	assert(hr_count == 10);
+	assert(t1.id == SC_TIMER_INVALID);
+	assert(elapsed >= 2500000);
+	assert(sc_loop_stats(&l)->timers == 10);
+
+	printf("hrtimer : 10 x 250us took %llu us \n",
+	       (unsigned long long) elapsed / 1000);
+
+	assert(sc_loop_term(&l) == 0);
+}
+
+static uint64_t wait_start;
+static uint64_t wait_elapsed;
+
+static uint64_t test_time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+static void on_timer_after_wait(struct sc_loop *l, struct sc_loop_timer *t)
+{
+	(void) t;
+
+	wait_elapsed = test_time_ms() - wait_start;
+	sc_loop_stop(l);
+}
+
+static void on_hrtimer_start(struct sc_loop *l, struct sc_loop_timer *t)
+{
+	// Runs after the loop blocked, the new timer must not inherit the time
+	// spent in the wait.
+	wait_start = test_time_ms();
+	assert(sc_loop_timer_start(l, t->data, 200, 0, on_timer_after_wait,
+				   NULL) == 0);
+}
+
+void test_timer_after_wait(void)
+{
+	struct sc_loop l;
+	struct sc_loop_timer hr, t;
+
+	assert(sc_loop_init(&l) == 0);
+	assert(sc_loop_hrtimer_start(&l, &hr, 300000000, 0, on_hrtimer_start,
+				     &t) == 0);
+	assert(sc_loop_run(&l) == 0);
+	assert(wait_elapsed >= 199);
+	assert(sc_loop_term(&l) == 0);
+}
+
+#else
+void test_hrtimer(void)
+{
+}
+
+void test_timer_after_wait(void)
+{
+}
+#endif
+
+void test_pool(void)
+{
+	int accepted;
+	struct sc_loop l;
+	struct sc_sock srv;
+	struct sc_loop_watcher sw;
+	struct sc_loop_pool p;
+	struct sc_loop_pool_dest *d;
+	struct sc_loop_pool_waiter w1, w2, w3, w4, w5;
+	struct sc_loop_conn *c, *c1 = NULL, *c2 = NULL, *c3 = NULL, *c4;
+	struct sc_loop_pool_conf conf = {
+		.min = 1,
+		.max = 2,
+		.idle_timeout = 50,
+		.connect_timeout = 1000,
+		.check_interval = 20,
+	};
+
+	assert(sc_loop_init(&l) == 0);
+	sc_sock_init(&srv, 0, false, SC_SOCK_INET);
+	assert(sc_sock_listen(&srv, "127.0.0.1", "8040") == 0);
+	assert(sc_loop_watch(&l, &sw, &srv.fdt, SC_SOCK_READ, on_pool_accept,
+			     &srv) == 0);
+
+	conf.max = 0;
+	conf.min = 20;
+	assert(sc_loop_pool_init(&p, &l, &conf) != 0);
+	assert(*sc_loop_pool_err(&p) != '\0');
+	conf.min = 1;
+	conf.max = 2;
+	assert(sc_loop_pool_init(&p, &l, &conf) == 0);
+
+	// Nothing to check out yet, waiters get connections as they connect.
+	assert(sc_loop_pool_get(&p, "127.0.0.1", "8040", &w1, on_pool_conn,
+				&c1) == NULL);
+	assert(errno == EAGAIN);
+	pool_wait(&l, &pool_cb_count, 1);
+	assert(c1 != NULL);
+
+	assert(sc_loop_pool_get(&p, "127.0.0.1", "8040", &w2, on_pool_conn,
+				&c2) == NULL);
+	assert(errno == EAGAIN);
+	pool_wait(&l, &pool_cb_count, 2);
+	assert(c2 != NULL && c2 != c1);
+
+	// At max, waits for a connection to be put back.
+	d = p.dests;
+#if !defined(_WIN32) && !defined(_WIN64)
+	assert(d->resolved && d->addr.family == AF_INET);
+#endif
+	assert(sc_loop_pool_get(&p, "127.0.0.1", "8040", &w3, on_pool_conn,
+				&c3) == NULL);
+	assert(errno == EAGAIN);
+	assert(d->waiting == 1 && d->count == 2);
+	sc_loop_pool_put(&p, c1, true);
+	assert(pool_cb_count == 3 && c3 == c1);
+
+	sc_loop_pool_put(&p, c3, true);
+	sc_loop_pool_put(&p, c2, true);
+	assert(d->idle == 2);
+
+	c = sc_loop_pool_get(&p, "127.0.0.1", "8040", NULL, NULL, NULL);
+	assert(c == c2);
+	sc_loop_pool_put(&p, c, true);
+
+	// Idle connections above 'min' are closed.
+	pool_run(&l, 150);
+	assert(d->count == 1 && d->idle == 1);
+	assert(pool_accepted == 2);
+
+	// Peer closes idle connections, pool drops them and reconnects to
+	// keep 'min' connections.
+	for (int i = 0; i < pool_accepted; i++) {
+		assert(sc_sock_term(&pool_srv[i]) == 0);
+	}
+
+	accepted = pool_accepted;
+	pool_wait(&l, &pool_accepted, accepted + 1);
+	pool_run(&l, 20);
+	assert(d->count == 1 && d->idle == 1);
+
+	// Broken connections are not reused.
+	c = sc_loop_pool_get(&p, "127.0.0.1", "8040", NULL, NULL, NULL);
+	assert(c != NULL);
+	sc_loop_pool_put(&p, c, false);
+	assert(d->count == 1 && d->connecting == 1);
+	pool_wait(&l, &pool_accepted, accepted + 2);
+
+	// Connect failure is reported to the waiter.
+	c4 = c1;
+	c = sc_loop_pool_get(&p, "127.0.0.1", "8041", &w4, on_pool_conn, &c4);
+	if (c == NULL && errno == EAGAIN) {
+		pool_wait(&l, &pool_cb_count, 4);
+		assert(c4 == NULL);
+	}
+
+	assert(sc_loop_pool_get(&p, "127.0.0.1", "8041", &w5, on_pool_conn,
+				&c4) == NULL);
+	sc_loop_pool_cancel(&p, &w5);
+	sc_loop_pool_cancel(&p, &w5);
+	pool_run(&l, 50);
+	assert(pool_cb_count <= 4);
+
+	sc_loop_pool_term(&p);
+
+	for (int i = accepted; i < pool_accepted; i++) {
+		assert(sc_sock_term(&pool_srv[i]) == 0);
+	}
+
+	assert(sc_sock_term(&srv) == 0);
+	assert(sc_loop_term(&l) == 0);
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+void test_pool_unix(void)
+{
+	int count;
+	struct sc_loop l;
+	struct sc_sock srv, peer;
+	struct sc_loop_pool p;
+	struct sc_loop_pool_waiter w;
+	struct sc_loop_conn *c, *out = NULL;
+	struct sc_loop_pool_conf conf = {
+		.family = SC_SOCK_UNIX,
+	};
+
+	assert(sc_loop_init(&l) == 0);
+	sc_sock_init(&srv, 0, true, SC_SOCK_UNIX);
+	assert(sc_sock_listen(&srv, "pool.sock", NULL) == 0);
+	assert(sc_loop_pool_init(&p, &l, &conf) == 0);
+
+	// Connect completes immediately, caller gets it without a callback.
+	count = pool_cb_count;
+	c = sc_loop_pool_get(&p, "pool.sock", "", &w, on_pool_conn, &out);
+	assert(c != NULL);
+	assert(pool_cb_count == count && out == NULL);
+	assert(p.dests->waiting == 0 && p.dests->count == 1);
+
+	assert(sc_sock_accept(&srv, &peer) == 0);
+	sc_loop_pool_put(&p, c, true);
+	assert(p.dests->idle == 1);
+
+	sc_loop_pool_term(&p);
+	assert(sc_sock_term(&peer) == 0);
+	assert(sc_sock_term(&srv) == 0);
+	remove("pool.sock");
+	assert(sc_loop_term(&l) == 0);
+}
+#else
+void test_pool_unix(void)
+{
+}
+#endif
+
+int main(void)
+{
+	assert(sc_sock_startup() == 0);
+
+	test_timer();
+	test_watch();
+	test_defer_idle();
+	test_post();
+	test_stats();
+	test_hrtimer();
+	test_timer_after_wait();
+	test_pool();
+	test_pool_unix();
+
+	assert(sc_sock_cleanup() == 0);
+
+	return 0;
+}
@@ -0,0 +1,1282 @@
+/*
+ * BSD-3-Clause
+ *
+ * Copyright 2021 Ozan Tezcan
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+
+#include "sc_loop.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+static uint64_t sc_loop_time_ns(void)
+{
+#if defined(_WIN32) || defined(_WIN64)
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER count;
+
+	if (freq.QuadPart == 0) {
+		QueryPerformanceFrequency(&freq);
+	}
+
+	QueryPerformanceCounter(&count);
+
+	return (uint64_t) (count.QuadPart / freq.QuadPart) * 1000000000 +
+	       (uint64_t) ((count.QuadPart % freq.QuadPart) * 1000000000 /
+			   freq.QuadPart);
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+static void sc_loop_set_err(struct sc_loop *l, const char *msg,
+			    const char *reason)
+{
+	snprintf(l->err, sizeof(l->err), "%s : %s", msg, reason);
+}
+
+const char *sc_loop_err(struct sc_loop *l)
+{
+	return l->err;
+}
+
+int sc_loop_init(struct sc_loop *l)
+{
+	int rc;
+
+	*l = (struct sc_loop){0};
+
+	l->now = sc_loop_time_ns() / 1000000;
+	sc_timer_init_tick(&l->timer, l->now, 1);
+
+	rc = sc_sock_poll_init(&l->poll);
+	if (rc != 0) {
+		sc_loop_set_err(l, "poll", sc_sock_poll_err(&l->poll));
+		return -1;
+	}
+
+	rc = sc_sock_notify_init(&l->wake, 0);
+	if (rc != 0) {
+		sc_loop_set_err(l, "notify", sc_sock_notify_err(&l->wake));
+		goto error_notify;
+	}
+
+	rc = sc_sock_poll_add(&l->poll, &l->wake.fdt, SC_SOCK_READ, &l->wake);
+	if (rc != 0) {
+		sc_loop_set_err(l, "poll", sc_sock_poll_err(&l->poll));
+		goto error;
+	}
+
+	// Without a timer fd, high resolution timers use poll timeout.
+	sc_timer_init_tick(&l->hrtimer, sc_loop_time_ns(), 1000);
+
+	rc = sc_sock_timer_init(&l->hrfd, 0);
+	if (rc == 0) {
+		rc = sc_sock_poll_add(&l->poll, &l->hrfd.fdt, SC_SOCK_READ,
+				      &l->hrfd);
+		if (rc != 0) {
+			sc_sock_timer_term(&l->hrfd);
+		}
+	}
+
+	l->hrfd_active = (rc == 0);
+
+	return 0;
+
+error:
+	sc_sock_notify_term(&l->wake);
+error_notify:
+	sc_sock_poll_term(&l->poll);
+	return -1;
+}
+
+int sc_loop_term(struct sc_loop *l)
+{
+	int rc = 0;
+
+	sc_timer_term(&l->timer);
+	sc_timer_term(&l->hrtimer);
+
+	if (l->hrfd_active && sc_sock_timer_term(&l->hrfd) != 0) {
+		sc_loop_set_err(l, "timer", sc_sock_timer_err(&l->hrfd));
+		rc = -1;
+	}
+
+	if (sc_sock_poll_term(&l->poll) != 0) {
+		sc_loop_set_err(l, "poll", sc_sock_poll_err(&l->poll));
+		rc = -1;
+	}
+
+	if (sc_sock_notify_term(&l->wake) != 0) {
+		sc_loop_set_err(l, "notify", sc_sock_notify_err(&l->wake));
+		rc = -1;
+	}
+
+	return rc;
+}
+
+uint64_t sc_loop_now(struct sc_loop *l)
+{
+	return l->now;
+}
+
+struct sc_loop_stats *sc_loop_stats(struct sc_loop *l)
+{
+	return &l->stats;
+}
+
+void sc_loop_stop(struct sc_loop *l)
+{
+	l->running = false;
+}
+
+int sc_loop_watch(struct sc_loop *l, struct sc_loop_watcher *w,
+		  struct sc_sock_fd *fdt, enum sc_sock_ev events,
+		  void (*cb)(struct sc_loop *, struct sc_loop_watcher *,
+			     uint32_t),
+		  void *data)
+{
+	int rc;
+
+	w->fdt = fdt;
+	w->cb = cb;
+	w->data = data;
+
+	rc = sc_sock_poll_add(&l->poll, fdt, events, w);
+	if (rc != 0) {
+		sc_loop_set_err(l, "poll", sc_sock_poll_err(&l->poll));
+	}
+
+	return rc;
+}
+
+int sc_loop_unwatch(struct sc_loop *l, struct sc_loop_watcher *w,
+		    enum sc_sock_ev events)
+{
+	int rc;
+
+	rc = sc_sock_poll_del(&l->poll, w->fdt, events, w);
+	if (rc != 0) {
+		sc_loop_set_err(l, "poll", sc_sock_poll_err(&l->poll));
+	}
+
+	return rc;
+}
+
+// Timer 'type' is '1' for high resolution timers.
+static void sc_loop_on_timer(void *arg, uint64_t timeout, uint64_t type,
+			     void *data)
+{
+	struct sc_loop *l = arg;
+	struct sc_loop_timer *t = data;
+	struct sc_timer *wheel = type ? &l->hrtimer : &l->timer;
+
+	(void) timeout;
+
+	l->stats.timers++;
+	t->id = SC_TIMER_INVALID;
+
+	// Re-arm before the callback, so the callback can stop it.
+	if (t->interval != 0) {
+		t->id = sc_timer_add(wheel, t->interval, type, t);
+	}
+
+	t->cb(l, t);
+}
+
+// Cancels the wheel entry if 't' is active. 't->id' may be garbage for a
+// timer which is never started, so the entry must point back to 't'.
+static void sc_loop_timer_cancel(struct sc_loop *l, struct sc_loop_timer *t)
+{
+	if (sc_timer_data(&l->timer, t->id) == t) {
+		sc_timer_cancel(&l->timer, &t->id);
+	} else if (sc_timer_data(&l->hrtimer, t->id) == t) {
+		sc_timer_cancel(&l->hrtimer, &t->id);
+	}
+}
+
+int sc_loop_timer_start(struct sc_loop *l, struct sc_loop_timer *t,
+			uint64_t timeout, uint64_t interval,
+			void (*cb)(struct sc_loop *, struct sc_loop_timer *),
+			void *data)
+{
+	sc_loop_timer_cancel(l, t);
+
+	t->interval = interval;
+	t->cb = cb;
+	t->data = data;
+
+	// Timeouts are relative to the wheel's last timestamp, which lags
+	// behind 'l->now' when called from a callback after a blocking wait.
+	if (l->now > l->timer.timestamp) {
+		timeout += l->now - l->timer.timestamp;
+	}
+
+	t->id = sc_timer_add(&l->timer, timeout, 0, t);
+
+	return t->id == SC_TIMER_INVALID ? -1 : 0;
+}
+
+void sc_loop_timer_stop(struct sc_loop *l, struct sc_loop_timer *t)
+{
+	sc_timer_cancel(&l->timer, &t->id);
+}
+
+// Arm the timer fd to the earliest high resolution timer, if it changed.
+static int sc_loop_hrtimer_arm(struct sc_loop *l)
+{
+	int rc;
+	uint64_t deadline;
+
+	if (!l->hrfd_active) {
+		return 0;
+	}
+
+	deadline = sc_timer_next_deadline(&l->hrtimer);
+	deadline = deadline == SC_TIMER_INVALID ? 0 : deadline;
+
+	if (deadline == l->hrfd.deadline) {
+		return 0;
+	}
+
+	rc = sc_sock_timer_arm(&l->hrfd, deadline);
+	if (rc != 0) {
+		sc_loop_set_err(l, "timer", sc_sock_timer_err(&l->hrfd));
+	}
+
+	return rc;
+}
+
+static void sc_loop_run_hrtimers(struct sc_loop *l)
+{
+	sc_timer_timeout(&l->hrtimer, sc_loop_time_ns(), l, sc_loop_on_timer);
+	sc_loop_hrtimer_arm(l);
+}
+
+int sc_loop_hrtimer_start(struct sc_loop *l, struct sc_loop_timer *t,
+			  uint64_t timeout_ns, uint64_t interval_ns,
+			  void (*cb)(struct sc_loop *, struct sc_loop_timer *),
+			  void *data)
+{
+	uint64_t now = sc_loop_time_ns();
+	uint64_t base = l->hrtimer.timestamp;
+
+	sc_loop_timer_cancel(l, t);
+
+	t->interval = interval_ns;
+	t->cb = cb;
+	t->data = data;
+
+	// Timeouts are relative to the wheel's last timestamp.
+	timeout_ns += now > base ? now - base : 0;
+
+	t->id = sc_timer_add(&l->hrtimer, timeout_ns, 1, t);
+	if (t->id == SC_TIMER_INVALID) {
+		sc_loop_set_err(l, "timer", "Out of memory");
+		return -1;
+	}
+
+	return sc_loop_hrtimer_arm(l);
+}
+
+void sc_loop_hrtimer_stop(struct sc_loop *l, struct sc_loop_timer *t)
+{
+	sc_timer_cancel(&l->hrtimer, &t->id);
+
+	// Leave the fd armed, an early wake up is cheaper than a syscall.
+}
+
+void sc_loop_defer(struct sc_loop *l, struct sc_loop_task *t,
+		   void (*cb)(struct sc_loop *, struct sc_loop_task *),
+		   void *data)
+{
+	t->next = NULL;
+	t->cb = cb;
+	t->data = data;
+
+	if (l->defer == NULL) {
+		l->defer = t;
+	} else {
+		l->defer_tail->next = t;
+	}
+
+	l->defer_tail = t;
+}
+
+void sc_loop_idle_start(struct sc_loop *l, struct sc_loop_task *t,
+			void (*cb)(struct sc_loop *, struct sc_loop_task *),
+			void *data)
+{
+	t->cb = cb;
+	t->data = data;
+	t->next = l->idle;
+	l->idle = t;
+}
+
+void sc_loop_idle_stop(struct sc_loop *l, struct sc_loop_task *t)
+{
+	struct sc_loop_task **p = &l->idle;
+
+	while (*p != NULL) {
+		if (*p == t) {
+			*p = t->next;
+			return;
+		}
+
+		p = &(*p)->next;
+	}
+}
+
+int sc_loop_post(struct sc_loop *l, struct sc_loop_task *t,
+		 void (*cb)(struct sc_loop *, struct sc_loop_task *),
+		 void *data)
+{
+	struct sc_loop_task *head;
+
+	t->cb = cb;
+	t->data = data;
+
+#if defined(_WIN32) || defined(_WIN64)
+	do {
+		head = l->posts;
+		t->next = head;
+	} while (InterlockedCompareExchangePointer((PVOID volatile *) &l->posts,
+						   t, head) != head);
+#else
+	head = __atomic_load_n(&l->posts, __ATOMIC_RELAXED);
+	do {
+		t->next = head;
+	} while (!__atomic_compare_exchange_n(&l->posts, &head, t, true,
+					      __ATOMIC_RELEASE,
+					      __ATOMIC_RELAXED));
+#endif
+
+	// Queue was empty, loop might be sleeping. Later posts are picked up
+	// together with this one.
+	if (head == NULL) {
+		return sc_sock_notify_post(&l->wake, 1);
+	}
+
+	return 0;
+}
+
+static void sc_loop_run_posts(struct sc_loop *l)
+{
+	uint64_t count;
+	struct sc_loop_task *list, *t, *next, *prev = NULL;
+
+	sc_sock_notify_read(&l->wake, &count);
+
+#if defined(_WIN32) || defined(_WIN64)
+	list = InterlockedExchangePointer((PVOID volatile *) &l->posts, NULL);
+#else
+	list = __atomic_exchange_n(&l->posts, NULL, __ATOMIC_ACQUIRE);
+#endif
+
+	// Most recent task is the first, reverse to run in post order.
+	while (list != NULL) {
+		next = list->next;
+		list->next = prev;
+		prev = list;
+		list = next;
+	}
+
+	for (t = prev; t != NULL; t = next) {
+		next = t->next;
+		l->stats.posts++;
+		t->cb(l, t);
+	}
+}
+
+static void sc_loop_run_defer(struct sc_loop *l)
+{
+	struct sc_loop_task *t, *next;
+
+	t = l->defer;
+	l->defer = NULL;
+	l->defer_tail = NULL;
+
+	for (; t != NULL; t = next) {
+		next = t->next;
+		t->cb(l, t);
+	}
+}
+
+static void sc_loop_run_idle(struct sc_loop *l)
+{
+	struct sc_loop_task *t, *next;
+
+	for (t = l->idle; t != NULL; t = next) {
+		next = t->next;
+		t->cb(l, t);
+	}
+}
+
+static void sc_loop_update_stats(struct sc_loop *l, uint64_t busy,
+				 uint64_t wait)
+{
+	uint32_t i = 0;
+	uint64_t v = busy;
+	struct sc_loop_stats *st = &l->stats;
+
+	while (v >>= 1) {
+		i++;
+	}
+
+	st->iterations++;
+	st->busy_ns += busy;
+	st->wait_ns += wait;
+	st->last_busy_ns = busy;
+	st->max_busy_ns = busy > st->max_busy_ns ? busy : st->max_busy_ns;
+
+	i = i < 40 ? i : 39;
+	st->busy_hist[i]++;
+}
+
+int sc_loop_run_once(struct sc_loop *l, int timeout)
+{
+	int n;
+	uint32_t events;
+	uint64_t count, next, timers, start, wait_start, wait_end;
+	void *data;
+	struct sc_loop_watcher *w;
+
+	start = sc_loop_time_ns();
+	l->now = start / 1000000;
+
+	timers = l->stats.timers;
+	sc_timer_timeout(&l->timer, l->now, l, sc_loop_on_timer);
+	sc_loop_run_hrtimers(l);
+
+	// Sleep until the next timer, or until an event if there is none.
+	next = sc_timer_next_deadline(&l->timer);
+	if (next != SC_TIMER_INVALID) {
+		next = next > l->now ? next - l->now : 0;
+		next = next < INT_MAX ? next : INT_MAX;
+
+		if (timeout < 0 || (uint64_t) timeout > next) {
+			timeout = (int) next;
+		}
+	}
+
+	if (!l->hrfd_active) {
+		next = sc_timer_next_deadline(&l->hrtimer);
+		if (next != SC_TIMER_INVALID) {
+			next = next > start ? (next - start + 999999) / 1000000 : 0;
+			next = next < INT_MAX ? next : INT_MAX;
+
+			if (timeout < 0 || (uint64_t) timeout > next) {
+				timeout = (int) next;
+			}
+		}
+	}
+
+	// Timer callbacks ran, return without blocking as there might be no
+	// timer left to wake up, e.g., a callback stopped the loop.
+	if (l->defer != NULL || l->idle != NULL || timers != l->stats.timers) {
+		timeout = 0;
+	}
+
+	wait_start = sc_loop_time_ns();
+	n = sc_sock_poll_wait(&l->poll, timeout);
+	wait_end = sc_loop_time_ns();
+
+	if (n < 0) {
+		sc_loop_set_err(l, "poll", sc_sock_poll_err(&l->poll));
+		return -1;
+	}
+
+	l->now = wait_end / 1000000;
+	l->stats.events += (uint64_t) n;
+
+	sc_sock_poll_foreach (&l->poll, n, data, events) {
+		if (data == &l->wake) {
+			sc_loop_run_posts(l);
+			continue;
+		}
+
+		if (data == &l->hrfd) {
+			sc_sock_timer_read(&l->hrfd, &count);
+			sc_loop_run_hrtimers(l);
+			continue;
+		}
+
+		w = data;
+		w->cb(l, w, events);
+	}
+
+	sc_loop_run_defer(l);
+
+	if (n == 0 && timers == l->stats.timers) {
+		sc_loop_run_idle(l);
+	}
+
+	sc_loop_update_stats(l,
+			     (wait_start - start) + (sc_loop_time_ns() - wait_end),
+			     wait_end - wait_start);
+
+	return 0;
+}
+
+int sc_loop_run(struct sc_loop *l)
+{
+	int rc;
+
+	l->running = true;
+
+	while (l->running) {
+		rc = sc_loop_run_once(l, -1);
+		if (rc != 0) {
+			l->running = false;
+			return rc;
+		}
+	}
+
+	return 0;
+}
+
+enum sc_loop_conn_state
+{
+	SC_LOOP_CONN_CONNECTING,
+	SC_LOOP_CONN_IDLE,
+	SC_LOOP_CONN_BUSY,
+	SC_LOOP_CONN_CLOSED,
+};
+
+static void sc_loop_pool_set_err(struct sc_loop_pool *p, const char *msg,
+				 const char *reason)
+{
+	snprintf(p->err, sizeof(p->err), "%s : %s", msg, reason);
+}
+
+const char *sc_loop_pool_err(struct sc_loop_pool *p)
+{
+	return p->err;
+}
+
+static void sc_loop_pool_enqueue(struct sc_loop_pool_dest *d,
+				 struct sc_loop_pool_waiter *w)
+{
+	w->next = NULL;
+	w->dest = d;
+
+	if (d->waiters == NULL) {
+		d->waiters = w;
+	} else {
+		d->waiters_tail->next = w;
+	}
+
+	d->waiters_tail = w;
+	d->waiting++;
+}
+
+static struct sc_loop_pool_waiter *
+sc_loop_pool_dequeue(struct sc_loop_pool_dest *d)
+{
+	struct sc_loop_pool_waiter *w = d->waiters;
+
+	if (w == NULL) {
+		return NULL;
+	}
+
+	d->waiters = w->next;
+	if (d->waiters == NULL) {
+		d->waiters_tail = NULL;
+	}
+
+	d->waiting--;
+	w->next = NULL;
+	w->dest = NULL;
+
+	return w;
+}
+
+static void sc_loop_pool_close(struct sc_loop_pool *p, struct sc_loop_conn *c)
+{
+	struct sc_loop_pool_dest *d = c->dest;
+
+	if (c->state == SC_LOOP_CONN_CLOSED) {
+		return;
+	}
+
+	if (c->state == SC_LOOP_CONN_IDLE) {
+		d->idle--;
+	} else if (c->state == SC_LOOP_CONN_CONNECTING) {
+		d->connecting--;
+	}
+
+	for (int i = 0; i < d->count; i++) {
+		if (d->conns[i] == c) {
+			d->conns[i] = d->conns[--d->count];
+			break;
+		}
+	}
+
+	sc_loop_unwatch(p->loop, &c->watcher, SC_SOCK_READ | SC_SOCK_WRITE);
+	sc_sock_term(&c->sock);
+
+	c->state = SC_LOOP_CONN_CLOSED;
+	c->next = p->closed;
+	p->closed = c;
+}
+
+static void sc_loop_pool_free_closed(struct sc_loop_pool *p)
+{
+	struct sc_loop_conn *c, *next;
+
+	for (c = p->closed; c != NULL; c = next) {
+		next = c->next;
+		sc_loop_free(c);
+	}
+
+	p->closed = NULL;
+}
+
+// Idle connections must not be readable, any data or EOF means the
+// connection can't be reused.
+static bool sc_loop_pool_alive(struct sc_loop_conn *c)
+{
+	char b;
+
+	return sc_sock_recv(&c->sock, &b, 1, MSG_PEEK) < 0 && errno == EAGAIN;
+}
+
+static void sc_loop_pool_on_event(struct sc_loop *l, struct sc_loop_watcher *w,
+				  uint32_t events);
+
+// Hand over a connected connection to the first waiter or keep it as idle.
+static void sc_loop_pool_release(struct sc_loop_pool *p,
+				 struct sc_loop_conn *c)
+{
+	int rc;
+	struct sc_loop_pool_waiter *w;
+	struct sc_loop_pool_dest *d = c->dest;
+
+	w = sc_loop_pool_dequeue(d);
+	if (w != NULL) {
+		c->state = SC_LOOP_CONN_BUSY;
+		c->since = sc_loop_now(p->loop);
+		w->cb(p, w, c);
+		return;
+	}
+
+	rc = sc_loop_watch(p->loop, &c->watcher, &c->sock.fdt, SC_SOCK_READ,
+			   sc_loop_pool_on_event, c);
+	if (rc != 0) {
+		sc_loop_pool_set_err(p, "watch", sc_loop_err(p->loop));
+		sc_loop_pool_close(p, c);
+		return;
+	}
+
+	c->state = SC_LOOP_CONN_IDLE;
+	c->since = sc_loop_now(p->loop);
+	d->idle++;
+}
+
+static void sc_loop_pool_connected(struct sc_loop_pool *p,
+				   struct sc_loop_conn *c)
+{
+	c->dest->connecting--;
+	c->state = SC_LOOP_CONN_BUSY;
+
+	// Unix domain sockets are connected in blocking mode.
+	if (p->conf.family == SC_SOCK_UNIX &&
+	    sc_sock_set_blocking(&c->sock, false) != 0) {
+		sc_loop_pool_set_err(p, "connect", sc_sock_error(&c->sock));
+		sc_loop_pool_close(p, c);
+		return;
+	}
+
+	sc_loop_pool_release(p, c);
+}
+
+// Connect failed or timed out, first waiter gets the failure. Others wait for
+// the remaining connections or for a retry on the next pool timer tick.
+static void sc_loop_pool_failed(struct sc_loop_pool *p, struct sc_loop_conn *c,
+				const char *reason)
+{
+	struct sc_loop_pool_waiter *w;
+	struct sc_loop_pool_dest *d = c->dest;
+
+	sc_loop_pool_set_err(p, "connect", reason);
+	sc_loop_pool_close(p, c);
+
+	w = sc_loop_pool_dequeue(d);
+	if (w != NULL) {
+		w->cb(p, w, NULL);
+	}
+}
+
+static void sc_loop_pool_on_event(struct sc_loop *l, struct sc_loop_watcher *w,
+				  uint32_t events)
+{
+	struct sc_loop_conn *c = w->data;
+	struct sc_loop_pool *p = c->pool;
+
+	(void) events;
+
+	switch (c->state) {
+	case SC_LOOP_CONN_CONNECTING:
+		sc_loop_unwatch(l, w, SC_SOCK_WRITE);
+		if (sc_sock_finish_connect(&c->sock) != 0) {
+			sc_loop_pool_failed(p, c, sc_sock_error(&c->sock));
+			return;
+		}
+
+		sc_loop_pool_connected(p, c);
+		break;
+	case SC_LOOP_CONN_IDLE:
+		if (!sc_loop_pool_alive(c)) {
+			sc_loop_pool_close(p, c);
+		}
+		break;
+	default:
+		// Closed in this iteration, memory is valid until the next tick.
+		break;
+	}
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+
+// Prefers the configured family, e.g., 'localhost' may resolve to both.
+static void sc_loop_pool_set_addr(struct sc_loop_pool *p,
+				  struct sc_loop_pool_dest *d)
+{
+	d->addr = d->req.addrs[0];
+
+	for (int i = 0; i < d->req.count; i++) {
+		if (d->req.addrs[i].family == p->conf.family) {
+			d->addr = d->req.addrs[i];
+			break;
+		}
+	}
+
+	d->resolved = true;
+	d->resolved_at = sc_loop_now(p->loop);
+}
+
+// Returns '1' if 'd' has an address to connect to, '0' if resolution is in
+// progress, negative number on failure. Stale address is used until the
+// refresh completes.
+static int sc_loop_pool_resolve(struct sc_loop_pool *p,
+				struct sc_loop_pool_dest *d)
+{
+	int rc;
+	uint64_t now = sc_loop_now(p->loop);
+
+	if (p->conf.family == SC_SOCK_UNIX || d->resolving ||
+	    (d->resolved && now - d->resolved_at < p->conf.resolve_ttl)) {
+		return p->conf.family == SC_SOCK_UNIX || d->resolved;
+	}
+
+	rc = sc_sock_resolve(&p->resolver, &d->req, d->host, d->port, d);
+	if (rc < 0) {
+		sc_loop_pool_set_err(p, "resolve",
+				     sc_sock_resolver_err(&p->resolver));
+		errno = EINVAL;
+		return d->resolved ? 1 : -1;
+	}
+
+	if (rc == 1 && d->req.count > 0) {
+		sc_loop_pool_set_addr(p, d);
+		return 1;
+	}
+
+	d->resolving = rc == 0;
+
+	return d->resolved;
+}
+
+static int sc_loop_pool_grow(struct sc_loop_pool *p,
+			     struct sc_loop_pool_dest *d);
+
+static void sc_loop_pool_on_resolve(struct sc_loop *l,
+				    struct sc_loop_watcher *w, uint32_t events)
+{
+	struct sc_loop_pool *p = w->data;
+	struct sc_loop_pool_dest *d;
+	struct sc_loop_pool_waiter *waiter;
+	struct sc_sock_resolve *req;
+
+	(void) l;
+	(void) events;
+
+	while ((req = sc_sock_resolver_next(&p->resolver)) != NULL) {
+		d = req->data;
+		d->resolving = false;
+
+		if (req->rc == 0 && req->count > 0) {
+			sc_loop_pool_set_addr(p, d);
+			sc_loop_pool_grow(p, d);
+			continue;
+		}
+
+		sc_loop_pool_set_err(p, "resolve", sc_sock_resolve_err(req));
+
+		// Keep using the stale address, waiters fail only if there
+		// is none.
+		if (d->resolved) {
+			continue;
+		}
+
+		while ((waiter = sc_loop_pool_dequeue(d)) != NULL) {
+			waiter->cb(p, waiter, NULL);
+		}
+	}
+}
+
+static int sc_loop_pool_start(struct sc_loop_pool *p,
+			      struct sc_loop_pool_dest *d,
+			      struct sc_loop_conn *c)
+{
+	if (p->conf.family == SC_SOCK_UNIX) {
+		sc_sock_init(&c->sock, 0, false, SC_SOCK_UNIX);
+		return sc_sock_connect(&c->sock, d->host, d->port, NULL, NULL);
+	}
+
+	sc_sock_init(&c->sock, 0, false, d->addr.family);
+	return sc_sock_connect_addr(&c->sock, &d->addr, NULL, NULL);
+}
+
+#else
+
+static int sc_loop_pool_resolve(struct sc_loop_pool *p,
+				struct sc_loop_pool_dest *d)
+{
+	(void) p;
+	(void) d;
+
+	return 1;
+}
+
+static int sc_loop_pool_start(struct sc_loop_pool *p,
+			      struct sc_loop_pool_dest *d,
+			      struct sc_loop_conn *c)
+{
+	sc_sock_init(&c->sock, 0, false, p->conf.family);
+	return sc_sock_connect(&c->sock, d->host, d->port, NULL, NULL);
+}
+
+#endif
+
+static int sc_loop_pool_connect(struct sc_loop_pool *p,
+				struct sc_loop_pool_dest *d)
+{
+	int rc;
+	struct sc_loop_conn *c;
+
+	c = sc_loop_malloc(sizeof(*c));
+	if (c == NULL) {
+		sc_loop_pool_set_err(p, "connect", "Out of memory");
+		errno = ENOMEM;
+		return -1;
+	}
+
+	*c = (struct sc_loop_conn){
+		.pool = p,
+		.dest = d,
+		.state = SC_LOOP_CONN_CONNECTING,
+		.since = sc_loop_now(p->loop),
+	};
+
+	c->watcher.fdt = &c->sock.fdt;
+
+	d->conns[d->count++] = c;
+	d->connecting++;
+
+	rc = sc_loop_pool_start(p, d, c);
+	if (rc == 0) {
+		sc_loop_pool_connected(p, c);
+		return 0;
+	}
+
+	if (errno != EAGAIN) {
+		rc = errno;
+		sc_loop_pool_set_err(p, "connect", sc_sock_error(&c->sock));
+		sc_loop_pool_close(p, c);
+		errno = rc;
+		return -1;
+	}
+
+	rc = sc_loop_watch(p->loop, &c->watcher, &c->sock.fdt, SC_SOCK_WRITE,
+			   sc_loop_pool_on_event, c);
+	if (rc != 0) {
+		sc_loop_pool_set_err(p, "watch", sc_loop_err(p->loop));
+		sc_loop_pool_close(p, c);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Start connects to stay above 'min' and to serve waiters, within 'max'.
+static int sc_loop_pool_grow(struct sc_loop_pool *p,
+			     struct sc_loop_pool_dest *d)
+{
+	int rc;
+
+	while (d->count < p->conf.max &&
+	       (d->count < p->conf.min ||
+		d->connecting + d->idle < d->waiting)) {
+		rc = sc_loop_pool_resolve(p, d);
+		if (rc <= 0) {
+			return rc;
+		}
+
+		if (sc_loop_pool_connect(p, d) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void sc_loop_pool_on_timer(struct sc_loop *l, struct sc_loop_timer *t)
+{
+	int i;
+	uint64_t now = sc_loop_now(l);
+	struct sc_loop_conn *c;
+	struct sc_loop_pool *p = t->data;
+	struct sc_loop_pool_dest *d;
+
+	// Timers run before polling, no events are pending for these.
+	sc_loop_pool_free_closed(p);
+
+	for (d = p->dests; d != NULL; d = d->next) {
+		i = 0;
+		while (i < d->count) {
+			c = d->conns[i];
+
+			if (c->state == SC_LOOP_CONN_CONNECTING &&
+			    now - c->since >= p->conf.connect_timeout) {
+				sc_loop_pool_failed(p, c, "Timed out");
+				i = 0;
+				continue;
+			}
+
+			if (c->state == SC_LOOP_CONN_IDLE &&
+			    d->count > p->conf.min &&
+			    now - c->since >= p->conf.idle_timeout) {
+				sc_loop_pool_close(p, c);
+				continue;
+			}
+
+			i++;
+		}
+
+		sc_loop_pool_grow(p, d);
+	}
+}
+
+static void sc_loop_pool_term_resolver(struct sc_loop_pool *p)
+{
+#if !defined(_WIN32) && !defined(_WIN64)
+	if (p->conf.family != SC_SOCK_UNIX) {
+		sc_loop_unwatch(p->loop, &p->resolver_watcher, SC_SOCK_READ);
+		sc_sock_resolver_term(&p->resolver);
+	}
+#else
+	(void) p;
+#endif
+}
+
+int sc_loop_pool_init(struct sc_loop_pool *p, struct sc_loop *l,
+		      struct sc_loop_pool_conf *conf)
+{
+	int rc;
+
+	*p = (struct sc_loop_pool){
+		.loop = l,
+		.conf = {
+			.family = SC_SOCK_INET,
+			.max = 16,
+			.idle_timeout = 60000,
+			.connect_timeout = 5000,
+			.check_interval = 1000,
+			.resolve_ttl = 30000,
+		},
+	};
+
+	if (conf != NULL) {
+		p->conf.family = conf->family ? conf->family : p->conf.family;
+		p->conf.min = conf->min;
+		p->conf.max = conf->max ? conf->max : p->conf.max;
+		p->conf.idle_timeout = conf->idle_timeout ?
+					       conf->idle_timeout :
+					       p->conf.idle_timeout;
+		p->conf.connect_timeout = conf->connect_timeout ?
+						  conf->connect_timeout :
+						  p->conf.connect_timeout;
+		p->conf.check_interval = conf->check_interval ?
+						 conf->check_interval :
+						 p->conf.check_interval;
+		p->conf.resolve_ttl = conf->resolve_ttl ?
+					      conf->resolve_ttl :
+					      p->conf.resolve_ttl;
+	}
+
+	if (p->conf.min < 0 || p->conf.max < p->conf.min) {
+		sc_loop_pool_set_err(p, "init", "Invalid min/max");
+		return -1;
+	}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+	if (p->conf.family != SC_SOCK_UNIX) {
+		rc = sc_sock_resolver_init(&p->resolver, 1, p->conf.resolve_ttl);
+		if (rc != 0) {
+			sc_loop_pool_set_err(p, "resolver",
+					     sc_sock_resolver_err(&p->resolver));
+			return -1;
+		}
+
+		rc = sc_loop_watch(l, &p->resolver_watcher,
+				   &p->resolver.pipe.fdt, SC_SOCK_READ,
+				   sc_loop_pool_on_resolve, p);
+		if (rc != 0) {
+			sc_loop_pool_set_err(p, "watch", sc_loop_err(l));
+			sc_sock_resolver_term(&p->resolver);
+			return -1;
+		}
+	}
+#endif
+
+	rc = sc_loop_timer_start(l, &p->timer, p->conf.check_interval,
+				 p->conf.check_interval, sc_loop_pool_on_timer,
+				 p);
+	if (rc != 0) {
+		sc_loop_pool_set_err(p, "timer", "Out of memory");
+		sc_loop_pool_term_resolver(p);
+		return -1;
+	}
+
+	return 0;
+}
+
+void sc_loop_pool_term(struct sc_loop_pool *p)
+{
+	struct sc_loop_pool_dest *d, *next;
+
+	sc_loop_timer_stop(p->loop, &p->timer);
+
+	// Resolver threads may be writing into the requests of destinations.
+	sc_loop_pool_term_resolver(p);
+
+	for (d = p->dests; d != NULL; d = next) {
+		next = d->next;
+
+		while (sc_loop_pool_dequeue(d) != NULL) {
+		}
+
+		while (d->count > 0) {
+			sc_loop_pool_close(p, d->conns[0]);
+		}
+
+		sc_loop_free(d->conns);
+		sc_loop_free(d);
+	}
+
+	p->dests = NULL;
+	sc_loop_pool_free_closed(p);
+}
+
+static struct sc_loop_pool_dest *sc_loop_pool_dest(struct sc_loop_pool *p,
+						   const char *host,
+						   const char *port)
+{
+	size_t host_len, port_len;
+	struct sc_loop_pool_dest *d;
+
+	for (d = p->dests; d != NULL; d = d->next) {
+		if (strcmp(d->host, host) == 0 && strcmp(d->port, port) == 0) {
+			return d;
+		}
+	}
+
+	host_len = strlen(host);
+	port_len = strlen(port);
+
+	if (host_len >= sizeof(d->host) || port_len >= sizeof(d->port)) {
+		sc_loop_pool_set_err(p, "get", "Destination is too long");
+		errno = EINVAL;
+		return NULL;
+	}
+
+	d = sc_loop_malloc(sizeof(*d));
+	if (d == NULL) {
+		goto oom;
+	}
+
+	*d = (struct sc_loop_pool_dest){0};
+
+	d->conns = sc_loop_malloc(sizeof(*d->conns) * (size_t) p->conf.max);
+	if (d->conns == NULL) {
+		sc_loop_free(d);
+		goto oom;
+	}
+
+	memcpy(d->host, host, host_len + 1);
+	memcpy(d->port, port, port_len + 1);
+
+	d->next = p->dests;
+	p->dests = d;
+
+	return d;
+
+oom:
+	sc_loop_pool_set_err(p, "get", "Out of memory");
+	errno = ENOMEM;
+	return NULL;
+}
+
+struct sc_loop_conn *
+sc_loop_pool_get(struct sc_loop_pool *p, const char *host, const char *port,
+		 struct sc_loop_pool_waiter *w,
+		 void (*cb)(struct sc_loop_pool *, struct sc_loop_pool_waiter *,
+			    struct sc_loop_conn *),
+		 void *data)
+{
+	int rc;
+	bool grown = false;
+	struct sc_loop_conn *c;
+	struct sc_loop_pool_dest *d;
+
+	d = sc_loop_pool_dest(p, host, port);
+	if (d == NULL) {
+		return NULL;
+	}
+
+retry:
+	while (d->idle > 0) {
+		c = NULL;
+
+		// Most recently used one, so the rest can time out.
+		for (int i = 0; i < d->count; i++) {
+			if (d->conns[i]->state == SC_LOOP_CONN_IDLE &&
+			    (c == NULL || d->conns[i]->since >= c->since)) {
+				c = d->conns[i];
+			}
+		}
+
+		if (!sc_loop_pool_alive(c)) {
+			sc_loop_pool_close(p, c);
+			continue;
+		}
+
+		sc_loop_unwatch(p->loop, &c->watcher, SC_SOCK_READ);
+		c->state = SC_LOOP_CONN_BUSY;
+		c->since = sc_loop_now(p->loop);
+		d->idle--;
+
+		return c;
+	}
+
+	if (!grown) {
+		// Caller counts as a waiter while growing. Connects which
+		// complete immediately, e.g., unix domain sockets, go to the
+		// queued waiters first, then to the caller.
+		grown = true;
+		d->waiting += (w != NULL);
+		rc = sc_loop_pool_grow(p, d);
+		d->waiting -= (w != NULL);
+
+		if (d->idle > 0) {
+			goto retry;
+		}
+
+		// Nothing to wait for.
+		if (rc < 0 && d->count == 0) {
+			return NULL;
+		}
+	}
+
+	if (w != NULL) {
+		w->cb = cb;
+		w->data = data;
+		sc_loop_pool_enqueue(d, w);
+	}
+
+	errno = EAGAIN;
+	return NULL;
+}
+
+void sc_loop_pool_put(struct sc_loop_pool *p, struct sc_loop_conn *c,
+		      bool reuse)
+{
+	if (!reuse || !sc_loop_pool_alive(c)) {
+		sc_loop_pool_close(p, c);
+		sc_loop_pool_grow(p, c->dest);
+		return;
+	}
+
+	sc_loop_pool_release(p, c);
+}
+
+void sc_loop_pool_cancel(struct sc_loop_pool *p, struct sc_loop_pool_waiter *w)
+{
+	struct sc_loop_pool_waiter **it;
+	struct sc_loop_pool_dest *d = w->dest;
+
+	(void) p;
+
+	if (d == NULL) {
+		return;
+	}
+
+	for (it = &d->waiters; *it != NULL; it = &(*it)->next) {
+		if (*it == w) {
+			*it = w->next;
+			d->waiting--;
+			break;
+		}
+	}
+
+	d->waiters_tail = NULL;
+	for (it = &d->waiters; *it != NULL; it = &(*it)->next) {
+		d->waiters_tail = *it;
+	}
+
+	w->next = NULL;
+	w->dest = NULL;
+}
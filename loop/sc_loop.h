@@ -0,0 +1,466 @@
+/*
+ * BSD-3-Clause
+ *
+ * Copyright 2021 Ozan Tezcan
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SC_LOOP_H
+#define SC_LOOP_H
+
+#define SC_LOOP_VERSION "1.0.0"
+
+#include "sc_sock.h"
+#include "sc_timer.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef SC_HAVE_CONFIG_H
+#include "config.h"
+#else
+#define sc_loop_malloc malloc
+#define sc_loop_free free
+#endif
+
+struct sc_loop;
+
+// fd watcher
+struct sc_loop_watcher {
+	struct sc_sock_fd *fdt;
+	void (*cb)(struct sc_loop *l, struct sc_loop_watcher *w,
+		   uint32_t events);
+	void *data;
+};
+
+struct sc_loop_timer {
+	uint64_t id;
+	uint64_t interval;
+	void (*cb)(struct sc_loop *l, struct sc_loop_timer *t);
+	void *data;
+};
+
+// Deferred, idle and posted callbacks.
+struct sc_loop_task {
+	struct sc_loop_task *next;
+	void (*cb)(struct sc_loop *l, struct sc_loop_task *t);
+	void *data;
+};
+
+struct sc_loop_stats {
+	uint64_t iterations;
+	uint64_t events;
+	uint64_t timers;
+	uint64_t posts;
+	// Total nanoseconds spent in poll and in callbacks.
+	uint64_t wait_ns;
+	uint64_t busy_ns;
+	// Callback time of the last and the slowest iteration.
+	uint64_t last_busy_ns;
+	uint64_t max_busy_ns;
+	// Iteration count by callback time, bucket 'i' counts iterations that
+	// took [2^i, 2^(i+1)) nanoseconds.
+	uint64_t busy_hist[40];
+};
+
+struct sc_loop {
+	struct sc_sock_poll poll;
+	struct sc_timer timer;
+	struct sc_sock_notify wake;
+
+	// High resolution timers, on a separate wheel with microsecond ticks.
+	// They share a single timer fd which is armed to the earliest deadline.
+	struct sc_timer hrtimer;
+	struct sc_sock_timer hrfd;
+	bool hrfd_active;
+
+	bool running;
+	uint64_t now;
+
+	struct sc_loop_task *defer;
+	struct sc_loop_task *defer_tail;
+	struct sc_loop_task *idle;
+
+	// Posted tasks, pushed by any thread, most recent first.
+	struct sc_loop_task *posts;
+
+	struct sc_loop_stats stats;
+	char err[128];
+};
+
+/**
+ * @param l loop
+ * @return  '0' on success, negative number on failure.
+ *          call sc_loop_err() for error string.
+ */
+int sc_loop_init(struct sc_loop *l);
+
+/**
+ * Posted tasks which are not run yet are dropped.
+ *
+ * @param l loop
+ * @return  '0' on success, negative number on failure.
+ *          call sc_loop_err() for error string.
+ */
+int sc_loop_term(struct sc_loop *l);
+
+/**
+ * Run until sc_loop_stop() is called.
+ *
+ * @param l loop
+ * @return  '0' on success, negative number on failure.
+ *          call sc_loop_err() for error string.
+ */
+int sc_loop_run(struct sc_loop *l);
+
+/**
+ * Run a single iteration : expired timers, fd events, posted tasks, deferred
+ * callbacks and if there was nothing else to do, idle callbacks. Doesn't block
+ * if a timer expired in this iteration.
+ *
+ * @param l       loop
+ * @param timeout max milliseconds to wait for events, '-1' to wait until
+ *                the next timer, or until an event if there is no timer.
+ * @return        '0' on success, negative number on failure.
+ *                call sc_loop_err() for error string.
+ */
+int sc_loop_run_once(struct sc_loop *l, int timeout);
+
+/**
+ * Make sc_loop_run() return after the current iteration. Must be called from
+ * the loop thread, post a task to stop from other threads.
+ *
+ * @param l loop
+ */
+void sc_loop_stop(struct sc_loop *l);
+
+/**
+ * @param l loop
+ * @return  cached monotonic timestamp of the current iteration in
+ *          milliseconds.
+ */
+uint64_t sc_loop_now(struct sc_loop *l);
+
+/**
+ * Watch fd events. Calling again for the same watcher adds 'events'.
+ *
+ * @param l      loop
+ * @param w      watcher, must be valid until sc_loop_unwatch().
+ * @param fdt    fd
+ * @param events SC_SOCK_READ, SC_SOCK_WRITE, optionally with SC_SOCK_EDGE.
+ * @param cb     callback
+ * @param data   user data
+ * @return       '0' on success, negative number on failure.
+ *               call sc_loop_err() for error string.
+ */
+int sc_loop_watch(struct sc_loop *l, struct sc_loop_watcher *w,
+		  struct sc_sock_fd *fdt, enum sc_sock_ev events,
+		  void (*cb)(struct sc_loop *, struct sc_loop_watcher *,
+			     uint32_t),
+		  void *data);
+
+/**
+ * @param l      loop
+ * @param w      watcher
+ * @param events events to remove
+ * @return       '0' on success, negative number on failure.
+ *               call sc_loop_err() for error string.
+ */
+int sc_loop_unwatch(struct sc_loop *l, struct sc_loop_watcher *w,
+		    enum sc_sock_ev events);
+
+/**
+ * Start a timer on the timing wheel, with millisecond resolution. Loop sleeps
+ * until the earliest timer, it doesn't wake up periodically. Starting an
+ * active timer again replaces its previous schedule.
+ *
+ * @param l        loop
+ * @param t        timer, must be valid until it expires or stopped.
+ * @param timeout  first expiry in milliseconds
+ * @param interval period in milliseconds, '0' for one-shot timers.
+ * @param cb       callback
+ * @param data     user data
+ * @return         '0' on success, negative number on out of memory.
+ */
+int sc_loop_timer_start(struct sc_loop *l, struct sc_loop_timer *t,
+			uint64_t timeout, uint64_t interval,
+			void (*cb)(struct sc_loop *, struct sc_loop_timer *),
+			void *data);
+
+/**
+ * Stop a timer, no-op if it is not active.
+ *
+ * @param l loop
+ * @param t timer
+ */
+void sc_loop_timer_stop(struct sc_loop *l, struct sc_loop_timer *t);
+
+/**
+ * Start a high resolution timer, with microsecond resolution. On Linux, these
+ * timers are multiplexed onto a single timerfd. Other platforms round the
+ * poll timeout up to milliseconds for them. Starting an active timer again
+ * replaces its previous schedule.
+ *
+ * @param l           loop
+ * @param t           timer, must be valid until it expires or stopped.
+ * @param timeout_ns  first expiry in nanoseconds
+ * @param interval_ns period in nanoseconds, '0' for one-shot timers.
+ * @param cb          callback
+ * @param data        user data
+ * @return            '0' on success, negative number on failure.
+ *                    call sc_loop_err() for error string.
+ */
+int sc_loop_hrtimer_start(struct sc_loop *l, struct sc_loop_timer *t,
+			  uint64_t timeout_ns, uint64_t interval_ns,
+			  void (*cb)(struct sc_loop *, struct sc_loop_timer *),
+			  void *data);
+
+/**
+ * Stop a high resolution timer, no-op if it is not active.
+ *
+ * @param l loop
+ * @param t timer
+ */
+void sc_loop_hrtimer_stop(struct sc_loop *l, struct sc_loop_timer *t);
+
+/**
+ * Run 'cb' once at the end of the current iteration, or the next one if it
+ * is called from a deferred callback. Loop doesn't block while there are
+ * deferred callbacks.
+ *
+ * @param l    loop
+ * @param t    task, must be valid until callback is called.
+ * @param cb   callback
+ * @param data user data
+ */
+void sc_loop_defer(struct sc_loop *l, struct sc_loop_task *t,
+		   void (*cb)(struct sc_loop *, struct sc_loop_task *),
+		   void *data);
+
+/**
+ * Run 'cb' on each iteration which has no events or timers, until
+ * sc_loop_idle_stop() is called. Loop doesn't block while there are idle
+ * callbacks.
+ *
+ * @param l    loop
+ * @param t    task, must be valid until sc_loop_idle_stop().
+ * @param cb   callback
+ * @param data user data
+ */
+void sc_loop_idle_start(struct sc_loop *l, struct sc_loop_task *t,
+			void (*cb)(struct sc_loop *, struct sc_loop_task *),
+			void *data);
+
+/**
+ * @param l loop
+ * @param t task
+ */
+void sc_loop_idle_stop(struct sc_loop *l, struct sc_loop_task *t);
+
+/**
+ * Thread-safe. Run 'cb' on the loop thread. Lock-free, the loop is woken up
+ * once per batch, only the first post to an empty queue writes to the wakeup
+ * fd.
+ *
+ * @param l    loop
+ * @param t    task, must be valid until callback is called.
+ * @param cb   callback
+ * @param data user data
+ * @return     '0' on success, negative number on failure.
+ */
+int sc_loop_post(struct sc_loop *l, struct sc_loop_task *t,
+		 void (*cb)(struct sc_loop *, struct sc_loop_task *),
+		 void *data);
+
+/**
+ * @param l loop
+ * @return  loop counters
+ */
+struct sc_loop_stats *sc_loop_stats(struct sc_loop *l);
+
+/**
+ * @param l loop
+ * @return  last error string
+ */
+const char *sc_loop_err(struct sc_loop *l);
+
+/**
+ * Outbound connection pool. Connections are kept per destination, idle ones
+ * are watched for readability, an idle connection becoming readable means
+ * the peer closed it (or sent something unexpected), it is dropped before
+ * anyone checks it out. Pool timer closes idle connections above 'min' and
+ * connects which take too long, then tops destinations up to 'min'.
+ *
+ * Destinations are resolved on a resolver thread and the address is cached,
+ * the loop thread never blocks on DNS. Windows resolves with a blocking
+ * connect.
+ */
+struct sc_loop_pool_conf {
+	int family;		  // SC_SOCK_INET (default), INET6 or UNIX
+	int min;		  // connections to keep per destination
+	int max;		  // connection limit per destination, default 16
+	uint64_t idle_timeout;	  // ms, default 60000
+	uint64_t connect_timeout; // ms, default 5000
+	uint64_t check_interval;  // ms, pool timer period, default 1000
+	uint64_t resolve_ttl;	  // ms, addresses are refreshed after, 30000
+};
+
+struct sc_loop_pool;
+struct sc_loop_pool_dest;
+
+struct sc_loop_conn {
+	struct sc_sock sock;
+	void *data; // user data, not touched by the pool
+
+	struct sc_loop_pool *pool;
+	struct sc_loop_pool_dest *dest;
+	struct sc_loop_conn *next;
+	struct sc_loop_watcher watcher;
+	int state;
+	uint64_t since;
+};
+
+struct sc_loop_pool_waiter {
+	struct sc_loop_pool_waiter *next;
+	struct sc_loop_pool_dest *dest;
+	void (*cb)(struct sc_loop_pool *p, struct sc_loop_pool_waiter *w,
+		   struct sc_loop_conn *c);
+	void *data;
+};
+
+struct sc_loop_pool_dest {
+	struct sc_loop_pool_dest *next;
+	char host[256];
+	char port[32];
+
+	int count;
+	int idle;
+	int connecting;
+	struct sc_loop_conn **conns;
+
+	struct sc_loop_pool_waiter *waiters;
+	struct sc_loop_pool_waiter *waiters_tail;
+	int waiting;
+
+#if !defined(_WIN32) && !defined(_WIN64)
+	// Connects use the cached address, it is refreshed in the background.
+	struct sc_sock_resolve req;
+	struct sc_sock_addr addr;
+	bool resolving;
+	bool resolved;
+	uint64_t resolved_at;
+#endif
+};
+
+struct sc_loop_pool {
+	struct sc_loop *loop;
+	struct sc_loop_pool_conf conf;
+	struct sc_loop_timer timer;
+	struct sc_loop_pool_dest *dests;
+	// Closed connections, freed on the next pool timer tick as there might
+	// be events for them in the current iteration.
+	struct sc_loop_conn *closed;
+
+#if !defined(_WIN32) && !defined(_WIN64)
+	struct sc_sock_resolver resolver;
+	struct sc_loop_watcher resolver_watcher;
+#endif
+	char err[128];
+};
+
+/**
+ * @param p    pool
+ * @param l    loop
+ * @param conf conf, zero fields get defaults, NULL for all defaults.
+ * @return     '0' on success, negative number on failure.
+ *             call sc_loop_pool_err() for error string.
+ */
+int sc_loop_pool_init(struct sc_loop_pool *p, struct sc_loop *l,
+		      struct sc_loop_pool_conf *conf);
+
+/**
+ * Close all connections. Queued waiters are dropped without a callback.
+ * Checked out connections are closed too, they must not be used after this.
+ *
+ * @param p pool
+ */
+void sc_loop_pool_term(struct sc_loop_pool *p);
+
+/**
+ * Non-blocking checkout. Returns an idle connection if there is one.
+ * Otherwise, if 'w' is not NULL, it is queued and 'cb' is called with a
+ * connection when one connects or is put back, or with NULL if connect fails.
+ * A new connection is started if the destination is below 'max'.
+ *
+ * Returned connection is not watched by the pool, user may watch
+ * 'c->sock.fdt' with its own watcher until it is put back.
+ *
+ * @param p    pool
+ * @param host destination host (or unix domain socket path)
+ * @param port destination port
+ * @param w    waiter, must be valid until callback or sc_loop_pool_cancel().
+ *             NULL to only try.
+ * @param cb   callback
+ * @param data user data
+ * @return     connection or NULL. If NULL and errno is EAGAIN, 'w' is
+ *             queued, 'cb' is never called before this function returns.
+ *             Otherwise, call sc_loop_pool_err() for error string.
+ */
+struct sc_loop_conn *
+sc_loop_pool_get(struct sc_loop_pool *p, const char *host, const char *port,
+		 struct sc_loop_pool_waiter *w,
+		 void (*cb)(struct sc_loop_pool *, struct sc_loop_pool_waiter *,
+			    struct sc_loop_conn *),
+		 void *data);
+
+/**
+ * Return a connection. Unwatch it before putting back. If there are waiters,
+ * first one gets the connection before this function returns.
+ *
+ * @param p     pool
+ * @param c     connection
+ * @param reuse false if connection is broken or in an unknown state, e.g
+ *              a request is timed out. It will be closed.
+ */
+void sc_loop_pool_put(struct sc_loop_pool *p, struct sc_loop_conn *c,
+		      bool reuse);
+
+/**
+ * Remove a queued waiter, no-op if it is not queued.
+ *
+ * @param p pool
+ * @param w waiter
+ */
+void sc_loop_pool_cancel(struct sc_loop_pool *p, struct sc_loop_pool_waiter *w);
+
+/**
+ * @param p pool
+ * @return  last error string
+ */
+const char *sc_loop_pool_err(struct sc_loop_pool *p);
+
+#endif
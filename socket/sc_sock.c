@@ -29,6 +29,10 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #ifndef _XOPEN_SOURCE
 #define _XOPEN_SOURCE 700
 #endif
@@ -61,6 +65,7 @@
 
 #define sc_close(n) closesocket(n)
 #define sc_unlink(n) DeleteFileA(n)
+#define sc_poll(fds, n, timeout) WSAPoll(fds, (ULONG) (n), timeout)
 #define SC_ERR SOCKET_ERROR
 #define SC_INVALID INVALID_SOCKET
 #define SC_EAGAIN WSAEWOULDBLOCK
@@ -132,12 +137,17 @@ int sc_sock_notify_systemd(const char *msg)
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
 #define sc_close(n) close(n)
 #define sc_unlink(n) unlink(n)
+#define sc_poll(fds, n, timeout) poll(fds, (nfds_t) (n), timeout)
 #define SC_ERR (-1)
 #define SC_INVALID (-1)
 #define SC_EAGAIN EAGAIN
@@ -237,6 +247,44 @@ int sc_sock_set_blocking(struct sc_sock *s, bool blocking)
 
 #endif
 
+static uint64_t sc_sock_time_ms(void)
+{
+#if defined(_WIN32) || defined(_WIN64)
+	return (uint64_t) GetTickCount64();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+#endif
+}
+
+#ifdef SC_SOCK_STATS
+#define sc_sock_stat_call(s, call) ((s)->stats.calls[call]++)
+#define sc_sock_stat_add(s, field, n) ((s)->stats.field += (uint64_t) (n))
+#else
+#define sc_sock_stat_call(s, call)
+#define sc_sock_stat_add(s, field, n) ((void) (n))
+#endif
+
+void sc_sock_stats(struct sc_sock *s, struct sc_sock_stats *stats, bool reset)
+{
+	*stats = s->stats;
+	if (reset) {
+		s->stats = (struct sc_sock_stats){0};
+	}
+}
+
+#if defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__)
+static uint64_t sc_sock_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+#endif
+
 void sc_sock_init(struct sc_sock *s, int type, bool blocking, int family)
 {
 	*s = (struct sc_sock){
@@ -295,6 +343,223 @@ int sc_sock_set_rcvtimeo(struct sc_sock *s, int ms)
 	return rc;
 }
 
+// Returns option level and name, '-1' if it is not supported.
+static int sc_sock_opt_name(enum sc_sock_opt opt, int *level, int *name)
+{
+	*level = IPPROTO_TCP;
+
+	switch (opt) {
+	case SC_SOCK_SNDBUF:
+		*level = SOL_SOCKET;
+		*name = SO_SNDBUF;
+		return 0;
+	case SC_SOCK_RCVBUF:
+		*level = SOL_SOCKET;
+		*name = SO_RCVBUF;
+		return 0;
+	case SC_SOCK_NODELAY:
+		*name = TCP_NODELAY;
+		return 0;
+	case SC_SOCK_CORK:
+#if defined(TCP_CORK)
+		*name = TCP_CORK;
+		return 0;
+#elif defined(TCP_NOPUSH)
+		*name = TCP_NOPUSH;
+		return 0;
+#else
+		return -1;
+#endif
+	case SC_SOCK_QUICKACK:
+#if defined(TCP_QUICKACK)
+		*name = TCP_QUICKACK;
+		return 0;
+#else
+		return -1;
+#endif
+	case SC_SOCK_DEFER_ACCEPT:
+#if defined(TCP_DEFER_ACCEPT)
+		*name = TCP_DEFER_ACCEPT;
+		return 0;
+#else
+		return -1;
+#endif
+	case SC_SOCK_FASTOPEN:
+#if defined(TCP_FASTOPEN)
+		*name = TCP_FASTOPEN;
+		return 0;
+#else
+		return -1;
+#endif
+	case SC_SOCK_FASTOPEN_CONNECT:
+#if defined(TCP_FASTOPEN_CONNECT)
+		*name = TCP_FASTOPEN_CONNECT;
+		return 0;
+#else
+		return -1;
+#endif
+	case SC_SOCK_BUSY_POLL:
+#if defined(SO_BUSY_POLL)
+		*level = SOL_SOCKET;
+		*name = SO_BUSY_POLL;
+		return 0;
+#else
+		return -1;
+#endif
+	case SC_SOCK_INCOMING_CPU:
+#if defined(SO_INCOMING_CPU)
+		*level = SOL_SOCKET;
+		*name = SO_INCOMING_CPU;
+		return 0;
+#else
+		return -1;
+#endif
+	case SC_SOCK_NOTSENT_LOWAT:
+#if defined(TCP_NOTSENT_LOWAT)
+		*name = TCP_NOTSENT_LOWAT;
+		return 0;
+#else
+		return -1;
+#endif
+	default:
+		return -1;
+	}
+}
+
+// Returns '0' on success, '-1' on failure, '-2' if option is not supported.
+// Sets the error string in both cases.
+static int sc_sock_setopt(struct sc_sock *s, enum sc_sock_opt opt, int value)
+{
+	int rc, level, name;
+
+	if (sc_sock_opt_name(opt, &level, &name) != 0) {
+		strncpy(s->err, "Option is not supported", sizeof(s->err) - 1);
+		return -2;
+	}
+
+	rc = setsockopt(s->fdt.fd, level, name, (void *) &value, sizeof(value));
+	if (rc != 0) {
+		sc_sock_errstr(s, 0);
+		return -1;
+	}
+
+	return 0;
+}
+
+int sc_sock_set_opt(struct sc_sock *s, enum sc_sock_opt opt, int value)
+{
+	int level, name;
+
+	// No socket yet, keep it to apply on creation.
+	if (s->fdt.fd == SC_INVALID) {
+		if (sc_sock_opt_name(opt, &level, &name) != 0) {
+			strncpy(s->err, "Option is not supported",
+				sizeof(s->err) - 1);
+			return -2;
+		}
+
+		for (int i = 0; i < s->opt_count; i++) {
+			if (s->opts[i].opt == opt) {
+				s->opts[i].value = value;
+				return 0;
+			}
+		}
+
+		if (s->opt_count == SC_SOCK_OPT_PENDING) {
+			strncpy(s->err, "Too many pending options",
+				sizeof(s->err) - 1);
+			return -1;
+		}
+
+		s->opts[s->opt_count].opt = opt;
+		s->opts[s->opt_count].value = value;
+		s->opt_count++;
+
+		return 0;
+	}
+
+	return sc_sock_setopt(s, opt, value);
+}
+
+int sc_sock_get_opt(struct sc_sock *s, enum sc_sock_opt opt, int *value)
+{
+	int rc, level, name;
+	socklen_t len = sizeof(*value);
+
+	if (sc_sock_opt_name(opt, &level, &name) != 0) {
+		strncpy(s->err, "Option is not supported", sizeof(s->err) - 1);
+		return -2;
+	}
+
+	*value = 0;
+
+	rc = getsockopt(s->fdt.fd, level, name, (void *) value, &len);
+	if (rc != 0) {
+		sc_sock_errstr(s, 0);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Applies options set before the socket was created. Error string is set on
+// failure, callers must not overwrite it.
+static int sc_sock_apply_opts(struct sc_sock *s)
+{
+	int rc;
+
+	for (int i = 0; i < s->opt_count; i++) {
+		rc = sc_sock_setopt(s, s->opts[i].opt, s->opts[i].value);
+		if (rc != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+#if defined(__linux__)
+
+int sc_sock_tcp_info(struct sc_sock *s, struct sc_sock_tcp_info *info)
+{
+	int rc;
+	struct tcp_info ti;
+	socklen_t len = sizeof(ti);
+
+	rc = getsockopt(s->fdt.fd, IPPROTO_TCP, TCP_INFO, (void *) &ti, &len);
+	if (rc != 0) {
+		sc_sock_errstr(s, 0);
+		return -1;
+	}
+
+	*info = (struct sc_sock_tcp_info){
+		.state = ti.tcpi_state,
+		.rtt = ti.tcpi_rtt,
+		.rttvar = ti.tcpi_rttvar,
+		.snd_cwnd = ti.tcpi_snd_cwnd,
+		.snd_mss = ti.tcpi_snd_mss,
+		.rcv_mss = ti.tcpi_rcv_mss,
+		.unacked = ti.tcpi_unacked,
+		.lost = ti.tcpi_lost,
+		.retrans = ti.tcpi_retrans,
+		.total_retrans = ti.tcpi_total_retrans,
+	};
+
+	return 0;
+}
+
+#else
+
+int sc_sock_tcp_info(struct sc_sock *s, struct sc_sock_tcp_info *info)
+{
+	(void) info;
+
+	strncpy(s->err, "TCP_INFO is not supported", sizeof(s->err) - 1);
+	return -1;
+}
+
+#endif
+
 int sc_sock_set_sndtimeo(struct sc_sock *s, int ms)
 {
 	int rc;
@@ -330,25 +595,32 @@ static int sc_sock_bind_unix(struct sc_sock *s, const char *host)
 	return rc == 0 ? 0 : -1;
 }
 
-static int sc_sock_bind(struct sc_sock *s, const char *host, const char *port)
+static int sc_sock_bind(struct sc_sock *s, const char *host, const char *port,
+			int type, bool reuseport)
 {
 	int rc, rv = 0;
 	struct addrinfo *servinfo = NULL;
 	struct addrinfo hints = {
 		.ai_family = s->family,
-		.ai_socktype = SOCK_STREAM,
+		.ai_socktype = type,
 	};
 
 	*s->err = '\0';
 
 	if (s->family == AF_UNIX) {
-		sc_sock_int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		sc_sock_int fd = socket(AF_UNIX, type, 0);
 		if (fd == SC_INVALID) {
 			goto error_unix;
 		}
 
 		s->fdt.fd = fd;
 
+		rc = sc_sock_apply_opts(s);
+		if (rc != 0) {
+			sc_sock_close(s);
+			return -1;
+		}
+
 		rc = sc_sock_bind_unix(s, host);
 		if (rc != 0) {
 			goto error_unix;
@@ -400,9 +672,29 @@ error_unix:
 			goto error;
 		}
 
-		rc = setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, tmp, sizeof(int));
+#if defined(SO_REUSEPORT)
+		if (reuseport) {
+			rc = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, tmp,
+					sizeof(int));
+			if (rc != 0) {
+				goto error;
+			}
+		}
+#else
+		(void) reuseport;
+#endif
+
+		if (type == SOCK_STREAM) {
+			rc = setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, tmp,
+					sizeof(int));
+			if (rc != 0) {
+				goto error;
+			}
+		}
+
+		rc = sc_sock_apply_opts(s);
 		if (rc != 0) {
-			goto error;
+			goto error_close;
 		}
 
 		rc = bind(s->fdt.fd, p->ai_addr, (socklen_t) p->ai_addrlen);
@@ -415,6 +707,7 @@ error_unix:
 
 error:
 	sc_sock_errstr(s, 0);
+error_close:
 	sc_sock_close(s);
 	rv = -1;
 out:
@@ -463,6 +756,12 @@ static int sc_sock_connect_unix(struct sc_sock *s, const char *addr)
 		goto err;
 	}
 
+	rc = sc_sock_apply_opts(s);
+	if (rc != 0) {
+		sc_sock_close(s);
+		return -1;
+	}
+
 	strcpy(un.sun_path, addr);
 
 	rc = connect(s->fdt.fd, (struct sockaddr *) &un, sizeof(un));
@@ -517,14 +816,80 @@ err:
 	return -1;
 }
 
+// Returns '0' on success, '-1' on failure, '-2' if this address failed and
+// the next one can be tried.
+static int sc_sock_connect_inner(struct sc_sock *s, int family, int protocol,
+				 const struct sockaddr *addr, socklen_t len,
+				 const char *src_addr, const char *src_port)
+{
+	int rc;
+	sc_sock_int fd;
+	void *tmp;
+
+	fd = socket(family, SOCK_STREAM, protocol);
+	if (fd == SC_INVALID) {
+		return -2;
+	}
+
+	s->family = family;
+	s->fdt.fd = fd;
+
+	rc = sc_sock_set_blocking(s, s->blocking);
+	if (rc != 0) {
+		goto error;
+	}
+
+	tmp = (void *) &(int){1};
+	rc = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, tmp, sizeof(int));
+	if (rc != 0) {
+		goto error;
+	}
+
+	rc = setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, tmp, sizeof(int));
+	if (rc != 0) {
+		goto error;
+	}
+
+	rc = sc_sock_apply_opts(s);
+	if (rc != 0) {
+		goto error_close;
+	}
+
+	if (src_addr || src_port) {
+		rc = sc_sock_bind_src(s, src_addr, src_port);
+		if (rc != 0) {
+			goto error_close;
+		}
+	}
+
+	rc = connect(fd, addr, len);
+	sc_sock_stat_call(s, SC_SOCK_CALL_CONNECT);
+	if (rc != 0) {
+		if (!s->blocking && (sc_sock_err() == SC_EINPROGRESS ||
+				     sc_sock_err() == SC_EAGAIN)) {
+			errno = EAGAIN;
+			return -1;
+		}
+
+		sc_sock_close(s);
+		return -2;
+	}
+
+	return 0;
+
+error:
+	sc_sock_errstr(s, 0);
+error_close:
+	sc_sock_close(s);
+	return -1;
+}
+
 int sc_sock_connect(struct sc_sock *s, const char *dst_addr,
 		    const char *dst_port, const char *src_addr,
 		    const char *src_port)
 {
 	int family = s->family;
 	int rc, rv = 0;
-	sc_sock_int fd;
-	void *tmp;
 	struct addrinfo *sinfo = NULL, *p;
 
 	struct addrinfo inf = {
@@ -549,57 +914,18 @@ int sc_sock_connect(struct sc_sock *s, const char *dst_addr,
 				continue;
 			}
 
-			fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-			if (fd == SC_INVALID) {
-				continue;
-			}
-
-			s->family = p->ai_family;
-			s->fdt.fd = fd;
-
-			rc = sc_sock_set_blocking(s, s->blocking);
-			if (rc != 0) {
-				goto error;
-			}
-
-			tmp = (void *) &(int){1};
-			rc = setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, tmp, sizeof(int));
-			if (rc != 0) {
-				goto error;
-			}
-
-			rc = setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, tmp, sizeof(int));
-			if (rc != 0) {
-				goto error;
-			}
-
-			if (src_addr || src_port) {
-				rc = sc_sock_bind_src(s, src_addr, src_port);
-				if (rc != 0) {
-					goto bind_error;
-				}
-			}
-
-			rc = connect(fd, p->ai_addr, (socklen_t) p->ai_addrlen);
-			if (rc != 0) {
-				if (!s->blocking && (sc_sock_err() == SC_EINPROGRESS ||
-							 sc_sock_err() == SC_EAGAIN)) {
-					errno = EAGAIN;
-					rv = -1;
-					goto end;
-				}
-
-				sc_sock_close(s);
-				continue;
+			rc = sc_sock_connect_inner(s, p->ai_family, p->ai_protocol,
+						   p->ai_addr,
+						   (socklen_t) p->ai_addrlen,
+						   src_addr, src_port);
+			if (rc != -2) {
+				rv = rc;
+				goto end;
 			}
-
-			goto end;
 		}
 	}
 
-error:
 	sc_sock_errstr(s, 0);
-bind_error:
 	rv = -1;
 	sc_sock_close(s);
 end:
@@ -608,25 +934,262 @@ end:
 	return rv;
 }
 
-#if defined(_WIN32) || defined(_WIN64)
-#define sc_send_recv_size_t int
-#else
-#define sc_send_recv_size_t size_t
-#endif
-
-int sc_sock_send(struct sc_sock *s, char *buf, int len, int flags)
+int sc_sock_connect_addr(struct sc_sock *s, const struct sc_sock_addr *addr,
+			 const char *src_addr, const char *src_port)
 {
-	int n, err;
+	int rc;
 
-	if (len <= 0) {
-		return len;
+	rc = sc_sock_connect_inner(s, addr->family, 0,
+				   (const struct sockaddr *) &addr->addr,
+				   addr->len, src_addr, src_port);
+	if (rc == -2) {
+		sc_sock_errstr(s, 0);
+		sc_sock_close(s);
+		return -1;
 	}
 
-retry:
-	n = (int) send(s->fdt.fd, buf, (sc_send_recv_size_t) len, flags);
-	if (n == SC_ERR) {
-		err = sc_sock_err();
-		if (err == SC_EINTR) {
+	return rc;
+}
+
+static void sc_sock_eyeballs_set_err(struct sc_sock_eyeballs *e,
+				     const char *msg, const char *reason)
+{
+	snprintf(e->err, sizeof(e->err), "%s : %s", msg, reason);
+}
+
+const char *sc_sock_eyeballs_err(struct sc_sock_eyeballs *e)
+{
+	return e->err;
+}
+
+static void sc_sock_eyeballs_close(struct sc_sock_eyeballs *e, int i)
+{
+	struct sc_sock *s = &e->socks[i];
+
+	if (s->fdt.fd != SC_INVALID) {
+		sc_sock_poll_del(e->poll, &s->fdt, SC_SOCK_WRITE, e);
+		sc_sock_close(s);
+	}
+}
+
+// Starts the next attempt, returns 'false' if there is no address left.
+static bool sc_sock_eyeballs_next(struct sc_sock_eyeballs *e)
+{
+	int rc, i;
+	struct sc_sock *s;
+
+	while (e->started < e->count) {
+		i = e->started++;
+		s = &e->socks[i];
+		e->next = sc_sock_time_ms() + e->delay;
+
+		sc_sock_init(s, 0, false, e->addrs[i].family);
+
+		rc = sc_sock_connect_addr(s, &e->addrs[i], NULL, NULL);
+		if (rc != 0 && errno != EAGAIN) {
+			sc_sock_eyeballs_set_err(e, "connect", sc_sock_error(s));
+			e->failed++;
+			continue;
+		}
+
+		// Connection result is reported as a write event.
+		rc = sc_sock_poll_add(e->poll, &s->fdt, SC_SOCK_WRITE, e);
+		if (rc != 0) {
+			sc_sock_eyeballs_set_err(e, "poll", sc_sock_poll_err(e->poll));
+			sc_sock_close(s);
+			e->failed++;
+			continue;
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+int sc_sock_eyeballs_start(struct sc_sock_eyeballs *e, struct sc_sock_poll *p,
+			   const struct sc_sock_addr *addrs, int count,
+			   int delay, int timeout)
+{
+	int n = 0, a = 0, b = 0;
+
+	*e = (struct sc_sock_eyeballs){
+		.poll = p,
+		.delay = (uint64_t) (delay > 0 ? delay : 0),
+	};
+
+	if (timeout >= 0) {
+		e->deadline = sc_sock_time_ms() + (uint64_t) timeout;
+	}
+
+	for (int i = 0; i < SC_SOCK_RESOLVE_MAX; i++) {
+		e->socks[i].fdt.fd = SC_INVALID;
+	}
+
+	count = count > 0 ? count : 0;
+	count = count < SC_SOCK_RESOLVE_MAX ? count : SC_SOCK_RESOLVE_MAX;
+
+	// Interleave address families, starting with the family of the first
+	// address, e.g., IPv6, IPv4, IPv6, IPv4...
+	while (n < count) {
+		while (a < count && addrs[a].family != addrs[0].family) {
+			a++;
+		}
+
+		if (a < count) {
+			e->addrs[n++] = addrs[a++];
+		}
+
+		while (b < count && addrs[b].family == addrs[0].family) {
+			b++;
+		}
+
+		if (b < count) {
+			e->addrs[n++] = addrs[b++];
+		}
+	}
+
+	e->count = count;
+
+	if (!sc_sock_eyeballs_next(e)) {
+		if (count == 0) {
+			sc_sock_eyeballs_set_err(e, "connect", "no address");
+		}
+		return -1;
+	}
+
+	return 0;
+}
+
+int sc_sock_eyeballs_timeout(struct sc_sock_eyeballs *e)
+{
+	uint64_t now, next = UINT64_MAX;
+
+	if (e->started < e->count) {
+		next = e->next;
+	}
+
+	if (e->deadline != 0 && e->deadline < next) {
+		next = e->deadline;
+	}
+
+	if (next == UINT64_MAX) {
+		return -1;
+	}
+
+	now = sc_sock_time_ms();
+
+	return next > now ? (int) (next - now) : 0;
+}
+
+int sc_sock_eyeballs_poll(struct sc_sock_eyeballs *e, struct sc_sock *out)
+{
+	int rc, err, n = 0, active = 0;
+	int idx[SC_SOCK_RESOLVE_MAX];
+	struct pollfd fds[SC_SOCK_RESOLVE_MAX];
+	socklen_t len;
+	struct sc_sock *s;
+
+	for (int i = 0; i < e->started; i++) {
+		if (e->socks[i].fdt.fd != SC_INVALID) {
+			fds[n] = (struct pollfd){
+				.fd = e->socks[i].fdt.fd,
+				.events = POLLOUT,
+			};
+			idx[n++] = i;
+		}
+	}
+
+	// A single non-blocking check tells which attempts have completed,
+	// only those are inspected.
+	rc = n > 0 ? sc_poll(fds, n, 0) : 0;
+	if (rc < 0) {
+		for (int j = 0; j < n; j++) {
+			fds[j].revents = 0;
+		}
+	}
+
+	for (int j = 0; j < n; j++) {
+		s = &e->socks[idx[j]];
+		if (fds[j].revents == 0) {
+			active++;
+			continue;
+		}
+
+		err = 0;
+		len = sizeof(err);
+
+		rc = getsockopt(s->fdt.fd, SOL_SOCKET, SO_ERROR, (void *) &err,
+				&len);
+		if (rc != 0 || err != 0 || !(fds[j].revents & POLLOUT)) {
+			errno = rc != 0 ? errno : (err != 0 ? err : ENOTCONN);
+			sc_sock_eyeballs_set_err(e, "connect", strerror(errno));
+			sc_sock_eyeballs_close(e, idx[j]);
+			e->failed++;
+
+			// Don't wait for the delay after a failure.
+			e->next = 0;
+			continue;
+		}
+
+		// Writable without an error, connected.
+		sc_sock_poll_del(e->poll, &s->fdt, SC_SOCK_WRITE, e);
+		*out = *s;
+		s->fdt.fd = SC_INVALID;
+
+		sc_sock_eyeballs_term(e);
+		return 0;
+	}
+
+	if (e->deadline != 0 && sc_sock_time_ms() >= e->deadline) {
+		sc_sock_eyeballs_set_err(e, "connect", strerror(ETIMEDOUT));
+		sc_sock_eyeballs_term(e);
+		errno = ETIMEDOUT;
+		return -1;
+	}
+
+	if ((active == 0 || sc_sock_eyeballs_timeout(e) == 0) &&
+	    sc_sock_eyeballs_next(e)) {
+		active++;
+	}
+
+	// All attempts failed.
+	errno = active == 0 ? ENOTCONN : EAGAIN;
+	return -1;
+}
+
+int sc_sock_eyeballs_term(struct sc_sock_eyeballs *e)
+{
+	for (int i = 0; i < e->started; i++) {
+		sc_sock_eyeballs_close(e, i);
+	}
+
+	e->started = e->count;
+	e->deadline = 0;
+
+	return 0;
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+#define sc_send_recv_size_t int
+#else
+#define sc_send_recv_size_t size_t
+#endif
+
+int sc_sock_send(struct sc_sock *s, char *buf, int len, int flags)
+{
+	int n, err;
+
+	if (len <= 0) {
+		return len;
+	}
+
+retry:
+	n = (int) send(s->fdt.fd, buf, (sc_send_recv_size_t) len, flags);
+	sc_sock_stat_call(s, SC_SOCK_CALL_SEND);
+	if (n == SC_ERR) {
+		err = sc_sock_err();
+		if (err == SC_EINTR) {
 			goto retry;
 		}
 
@@ -638,14 +1201,18 @@ retry:
 				InterlockedAnd(&pd->edge_mask, ~SC_SOCK_WRITE);
 			}
 #endif
+			sc_sock_stat_add(s, eagain, 1);
 			errno = EAGAIN;
 			return -1;
 		}
 
 		sc_sock_errstr(s, 0);
-		n = -1;
+		return -1;
 	}
 
+	sc_sock_stat_add(s, bytes_out, n);
+	sc_sock_stat_add(s, partial_writes, n < len);
+
 	return n;
 }
 
@@ -659,6 +1226,7 @@ int sc_sock_recv(struct sc_sock *s, char *buf, int len, int flags)
 
 retry:
 	n = (int) recv(s->fdt.fd, buf, (sc_send_recv_size_t) len, flags);
+	sc_sock_stat_call(s, SC_SOCK_CALL_RECV);
 	if (n == 0) {
 		errno = EOF;
 		return -1;
@@ -676,460 +1244,3763 @@ retry:
 				InterlockedAnd(&pd->edge_mask, ~SC_SOCK_READ);
 			}
 #endif
+			sc_sock_stat_add(s, eagain, 1);
 			errno = EAGAIN;
 			return -1;
 		}
 
 		sc_sock_errstr(s, 0);
-		n = -1;
+		return -1;
 	}
 
+	sc_sock_stat_add(s, bytes_in, n);
+	sc_sock_stat_add(s, short_reads, n < len);
+
 	return n;
 }
 
-int sc_sock_accept(struct sc_sock *s, struct sc_sock *in)
+#ifndef SC_SOCK_BUF_MIN
+#define SC_SOCK_BUF_MIN (4 * 1024)
+#endif
+
+void sc_sock_buf_init(struct sc_sock_buf *b, size_t limit)
 {
-	const void *tmp = (void *) &(int){1};
+	*b = (struct sc_sock_buf){
+		.limit = limit,
+		.hint = SC_SOCK_BUF_MIN,
+	};
+}
 
-	int rc;
-	sc_sock_int fd;
+void sc_sock_buf_term(struct sc_sock_buf *b)
+{
+	sc_sock_free(b->mem);
+	sc_sock_buf_init(b, b->limit);
+}
 
-	fd = accept(s->fdt.fd, NULL, NULL);
-	if (fd == SC_INVALID) {
-		if (!s->blocking && sc_sock_err() == SC_EAGAIN) {
-			errno = EAGAIN;
-		} else {
-			sc_sock_errstr(s, 0);
-		}
-		return -1;
+// Makes at least 'len' bytes of space at the end, up to the buffer limit.
+// Returns available space.
+static size_t sc_sock_buf_reserve(struct sc_sock_buf *b, size_t len)
+{
+	size_t cap;
+	char *mem;
+
+	if (b->cap - b->wpos >= len) {
+		return b->cap - b->wpos;
 	}
 
-	in->fdt.fd = fd;
-	in->fdt.op = SC_SOCK_NONE;
-	in->family = s->family;
+	if (b->rpos > 0) {
+		memmove(b->mem, b->mem + b->rpos, b->wpos - b->rpos);
+		b->wpos -= b->rpos;
+		b->rpos = 0;
+	}
 
-	if (in->family != AF_UNIX) {
-		rc = setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, tmp, sizeof(int));
-		if (rc != 0) {
-			goto error;
-		}
+	if (b->cap - b->wpos >= len || b->cap >= b->limit) {
+		return b->cap - b->wpos;
 	}
 
-	rc = sc_sock_set_blocking(in, s->blocking);
-	if (rc != 0) {
-		goto error;
+	cap = b->cap < SC_SOCK_BUF_MIN ? SC_SOCK_BUF_MIN : b->cap;
+	while (cap - b->wpos < len && cap < b->limit) {
+		cap *= 2;
 	}
 
-	return 0;
+	cap = cap > b->limit ? b->limit : cap;
 
-error:
-	sc_sock_errstr(s, 0);
-	sc_sock_close(in);
+	mem = sc_sock_realloc(b->mem, cap);
+	if (mem == NULL) {
+		return b->cap - b->wpos;
+	}
 
-	return -1;
+	b->mem = mem;
+	b->cap = cap;
+
+	return b->cap - b->wpos;
 }
 
-int sc_sock_listen(struct sc_sock *s, const char *host, const char *port)
+int sc_sock_buf_put(struct sc_sock_buf *b, const void *buf, size_t len)
 {
-	int rc;
-
-	rc = sc_sock_bind(s, host, port);
-	if (rc != 0) {
-		return rc;
+	if (sc_sock_buf_reserve(b, len) < len) {
+		return -1;
 	}
 
-	rc = listen(s->fdt.fd, 4096);
-	if (rc != 0) {
-		goto err;
-	}
+	memcpy(b->mem + b->wpos, buf, len);
+	b->wpos += len;
 
 	return 0;
-err:
-	sc_sock_errstr(s, 0);
-	sc_sock_close(s);
-	return -1;
 }
 
-const char *sc_sock_error(struct sc_sock *s)
+void sc_sock_buf_consume(struct sc_sock_buf *b, size_t len)
 {
-	s->err[sizeof(s->err) - 1] = '\0';
-	return s->err;
+	b->rpos += len;
+	assert(b->rpos <= b->wpos);
+
+	if (b->rpos == b->wpos) {
+		b->rpos = 0;
+		b->wpos = 0;
+	}
 }
 
+// Returns pending byte count on the socket or zero if it is unknown.
+static size_t sc_sock_pending(struct sc_sock *s)
+{
 #if defined(_WIN32) || defined(_WIN64)
-#define sc_sock_addr_size_t size_t
+	u_long n = 0;
+
+	if (ioctlsocket(s->fdt.fd, FIONREAD, &n) != 0) {
+		return 0;
+	}
 #else
-#define sc_sock_addr_size_t socklen_t
+	int n = 0;
+
+	if (ioctl(s->fdt.fd, FIONREAD, &n) != 0 || n < 0) {
+		return 0;
+	}
 #endif
+	return (size_t) n;
+}
 
-static const char *sc_sock_addr(struct sc_sock *sock, int af, void *cp,
-				char *buf, size_t len)
+int64_t sc_sock_recv_all(struct sc_sock *s, struct sc_sock_buf *b, size_t max,
+			 bool *drained)
 {
-	const char *dest;
+	int n;
+	size_t len, want, total = 0;
 
-	dest = inet_ntop(af, cp, buf, (sc_sock_addr_size_t) len);
-	if (dest == NULL) {
-		sc_sock_errstr(sock, 0);
-		*buf = '\0';
-	}
+	*drained = false;
 
-	return dest;
-}
+	// Size the buffer for the whole queue on the first read.
+	want = sc_sock_pending(s);
+	want = want > b->hint ? want : b->hint;
 
-static const char *sc_sock_print_storage(struct sc_sock *sock,
-					 struct sockaddr_storage *storage,
-					 char *buf, size_t len)
-{
-	const char *dst;
-	struct sockaddr_in *addr;
-	struct sockaddr_in6 *addr6;
-	struct sockaddr_un *addr_un;
-	char tmp[INET6_ADDRSTRLEN];
+	while (total < max) {
+		len = sc_sock_buf_reserve(b, want);
+		if (len == 0) {
+			if (b->cap < b->limit) {
+				strncpy(s->err, "Out of memory", sizeof(s->err) - 1);
+				errno = ENOMEM;
+				return -1;
+			}
+			// Buffer is full, caller must consume.
+			break;
+		}
 
-	*buf = '\0';
+		len = len < max - total ? len : max - total;
+		len = len < SC_SIZE_MAX ? len : SC_SIZE_MAX;
 
-	switch (storage->ss_family) {
-	case AF_INET:
-		addr = (struct sockaddr_in *) storage;
-		dst = sc_sock_addr(sock, AF_INET, &addr->sin_addr, tmp,
-				   sizeof(tmp));
-		snprintf(buf, len, "%s:%d", dst, ntohs(addr->sin_port));
-		break;
+		n = sc_sock_recv(s, b->mem + b->wpos, (int) len, 0);
+		if (n < 0) {
+			if (errno == EAGAIN) {
+				*drained = true;
+				break;
+			}
+			return -1;
+		}
 
-	case AF_INET6:
-		addr6 = (struct sockaddr_in6 *) storage;
-		dst = sc_sock_addr(sock, AF_INET6, &addr6->sin6_addr, tmp,
-				   sizeof(tmp));
-		snprintf(buf, len, "%s:%d", dst, ntohs(addr6->sin6_port));
-		break;
+		b->wpos += (size_t) n;
+		total += (size_t) n;
 
-	case AF_UNIX:
-		addr_un = (struct sockaddr_un *) storage;
-		snprintf(buf, len, "%s", addr_un->sun_path);
-		break;
+		// Grow read size if reads fill the buffer, shrink if reads are
+		// much smaller than the read size.
+		if ((size_t) n == len && b->hint < b->limit / 2) {
+			b->hint *= 2;
+		} else if ((size_t) n < b->hint / 4 &&
+			   b->hint > SC_SOCK_BUF_MIN) {
+			b->hint /= 2;
+		}
+
+		want = b->hint;
 	}
 
-	return buf;
+	return (int64_t) total;
 }
 
-const char *sc_sock_local_str(struct sc_sock *sock, char *buf, size_t len)
+int64_t sc_sock_send_all(struct sc_sock *s, struct sc_sock_buf *b, size_t max,
+			 bool *drained)
 {
-	int rc;
-	struct sockaddr_storage st;
-	socklen_t storage_len = sizeof(st);
+	int n;
+	size_t len, total = 0;
 
-	rc = getsockname(sock->fdt.fd, (struct sockaddr *) &st, &storage_len);
-	if (rc != 0) {
-		sc_sock_errstr(sock, 0);
-		*buf = '\0';
-		return NULL;
-	}
+	*drained = false;
 
-	return sc_sock_print_storage(sock, &st, buf, len);
+	while (total < max) {
+		len = b->wpos - b->rpos;
+		if (len == 0) {
+			*drained = true;
+			break;
+		}
+
+		len = len < max - total ? len : max - total;
+		len = len < SC_SIZE_MAX ? len : SC_SIZE_MAX;
+
+		n = sc_sock_send(s, b->mem + b->rpos, (int) len, 0);
+		if (n < 0) {
+			if (errno == EAGAIN) {
+				*drained = true;
+				break;
+			}
+			return -1;
+		}
+
+		sc_sock_buf_consume(b, (size_t) n);
+		total += (size_t) n;
+	}
+
+	if (b->wpos == b->rpos) {
+		*drained = true;
+	}
+
+	return (int64_t) total;
+}
+
+#ifndef SC_SOCK_WQ_CHUNK
+#define SC_SOCK_WQ_CHUNK (16 * 1024)
+#endif
+
+#define SC_SOCK_WQ_IOV 64
+
+int sc_sock_wq_init(struct sc_sock_wq *q, struct sc_sock *s,
+		   struct sc_sock_poll *p, void *data, size_t low, size_t high)
+{
+	*q = (struct sc_sock_wq){
+		.sock = s,
+		.poll = p,
+		.data = data,
+		.low = low,
+		.high = high,
+	};
+
+	return 0;
+}
+
+void sc_sock_wq_term(struct sc_sock_wq *q)
+{
+	struct sc_sock_wq_chunk *c, *next;
+
+	for (c = q->head; c != NULL; c = next) {
+		next = c->next;
+		sc_sock_free(c);
+	}
+
+	q->head = NULL;
+	q->tail = NULL;
+	q->size = 0;
+}
+
+static void sc_sock_wq_set_err(struct sc_sock_wq *q, const char *str)
+{
+	strncpy(q->sock->err, str, sizeof(q->sock->err) - 1);
+}
+
+// Vectored send from queued chunks. Returns sent bytes or -1.
+static int64_t sc_sock_wq_send(struct sc_sock_wq *q)
+{
+	int cnt = 0;
+	size_t total = 0;
+	struct sc_sock_wq_chunk *c;
+
+#if defined(_WIN32) || defined(_WIN64)
+	int rc;
+	DWORD n;
+	WSABUF iov[SC_SOCK_WQ_IOV];
+
+	for (c = q->head; c != NULL && cnt < SC_SOCK_WQ_IOV; c = c->next) {
+		iov[cnt].buf = c->buf + c->pos;
+		iov[cnt++].len = (ULONG) (c->len - c->pos);
+		total += c->len - c->pos;
+	}
+
+	rc = WSASend(q->sock->fdt.fd, iov, (DWORD) cnt, &n, 0, NULL, NULL);
+	sc_sock_stat_call(q->sock, SC_SOCK_CALL_WRITEV);
+	if (rc == SOCKET_ERROR) {
+		if (sc_sock_err() == SC_EAGAIN) {
+			struct sc_sock_poll_data *pd = q->sock->fdt.poll_data;
+			if (pd != NULL && (pd->edge_mask & SC_SOCK_WRITE)) {
+				InterlockedAnd(&pd->edge_mask, ~SC_SOCK_WRITE);
+			}
+			sc_sock_stat_add(q->sock, eagain, 1);
+			errno = EAGAIN;
+		} else {
+			sc_sock_errstr(q->sock, 0);
+		}
+		return -1;
+	}
+#else
+	ssize_t n;
+	int flags = 0;
+	struct iovec iov[SC_SOCK_WQ_IOV];
+	struct msghdr msg = {.msg_iov = iov};
+
+	for (c = q->head; c != NULL && cnt < SC_SOCK_WQ_IOV; c = c->next) {
+		iov[cnt].iov_base = c->buf + c->pos;
+		iov[cnt++].iov_len = c->len - c->pos;
+		total += c->len - c->pos;
+	}
+
+	msg.msg_iovlen = (size_t) cnt;
+
+#if defined(MSG_NOSIGNAL)
+	// writev() can't pass flags, a closed peer would raise SIGPIPE.
+	flags = MSG_NOSIGNAL;
+#endif
+
+retry:
+	n = sendmsg(q->sock->fdt.fd, &msg, flags);
+	sc_sock_stat_call(q->sock, SC_SOCK_CALL_WRITEV);
+	if (n == -1) {
+		if (errno == EINTR) {
+			goto retry;
+		}
+
+		if (errno != EAGAIN) {
+			sc_sock_errstr(q->sock, 0);
+		}
+		sc_sock_stat_add(q->sock, eagain, errno == EAGAIN);
+		return -1;
+	}
+#endif
+
+	sc_sock_stat_add(q->sock, bytes_out, n);
+	sc_sock_stat_add(q->sock, partial_writes, (size_t) n < total);
+
+	return (int64_t) n;
+}
+
+static void sc_sock_wq_consume(struct sc_sock_wq *q, size_t n)
+{
+	size_t len;
+	struct sc_sock_wq_chunk *c;
+
+	q->size -= n;
+
+	while (n > 0) {
+		c = q->head;
+		len = c->len - c->pos;
+
+		if (n < len) {
+			c->pos += n;
+			return;
+		}
+
+		n -= len;
+		q->head = c->next;
+		sc_sock_free(c);
+	}
+
+	if (q->head == NULL) {
+		q->tail = NULL;
+	}
+}
+
+int sc_sock_wq_flush(struct sc_sock_wq *q)
+{
+	int rc;
+	int64_t n;
+
+	while (q->head != NULL) {
+		n = sc_sock_wq_send(q);
+		if (n < 0) {
+			if (errno != EAGAIN) {
+				return -1;
+			}
+
+			break;
+		}
+
+		sc_sock_wq_consume(q, (size_t) n);
+	}
+
+	if (q->paused && q->size <= q->low) {
+		q->paused = false;
+		if (q->on_low) {
+			q->on_low(q);
+		}
+	}
+
+	if (q->head != NULL) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	if (q->armed) {
+		rc = sc_sock_poll_del(q->poll, &q->sock->fdt, SC_SOCK_WRITE,
+				      q->data);
+		if (rc != 0) {
+			sc_sock_wq_set_err(q, sc_sock_poll_err(q->poll));
+			return -1;
+		}
+		q->armed = false;
+	}
+
+	return 0;
+}
+
+int sc_sock_wq_write(struct sc_sock_wq *q, const void *buf, size_t len)
+{
+	int rc;
+	size_t n, cap;
+	const char *b = buf;
+	struct sc_sock_wq_chunk *c = q->tail;
+
+	// Nothing queued, try to send directly without copying.
+	if (q->head == NULL && len > 0) {
+		rc = sc_sock_send(q->sock, (char *) b,
+				  len > INT32_MAX ? INT32_MAX : (int) len, 0);
+		if (rc < 0 && errno != EAGAIN) {
+			return -1;
+		}
+
+		if (rc > 0) {
+			b += rc;
+			len -= (size_t) rc;
+		}
+	}
+
+	while (len > 0) {
+		// Fill the last chunk first to keep the iovec count low.
+		if (c == NULL || c->len == c->cap) {
+			cap = len > SC_SOCK_WQ_CHUNK ? len : SC_SOCK_WQ_CHUNK;
+
+			c = sc_sock_malloc(sizeof(*c) + cap);
+			if (c == NULL) {
+				sc_sock_wq_set_err(q, "Out of memory");
+				return -1;
+			}
+
+			c->next = NULL;
+			c->cap = cap;
+			c->len = 0;
+			c->pos = 0;
+
+			if (q->tail == NULL) {
+				q->head = c;
+			} else {
+				q->tail->next = c;
+			}
+			q->tail = c;
+		}
+
+		n = c->cap - c->len < len ? c->cap - c->len : len;
+		memcpy(c->buf + c->len, b, n);
+		c->len += n;
+		q->size += n;
+		b += n;
+		len -= n;
+	}
+
+	if (q->head != NULL && !q->armed) {
+		rc = sc_sock_poll_add(q->poll, &q->sock->fdt, SC_SOCK_WRITE,
+				      q->data);
+		if (rc != 0) {
+			sc_sock_wq_set_err(q, sc_sock_poll_err(q->poll));
+			return -1;
+		}
+		q->armed = true;
+	}
+
+	if (!q->paused && q->size >= q->high && q->high > 0) {
+		q->paused = true;
+		if (q->on_high) {
+			q->on_high(q);
+		}
+	}
+
+	return 0;
+}
+
+static void sc_sock_idle_link(struct sc_sock_idle *i,
+			      struct sc_sock_idle_entry *e)
+{
+	uint64_t tick = (e->last + i->timeout) / i->tick;
+	struct sc_sock_idle_entry *head;
+
+	// Keep it in the wheel range, it will be checked again early if the
+	// deadline is beyond.
+	tick = tick <= i->pos ? i->pos + 1 : tick;
+	tick = tick >= i->pos + i->count ? i->pos + i->count - 1 : tick;
+
+	head = &i->slots[tick % i->count];
+
+	e->prev = head;
+	e->next = head->next;
+	head->next->prev = e;
+	head->next = e;
+}
+
+static void sc_sock_idle_unlink(struct sc_sock_idle_entry *e)
+{
+	e->prev->next = e->next;
+	e->next->prev = e->prev;
+	e->next = NULL;
+	e->prev = NULL;
+}
+
+int sc_sock_idle_init(struct sc_sock_idle *i, uint64_t timeout, uint64_t tick)
+{
+	uint64_t count;
+
+	tick = tick == 0 ? 1 : tick;
+	count = timeout / tick + 2;
+
+	*i = (struct sc_sock_idle){
+		.timeout = timeout,
+		.tick = tick,
+		.now = sc_sock_time_ms(),
+		.count = count,
+	};
+
+	i->slots = sc_sock_malloc(sizeof(*i->slots) * count);
+	if (i->slots == NULL) {
+		strncpy(i->err, "Out of memory", sizeof(i->err) - 1);
+		return -1;
+	}
+
+	for (uint64_t j = 0; j < count; j++) {
+		i->slots[j].next = &i->slots[j];
+		i->slots[j].prev = &i->slots[j];
+	}
+
+	i->pos = i->now / tick;
+
+	return 0;
+}
+
+int sc_sock_idle_term(struct sc_sock_idle *i)
+{
+	sc_sock_free(i->slots);
+	i->slots = NULL;
+	i->size = 0;
+
+	return 0;
+}
+
+void sc_sock_idle_add(struct sc_sock_idle *i, struct sc_sock_idle_entry *e,
+		      void *data)
+{
+	e->last = i->now;
+	e->data = data;
+
+	sc_sock_idle_link(i, e);
+	i->size++;
+}
+
+void sc_sock_idle_del(struct sc_sock_idle *i, struct sc_sock_idle_entry *e)
+{
+	if (e->next == NULL) {
+		return;
+	}
+
+	sc_sock_idle_unlink(e);
+	i->size--;
+}
+
+int sc_sock_idle_expired(struct sc_sock_idle *i, struct sc_sock_idle_entry **out,
+			 int max)
+{
+	int n = 0;
+	uint64_t end;
+	struct sc_sock_idle_entry *head, *e, *next, list;
+
+	i->now = sc_sock_time_ms();
+	end = i->now / i->tick;
+
+	// Entries are at most one revolution ahead, don't walk the same
+	// buckets again after a long pause.
+	if (end - i->pos > i->count) {
+		i->pos = end - i->count;
+	}
+
+	// Check buckets of the past ticks, the current one is not complete.
+	while (i->pos < end) {
+		head = &i->slots[i->pos % i->count];
+		if (head->next == head) {
+			i->pos++;
+			continue;
+		}
+
+		if (n == max) {
+			break;
+		}
+
+		// Detach the bucket, entries with recent activity are linked
+		// to the later buckets.
+		list.next = head->next;
+		list.prev = head->prev;
+		list.next->prev = &list;
+		list.prev->next = &list;
+		head->next = head;
+		head->prev = head;
+
+		for (e = list.next; e != &list; e = next) {
+			next = e->next;
+
+			if (e->last + i->timeout > i->now) {
+				sc_sock_idle_link(i, e);
+			} else if (n < max) {
+				e->next = NULL;
+				e->prev = NULL;
+				out[n++] = e;
+				i->size--;
+			} else {
+				// Batch is full, keep it in this bucket.
+				e->prev = head;
+				e->next = head->next;
+				head->next->prev = e;
+				head->next = e;
+			}
+		}
+	}
+
+	return n;
+}
+
+int64_t sc_sock_idle_timeout(struct sc_sock_idle *i)
+{
+	uint64_t now, next;
+
+	if (i->size == 0) {
+		return -1;
+	}
+
+	now = sc_sock_time_ms();
+	next = (i->pos + 1) * i->tick;
+
+	return next > now ? (int64_t) (next - now) : 0;
+}
+
+const char *sc_sock_idle_err(struct sc_sock_idle *i)
+{
+	return i->err;
+}
+
+#if defined(__linux__)
+
+#include <netinet/udp.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+#define SC_SOCK_BATCH 64
+
+union sc_sock_cmsg {
+	char buf[CMSG_SPACE(sizeof(int))];
+	size_t align;
+};
+
+int sc_sock_set_udp_gro(struct sc_sock *s, bool enable)
+{
+	int rc;
+
+	rc = setsockopt(s->fdt.fd, SOL_UDP, UDP_GRO, &(int){enable}, sizeof(int));
+	if (rc != 0) {
+		sc_sock_errstr(s, 0);
+	}
+
+	return rc;
+}
+
+int sc_sock_recv_batch(struct sc_sock *s, struct sc_sock_msg *msgs, int count,
+		       int flags)
+{
+	int n, batch, total = 0;
+	struct cmsghdr *cmsg;
+	struct sc_sock_msg *m;
+	struct mmsghdr hdr[SC_SOCK_BATCH];
+	struct iovec iov[SC_SOCK_BATCH];
+	union sc_sock_cmsg ctl[SC_SOCK_BATCH];
+
+	while (total < count) {
+		batch = count - total < SC_SOCK_BATCH ? count - total :
+							SC_SOCK_BATCH;
+
+		for (int i = 0; i < batch; i++) {
+			m = &msgs[total + i];
+			iov[i] = (struct iovec){
+				.iov_base = m->buf,
+				.iov_len = (size_t) m->len,
+			};
+
+			hdr[i] = (struct mmsghdr){
+				.msg_hdr.msg_name = &m->addr,
+				.msg_hdr.msg_namelen = sizeof(m->addr),
+				.msg_hdr.msg_iov = &iov[i],
+				.msg_hdr.msg_iovlen = 1,
+				.msg_hdr.msg_control = ctl[i].buf,
+				.msg_hdr.msg_controllen = sizeof(ctl[i].buf),
+			};
+		}
+
+		// Block for the first message only, if socket is blocking.
+		n = recvmmsg(s->fdt.fd, hdr, (unsigned int) batch,
+			     flags | MSG_WAITFORONE | (total ? MSG_DONTWAIT : 0),
+			     NULL);
+		sc_sock_stat_call(s, SC_SOCK_CALL_RECVMMSG);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			sc_sock_stat_add(s, eagain, errno == EAGAIN);
+
+			if (total > 0) {
+				break;
+			}
+
+			if (errno != EAGAIN) {
+				sc_sock_errstr(s, 0);
+			}
+
+			return -1;
+		}
+
+		for (int i = 0; i < n; i++) {
+			m = &msgs[total + i];
+			m->len = (int) hdr[i].msg_len;
+			m->addr_len = hdr[i].msg_hdr.msg_namelen;
+			m->segment_size = 0;
+			sc_sock_stat_add(s, bytes_in, m->len);
+
+			cmsg = CMSG_FIRSTHDR(&hdr[i].msg_hdr);
+			for (; cmsg; cmsg = CMSG_NXTHDR(&hdr[i].msg_hdr, cmsg)) {
+				if (cmsg->cmsg_level == SOL_UDP &&
+				    cmsg->cmsg_type == UDP_GRO) {
+					memcpy(&m->segment_size, CMSG_DATA(cmsg),
+					       sizeof(int));
+				}
+			}
+		}
+
+		total += n;
+		if (n < batch) {
+			break;
+		}
+	}
+
+	return total;
+}
+
+int sc_sock_send_batch(struct sc_sock *s, struct sc_sock_msg *msgs, int count,
+		       int flags)
+{
+	int n, batch, total = 0;
+	uint16_t segment;
+	struct cmsghdr *cmsg;
+	struct sc_sock_msg *m;
+	struct mmsghdr hdr[SC_SOCK_BATCH];
+	struct iovec iov[SC_SOCK_BATCH];
+	union sc_sock_cmsg ctl[SC_SOCK_BATCH];
+
+	while (total < count) {
+		batch = count - total < SC_SOCK_BATCH ? count - total :
+							SC_SOCK_BATCH;
+
+		for (int i = 0; i < batch; i++) {
+			m = &msgs[total + i];
+			iov[i] = (struct iovec){
+				.iov_base = m->buf,
+				.iov_len = (size_t) m->len,
+			};
+
+			hdr[i] = (struct mmsghdr){
+				.msg_hdr.msg_name = m->addr_len ? &m->addr : NULL,
+				.msg_hdr.msg_namelen = m->addr_len,
+				.msg_hdr.msg_iov = &iov[i],
+				.msg_hdr.msg_iovlen = 1,
+			};
+
+			// UDP_SEGMENT lets the kernel split the buffer into
+			// 'segment_size' datagrams, one syscall for up to 64k.
+			if (m->segment_size > 0) {
+				memset(ctl[i].buf, 0, sizeof(ctl[i].buf));
+				hdr[i].msg_hdr.msg_control = ctl[i].buf;
+				hdr[i].msg_hdr.msg_controllen =
+					CMSG_SPACE(sizeof(segment));
+
+				segment = (uint16_t) m->segment_size;
+				cmsg = CMSG_FIRSTHDR(&hdr[i].msg_hdr);
+				cmsg->cmsg_level = SOL_UDP;
+				cmsg->cmsg_type = UDP_SEGMENT;
+				cmsg->cmsg_len = CMSG_LEN(sizeof(segment));
+				memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+			}
+		}
+
+		n = sendmmsg(s->fdt.fd, hdr, (unsigned int) batch,
+			     flags | MSG_NOSIGNAL);
+		sc_sock_stat_call(s, SC_SOCK_CALL_SENDMMSG);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			sc_sock_stat_add(s, eagain, errno == EAGAIN);
+
+			if (total > 0) {
+				break;
+			}
+
+			if (errno != EAGAIN) {
+				sc_sock_errstr(s, 0);
+			}
+
+			return -1;
+		}
+
+#ifdef SC_SOCK_STATS
+		for (int i = 0; i < n; i++) {
+			sc_sock_stat_add(s, bytes_out, hdr[i].msg_len);
+		}
+#endif
+		sc_sock_stat_add(s, partial_writes, n < batch);
+
+		total += n;
+		if (n < batch) {
+			break;
+		}
+	}
+
+	return total;
+}
+
+#else
+
+int sc_sock_set_udp_gro(struct sc_sock *s, bool enable)
+{
+	(void) enable;
+
+	strncpy(s->err, "UDP GRO is not supported", sizeof(s->err) - 1);
+	return -1;
+}
+
+int sc_sock_recv_batch(struct sc_sock *s, struct sc_sock_msg *msgs, int count,
+		       int flags)
+{
+	int n, err;
+	struct sc_sock_msg *m;
+
+	for (int i = 0; i < count; i++) {
+		m = &msgs[i];
+		m->addr_len = sizeof(m->addr);
+		m->segment_size = 0;
+
+retry:
+		n = (int) recvfrom(s->fdt.fd, m->buf, (sc_send_recv_size_t) m->len,
+				   flags, (struct sockaddr *) &m->addr,
+				   &m->addr_len);
+		if (n == SC_ERR) {
+			err = sc_sock_err();
+			if (err == SC_EINTR) {
+				goto retry;
+			}
+
+			if (i > 0) {
+				return i;
+			}
+
+			if (err == SC_EAGAIN) {
+				errno = EAGAIN;
+			} else {
+				sc_sock_errstr(s, 0);
+			}
+
+			return -1;
+		}
+
+		m->len = n;
+
+		// Do not block for the remaining messages.
+		if (s->blocking) {
+			return i + 1;
+		}
+	}
+
+	return count;
+}
+
+int sc_sock_send_batch(struct sc_sock *s, struct sc_sock_msg *msgs, int count,
+		       int flags)
+{
+	int n, err, len, seg;
+	struct sc_sock_msg *m;
+	struct sockaddr *addr;
+
+	for (int i = 0; i < count; i++) {
+		m = &msgs[i];
+		addr = m->addr_len ? (struct sockaddr *) &m->addr : NULL;
+		seg = m->segment_size > 0 ? m->segment_size : m->len;
+
+		// No segmentation offload, send segments one by one.
+		for (int off = 0; off < m->len || off == 0; off += seg) {
+			len = m->len - off < seg ? m->len - off : seg;
+retry:
+			n = (int) sendto(s->fdt.fd, m->buf + off,
+					 (sc_send_recv_size_t) len, flags, addr,
+					 m->addr_len);
+			if (n == SC_ERR) {
+				err = sc_sock_err();
+				if (err == SC_EINTR) {
+					goto retry;
+				}
+
+				if (i > 0) {
+					return i;
+				}
+
+				if (err == SC_EAGAIN) {
+					errno = EAGAIN;
+				} else {
+					sc_sock_errstr(s, 0);
+				}
+
+				return -1;
+			}
+
+			if (m->len == 0) {
+				break;
+			}
+		}
+	}
+
+	return count;
+}
+
+#endif
+
+#if defined(__linux__)
+
+#include <linux/errqueue.h>
+#include <sys/sendfile.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+
+int64_t sc_sock_sendfile(struct sc_sock *s, int fd, int64_t *offset,
+			 int64_t len)
+{
+	ssize_t n;
+	off_t off = (off_t) *offset;
+
+	if (len <= 0) {
+		return 0;
+	}
+
+retry:
+	n = sendfile(s->fdt.fd, fd, &off, (size_t) len);
+	sc_sock_stat_call(s, SC_SOCK_CALL_SENDFILE);
+	if (n == -1) {
+		if (errno == EINTR) {
+			goto retry;
+		}
+
+		if (errno != EAGAIN) {
+			sc_sock_errstr(s, 0);
+		}
+
+		sc_sock_stat_add(s, eagain, errno == EAGAIN);
+		return -1;
+	}
+
+	sc_sock_stat_add(s, bytes_out, n);
+	sc_sock_stat_add(s, partial_writes, n < len);
+	*offset = (int64_t) off;
+
+	return (int64_t) n;
+}
+
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__DragonFly__)
+
+int64_t sc_sock_sendfile(struct sc_sock *s, int fd, int64_t *offset,
+			 int64_t len)
+{
+	int rc;
+	off_t sent;
+
+	if (len <= 0) {
+		return 0;
+	}
+
+retry:
+#if defined(__APPLE__)
+	sent = (off_t) len;
+	rc = sendfile(fd, s->fdt.fd, (off_t) *offset, &sent, NULL, 0);
+#else
+	sent = 0;
+	rc = sendfile(fd, s->fdt.fd, (off_t) *offset, (size_t) len, NULL, &sent,
+		      0);
+#endif
+	sc_sock_stat_call(s, SC_SOCK_CALL_SENDFILE);
+	// On EAGAIN and EINTR, 'sent' is set to the partially sent byte count.
+	if (rc == -1 && sent == 0) {
+		if (errno == EINTR) {
+			goto retry;
+		}
+
+		if (errno == EAGAIN || errno == EBUSY) {
+			sc_sock_stat_add(s, eagain, 1);
+			errno = EAGAIN;
+		} else {
+			sc_sock_errstr(s, 0);
+		}
+
+		return -1;
+	}
+
+	sc_sock_stat_add(s, bytes_out, sent);
+	sc_sock_stat_add(s, partial_writes, sent < len);
+	*offset += (int64_t) sent;
+
+	return (int64_t) sent;
+}
+
+#elif !defined(_WIN32) && !defined(_WIN64)
+
+int64_t sc_sock_sendfile(struct sc_sock *s, int fd, int64_t *offset,
+			 int64_t len)
+{
+	ssize_t n, r;
+	char buf[16384];
+	size_t size = len < (int64_t) sizeof(buf) ? (size_t) len : sizeof(buf);
+
+	if (len <= 0) {
+		return 0;
+	}
+
+	// No sendfile(), data is sent from a stack buffer. Only the sent part
+	// is consumed, so partial writes don't lose data.
+retry_read:
+	r = pread(fd, buf, size, (off_t) *offset);
+	if (r <= 0) {
+		if (r == -1 && errno == EINTR) {
+			goto retry_read;
+		}
+
+		if (r == -1) {
+			sc_sock_errstr(s, 0);
+		}
+		return r;
+	}
+
+retry:
+	n = send(s->fdt.fd, buf, (size_t) r, 0);
+	sc_sock_stat_call(s, SC_SOCK_CALL_SENDFILE);
+	if (n == -1) {
+		if (errno == EINTR) {
+			goto retry;
+		}
+
+		if (errno != EAGAIN) {
+			sc_sock_errstr(s, 0);
+		}
+
+		sc_sock_stat_add(s, eagain, errno == EAGAIN);
+		return -1;
+	}
+
+	sc_sock_stat_add(s, bytes_out, n);
+	sc_sock_stat_add(s, partial_writes, n < len);
+	*offset += n;
+
+	return (int64_t) n;
+}
+
+#else
+
+int64_t sc_sock_sendfile(struct sc_sock *s, int fd, int64_t *offset,
+			 int64_t len)
+{
+	(void) fd;
+	(void) offset;
+	(void) len;
+
+	strncpy(s->err, "sendfile is not supported", sizeof(s->err) - 1);
+	return -1;
+}
+
+#endif
+
+#if defined(__linux__)
+
+int sc_sock_set_zerocopy(struct sc_sock *s, bool enable)
+{
+	int rc;
+	void *tmp = (void *) &(int){enable};
+
+	rc = setsockopt(s->fdt.fd, SOL_SOCKET, SO_ZEROCOPY, tmp, sizeof(int));
+	if (rc != 0) {
+		sc_sock_errstr(s, 0);
+	}
+
+	return rc;
+}
+
+int sc_sock_send_zerocopy(struct sc_sock *s, char *buf, int len, int flags)
+{
+	return sc_sock_send(s, buf, len, flags | MSG_ZEROCOPY);
+}
+
+int sc_sock_zerocopy_done(struct sc_sock *s, uint32_t *lo, uint32_t *hi,
+			  bool *copied)
+{
+	int rc, err = 0;
+	ssize_t n;
+	socklen_t len = sizeof(err);
+	struct cmsghdr *cm;
+	struct sock_extended_err *ee;
+	union {
+		char buf[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+		size_t align;
+	} ctl;
+
+	struct msghdr msg = {
+		.msg_control = ctl.buf,
+		.msg_controllen = sizeof(ctl.buf),
+	};
+
+retry:
+	n = recvmsg(s->fdt.fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+	if (n == -1) {
+		if (errno == EINTR) {
+			goto retry;
+		}
+
+		if (errno != EAGAIN) {
+			sc_sock_errstr(s, 0);
+			return -1;
+		}
+
+		// Queue is empty, but a pending socket error raises the same
+		// event. Report it, otherwise level triggered poll never stops.
+		rc = getsockopt(s->fdt.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+		if (rc == 0 && err != 0) {
+			errno = err;
+			sc_sock_errstr(s, 0);
+		} else {
+			errno = EAGAIN;
+		}
+
+		return -1;
+	}
+
+	for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+		if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+		    !(cm->cmsg_level == SOL_IPV6 &&
+		      cm->cmsg_type == IPV6_RECVERR)) {
+			continue;
+		}
+
+		ee = (struct sock_extended_err *) (void *) CMSG_DATA(cm);
+		if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+			// e.g., ICMP error on a socket with IP_RECVERR.
+			errno = ee->ee_errno != 0 ? (int) ee->ee_errno : EIO;
+			sc_sock_errstr(s, 0);
+			return -1;
+		}
+
+		*lo = ee->ee_info;
+		*hi = ee->ee_data;
+		*copied = (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0;
+
+		return 0;
+	}
+
+	errno = EIO;
+	strncpy(s->err, "Unknown error queue message", sizeof(s->err) - 1);
+
+	return -1;
+}
+
+#else
+
+int sc_sock_set_zerocopy(struct sc_sock *s, bool enable)
+{
+	(void) enable;
+
+	strncpy(s->err, "MSG_ZEROCOPY is not supported", sizeof(s->err) - 1);
+	return -1;
+}
+
+int sc_sock_send_zerocopy(struct sc_sock *s, char *buf, int len, int flags)
+{
+	(void) buf;
+	(void) len;
+	(void) flags;
+
+	strncpy(s->err, "MSG_ZEROCOPY is not supported", sizeof(s->err) - 1);
+	return -1;
+}
+
+int sc_sock_zerocopy_done(struct sc_sock *s, uint32_t *lo, uint32_t *hi,
+			  bool *copied)
+{
+	(void) lo;
+	(void) hi;
+	(void) copied;
+
+	strncpy(s->err, "MSG_ZEROCOPY is not supported", sizeof(s->err) - 1);
+	return -1;
+}
+
+#endif
+
+static void sc_sock_relay_errstr(struct sc_sock_relay *r, const char *op,
+				 const char *reason)
+{
+	snprintf(r->err, sizeof(r->err), "%s : %s", op, reason);
+}
+
+const char *sc_sock_relay_err(struct sc_sock_relay *r)
+{
+	return r->err;
+}
+
+#if defined(__linux__)
+
+int sc_sock_relay_init(struct sc_sock_relay *r)
+{
+	int rc;
+
+	*r = (struct sc_sock_relay){
+		.fds = {-1, -1},
+	};
+
+	rc = pipe2(r->fds, O_NONBLOCK | O_CLOEXEC);
+	if (rc != 0) {
+		sc_sock_relay_errstr(r, "pipe2", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int sc_sock_relay_term(struct sc_sock_relay *r)
+{
+	int rc = 0;
+
+	for (int i = 0; i < 2; i++) {
+		if (r->fds[i] != -1 && close(r->fds[i]) != 0) {
+			sc_sock_relay_errstr(r, "close", strerror(errno));
+			rc = -1;
+		}
+		r->fds[i] = -1;
+	}
+
+	return rc;
+}
+
+int64_t sc_sock_relay(struct sc_sock_relay *r, struct sc_sock *src,
+		      struct sc_sock *dst, int64_t len)
+{
+	const unsigned int flags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+
+	ssize_t n;
+	int64_t total = 0;
+	bool eof = false;
+
+	while (total < len) {
+		if (r->pending == 0) {
+			n = splice(src->fdt.fd, NULL, r->fds[1], NULL,
+				   (size_t) (len - total), flags);
+			if (n == 0) {
+				eof = true;
+				break;
+			} else if (n == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+
+				if (errno == EAGAIN) {
+					break;
+				}
+
+				sc_sock_relay_errstr(r, "splice", strerror(errno));
+				return -1;
+			}
+
+			r->pending = n;
+		}
+
+		n = splice(r->fds[0], NULL, dst->fdt.fd, NULL,
+			   (size_t) r->pending, flags);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			if (errno == EAGAIN) {
+				break;
+			}
+
+			sc_sock_relay_errstr(r, "splice", strerror(errno));
+			return -1;
+		}
+
+		r->pending -= n;
+		total += n;
+	}
+
+	if (total > 0) {
+		return total;
+	}
+
+	errno = eof ? EOF : EAGAIN;
+	return -1;
+}
+
+#else
+
+#define SC_SOCK_RELAY_BUF (64 * 1024)
+
+int sc_sock_relay_init(struct sc_sock_relay *r)
+{
+	*r = (struct sc_sock_relay){0};
+
+	r->buf = sc_sock_malloc(SC_SOCK_RELAY_BUF);
+	if (r->buf == NULL) {
+		sc_sock_relay_errstr(r, "malloc", "Out of memory");
+		return -1;
+	}
+
+	return 0;
+}
+
+int sc_sock_relay_term(struct sc_sock_relay *r)
+{
+	sc_sock_free(r->buf);
+	r->buf = NULL;
+
+	return 0;
+}
+
+int64_t sc_sock_relay(struct sc_sock_relay *r, struct sc_sock *src,
+		      struct sc_sock *dst, int64_t len)
+{
+	int n;
+	int64_t total = 0;
+	bool eof = false;
+
+	// No splice(), data is relayed through a user space buffer.
+	while (total < len) {
+		if (r->pending == 0) {
+			n = (int) (len - total < SC_SOCK_RELAY_BUF ?
+					   len - total :
+					   SC_SOCK_RELAY_BUF);
+			n = sc_sock_recv(src, r->buf, n, 0);
+			if (n < 0) {
+				if (errno == EOF) {
+					eof = true;
+					break;
+				}
+
+				if (errno == EAGAIN) {
+					break;
+				}
+
+				sc_sock_relay_errstr(r, "recv", sc_sock_error(src));
+				return -1;
+			}
+
+			r->pos = 0;
+			r->pending = n;
+		}
+
+		n = sc_sock_send(dst, r->buf + r->pos, (int) r->pending, 0);
+		if (n < 0) {
+			if (errno == EAGAIN) {
+				break;
+			}
+
+			sc_sock_relay_errstr(r, "send", sc_sock_error(dst));
+			return -1;
+		}
+
+		r->pos += n;
+		r->pending -= n;
+		total += n;
+	}
+
+	if (total > 0) {
+		return total;
+	}
+
+	errno = eof ? EOF : EAGAIN;
+	return -1;
+}
+
+#endif
+
+int sc_sock_accept(struct sc_sock *s, struct sc_sock *in)
+{
+	const void *tmp = (void *) &(int){1};
+
+	int rc;
+	sc_sock_int fd;
+
+	fd = accept(s->fdt.fd, NULL, NULL);
+	sc_sock_stat_call(s, SC_SOCK_CALL_ACCEPT);
+	if (fd == SC_INVALID) {
+		if (!s->blocking && sc_sock_err() == SC_EAGAIN) {
+			sc_sock_stat_add(s, eagain, 1);
+			errno = EAGAIN;
+		} else {
+			sc_sock_errstr(s, 0);
+		}
+		return -1;
+	}
+
+	in->fdt.fd = fd;
+	in->fdt.op = SC_SOCK_NONE;
+	in->family = s->family;
+	in->stats = (struct sc_sock_stats){0};
+
+	if (in->family != AF_UNIX) {
+		rc = setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, tmp, sizeof(int));
+		if (rc != 0) {
+			goto error;
+		}
+	}
+
+	rc = sc_sock_set_blocking(in, s->blocking);
+	if (rc != 0) {
+		goto error;
+	}
+
+	return 0;
+
+error:
+	sc_sock_errstr(s, 0);
+	sc_sock_close(in);
+
+	return -1;
+}
+
+static int sc_sock_listen_inner(struct sc_sock *s, const char *host,
+				const char *port, bool reuseport)
+{
+	int rc;
+
+	rc = sc_sock_bind(s, host, port, SOCK_STREAM, reuseport);
+	if (rc != 0) {
+		return rc;
+	}
+
+	rc = listen(s->fdt.fd, 4096);
+	if (rc != 0) {
+		goto err;
+	}
+
+	return 0;
+err:
+	sc_sock_errstr(s, 0);
+	sc_sock_close(s);
+	return -1;
+}
+
+int sc_sock_accept_batch(struct sc_sock *s, struct sc_sock *in, int count)
+{
+	const void *tmp = (void *) &(int){1};
+
+	int rc, n = 0;
+	sc_sock_int fd;
+
+	while (n < count) {
+#if defined(__linux__)
+		// accept4() sets non-blocking mode without extra fcntl() calls.
+		fd = accept4(s->fdt.fd, NULL, NULL,
+			     s->blocking ? 0 : SOCK_NONBLOCK);
+#else
+		fd = accept(s->fdt.fd, NULL, NULL);
+#endif
+		sc_sock_stat_call(s, SC_SOCK_CALL_ACCEPT);
+		if (fd == SC_INVALID) {
+			if (sc_sock_err() == SC_EINTR) {
+				continue;
+			}
+
+			sc_sock_stat_add(s, eagain, sc_sock_err() == SC_EAGAIN);
+
+			if (n > 0) {
+				break;
+			}
+
+			if (!s->blocking && sc_sock_err() == SC_EAGAIN) {
+				errno = EAGAIN;
+			} else {
+				sc_sock_errstr(s, 0);
+			}
+
+			return -1;
+		}
+
+		sc_sock_init(&in[n], s->fdt.type, s->blocking, s->family);
+		in[n].fdt.fd = fd;
+
+		if (s->family != AF_UNIX) {
+			rc = setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, tmp,
+					sizeof(int));
+			if (rc != 0) {
+				goto error;
+			}
+		}
+
+#if !defined(__linux__)
+		rc = sc_sock_set_blocking(&in[n], s->blocking);
+		if (rc != 0) {
+			goto error;
+		}
+#endif
+		n++;
+
+		// Next accept() call would block.
+		if (s->blocking) {
+			break;
+		}
+	}
+
+	return n;
+
+error:
+	sc_sock_errstr(s, 0);
+	sc_sock_close(&in[n]);
+
+	return n > 0 ? n : -1;
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+
+// Socket state that is sent along with the descriptor.
+struct sc_sock_handoff_info {
+	int32_t type;
+	int32_t family;
+	int32_t blocking;
+};
+
+int sc_sock_handoff_send(struct sc_sock *s, struct sc_sock **socks, int count)
+{
+	ssize_t n;
+	int *fds;
+	struct cmsghdr *cmsg;
+	struct sc_sock_handoff_info info[SC_SOCK_HANDOFF_MAX];
+	union {
+		char buf[CMSG_SPACE(sizeof(int) * SC_SOCK_HANDOFF_MAX)];
+		struct cmsghdr align;
+	} ctl;
+
+	if (count <= 0 || count > SC_SOCK_HANDOFF_MAX) {
+		strncpy(s->err, "Invalid socket count", sizeof(s->err) - 1);
+		return -1;
+	}
+
+	struct iovec iov = {
+		.iov_base = info,
+		.iov_len = sizeof(info[0]) * (size_t) count,
+	};
+
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = ctl.buf,
+		.msg_controllen = CMSG_SPACE(sizeof(int) * (size_t) count),
+	};
+
+	memset(&ctl, 0, sizeof(ctl));
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * (size_t) count);
+	fds = (int *) (void *) CMSG_DATA(cmsg);
+
+	for (int i = 0; i < count; i++) {
+		fds[i] = socks[i]->fdt.fd;
+		info[i] = (struct sc_sock_handoff_info){
+			.type = socks[i]->fdt.type,
+			.family = socks[i]->family,
+			.blocking = socks[i]->blocking,
+		};
+	}
+
+retry:
+	n = sendmsg(s->fdt.fd, &msg, 0);
+	if (n == -1) {
+		if (errno == EINTR) {
+			goto retry;
+		}
+
+		if (errno != EAGAIN) {
+			sc_sock_errstr(s, 0);
+		}
+
+		return -1;
+	}
+
+	if ((size_t) n != iov.iov_len) {
+		strncpy(s->err, "Partial write", sizeof(s->err) - 1);
+		return -1;
+	}
+
+	return count;
+}
+
+int sc_sock_handoff_recv(struct sc_sock *s, struct sc_sock *socks, int count)
+{
+	int flags = 0;
+	int fd_count = 0, info_count;
+	int fds[SC_SOCK_HANDOFF_MAX];
+	ssize_t n;
+	struct cmsghdr *cmsg;
+	struct sc_sock_handoff_info info[SC_SOCK_HANDOFF_MAX];
+	union {
+		char buf[CMSG_SPACE(sizeof(int) * SC_SOCK_HANDOFF_MAX)];
+		struct cmsghdr align;
+	} ctl;
+
+	struct iovec iov = {
+		.iov_base = info,
+		.iov_len = sizeof(info),
+	};
+
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = ctl.buf,
+		.msg_controllen = sizeof(ctl.buf),
+	};
+
+#if defined(MSG_CMSG_CLOEXEC)
+	flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+retry:
+	n = recvmsg(s->fdt.fd, &msg, flags);
+	if (n == 0) {
+		errno = EOF;
+		return -1;
+	} else if (n == -1) {
+		if (errno == EINTR) {
+			goto retry;
+		}
+
+		if (errno != EAGAIN) {
+			sc_sock_errstr(s, 0);
+		}
+
+		return -1;
+	}
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS) {
+			fd_count = (int) ((cmsg->cmsg_len - CMSG_LEN(0)) /
+					  sizeof(int));
+			memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * (size_t) fd_count);
+			break;
+		}
+	}
+
+	info_count = (int) ((size_t) n / sizeof(info[0]));
+
+	if (fd_count == 0 || fd_count != info_count || fd_count > count ||
+	    (msg.msg_flags & MSG_CTRUNC)) {
+		strncpy(s->err, "Invalid handoff message", sizeof(s->err) - 1);
+		goto error;
+	}
+
+	for (int i = 0; i < fd_count; i++) {
+		sc_sock_init(&socks[i], info[i].type, info[i].blocking != 0,
+			     info[i].family);
+		socks[i].fdt.fd = fds[i];
+	}
+
+	return fd_count;
+
+error:
+	for (int i = 0; i < fd_count; i++) {
+		close(fds[i]);
+	}
+
+	return -1;
+}
+
+#else
+
+int sc_sock_handoff_send(struct sc_sock *s, struct sc_sock **socks, int count)
+{
+	(void) socks;
+	(void) count;
+
+	strncpy(s->err, "Socket handoff is not supported", sizeof(s->err) - 1);
+	return -1;
+}
+
+int sc_sock_handoff_recv(struct sc_sock *s, struct sc_sock *socks, int count)
+{
+	(void) socks;
+	(void) count;
+
+	strncpy(s->err, "Socket handoff is not supported", sizeof(s->err) - 1);
+	return -1;
+}
+
+#endif
+
+int sc_sock_listen(struct sc_sock *s, const char *host, const char *port)
+{
+	return sc_sock_listen_inner(s, host, port, false);
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+
+#if defined(__linux__)
+#include <linux/filter.h>
+#include <sched.h>
+#endif
+
+static void sc_sock_listener_set_err(struct sc_sock_listener *l,
+				     const char *msg, const char *reason)
+{
+	snprintf(l->err, sizeof(l->err), "%s : %s", msg, reason);
+}
+
+const char *sc_sock_listener_err(struct sc_sock_listener *l)
+{
+	l->err[sizeof(l->err) - 1] = '\0';
+	return l->err;
+}
+
+// Classic BPF program for the SO_REUSEPORT group, selects the socket of the
+// reactor pinned to the CPU which handled the incoming packet. CPU ids may not
+// be contiguous, so it is a compare chain over the process affinity mask.
+static int sc_sock_listener_steer(struct sc_sock_listener *l)
+{
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+	int rc, j = 0, n = 0;
+	cpu_set_t set;
+	struct sock_filter *code;
+	struct sock_fprog prog;
+
+	rc = sched_getaffinity(0, sizeof(set), &set);
+	if (rc != 0) {
+		sc_sock_listener_set_err(l, "steer", strerror(errno));
+		return -1;
+	}
+
+	if (CPU_COUNT(&set) != l->count) {
+		sc_sock_listener_set_err(l, "steer",
+					 "reactor count must match CPU count");
+		return -1;
+	}
+
+	code = sc_sock_malloc(sizeof(*code) * (size_t) (l->count * 2 + 3));
+	if (code == NULL) {
+		sc_sock_listener_set_err(l, "steer", strerror(ENOMEM));
+		return -1;
+	}
+
+	code[n++] = (struct sock_filter){BPF_LD | BPF_W | BPF_ABS, 0, 0,
+					 (uint32_t) (SKF_AD_OFF + SKF_AD_CPU)};
+
+	for (int cpu = 0; cpu < CPU_SETSIZE && j < l->count; cpu++) {
+		if (!CPU_ISSET(cpu, &set)) {
+			continue;
+		}
+
+		l->reactors[j].cpu = cpu;
+		code[n++] = (struct sock_filter){BPF_JMP | BPF_JEQ | BPF_K, 0, 1,
+						 (uint32_t) cpu};
+		code[n++] = (struct sock_filter){BPF_RET | BPF_K, 0, 0,
+						 (uint32_t) j++};
+	}
+
+	// Unknown CPU, e.g. affinity changed later.
+	code[n++] = (struct sock_filter){BPF_ALU | BPF_MOD | BPF_K, 0, 0,
+					 (uint32_t) l->count};
+	code[n++] = (struct sock_filter){BPF_RET | BPF_A, 0, 0, 0};
+
+	prog = (struct sock_fprog){
+		.len = (unsigned short) n,
+		.filter = code,
+	};
+
+	rc = setsockopt(l->reactors[0].sock.fdt.fd, SOL_SOCKET,
+			SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+	if (rc != 0) {
+		sc_sock_listener_set_err(l, "steer", strerror(errno));
+	}
+
+	sc_sock_free(code);
+
+	return rc;
+#else
+	sc_sock_listener_set_err(l, "steer", "not supported");
+	return -1;
+#endif
+}
+
+int sc_sock_listener_init(struct sc_sock_listener *l, int count, int family,
+			  const char *host, const char *port, bool steer)
+{
+	int rc;
+	char buf[16];
+	const char *p = port;
+	struct sockaddr_storage st;
+	socklen_t len = sizeof(st);
+	struct sc_sock_reactor *r;
+
+	*l = (struct sc_sock_listener){
+		.steer = steer,
+	};
+
+	if (count <= 0 || family == AF_UNIX) {
+		sc_sock_listener_set_err(l, "init", strerror(EINVAL));
+		return -1;
+	}
+
+	l->reactors = sc_sock_malloc(sizeof(*l->reactors) * (size_t) count);
+	if (l->reactors == NULL) {
+		sc_sock_listener_set_err(l, "init", strerror(ENOMEM));
+		return -1;
+	}
+
+	for (int i = 0; i < count; i++) {
+		r = &l->reactors[i];
+		*r = (struct sc_sock_reactor){
+			.index = i,
+			.cpu = -1,
+			.listener = l,
+		};
+
+		sc_sock_init(&r->sock, 0, false, family);
+
+		rc = sc_sock_poll_init(&r->poll);
+		if (rc != 0) {
+			sc_sock_listener_set_err(l, "poll", sc_sock_poll_err(&r->poll));
+			goto error;
+		}
+		l->count++;
+
+		rc = sc_sock_listen_inner(&r->sock, host, p, true);
+		if (rc != 0) {
+			sc_sock_listener_set_err(l, "listen", sc_sock_error(&r->sock));
+			goto error;
+		}
+
+		// If an ephemeral port is requested, the first socket decides it.
+		if (i == 0) {
+			rc = getsockname(r->sock.fdt.fd, (struct sockaddr *) &st,
+					 &len);
+			if (rc != 0) {
+				sc_sock_listener_set_err(l, "listen", strerror(errno));
+				goto error;
+			}
+
+			snprintf(buf, sizeof(buf), "%d",
+				 st.ss_family == AF_INET ?
+					 ntohs(((struct sockaddr_in *) &st)->sin_port) :
+					 ntohs(((struct sockaddr_in6 *) &st)->sin6_port));
+			p = buf;
+		}
+
+		rc = sc_sock_poll_add(&r->poll, &r->sock.fdt, SC_SOCK_READ,
+				      &r->sock);
+		if (rc != 0) {
+			sc_sock_listener_set_err(l, "poll", sc_sock_poll_err(&r->poll));
+			goto error;
+		}
+	}
+
+	if (steer && sc_sock_listener_steer(l) != 0) {
+		goto error;
+	}
+
+	return 0;
+
+error:
+	sc_sock_listener_term(l);
+	return -1;
+}
+
+static void *sc_sock_listener_run(void *arg)
+{
+	struct sc_sock_reactor *r = arg;
+
+	r->listener->fn(r);
+
+	return NULL;
+}
+
+int sc_sock_listener_start(struct sc_sock_listener *l,
+			   void (*fn)(struct sc_sock_reactor *r), void *arg)
+{
+	int rc;
+	pthread_attr_t attr;
+	struct sc_sock_reactor *r;
+
+	l->fn = fn;
+
+	for (int i = 0; i < l->count; i++) {
+		r = &l->reactors[i];
+		r->arg = arg;
+
+		rc = pthread_attr_init(&attr);
+		if (rc != 0) {
+			sc_sock_listener_set_err(l, "pthread_attr_init",
+						 strerror(rc));
+			return -1;
+		}
+
+#if defined(__linux__)
+		if (r->cpu >= 0) {
+			cpu_set_t set;
+
+			CPU_ZERO(&set);
+			CPU_SET((size_t) r->cpu, &set);
+			rc = pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+			if (rc != 0) {
+				pthread_attr_destroy(&attr);
+				sc_sock_listener_set_err(l, "affinity",
+							 strerror(rc));
+				return -1;
+			}
+		}
+#endif
+
+		rc = pthread_create(&r->thread, &attr, sc_sock_listener_run, r);
+		pthread_attr_destroy(&attr);
+		if (rc != 0) {
+			sc_sock_listener_set_err(l, "pthread_create", strerror(rc));
+			return -1;
+		}
+
+		r->started = true;
+	}
+
+	return 0;
+}
+
+int sc_sock_listener_term(struct sc_sock_listener *l)
+{
+	int rc = 0;
+	struct sc_sock_reactor *r;
+
+	if (l->reactors == NULL) {
+		return 0;
+	}
+
+	for (int i = 0; i < l->count; i++) {
+		r = &l->reactors[i];
+
+		if (r->started) {
+			pthread_join(r->thread, NULL);
+			r->started = false;
+		}
+
+		if (sc_sock_term(&r->sock) != 0) {
+			sc_sock_listener_set_err(l, "term", sc_sock_error(&r->sock));
+			rc = -1;
+		}
+
+		if (sc_sock_poll_term(&r->poll) != 0) {
+			sc_sock_listener_set_err(l, "term", sc_sock_poll_err(&r->poll));
+			rc = -1;
+		}
+	}
+
+	sc_sock_free(l->reactors);
+	l->reactors = NULL;
+	l->count = 0;
+
+	return rc;
+}
+
+#ifndef SC_SOCK_RESOLVE_CACHE
+#define SC_SOCK_RESOLVE_CACHE 128
+#endif
+
+static void sc_sock_resolver_set_err(struct sc_sock_resolver *r,
+				     const char *msg, const char *reason)
+{
+	snprintf(r->err, sizeof(r->err), "%s : %s", msg, reason);
+}
+
+const char *sc_sock_resolver_err(struct sc_sock_resolver *r)
+{
+	return r->err;
+}
+
+const char *sc_sock_resolve_err(struct sc_sock_resolve *req)
+{
+	return req->rc == 0 ? "" : gai_strerror(req->rc);
+}
+
+static struct sc_sock_resolver_entry *
+sc_sock_resolver_find(struct sc_sock_resolver *r, const char *host,
+		      const char *port)
+{
+	struct sc_sock_resolver_entry *e;
+
+	for (int i = 0; i < r->cache_size; i++) {
+		e = &r->cache[i];
+		if (e->expiry != 0 && strcmp(e->host, host) == 0 &&
+		    strcmp(e->port, port) == 0) {
+			return e;
+		}
+	}
+
+	return NULL;
+}
+
+static void sc_sock_resolver_cache_add(struct sc_sock_resolver *r,
+				       struct sc_sock_resolve *req)
+{
+	uint64_t now = sc_sock_time_ms();
+	struct sc_sock_resolver_entry *e;
+
+	e = sc_sock_resolver_find(r, req->host, req->port);
+	if (e == NULL) {
+		// Replace an expired or unused entry, otherwise the one that
+		// expires first.
+		e = &r->cache[0];
+		for (int i = 0; i < r->cache_size; i++) {
+			if (r->cache[i].expiry <= now) {
+				e = &r->cache[i];
+				break;
+			}
+
+			if (r->cache[i].expiry < e->expiry) {
+				e = &r->cache[i];
+			}
+		}
+	}
+
+	strcpy(e->host, req->host);
+	strcpy(e->port, req->port);
+	e->expiry = now + r->ttl;
+	e->count = req->count;
+	memcpy(e->addrs, req->addrs, sizeof(*e->addrs) * (size_t) req->count);
+}
+
+static void sc_sock_resolver_lookup(struct sc_sock_resolve *req)
+{
+	struct addrinfo *info = NULL, *p;
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+	};
+
+	req->count = 0;
+	req->rc = getaddrinfo(req->host, req->port, &hints, &info);
+	if (req->rc != 0) {
+		return;
+	}
+
+	for (p = info; p && req->count < SC_SOCK_RESOLVE_MAX; p = p->ai_next) {
+		if (p->ai_addrlen > sizeof(req->addrs[0].addr)) {
+			continue;
+		}
+
+		req->addrs[req->count].family = p->ai_family;
+		req->addrs[req->count].len = (socklen_t) p->ai_addrlen;
+		memcpy(&req->addrs[req->count].addr, p->ai_addr, p->ai_addrlen);
+		req->count++;
+	}
+
+	freeaddrinfo(info);
+}
+
+static void *sc_sock_resolver_run(void *arg)
+{
+	bool wake;
+	struct sc_sock_resolve *req;
+	struct sc_sock_resolver *r = arg;
+
+	while (true) {
+		pthread_mutex_lock(&r->mtx);
+		while (!r->stop && r->pending == NULL) {
+			pthread_cond_wait(&r->cond, &r->mtx);
+		}
+
+		if (r->stop) {
+			pthread_mutex_unlock(&r->mtx);
+			break;
+		}
+
+		req = r->pending;
+		r->pending = req->next;
+		pthread_mutex_unlock(&r->mtx);
+
+		sc_sock_resolver_lookup(req);
+		req->next = NULL;
+
+		pthread_mutex_lock(&r->mtx);
+		if (req->rc == 0 && r->cache_size > 0) {
+			sc_sock_resolver_cache_add(r, req);
+		}
+
+		if (r->done == NULL) {
+			r->done = req;
+		} else {
+			r->done_tail->next = req;
+		}
+		r->done_tail = req;
+
+		// Single pipe write until the completion list is drained.
+		wake = !r->signalled;
+		r->signalled = true;
+		pthread_mutex_unlock(&r->mtx);
+
+		if (wake) {
+			sc_sock_pipe_write(&r->pipe, "", 1);
+		}
+	}
+
+	return NULL;
+}
+
+int sc_sock_resolver_init(struct sc_sock_resolver *r, int threads,
+			  uint64_t ttl)
+{
+	int rc;
+
+	*r = (struct sc_sock_resolver){
+		.ttl = ttl,
+		.pipe.fds = {SC_INVALID, SC_INVALID},
+	};
+
+	if (threads <= 0) {
+		sc_sock_resolver_set_err(r, "init", strerror(EINVAL));
+		return -1;
+	}
+
+	rc = sc_sock_pipe_init(&r->pipe, 0);
+	if (rc != 0) {
+		sc_sock_resolver_set_err(r, "pipe", sc_sock_pipe_err(&r->pipe));
+		return -1;
+	}
+
+	pthread_mutex_init(&r->mtx, NULL);
+	pthread_cond_init(&r->cond, NULL);
+
+	r->threads = sc_sock_malloc(sizeof(*r->threads) * (size_t) threads);
+	if (r->threads == NULL) {
+		sc_sock_resolver_set_err(r, "init", strerror(ENOMEM));
+		goto error;
+	}
+
+	if (ttl > 0) {
+		r->cache = sc_sock_malloc(sizeof(*r->cache) * SC_SOCK_RESOLVE_CACHE);
+		if (r->cache == NULL) {
+			sc_sock_resolver_set_err(r, "init", strerror(ENOMEM));
+			goto error;
+		}
+
+		r->cache_size = SC_SOCK_RESOLVE_CACHE;
+		for (int i = 0; i < r->cache_size; i++) {
+			r->cache[i].expiry = 0;
+		}
+	}
+
+	for (int i = 0; i < threads; i++) {
+		rc = pthread_create(&r->threads[i], NULL, sc_sock_resolver_run, r);
+		if (rc != 0) {
+			sc_sock_resolver_set_err(r, "pthread_create", strerror(rc));
+			goto error;
+		}
+		r->count++;
+	}
+
+	return 0;
+
+error:
+	sc_sock_resolver_term(r);
+	return -1;
+}
+
+int sc_sock_resolver_term(struct sc_sock_resolver *r)
+{
+	int rc = 0;
+
+	if (r->pipe.fds[0] == SC_INVALID) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&r->mtx);
+	r->stop = true;
+	pthread_cond_broadcast(&r->cond);
+	pthread_mutex_unlock(&r->mtx);
+
+	for (int i = 0; i < r->count; i++) {
+		pthread_join(r->threads[i], NULL);
+	}
+
+	if (sc_sock_pipe_term(&r->pipe) != 0) {
+		sc_sock_resolver_set_err(r, "pipe", sc_sock_pipe_err(&r->pipe));
+		rc = -1;
+	}
+
+	pthread_cond_destroy(&r->cond);
+	pthread_mutex_destroy(&r->mtx);
+
+	sc_sock_free(r->threads);
+	sc_sock_free(r->cache);
+	r->threads = NULL;
+	r->cache = NULL;
+	r->count = 0;
+	r->cache_size = 0;
+
+	return rc;
+}
+
+int sc_sock_resolve(struct sc_sock_resolver *r, struct sc_sock_resolve *req,
+		    const char *host, const char *port, void *data)
+{
+	int n, m;
+	struct sc_sock_resolver_entry *e;
+
+	n = snprintf(req->host, sizeof(req->host), "%s", host);
+	m = snprintf(req->port, sizeof(req->port), "%s", port);
+	if (n < 0 || (size_t) n >= sizeof(req->host) || m < 0 ||
+	    (size_t) m >= sizeof(req->port)) {
+		sc_sock_resolver_set_err(r, "resolve", strerror(EINVAL));
+		return -1;
+	}
+
+	req->data = data;
+	req->next = NULL;
+	req->rc = 0;
+	req->count = 0;
+
+	pthread_mutex_lock(&r->mtx);
+
+	e = sc_sock_resolver_find(r, req->host, req->port);
+	if (e != NULL && e->expiry > sc_sock_time_ms()) {
+		req->count = e->count;
+		memcpy(req->addrs, e->addrs,
+		       sizeof(*req->addrs) * (size_t) e->count);
+		pthread_mutex_unlock(&r->mtx);
+		return 1;
+	}
+
+	if (r->pending == NULL) {
+		r->pending = req;
+	} else {
+		r->pending_tail->next = req;
+	}
+	r->pending_tail = req;
+
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->mtx);
+
+	return 0;
+}
+
+struct sc_sock_resolve *sc_sock_resolver_next(struct sc_sock_resolver *r)
+{
+	char c;
+	struct sc_sock_resolve *req;
+
+	pthread_mutex_lock(&r->mtx);
+
+	req = r->done;
+	if (req != NULL) {
+		r->done = req->next;
+		req->next = NULL;
+	}
+
+	if (r->done == NULL && r->signalled) {
+		r->signalled = false;
+		sc_sock_pipe_read(&r->pipe, &c, 1);
+	}
+
+	pthread_mutex_unlock(&r->mtx);
+
+	return req;
+}
+
+#endif
+
+int sc_sock_udp_bind(struct sc_sock *s, const char *host, const char *port)
+{
+	return sc_sock_bind(s, host, port, SOCK_DGRAM, false);
+}
+
+const char *sc_sock_error(struct sc_sock *s)
+{
+	s->err[sizeof(s->err) - 1] = '\0';
+	return s->err;
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+#define sc_sock_addr_size_t size_t
+#else
+#define sc_sock_addr_size_t socklen_t
+#endif
+
+static const char *sc_sock_addr(struct sc_sock *sock, int af, void *cp,
+				char *buf, size_t len)
+{
+	const char *dest;
+
+	dest = inet_ntop(af, cp, buf, (sc_sock_addr_size_t) len);
+	if (dest == NULL) {
+		sc_sock_errstr(sock, 0);
+		*buf = '\0';
+	}
+
+	return dest;
+}
+
+static const char *sc_sock_print_storage(struct sc_sock *sock,
+					 struct sockaddr_storage *storage,
+					 char *buf, size_t len)
+{
+	const char *dst;
+	struct sockaddr_in *addr;
+	struct sockaddr_in6 *addr6;
+	struct sockaddr_un *addr_un;
+	char tmp[INET6_ADDRSTRLEN];
+
+	*buf = '\0';
+
+	switch (storage->ss_family) {
+	case AF_INET:
+		addr = (struct sockaddr_in *) storage;
+		dst = sc_sock_addr(sock, AF_INET, &addr->sin_addr, tmp,
+				   sizeof(tmp));
+		snprintf(buf, len, "%s:%d", dst, ntohs(addr->sin_port));
+		break;
+
+	case AF_INET6:
+		addr6 = (struct sockaddr_in6 *) storage;
+		dst = sc_sock_addr(sock, AF_INET6, &addr6->sin6_addr, tmp,
+				   sizeof(tmp));
+		snprintf(buf, len, "%s:%d", dst, ntohs(addr6->sin6_port));
+		break;
+
+	case AF_UNIX:
+		addr_un = (struct sockaddr_un *) storage;
+		snprintf(buf, len, "%s", addr_un->sun_path);
+		break;
+	}
+
+	return buf;
+}
+
+const char *sc_sock_local_str(struct sc_sock *sock, char *buf, size_t len)
+{
+	int rc;
+	struct sockaddr_storage st;
+	socklen_t storage_len = sizeof(st);
+
+	rc = getsockname(sock->fdt.fd, (struct sockaddr *) &st, &storage_len);
+	if (rc != 0) {
+		sc_sock_errstr(sock, 0);
+		*buf = '\0';
+		return NULL;
+	}
+
+	return sc_sock_print_storage(sock, &st, buf, len);
+}
+
+const char *sc_sock_remote_str(struct sc_sock *sock, char *buf, size_t len)
+{
+	int rc;
+	struct sockaddr_storage st;
+	socklen_t storage_len = sizeof(st);
+
+	rc = getpeername(sock->fdt.fd, (struct sockaddr *) &st, &storage_len);
+	if (rc != 0) {
+		sc_sock_errstr(sock, 0);
+		*buf = '\0';
+		return NULL;
+	}
+
+	return sc_sock_print_storage(sock, &st, buf, len);
+}
+
+void sc_sock_print(struct sc_sock *sock, char *buf, size_t len)
+{
+	char l[128];
+	char r[128];
+
+	sc_sock_local_str(sock, l, sizeof(l));
+	sc_sock_remote_str(sock, r, sizeof(r));
+
+	snprintf(buf, len, "Local(%s), Remote(%s) ", l, r);
+}
+
+const char *sc_sock_pipe_err(struct sc_sock_pipe *pipe)
+{
+	pipe->err[sizeof(pipe->err) - 1] = '\0';
+	return pipe->err;
+}
+
+static void sc_sock_pipe_set_err(struct sc_sock_pipe *pipe, const char *fmt,
+				 ...)
+{
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(pipe->err, sizeof(pipe->err), fmt, args);
+	va_end(args);
+
+	pipe->err[sizeof(pipe->err) - 1] = '\0';
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+
+int sc_sock_pipe_init(struct sc_sock_pipe *p, int type)
+{
+	SOCKET listener;
+	int rc;
+	struct sockaddr_in addr;
+	int addrlen = sizeof(addr);
+	int val = 1;
+	BOOL nodelay = 1;
+
+	*p = (struct sc_sock_pipe){
+		.fds = {SC_INVALID, SC_INVALID},
+	};
+
+	p->fdt.type = type;
+
+	/*  Create listening socket. */
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (listener == INVALID_SOCKET) {
+		goto wsafail;
+	}
+
+	rc = setsockopt(listener, SOL_SOCKET, SO_EXCLUSIVEADDRUSE,
+			(char *) &val, sizeof(val));
+	if (rc == SOCKET_ERROR) {
+		goto wsafail;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+
+	rc = bind(listener, (const struct sockaddr *) &addr, sizeof(addr));
+	if (rc == SOCKET_ERROR) {
+		goto wsafail;
+	}
+
+	rc = getsockname(listener, (struct sockaddr *) &addr, &addrlen);
+	if (rc == SOCKET_ERROR) {
+		goto wsafail;
+	}
+
+	rc = listen(listener, 1);
+	if (rc == SOCKET_ERROR) {
+		goto wsafail;
+	}
+
+	p->fds[1] = socket(AF_INET, SOCK_STREAM, 0);
+	if (p->fds[1] == INVALID_SOCKET) {
+		goto wsafail;
+	}
+
+	rc = setsockopt(p->fds[1], IPPROTO_TCP, TCP_NODELAY, (char *) &nodelay,
+			sizeof(nodelay));
+	if (rc == SOCKET_ERROR) {
+		goto wsafail;
+	}
+
+	rc = connect(p->fds[1], (struct sockaddr *) &addr, sizeof(addr));
+	if (rc == SOCKET_ERROR) {
+		goto wsafail;
+	}
+
+	p->fds[0] = accept(listener, (struct sockaddr *) &addr, &addrlen);
+	if (p->fds[0] == INVALID_SOCKET) {
+		goto wsafail;
+	}
+
+	p->fdt.fd = p->fds[0];
+	closesocket(listener);
+
+	return 0;
+
+wsafail:
+	sc_sock_pipe_set_err(p, "sc_sock_pipe_init() : %d ", WSAGetLastError());
+	return -1;
+}
+
+int sc_sock_pipe_term(struct sc_sock_pipe *p)
+{
+	int rc = 0, rv;
+
+	if (p->fds[0] == SC_INVALID) {
+		return 0;
+	}
+
+	rv = closesocket(p->fds[0]);
+	if (rv != 0) {
+		rc = -1;
+		sc_sock_pipe_set_err(p, "closesocket() : err(%d) ",
+				     WSAGetLastError());
+	}
+
+	rv = closesocket(p->fds[1]);
+	if (rv != 0) {
+		rc = -1;
+		sc_sock_pipe_set_err(p, "closesocket() : err(%d) ",
+				     WSAGetLastError());
+	}
+
+	p->fds[0] = SC_INVALID;
+	p->fds[1] = SC_INVALID;
+
+	return rc;
+}
+
+int sc_sock_pipe_write(struct sc_sock_pipe *p, void *data, unsigned int len)
+{
+	int rc;
+
+	rc = send(p->fds[1], data, (int)len, 0);
+	if (rc == SOCKET_ERROR) {
+		sc_sock_pipe_set_err(p, "pipe send() : err(%d) ",
+				     WSAGetLastError());
+	}
+
+	return rc;
+}
+
+int sc_sock_pipe_read(struct sc_sock_pipe *p, void *data, unsigned int len)
+{
+	int rc;
+
+	rc = recv(p->fds[0], (char *) data, (int)len, 0);
+	if (rc == SOCKET_ERROR) {
+		sc_sock_pipe_set_err(p, "pipe recv() : err(%d) ",
+				     WSAGetLastError());
+	}
+
+	return rc;
+}
+
+#else
+
+int sc_sock_pipe_init(struct sc_sock_pipe *p, int type)
+{
+	int rc;
+
+	*p = (struct sc_sock_pipe){
+		.fds = {SC_INVALID, SC_INVALID},
+	};
+
+	rc = pipe(p->fds);
+	if (rc != 0) {
+		sc_sock_pipe_set_err(p, "pipe() : %s ", strerror(errno));
+		return -1;
+	}
+
+	p->fdt.type = type;
+	p->fdt.op = SC_SOCK_NONE;
+	p->fdt.fd = p->fds[0];
+
+	return 0;
+}
+
+int sc_sock_pipe_term(struct sc_sock_pipe *p)
+{
+	int rc = 0, rv;
+
+	if (p->fds[0] == SC_INVALID) {
+		return 0;
+	}
+
+	rv = close(p->fds[0]);
+	if (rv != 0) {
+		rc = -1;
+		sc_sock_pipe_set_err(p, "pipe close() : %s ", strerror(errno));
+	}
+
+	rv = close(p->fds[1]);
+	if (rv != 0) {
+		rc = -1;
+		sc_sock_pipe_set_err(p, "pipe close() : %s ", strerror(errno));
+	}
+
+	p->fds[0] = SC_INVALID;
+	p->fds[1] = SC_INVALID;
+
+	return rc;
+}
+
+int sc_sock_pipe_write(struct sc_sock_pipe *p, void *data, unsigned int len)
+{
+	ssize_t n;
+	char *b = data;
+
+retry:
+	n = write(p->fds[1], b, len);
+	if (n == -1 && errno == EINTR) {
+		goto retry;
+	}
+
+	return (int) n;
+}
+
+int sc_sock_pipe_read(struct sc_sock_pipe *p, void *data, unsigned int len)
+{
+	ssize_t n;
+	char *b = data;
+
+retry:
+	n = read(p->fds[0], b, len);
+	if (n == -1 && errno == EINTR) {
+		goto retry;
+	}
+
+	return (int) n;
+}
+
+#endif
+
+static void sc_sock_notify_set_err(struct sc_sock_notify *n, const char *msg,
+				   const char *reason)
+{
+	snprintf(n->err, sizeof(n->err), "%s : %s", msg, reason);
+}
+
+const char *sc_sock_notify_err(struct sc_sock_notify *n)
+{
+	return n->err;
+}
+
+#if defined(__linux__)
+
+#include <sys/eventfd.h>
+
+int sc_sock_notify_init(struct sc_sock_notify *n, int type)
+{
+	*n = (struct sc_sock_notify){
+		.fdt = {.fd = SC_INVALID, .op = SC_SOCK_NONE, .type = type},
+	};
+
+	n->fdt.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (n->fdt.fd == SC_INVALID) {
+		sc_sock_notify_set_err(n, "eventfd", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int sc_sock_notify_term(struct sc_sock_notify *n)
+{
+	int rc = 0;
+
+	if (n->fdt.fd == SC_INVALID) {
+		return 0;
+	}
+
+	if (close(n->fdt.fd) != 0) {
+		sc_sock_notify_set_err(n, "close", strerror(errno));
+		rc = -1;
+	}
+
+	n->fdt.fd = SC_INVALID;
+
+	return rc;
+}
+
+int sc_sock_notify_post(struct sc_sock_notify *n, uint64_t count)
+{
+	ssize_t rc;
+
+retry:
+	rc = write(n->fdt.fd, &count, sizeof(count));
+	if (rc == -1) {
+		if (errno == EINTR) {
+			goto retry;
+		}
+
+		// Counter is saturated, reader has plenty to wake up for.
+		if (errno == EAGAIN) {
+			return 0;
+		}
+
+		sc_sock_notify_set_err(n, "write", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int sc_sock_notify_read(struct sc_sock_notify *n, uint64_t *count)
+{
+	ssize_t rc;
+
+	*count = 0;
+
+retry:
+	rc = read(n->fdt.fd, count, sizeof(*count));
+	if (rc == -1) {
+		if (errno == EINTR) {
+			goto retry;
+		}
+
+		if (errno != EAGAIN) {
+			sc_sock_notify_set_err(n, "read", strerror(errno));
+		}
+
+		return -1;
+	}
+
+	return 0;
+}
+
+#else
+
+int sc_sock_notify_init(struct sc_sock_notify *n, int type)
+{
+	int rc;
+	struct sc_sock s;
+
+	*n = (struct sc_sock_notify){
+		.fdt = {.fd = SC_INVALID, .op = SC_SOCK_NONE, .type = type},
+	};
+
+	rc = sc_sock_pipe_init(&n->pipe, type);
+	if (rc != 0) {
+		sc_sock_notify_set_err(n, "pipe", sc_sock_pipe_err(&n->pipe));
+		return -1;
+	}
+
+	// Posts and reads must not block when the pipe is full or empty.
+	for (int i = 0; i < 2; i++) {
+		s.fdt.fd = n->pipe.fds[i];
+
+		rc = sc_sock_set_blocking(&s, false);
+		if (rc != 0) {
+			sc_sock_notify_set_err(n, "pipe", "cannot set non-blocking");
+			sc_sock_pipe_term(&n->pipe);
+			return -1;
+		}
+	}
+
+	n->fdt.fd = n->pipe.fds[0];
+
+	return 0;
+}
+
+int sc_sock_notify_term(struct sc_sock_notify *n)
+{
+	int rc;
+
+	rc = sc_sock_pipe_term(&n->pipe);
+	if (rc != 0) {
+		sc_sock_notify_set_err(n, "pipe", sc_sock_pipe_err(&n->pipe));
+	}
+
+	n->fdt.fd = SC_INVALID;
+
+	return rc;
+}
+
+int sc_sock_notify_post(struct sc_sock_notify *n, uint64_t count)
+{
+	int rc, err;
+
+	(void) count;
+
+retry:
+	rc = sc_sock_pipe_write(&n->pipe, "", 1);
+	if (rc != 1) {
+		err = sc_sock_err();
+		if (err == SC_EINTR) {
+			goto retry;
+		}
+
+		// Pipe is full, reader has plenty to wake up for.
+		if (err == SC_EAGAIN) {
+			return 0;
+		}
+
+		sc_sock_notify_set_err(n, "pipe", sc_sock_pipe_err(&n->pipe));
+		return -1;
+	}
+
+	return 0;
+}
+
+int sc_sock_notify_read(struct sc_sock_notify *n, uint64_t *count)
+{
+	int rc, err = 0;
+	char buf[256];
+
+	*count = 0;
+
+	while (true) {
+		rc = sc_sock_pipe_read(&n->pipe, buf, sizeof(buf));
+		if (rc <= 0) {
+			err = sc_sock_err();
+			if (rc < 0 && err == SC_EINTR) {
+				continue;
+			}
+
+			break;
+		}
+
+		*count += (uint64_t) rc;
+	}
+
+	if (*count > 0) {
+		return 0;
+	}
+
+	if (rc == 0 || err != SC_EAGAIN) {
+		sc_sock_notify_set_err(n, "pipe", sc_sock_pipe_err(&n->pipe));
+	} else {
+		errno = EAGAIN;
+	}
+
+	return -1;
+}
+
+#endif
+
+static void sc_sock_timer_set_err(struct sc_sock_timer *t, const char *msg,
+				  const char *reason)
+{
+	snprintf(t->err, sizeof(t->err), "%s : %s", msg, reason);
+}
+
+const char *sc_sock_timer_err(struct sc_sock_timer *t)
+{
+	return t->err;
 }
 
-const char *sc_sock_remote_str(struct sc_sock *sock, char *buf, size_t len)
+#if defined(__linux__)
+
+#include <sys/timerfd.h>
+
+int sc_sock_timer_init(struct sc_sock_timer *t, int type)
+{
+	*t = (struct sc_sock_timer){
+		.fdt = {.fd = SC_INVALID, .op = SC_SOCK_NONE, .type = type},
+	};
+
+	t->fdt.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (t->fdt.fd == SC_INVALID) {
+		sc_sock_timer_set_err(t, "timerfd_create", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int sc_sock_timer_term(struct sc_sock_timer *t)
+{
+	int rc = 0;
+
+	if (t->fdt.fd == SC_INVALID) {
+		return 0;
+	}
+
+	if (close(t->fdt.fd) != 0) {
+		sc_sock_timer_set_err(t, "close", strerror(errno));
+		rc = -1;
+	}
+
+	t->fdt.fd = SC_INVALID;
+	t->deadline = 0;
+
+	return rc;
+}
+
+int sc_sock_timer_arm(struct sc_sock_timer *t, uint64_t deadline)
+{
+	int rc;
+	struct itimerspec spec = {
+		.it_value.tv_sec = (time_t) (deadline / 1000000000),
+		.it_value.tv_nsec = (long) (deadline % 1000000000),
+	};
+
+	rc = timerfd_settime(t->fdt.fd, TFD_TIMER_ABSTIME, &spec, NULL);
+	if (rc != 0) {
+		sc_sock_timer_set_err(t, "timerfd_settime", strerror(errno));
+		return -1;
+	}
+
+	t->deadline = deadline;
+
+	return 0;
+}
+
+int sc_sock_timer_read(struct sc_sock_timer *t, uint64_t *count)
+{
+	ssize_t rc;
+
+	*count = 0;
+
+retry:
+	rc = read(t->fdt.fd, count, sizeof(*count));
+	if (rc == -1) {
+		if (errno == EINTR) {
+			goto retry;
+		}
+
+		if (errno != EAGAIN) {
+			sc_sock_timer_set_err(t, "read", strerror(errno));
+		}
+
+		return -1;
+	}
+
+	t->deadline = 0;
+
+	return 0;
+}
+
+#else
+
+int sc_sock_timer_init(struct sc_sock_timer *t, int type)
+{
+	*t = (struct sc_sock_timer){
+		.fdt = {.fd = SC_INVALID, .op = SC_SOCK_NONE, .type = type},
+	};
+
+	sc_sock_timer_set_err(t, "timer", "Not supported");
+	return -1;
+}
+
+int sc_sock_timer_term(struct sc_sock_timer *t)
+{
+	(void) t;
+	return 0;
+}
+
+int sc_sock_timer_arm(struct sc_sock_timer *t, uint64_t deadline)
+{
+	(void) deadline;
+
+	sc_sock_timer_set_err(t, "timer", "Not supported");
+	return -1;
+}
+
+int sc_sock_timer_read(struct sc_sock_timer *t, uint64_t *count)
+{
+	*count = 0;
+
+	sc_sock_timer_set_err(t, "timer", "Not supported");
+	return -1;
+}
+
+#endif
+
+#ifdef _MSC_VER
+// Thread local for MSVC compiler.
+#define __thread __declspec(thread)
+#endif
+
+static __thread char sc_sock_poll_errstr[128];
+
+const char *sc_sock_poll_err(struct sc_sock_poll *p)
+{
+	(void)p;
+	return sc_sock_poll_errstr;
+}
+
+static void sc_sock_poll_set_err(struct sc_sock_poll *p, const char *fmt, ...)
+{
+	(void)p;
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(sc_sock_poll_errstr, sizeof(sc_sock_poll_errstr), fmt, args);
+	va_end(args);
+
+	sc_sock_poll_errstr[sizeof(sc_sock_poll_errstr) - 1] = '\0';
+}
+
+#ifdef SC_SOCK_STATS
+static void sc_sock_poll_stat(struct sc_sock_poll *p, int n)
+{
+	int i = 0;
+
+	p->stats.waits++;
+
+	if (n < 0) {
+		p->stats.errors++;
+		return;
+	}
+
+	if (n == 0) {
+		p->stats.timeouts++;
+		return;
+	}
+
+	p->stats.wakeups++;
+	p->stats.events += (uint64_t) n;
+
+	while (n > 1 && i < SC_SOCK_POLL_HIST - 1) {
+		n >>= 1;
+		i++;
+	}
+
+	p->stats.hist[i]++;
+}
+#define sc_sock_poll_stat_add(p, field, n) ((p)->stats.field += (uint64_t) (n))
+#else
+#define sc_sock_poll_stat(p, n)
+#define sc_sock_poll_stat_add(p, field, n)
+#endif
+
+void sc_sock_poll_stats(struct sc_sock_poll *p, struct sc_sock_poll_stats *stats,
+			bool reset)
+{
+	*stats = p->stats;
+	if (reset) {
+		p->stats = (struct sc_sock_poll_stats){0};
+	}
+}
+
+static int sc_sock_poll_max_events(struct sc_sock_poll_conf *conf)
+{
+	if (conf == NULL || conf->max_events <= 0) {
+		return SC_SOCK_POLL_MAX_EVENTS;
+	}
+
+	return conf->max_events;
+}
+
+#if defined(__linux__)
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define SC_SOCK_URING_SQ_SIZE 256u
+#define SC_SOCK_URING_CQ_SIZE (SC_SOCK_POLL_MAX_EVENTS * 4u)
+#define SC_SOCK_URING_IGNORE UINT64_MAX
+#define SC_SOCK_URING_GEN_MASK 0x3fffffffu
+#define SC_SOCK_URING_BUF_SIZE 4096u
+#define SC_SOCK_URING_BUF_MAX 32768u
+
+// Request type, stored in the completion user data next to the fd.
+enum sc_sock_uring_op
 {
-	int rc;
-	struct sockaddr_storage st;
-	socklen_t storage_len = sizeof(st);
+	SC_SOCK_URING_POLL = 0,
+	SC_SOCK_URING_RECV = 1,
+	SC_SOCK_URING_SEND = 2,
+};
+
+// Registration state of an fd, indexed by the fd number. Generations are
+// bumped whenever a request is re-registered or removed, so completions of
+// cancelled requests can be recognized and dropped.
+struct sc_sock_uring_slot {
+	void *data;
+	uint32_t gen;
+	uint32_t events;
+	// Wait sequence of the last poll event, duplicates are merged into the
+	// event at 'idx'.
+	uint64_t seq;
+	int idx;
+
+	void *recv_data;
+	uint32_t recv_gen;
+	bool recv;
+
+	void *send_data;
+	char *send_buf;
+	uint32_t send_gen;
+	bool send;
+};
+
+struct sc_sock_uring {
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	unsigned sq_local_tail;
+	struct io_uring_sqe *sqes;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	int fd;
+	void *ring;
+	size_t ring_len;
+	size_t sqes_len;
+	// IOSQE_CQE_SKIP_SUCCESS if supported, for requests without a result.
+	uint8_t skip;
+
+	int slot_cap;
+	struct sc_sock_uring_slot *slots;
+
+	uint64_t seq;
+	struct sc_sock_io *io;
+
+	// Provided buffer ring for multishot receives. Buffers of the reported
+	// events are returned to the ring by the next wait.
+	struct io_uring_buf_ring *br;
+	size_t br_len;
+	char *bufs;
+	uint32_t buf_count;
+	uint32_t buf_size;
+	uint16_t br_tail;
+	uint16_t *recycle;
+	uint32_t recycle_count;
+};
+
+static void sc_sock_uring_term(struct sc_sock_uring *u)
+{
+	struct io_uring_buf_reg reg = {0};
 
-	rc = getpeername(sock->fdt.fd, (struct sockaddr *) &st, &storage_len);
-	if (rc != 0) {
-		sc_sock_errstr(sock, 0);
-		*buf = '\0';
-		return NULL;
+	if (u == NULL) {
+		return;
 	}
 
-	return sc_sock_print_storage(sock, &st, buf, len);
+	if (u->br != NULL) {
+		// Kernel must not pick a buffer after they are released.
+		syscall(__NR_io_uring_register, u->fd,
+			IORING_UNREGISTER_PBUF_RING, &reg, 1);
+		munmap(u->br, u->br_len);
+	}
+
+	if (u->sqes != NULL) {
+		munmap(u->sqes, u->sqes_len);
+	}
+
+	if (u->ring != NULL) {
+		munmap(u->ring, u->ring_len);
+	}
+
+	sc_sock_free(u->bufs);
+	sc_sock_free(u->recycle);
+	sc_sock_free(u->io);
+	sc_sock_free(u->slots);
+	sc_sock_free(u);
 }
 
-void sc_sock_print(struct sc_sock *sock, char *buf, size_t len)
+static void sc_sock_uring_buf_put(struct sc_sock_uring *u, uint16_t bid)
 {
-	char l[128];
-	char r[128];
-
-	sc_sock_local_str(sock, l, sizeof(l));
-	sc_sock_remote_str(sock, r, sizeof(r));
+	struct io_uring_buf *b = &u->br->bufs[u->br_tail & (u->buf_count - 1)];
 
-	snprintf(buf, len, "Local(%s), Remote(%s) ", l, r);
+	// 'resv' of the first entry is the ring tail, it is not written here.
+	b->addr = (uint64_t) (uintptr_t) (u->bufs + (size_t) bid * u->buf_size);
+	b->len = u->buf_size;
+	b->bid = bid;
+	u->br_tail++;
 }
 
-const char *sc_sock_pipe_err(struct sc_sock_pipe *pipe)
+static void sc_sock_uring_buf_publish(struct sc_sock_uring *u)
 {
-	pipe->err[sizeof(pipe->err) - 1] = '\0';
-	return pipe->err;
+	__atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
 }
 
-static void sc_sock_pipe_set_err(struct sc_sock_pipe *pipe, const char *fmt,
-				 ...)
+static int sc_sock_uring_init_bufs(struct sc_sock_uring *u,
+				   struct sc_sock_poll_conf *conf)
 {
-	va_list args;
+	void *mem;
+	uint32_t count = 1;
+	struct io_uring_buf_reg reg = {0};
 
-	va_start(args, fmt);
-	vsnprintf(pipe->err, sizeof(pipe->err), fmt, args);
-	va_end(args);
+	while (count < (uint32_t) conf->recv_buf_count &&
+	       count < SC_SOCK_URING_BUF_MAX) {
+		count *= 2;
+	}
 
-	pipe->err[sizeof(pipe->err) - 1] = '\0';
-}
+	u->buf_count = count;
+	u->buf_size = conf->recv_buf_size > 0 ? (uint32_t) conf->recv_buf_size :
+						SC_SOCK_URING_BUF_SIZE;
 
-#if defined(_WIN32) || defined(_WIN64)
+	u->recycle = sc_sock_malloc(sizeof(*u->recycle) * count);
+	u->bufs = sc_sock_malloc((size_t) count * u->buf_size);
+	if (u->recycle == NULL || u->bufs == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
 
-int sc_sock_pipe_init(struct sc_sock_pipe *p, int type)
-{
-	SOCKET listener;
-	int rc;
-	struct sockaddr_in addr;
-	int addrlen = sizeof(addr);
-	int val = 1;
-	BOOL nodelay = 1;
+	// Ring memory must be page aligned.
+	u->br_len = sizeof(struct io_uring_buf) * count;
+	mem = mmap(NULL, u->br_len, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED) {
+		return -1;
+	}
 
-	*p = (struct sc_sock_pipe){
-		.fds = {SC_INVALID, SC_INVALID},
-	};
+	reg.ring_addr = (uint64_t) (uintptr_t) mem;
+	reg.ring_entries = count;
 
-	p->fdt.type = type;
+	if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING,
+		    &reg, 1) != 0) {
+		int err = errno;
+		munmap(mem, u->br_len);
+		errno = err;
+		return -1;
+	}
 
-	/*  Create listening socket. */
-	listener = socket(AF_INET, SOCK_STREAM, 0);
-	if (listener == INVALID_SOCKET) {
-		goto wsafail;
+	u->br = mem;
+
+	for (uint32_t i = 0; i < count; i++) {
+		sc_sock_uring_buf_put(u, (uint16_t) i);
 	}
+	sc_sock_uring_buf_publish(u);
 
-	rc = setsockopt(listener, SOL_SOCKET, SO_EXCLUSIVEADDRUSE,
-			(char *) &val, sizeof(val));
-	if (rc == SOCKET_ERROR) {
-		goto wsafail;
+	return 0;
+}
+
+static int sc_sock_uring_init(struct sc_sock_uring **uring, int *fds, int max,
+			      struct sc_sock_poll_conf *conf)
+{
+	const uint32_t feat = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP |
+			      IORING_FEAT_EXT_ARG;
+	void *mem;
+	size_t sq_len;
+	struct sc_sock_uring *u;
+	struct io_uring_params prm = {
+		.flags = IORING_SETUP_CQSIZE,
+		.cq_entries = SC_SOCK_URING_CQ_SIZE,
+	};
+
+	u = sc_sock_malloc(sizeof(*u));
+	if (u == NULL) {
+		errno = ENOMEM;
+		return -1;
 	}
 
-	memset(&addr, 0, sizeof(addr));
-	addr.sin_family = AF_INET;
-	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-	addr.sin_port = 0;
+	*u = (struct sc_sock_uring){0};
 
-	rc = bind(listener, (const struct sockaddr *) &addr, sizeof(addr));
-	if (rc == SOCKET_ERROR) {
-		goto wsafail;
+	u->io = sc_sock_malloc(sizeof(*u->io) * (size_t) max);
+	if (u->io == NULL) {
+		sc_sock_uring_term(u);
+		errno = ENOMEM;
+		return -1;
 	}
 
-	rc = getsockname(listener, (struct sockaddr *) &addr, &addrlen);
-	if (rc == SOCKET_ERROR) {
-		goto wsafail;
+	u->fd = (int) syscall(__NR_io_uring_setup, SC_SOCK_URING_SQ_SIZE, &prm);
+	if (u->fd == -1) {
+		goto error;
 	}
 
-	rc = listen(listener, 1);
-	if (rc == SOCKET_ERROR) {
-		goto wsafail;
+	if ((prm.features & feat) != feat) {
+		errno = ENOSYS;
+		goto error;
 	}
 
-	p->fds[1] = socket(AF_INET, SOCK_STREAM, 0);
-	if (p->fds[1] == INVALID_SOCKET) {
-		goto wsafail;
+	if (prm.features & IORING_FEAT_CQE_SKIP) {
+		u->skip = IOSQE_CQE_SKIP_SUCCESS;
 	}
 
-	rc = setsockopt(p->fds[1], IPPROTO_TCP, TCP_NODELAY, (char *) &nodelay,
-			sizeof(nodelay));
-	if (rc == SOCKET_ERROR) {
-		goto wsafail;
+	u->ring_len = prm.cq_off.cqes + prm.cq_entries * sizeof(*u->cqes);
+	sq_len = prm.sq_off.array + prm.sq_entries * sizeof(unsigned);
+	if (sq_len > u->ring_len) {
+		u->ring_len = sq_len;
 	}
 
-	rc = connect(p->fds[1], (struct sockaddr *) &addr, sizeof(addr));
-	if (rc == SOCKET_ERROR) {
-		goto wsafail;
+	mem = mmap(NULL, u->ring_len, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (mem == MAP_FAILED) {
+		goto error;
 	}
+	u->ring = mem;
 
-	p->fds[0] = accept(listener, (struct sockaddr *) &addr, &addrlen);
-	if (p->fds[0] == INVALID_SOCKET) {
-		goto wsafail;
+	u->sqes_len = prm.sq_entries * sizeof(*u->sqes);
+	mem = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (mem == MAP_FAILED) {
+		goto error;
 	}
+	u->sqes = mem;
 
-	p->fdt.fd = p->fds[0];
-	closesocket(listener);
+	u->sq_head = (unsigned *) ((char *) u->ring + prm.sq_off.head);
+	u->sq_tail = (unsigned *) ((char *) u->ring + prm.sq_off.tail);
+	u->sq_mask = (unsigned *) ((char *) u->ring + prm.sq_off.ring_mask);
+	u->sq_array = (unsigned *) ((char *) u->ring + prm.sq_off.array);
+	u->sq_entries = prm.sq_entries;
+	u->sq_local_tail = *u->sq_tail;
+
+	u->cq_head = (unsigned *) ((char *) u->ring + prm.cq_off.head);
+	u->cq_tail = (unsigned *) ((char *) u->ring + prm.cq_off.tail);
+	u->cq_mask = (unsigned *) ((char *) u->ring + prm.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *) ((char *) u->ring + prm.cq_off.cqes);
+
+	if (conf->recv_buf_count > 0 && sc_sock_uring_init_bufs(u, conf) != 0) {
+		goto error;
+	}
+
+	*fds = u->fd;
+	*uring = u;
 
 	return 0;
 
-wsafail:
-	sc_sock_pipe_set_err(p, "sc_sock_pipe_init() : %d ", WSAGetLastError());
+error:
+	if (u->fd != -1) {
+		int err = errno;
+		close(u->fd);
+		errno = err;
+	}
+	sc_sock_uring_term(u);
 	return -1;
 }
 
-int sc_sock_pipe_term(struct sc_sock_pipe *p)
+// Publishes queued submissions and enters the kernel.
+static int sc_sock_uring_enter(struct sc_sock_uring *u, unsigned min,
+			       unsigned flags, struct io_uring_getevents_arg *arg)
 {
-	int rc = 0, rv;
+	unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	unsigned submit = u->sq_local_tail - head;
 
-	if (p->fds[0] == SC_INVALID) {
+	if (submit == 0 && (flags & IORING_ENTER_GETEVENTS) == 0) {
 		return 0;
 	}
 
-	rv = closesocket(p->fds[0]);
-	if (rv != 0) {
-		rc = -1;
-		sc_sock_pipe_set_err(p, "closesocket() : err(%d) ",
-				     WSAGetLastError());
-	}
+	__atomic_store_n(u->sq_tail, u->sq_local_tail, __ATOMIC_RELEASE);
 
-	rv = closesocket(p->fds[1]);
-	if (rv != 0) {
-		rc = -1;
-		sc_sock_pipe_set_err(p, "closesocket() : err(%d) ",
-				     WSAGetLastError());
+	return (int) syscall(__NR_io_uring_enter, u->fd, submit, min,
+			     flags | IORING_ENTER_EXT_ARG, arg, sizeof(*arg));
+}
+
+static struct io_uring_sqe *sc_sock_uring_sqe(struct sc_sock_uring *u)
+{
+	unsigned idx, head;
+	struct io_uring_sqe *sqe;
+	struct io_uring_getevents_arg arg = {0};
+
+	head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	if (u->sq_local_tail - head == u->sq_entries) {
+		// Submission queue is full, flush it to the kernel.
+		if (sc_sock_uring_enter(u, 0, 0, &arg) < 0) {
+			return NULL;
+		}
+
+		head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+		if (u->sq_local_tail - head == u->sq_entries) {
+			errno = EBUSY;
+			return NULL;
+		}
 	}
 
-	p->fds[0] = SC_INVALID;
-	p->fds[1] = SC_INVALID;
+	idx = u->sq_local_tail & *u->sq_mask;
+	u->sq_array[idx] = idx;
+	u->sq_local_tail++;
 
-	return rc;
+	sqe = &u->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+
+	return sqe;
 }
 
-int sc_sock_pipe_write(struct sc_sock_pipe *p, void *data, unsigned int len)
+static uint64_t sc_sock_uring_id(int fd, uint32_t gen, enum sc_sock_uring_op op)
 {
-	int rc;
+	return ((uint64_t) (gen & SC_SOCK_URING_GEN_MASK) << 34u) |
+	       ((uint64_t) op << 32u) | (uint32_t) fd;
+}
 
-	rc = send(p->fds[1], data, (int)len, 0);
-	if (rc == SOCKET_ERROR) {
-		sc_sock_pipe_set_err(p, "pipe send() : err(%d) ",
-				     WSAGetLastError());
+static struct sc_sock_uring_slot *sc_sock_uring_slot(struct sc_sock_uring *u,
+						     int fd)
+{
+	int cap;
+	struct sc_sock_uring_slot *slots;
+
+	if (fd < 0) {
+		errno = EBADF;
+		return NULL;
 	}
 
-	return rc;
+	if (fd >= u->slot_cap) {
+		cap = u->slot_cap == 0 ? 64 : u->slot_cap;
+		while (cap <= fd) {
+			cap *= 2;
+		}
+
+		slots = sc_sock_realloc(u->slots, sizeof(*slots) * (size_t) cap);
+		if (slots == NULL) {
+			errno = ENOMEM;
+			return NULL;
+		}
+
+		memset(&slots[u->slot_cap], 0,
+		       sizeof(*slots) * (size_t) (cap - u->slot_cap));
+		u->slots = slots;
+		u->slot_cap = cap;
+	}
+
+	return &u->slots[fd];
 }
 
-int sc_sock_pipe_read(struct sc_sock_pipe *p, void *data, unsigned int len)
+static int sc_sock_uring_arm(struct sc_sock_uring *u, int fd)
 {
-	int rc;
+	struct sc_sock_uring_slot *slot = &u->slots[fd];
+	struct io_uring_sqe *sqe;
+	uint32_t events = slot->events & ~(uint32_t) EPOLLET;
 
-	rc = recv(p->fds[0], (char *) data, (int)len, 0);
-	if (rc == SOCKET_ERROR) {
-		sc_sock_pipe_set_err(p, "pipe recv() : err(%d) ",
-				     WSAGetLastError());
+	sqe = sc_sock_uring_sqe(u);
+	if (sqe == NULL) {
+		return -1;
 	}
 
-	return rc;
-}
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	events = (events << 16u) | (events >> 16u);
+#endif
 
-#else
+	// Multishot poll requests stay armed and report wakeups, so they are
+	// edge-triggered. Level-triggered fds use one-shot requests, they are
+	// re-armed on completion and the next wait submits them, so a fd that
+	// is still ready is reported again without an extra syscall.
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	sqe->len = (slot->events & EPOLLET) ? IORING_POLL_ADD_MULTI : 0;
+	sqe->user_data = sc_sock_uring_id(fd, slot->gen, SC_SOCK_URING_POLL);
 
-int sc_sock_pipe_init(struct sc_sock_pipe *p, int type)
-{
-	int rc;
+	return 0;
+}
 
-	*p = (struct sc_sock_pipe){
-		.fds = {SC_INVALID, SC_INVALID},
-	};
+static int sc_sock_uring_arm_recv(struct sc_sock_uring *u, int fd)
+{
+	struct sc_sock_uring_slot *slot = &u->slots[fd];
+	struct io_uring_sqe *sqe;
 
-	rc = pipe(p->fds);
-	if (rc != 0) {
-		sc_sock_pipe_set_err(p, "pipe() : %s ", strerror(errno));
+	sqe = sc_sock_uring_sqe(u);
+	if (sqe == NULL) {
 		return -1;
 	}
 
-	p->fdt.type = type;
-	p->fdt.op = SC_SOCK_NONE;
-	p->fdt.fd = p->fds[0];
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = fd;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->user_data = sc_sock_uring_id(fd, slot->recv_gen, SC_SOCK_URING_RECV);
 
 	return 0;
 }
 
-int sc_sock_pipe_term(struct sc_sock_pipe *p)
+static int sc_sock_uring_ctl(struct sc_sock_uring *u, int op, int fd,
+			     struct epoll_event *ev)
 {
-	int rc = 0, rv;
+	struct io_uring_sqe *sqe;
+	struct sc_sock_uring_slot *slot;
+
+	if (op == EPOLL_CTL_DEL && (fd >= u->slot_cap || fd < 0)) {
+		errno = fd < 0 ? EBADF : ENOENT;
+		return -1;
+	}
+
+	slot = sc_sock_uring_slot(u, fd);
+	if (slot == NULL) {
+		return -1;
+	}
+
+	if (slot->events != 0) {
+		sqe = sc_sock_uring_sqe(u);
+		if (sqe == NULL) {
+			return -1;
+		}
+
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->fd = -1;
+		sqe->flags = u->skip;
+		sqe->addr = sc_sock_uring_id(fd, slot->gen, SC_SOCK_URING_POLL);
+		sqe->user_data = SC_SOCK_URING_IGNORE;
+
+		slot->data = NULL;
+		slot->gen++;
+		slot->events = 0;
+	} else if (op == EPOLL_CTL_DEL) {
+		errno = ENOENT;
+		return -1;
+	}
+
+	if (op == EPOLL_CTL_DEL) {
+		// fd might be closed and reused, drop the in-flight send.
+		if (slot->send) {
+			sqe = sc_sock_uring_sqe(u);
+			if (sqe == NULL) {
+				return -1;
+			}
+
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->fd = -1;
+			sqe->flags = u->skip;
+			sqe->addr = sc_sock_uring_id(fd, slot->send_gen,
+						     SC_SOCK_URING_SEND);
+			sqe->user_data = SC_SOCK_URING_IGNORE;
+
+			slot->send = false;
+			slot->send_gen++;
+			slot->send_buf = NULL;
+			slot->send_data = NULL;
+		}
 
-	if (p->fds[0] == SC_INVALID) {
 		return 0;
 	}
 
-	rv = close(p->fds[0]);
-	if (rv != 0) {
-		rc = -1;
-		sc_sock_pipe_set_err(p, "pipe close() : %s ", strerror(errno));
+	slot->data = ev->data.ptr;
+	slot->events = ev->events;
+
+	if (sc_sock_uring_arm(u, fd) != 0) {
+		slot->events = 0;
+		return -1;
 	}
 
-	rv = close(p->fds[1]);
-	if (rv != 0) {
-		rc = -1;
-		sc_sock_pipe_set_err(p, "pipe close() : %s ", strerror(errno));
+	return 0;
+}
+
+// Adds a poll event, merges it if the fd is already reported by this wait.
+static int sc_sock_uring_report(struct sc_sock_uring *u,
+				struct epoll_event *events, int n, int fd,
+				uint32_t mask)
+{
+	struct sc_sock_uring_slot *slot = &u->slots[fd];
+
+	if (slot->seq == u->seq) {
+		events[slot->idx].events |= mask;
+		return n;
 	}
 
-	p->fds[0] = SC_INVALID;
-	p->fds[1] = SC_INVALID;
+	slot->seq = u->seq;
+	slot->idx = n;
 
-	return rc;
+	events[n].data.ptr = slot->data;
+	events[n].events = mask;
+	u->io[n].op = SC_SOCK_IO_NONE;
+
+	return n + 1;
 }
 
-int sc_sock_pipe_write(struct sc_sock_pipe *p, void *data, unsigned int len)
+// Returns buffers of the previous wait's events to the ring.
+static void sc_sock_uring_recycle(struct sc_sock_uring *u)
 {
-	ssize_t n;
-	char *b = data;
+	if (u->recycle_count == 0) {
+		return;
+	}
 
-retry:
-	n = write(p->fds[1], b, len);
-	if (n == -1 && errno == EINTR) {
-		goto retry;
+	for (uint32_t i = 0; i < u->recycle_count; i++) {
+		sc_sock_uring_buf_put(u, u->recycle[i]);
 	}
 
-	return (int) n;
-}
+	u->recycle_count = 0;
+	sc_sock_uring_buf_publish(u);
+}
+
+static int sc_sock_uring_reap(struct sc_sock_uring *u,
+			      struct epoll_event *events, int n, int max)
+{
+	int fd, res;
+	bool more;
+	uint16_t bid;
+	uint32_t gen, mask;
+	uint64_t id;
+	struct io_uring_cqe *cqe;
+	struct sc_sock_uring_slot *slot;
+	unsigned head = *u->cq_head;
+	unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+
+	for (; head != tail && n < max; head++) {
+		cqe = &u->cqes[head & *u->cq_mask];
+		id = cqe->user_data;
+		res = cqe->res;
+		more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+
+		if (id == SC_SOCK_URING_IGNORE) {
+			continue;
+		}
+
+		fd = (int) (uint32_t) id;
+		gen = (uint32_t) (id >> 34u);
+		slot = &u->slots[fd];
+
+		switch ((enum sc_sock_uring_op) ((id >> 32u) & 3u)) {
+		case SC_SOCK_URING_POLL:
+			if (slot->events == 0 ||
+			    (slot->gen & SC_SOCK_URING_GEN_MASK) != gen) {
+				continue;
+			}
+
+			mask = res < 0 ? EPOLLERR | EPOLLHUP : (uint32_t) res;
+
+			// One-shot and terminated multishot requests must be
+			// re-armed. These are submitted with the next wait call.
+			if (res >= 0 && !more && sc_sock_uring_arm(u, fd) != 0) {
+				mask |= EPOLLERR | EPOLLHUP;
+			}
+
+			n = sc_sock_uring_report(u, events, n, fd, mask);
+			break;
+
+		case SC_SOCK_URING_RECV:
+			bid = (uint16_t) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+			if (cqe->flags & IORING_CQE_F_BUFFER) {
+				u->recycle[u->recycle_count++] = bid;
+			}
+
+			if (!slot->recv ||
+			    (slot->recv_gen & SC_SOCK_URING_GEN_MASK) != gen) {
+				continue;
+			}
+
+			// Out of buffers, they are returned to the ring by the
+			// next wait. Receive is re-armed with it.
+			if (res == -ENOBUFS || res == -EAGAIN) {
+				if (!more && sc_sock_uring_arm_recv(u, fd) != 0) {
+					res = -errno;
+				} else {
+					continue;
+				}
+			}
+
+			events[n].data.ptr = slot->recv_data;
+			events[n].events = res > 0 ? EPOLLIN : EPOLLIN | EPOLLRDHUP;
+			u->io[n] = (struct sc_sock_io){
+				.op = SC_SOCK_IO_RECV,
+				.len = res,
+			};
 
-int sc_sock_pipe_read(struct sc_sock_pipe *p, void *data, unsigned int len)
-{
-	ssize_t n;
-	char *b = data;
+			if (cqe->flags & IORING_CQE_F_BUFFER) {
+				u->io[n].buf = u->bufs + (size_t) bid * u->buf_size;
+			}
 
-retry:
-	n = read(p->fds[0], b, len);
-	if (n == -1 && errno == EINTR) {
-		goto retry;
-	}
+			// Receive stops on end of stream and on error.
+			if (!more && (res <= 0 || sc_sock_uring_arm_recv(u, fd) != 0)) {
+				events[n].events |= res < 0 ? EPOLLERR : 0;
+				slot->recv = false;
+			}
 
-	return (int) n;
-}
+			n++;
+			break;
 
-#endif
+		case SC_SOCK_URING_SEND:
+			if (!slot->send ||
+			    (slot->send_gen & SC_SOCK_URING_GEN_MASK) != gen) {
+				continue;
+			}
 
-#ifdef _MSC_VER
-// Thread local for MSVC compiler.
-#define __thread __declspec(thread)
-#endif
+			events[n].data.ptr = slot->send_data;
+			events[n].events = res < 0 ? EPOLLOUT | EPOLLERR | EPOLLHUP :
+						   EPOLLOUT;
+			u->io[n] = (struct sc_sock_io){
+				.op = SC_SOCK_IO_SEND,
+				.buf = slot->send_buf,
+				.len = res,
+			};
 
-static __thread char sc_sock_poll_errstr[128];
+			slot->send = false;
+			n++;
+			break;
 
-const char *sc_sock_poll_err(struct sc_sock_poll *p)
-{
-	(void)p;
-	return sc_sock_poll_errstr;
+		default:
+			break;
+		}
+	}
+
+	__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+	return n;
 }
 
-static void sc_sock_poll_set_err(struct sc_sock_poll *p, const char *fmt, ...)
+static int sc_sock_uring_wait(struct sc_sock_uring *u,
+			      struct epoll_event *events, int max,
+			      struct __kernel_timespec *ts)
 {
-	(void)p;
-	va_list args;
+	int rc, n = 0;
+	unsigned min, flags, head, tail;
+	uint64_t now, end = 0;
+	struct __kernel_timespec rem = {0};
+	struct io_uring_getevents_arg arg = {0};
+
+	if (ts != NULL) {
+		rem = *ts;
+		end = sc_sock_time_ns() + (uint64_t) ts->tv_sec * 1000000000ull +
+		      (uint64_t) ts->tv_nsec;
+		arg.ts = (uint64_t) (uintptr_t) &rem;
+	}
+
+	// Events of the previous wait are consumed now.
+	u->seq++;
+	sc_sock_uring_recycle(u);
+
+	while (true) {
+		min = 0;
+		flags = 0;
+		head = *u->cq_head;
+		tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+
+		if (n == 0 && head == tail &&
+		    (ts == NULL || rem.tv_sec != 0 || rem.tv_nsec != 0)) {
+			min = 1;
+			flags = IORING_ENTER_GETEVENTS;
+		}
 
-	va_start(args, fmt);
-	vsnprintf(sc_sock_poll_errstr, sizeof(sc_sock_poll_errstr), fmt, args);
-	va_end(args);
+		rc = sc_sock_uring_enter(u, min, flags, &arg);
+		if (rc < 0 && errno != ETIME && errno != EBUSY) {
+			return n > 0 ? n : -1;
+		}
 
-	sc_sock_poll_errstr[sizeof(sc_sock_poll_errstr) - 1] = '\0';
-}
+		n = sc_sock_uring_reap(u, events, n, max);
+		if (n > 0 || min == 0) {
+			return n;
+		}
 
-#if defined(__linux__)
+		// Woken up by completions of removed requests only, wait for
+		// the rest of the timeout.
+		if (ts != NULL) {
+			now = sc_sock_time_ns();
+			if (now >= end) {
+				return 0;
+			}
+
+			rem.tv_sec = (long long) ((end - now) / 1000000000);
+			rem.tv_nsec = (long long) ((end - now) % 1000000000);
+		}
+	}
+}
 
 int sc_sock_poll_init(struct sc_sock_poll *p)
+{
+	return sc_sock_poll_init_conf(p, NULL);
+}
+
+int sc_sock_poll_init_conf(struct sc_sock_poll *p,
+			   struct sc_sock_poll_conf *conf)
 {
 	int fds;
+	int max = sc_sock_poll_max_events(conf);
 
 	*p = (struct sc_sock_poll){0};
 
-	p->events = sc_sock_malloc(sizeof(*p->events) * SC_SOCK_POLL_MAX_EVENTS);
+	p->events = sc_sock_malloc(sizeof(*p->events) * (size_t) max);
 	if (p->events == NULL) {
 		errno = ENOMEM;
 		goto error;
 	}
 
-	fds = epoll_create1(0);
-	if (fds == -1) {
-		goto error;
+	if (conf != NULL && conf->backend == SC_SOCK_POLL_URING) {
+		if (sc_sock_uring_init(&p->uring, &fds, max, conf) != 0) {
+			goto error;
+		}
+	} else {
+		fds = epoll_create1(0);
+		if (fds == -1) {
+			goto error;
+		}
 	}
 	p->fds = fds;
+	p->max_events = max;
+	p->spin_ns = conf != NULL && conf->spin_ns > 0 ? conf->spin_ns : 0;
 
 	return 0;
 error:
@@ -1151,6 +5022,7 @@ int sc_sock_poll_term(struct sc_sock_poll *p)
 	}
 
 	sc_sock_free(p->events);
+	sc_sock_uring_term(p->uring);
 
 	rc = close(p->fds);
 	if (rc != 0) {
@@ -1158,11 +5030,22 @@ int sc_sock_poll_term(struct sc_sock_poll *p)
 	}
 
 	p->events = NULL;
+	p->uring = NULL;
 	p->fds = SC_INVALID;
 
 	return rc;
 }
 
+static int sc_sock_poll_ctl(struct sc_sock_poll *p, int op, int fd,
+			    struct epoll_event *ev)
+{
+	if (p->uring != NULL) {
+		return sc_sock_uring_ctl(p->uring, op, fd, ev);
+	}
+
+	return epoll_ctl(p->fds, op, fd, ev);
+}
+
 int sc_sock_poll_add(struct sc_sock_poll *p, struct sc_sock_fd *fdt,
 		     enum sc_sock_ev events, void *data)
 {
@@ -1206,7 +5089,7 @@ int sc_sock_poll_add(struct sc_sock_poll *p, struct sc_sock_fd *fdt,
 	// that rule.
 	fdt->op = new_mask;
 
-	rc = epoll_ctl(p->fds, op, fdt->fd, &ep_ev);
+	rc = sc_sock_poll_ctl(p, op, fdt->fd, &ep_ev);
 
 	if (rc != 0) {
 		// Rollback to the original state if failed.
@@ -1257,7 +5140,7 @@ int sc_sock_poll_del(struct sc_sock_poll *p, struct sc_sock_fd *fdt,
 	// thread can see it partially updated if we do not follow that rule.
 	fdt->op = new_mask;
 
-	rc = epoll_ctl(p->fds, op, fdt->fd, &ep_ev);
+	rc = sc_sock_poll_ctl(p, op, fdt->fd, &ep_ev);
 
 	if (rc != 0) {
 		// Rollback to the original state if failed.
@@ -1271,28 +5154,137 @@ int sc_sock_poll_del(struct sc_sock_poll *p, struct sc_sock_fd *fdt,
 
 void *sc_sock_poll_data(struct sc_sock_poll *p, int i)
 {
-	return p->events[i].data.ptr;
+	return sc_sock_poll_data_inline(p, i);
 }
 
 uint32_t sc_sock_poll_event(struct sc_sock_poll *p, int i)
 {
-	uint32_t ev = 0;
-	uint32_t epoll_ev = p->events[i].events;
+	return sc_sock_poll_event_inline(p, i);
+}
+
+int sc_sock_poll_recv_add(struct sc_sock_poll *p, struct sc_sock_fd *fdt,
+			  void *data)
+{
+	struct sc_sock_uring *u = p->uring;
+	struct sc_sock_uring_slot *slot;
+
+	if (u == NULL || u->br == NULL) {
+		sc_sock_poll_set_err(p, "poll : receive buffers are not configured");
+		return -1;
+	}
+
+	slot = sc_sock_uring_slot(u, fdt->fd);
+	if (slot == NULL) {
+		goto error;
+	}
+
+	slot->recv_data = data;
+
+	if (!slot->recv) {
+		slot->recv = true;
+		slot->recv_gen++;
+
+		if (sc_sock_uring_arm_recv(u, fdt->fd) != 0) {
+			slot->recv = false;
+			goto error;
+		}
+	}
+
+	return 0;
+
+error:
+	sc_sock_poll_set_err(p, "poll : %s", strerror(errno));
+	return -1;
+}
+
+int sc_sock_poll_recv_del(struct sc_sock_poll *p, struct sc_sock_fd *fdt)
+{
+	struct io_uring_sqe *sqe;
+	struct sc_sock_uring *u = p->uring;
+	struct sc_sock_uring_slot *slot;
+
+	if (u == NULL || fdt->fd < 0 || fdt->fd >= u->slot_cap) {
+		return 0;
+	}
+
+	slot = &u->slots[fdt->fd];
+	if (!slot->recv) {
+		return 0;
+	}
+
+	sqe = sc_sock_uring_sqe(u);
+	if (sqe == NULL) {
+		sc_sock_poll_set_err(p, "poll : %s", strerror(errno));
+		return -1;
+	}
+
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->fd = -1;
+	sqe->flags = u->skip;
+	sqe->addr = sc_sock_uring_id(fdt->fd, slot->recv_gen,
+				     SC_SOCK_URING_RECV);
+	sqe->user_data = SC_SOCK_URING_IGNORE;
+
+	slot->recv = false;
+	slot->recv_gen++;
+	slot->recv_data = NULL;
+
+	return 0;
+}
+
+int sc_sock_poll_send(struct sc_sock_poll *p, struct sc_sock_fd *fdt,
+		      char *buf, int len, void *data)
+{
+	struct io_uring_sqe *sqe;
+	struct sc_sock_uring *u = p->uring;
+	struct sc_sock_uring_slot *slot;
+
+	if (u == NULL) {
+		sc_sock_poll_set_err(p, "poll : send requires io_uring backend");
+		return -1;
+	}
+
+	slot = sc_sock_uring_slot(u, fdt->fd);
+	if (slot == NULL) {
+		goto error;
+	}
 
-	if (epoll_ev & EPOLLIN) {
-		ev |= SC_SOCK_READ;
+	if (slot->send) {
+		errno = EBUSY;
+		goto error;
 	}
 
-	if (epoll_ev & EPOLLOUT) {
-		ev |= SC_SOCK_WRITE;
+	sqe = sc_sock_uring_sqe(u);
+	if (sqe == NULL) {
+		goto error;
 	}
 
-	epoll_ev &= EPOLLHUP | EPOLLRDHUP | EPOLLERR;
-	if (epoll_ev != 0) {
-		ev = (SC_SOCK_READ | SC_SOCK_WRITE);
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = fdt->fd;
+	sqe->addr = (uint64_t) (uintptr_t) buf;
+	sqe->len = (uint32_t) (len > 0 ? len : 0);
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = sc_sock_uring_id(fdt->fd, ++slot->send_gen,
+					  SC_SOCK_URING_SEND);
+
+	slot->send = true;
+	slot->send_buf = buf;
+	slot->send_data = data;
+
+	return 0;
+
+error:
+	sc_sock_poll_set_err(p, "poll : %s", strerror(errno));
+	return -1;
+}
+
+struct sc_sock_io *sc_sock_poll_io(struct sc_sock_poll *p, int i)
+{
+	if (p->uring == NULL || p->uring->io[i].op == SC_SOCK_IO_NONE) {
+		return NULL;
 	}
 
-	return ev;
+	return &p->uring->io[i];
 }
 
 int sc_sock_poll_wait(struct sc_sock_poll *p, int timeout)
@@ -1300,17 +5292,152 @@ int sc_sock_poll_wait(struct sc_sock_poll *p, int timeout)
 	int n;
 	struct epoll_event *events = p->events;
 
+	if (p->spin_ns > 0 && timeout != 0) {
+		return sc_sock_poll_wait_ns(p, timeout >= 0 ? timeout * 1000000ll :
+							       -1);
+	}
+
 	if (events == NULL) {
 		sc_sock_poll_set_err(p, "poll : sc_sock_poll is not initialized or already terminated");
 		return -1;
 	}
 
+	struct __kernel_timespec ts = {
+		.tv_sec = timeout / 1000,
+		.tv_nsec = (timeout % 1000) * 1000000,
+	};
+
 	do {
-		n = epoll_wait(p->fds, events, SC_SOCK_POLL_MAX_EVENTS, timeout);
-	} while (n < 0 && errno == EINTR);
+		if (p->uring != NULL) {
+			n = sc_sock_uring_wait(p->uring, events, p->max_events,
+					       timeout >= 0 ? &ts : NULL);
+		} else {
+			n = epoll_wait(p->fds, events, p->max_events, timeout);
+		}
+	} while ((n < 0 && errno == EINTR) || (n == 0 && timeout < 0));
+
+	sc_sock_poll_stat(p, n);
+
+	if (n == -1) {
+		sc_sock_poll_set_err(p, "%s : %s ",
+				     p->uring ? "io_uring_enter" : "epoll_wait",
+				     strerror(errno));
+	}
+
+	return n;
+}
+
+#if defined(__NR_epoll_pwait2)
+// Set once epoll_pwait2() returns ENOSYS, so older kernels don't pay for the
+// failing syscall on each wait.
+static int sc_sock_no_pwait2;
+#endif
+
+static int sc_sock_epoll_wait_ns(struct sc_sock_poll *p,
+				 struct __kernel_timespec *ts)
+{
+	int n = -1;
+	int64_t ms;
+
+#if defined(__NR_epoll_pwait2)
+	if (!__atomic_load_n(&sc_sock_no_pwait2, __ATOMIC_RELAXED)) {
+		n = (int) syscall(__NR_epoll_pwait2, p->fds, p->events,
+				  p->max_events, ts, NULL, 0);
+		if (n != -1 || errno != ENOSYS) {
+			return n;
+		}
+
+		__atomic_store_n(&sc_sock_no_pwait2, 1, __ATOMIC_RELAXED);
+	}
+#endif
+
+	// epoll_pwait2() is not available, round up to milliseconds.
+	ms = -1;
+	if (ts != NULL) {
+		ms = ts->tv_sec * 1000 + (ts->tv_nsec + 999999) / 1000000;
+		ms = ms > INT32_MAX ? INT32_MAX : ms;
+	}
+
+	return epoll_wait(p->fds, p->events, p->max_events, (int) ms);
+}
+
+// Polls without blocking until there is an event or the budget is spent.
+// Spent time is subtracted from the timeout.
+static int sc_sock_poll_spin(struct sc_sock_poll *p, int64_t *timeout)
+{
+	int n;
+	uint64_t start, elapsed, budget = (uint64_t) p->spin_ns;
+	struct __kernel_timespec ts = {0};
+
+	if (*timeout >= 0 && (uint64_t) *timeout < budget) {
+		budget = (uint64_t) *timeout;
+	}
+
+	start = sc_sock_time_ns();
+
+	do {
+		if (p->uring != NULL) {
+			n = sc_sock_uring_wait(p->uring, p->events,
+					       p->max_events, &ts);
+		} else {
+			n = epoll_wait(p->fds, p->events, p->max_events, 0);
+		}
+
+		if (n < 0 && errno == EINTR) {
+			n = 0;
+		}
+
+		elapsed = sc_sock_time_ns() - start;
+	} while (n == 0 && elapsed < budget);
+
+	sc_sock_poll_stat_add(p, spins, 1);
+	sc_sock_poll_stat_add(p, spin_hits, n > 0);
+
+	if (*timeout >= 0) {
+		*timeout -= (int64_t) elapsed;
+		*timeout = *timeout < 0 ? 0 : *timeout;
+	}
+
+	return n;
+}
+
+int sc_sock_poll_wait_ns(struct sc_sock_poll *p, int64_t timeout)
+{
+	int n = 0;
+	struct __kernel_timespec ts;
+
+	if (p->events == NULL) {
+		sc_sock_poll_set_err(p, "poll : sc_sock_poll is not initialized or already terminated");
+		return -1;
+	}
+
+	if (p->spin_ns > 0 && timeout != 0) {
+		n = sc_sock_poll_spin(p, &timeout);
+		if (n != 0) {
+			goto out;
+		}
+	}
+
+	ts.tv_sec = timeout / 1000000000;
+	ts.tv_nsec = timeout % 1000000000;
+
+	do {
+		if (p->uring != NULL) {
+			n = sc_sock_uring_wait(p->uring, p->events,
+					       p->max_events,
+					       timeout >= 0 ? &ts : NULL);
+		} else {
+			n = sc_sock_epoll_wait_ns(p, timeout >= 0 ? &ts : NULL);
+		}
+	} while ((n < 0 && errno == EINTR) || (n == 0 && timeout < 0));
+
+out:
+	sc_sock_poll_stat(p, n);
 
 	if (n == -1) {
-		sc_sock_poll_set_err(p, "epoll_wait : %s ", strerror(errno));
+		sc_sock_poll_set_err(p, "%s : %s ",
+				     p->uring ? "io_uring_enter" : "epoll_pwait2",
+				     strerror(errno));
 	}
 
 	return n;
@@ -1319,12 +5446,24 @@ int sc_sock_poll_wait(struct sc_sock_poll *p, int timeout)
 #elif defined(__APPLE__) || defined(__FreeBSD__)
 
 int sc_sock_poll_init(struct sc_sock_poll *p)
+{
+	return sc_sock_poll_init_conf(p, NULL);
+}
+
+int sc_sock_poll_init_conf(struct sc_sock_poll *p,
+			   struct sc_sock_poll_conf *conf)
 {
 	int fds;
+	int max = sc_sock_poll_max_events(conf);
 
 	*p = (struct sc_sock_poll){0};
 
-	p->events = sc_sock_malloc(sizeof(*p->events) * SC_SOCK_POLL_MAX_EVENTS);
+	if (conf != NULL && conf->backend != SC_SOCK_POLL_DEFAULT) {
+		sc_sock_poll_set_err(p, "poll : backend is not supported");
+		return -1;
+	}
+
+	p->events = sc_sock_malloc(sizeof(*p->events) * (size_t) max);
 	if (p->events == NULL) {
 		errno = ENOMEM;
 		goto err;
@@ -1335,6 +5474,8 @@ int sc_sock_poll_init(struct sc_sock_poll *p)
 		goto err;
 	}
 	p->fds = fds;
+	p->max_events = max;
+	p->spin_ns = conf != NULL && conf->spin_ns > 0 ? conf->spin_ns : 0;
 
 	return 0;
 err:
@@ -1464,27 +5605,51 @@ int sc_sock_poll_del(struct sc_sock_poll *p, struct sc_sock_fd *fdt,
 
 void *sc_sock_poll_data(struct sc_sock_poll *p, int i)
 {
-	return p->events[i].udata;
+	return sc_sock_poll_data_inline(p, i);
 }
 
 uint32_t sc_sock_poll_event(struct sc_sock_poll *p, int i)
 {
-	uint32_t events = 0;
+	return sc_sock_poll_event_inline(p, i);
+}
+
+// Polls without blocking until there is an event or the budget is spent.
+// Spent time is subtracted from the timeout.
+static int sc_sock_poll_spin(struct sc_sock_poll *p, int64_t *timeout)
+{
+	int n;
+	uint64_t start, elapsed, budget = (uint64_t) p->spin_ns;
+	struct timespec ts = {0};
+
+	if (*timeout >= 0 && (uint64_t) *timeout < budget) {
+		budget = (uint64_t) *timeout;
+	}
+
+	start = sc_sock_time_ns();
+
+	do {
+		n = kevent(p->fds, NULL, 0, p->events, p->max_events, &ts);
+		if (n < 0 && errno == EINTR) {
+			n = 0;
+		}
+
+		elapsed = sc_sock_time_ns() - start;
+	} while (n == 0 && elapsed < budget);
+
+	sc_sock_poll_stat_add(p, spins, 1);
+	sc_sock_poll_stat_add(p, spin_hits, n > 0);
 
-	if (p->events[i].flags & EV_EOF) {
-		events = (SC_SOCK_READ | SC_SOCK_WRITE);
-	} else if (p->events[i].filter == EVFILT_READ) {
-		events |= SC_SOCK_READ;
-	} else if (p->events[i].filter == EVFILT_WRITE) {
-		events |= SC_SOCK_WRITE;
+	if (*timeout >= 0) {
+		*timeout -= (int64_t) elapsed;
+		*timeout = *timeout < 0 ? 0 : *timeout;
 	}
 
-	return events;
+	return n;
 }
 
-int sc_sock_poll_wait(struct sc_sock_poll *p, int timeout)
+int sc_sock_poll_wait_ns(struct sc_sock_poll *p, int64_t timeout)
 {
-	int n;
+	int n = 0;
 	struct timespec ts;
 	struct kevent *events = p->events;
 
@@ -1493,14 +5658,24 @@ int sc_sock_poll_wait(struct sc_sock_poll *p, int timeout)
 		return -1;
 	}
 
+	if (p->spin_ns > 0 && timeout != 0) {
+		n = sc_sock_poll_spin(p, &timeout);
+		if (n != 0) {
+			goto out;
+		}
+	}
+
 	do {
-		ts.tv_sec = timeout / 1000;
-		ts.tv_nsec = (timeout % 1000) * 1000000;
+		ts.tv_sec = (time_t) (timeout / 1000000000);
+		ts.tv_nsec = (long) (timeout % 1000000000);
 
-		n = kevent(p->fds, NULL, 0, events, SC_SOCK_POLL_MAX_EVENTS,
+		n = kevent(p->fds, NULL, 0, events, p->max_events,
 			   timeout >= 0 ? &ts : NULL);
 	} while (n < 0 && errno == EINTR);
 
+out:
+	sc_sock_poll_stat(p, n);
+
 	if (n == -1) {
 		sc_sock_poll_set_err(p, "kevent : %s ", strerror(errno));
 	}
@@ -1508,6 +5683,11 @@ int sc_sock_poll_wait(struct sc_sock_poll *p, int timeout)
 	return n;
 }
 
+int sc_sock_poll_wait(struct sc_sock_poll *p, int timeout)
+{
+	return sc_sock_poll_wait_ns(p, timeout >= 0 ? timeout * 1000000ll : -1);
+}
+
 #else // WINDOWS
 
 static void sc_sock_poll_set_err_from_code(int err_code)
@@ -1525,16 +5705,30 @@ static void sc_sock_poll_set_err_from_code(int err_code)
 }
 
 int sc_sock_poll_init(struct sc_sock_poll *p)
+{
+	return sc_sock_poll_init_conf(p, NULL);
+}
+
+int sc_sock_poll_init_conf(struct sc_sock_poll *p,
+			   struct sc_sock_poll_conf *conf)
 {
 	bool pipe_failed = false;
+	int max = sc_sock_poll_max_events(conf);
 
 	*p = (struct sc_sock_poll){0};
 
-	p->results = sc_sock_malloc(sizeof(*p->results) * SC_SOCK_POLL_MAX_EVENTS);
+	if (conf != NULL && conf->backend != SC_SOCK_POLL_DEFAULT) {
+		sc_sock_poll_set_err(p, "poll : backend is not supported");
+		return -1;
+	}
+
+	p->results = sc_sock_malloc(sizeof(*p->results) * (size_t) max);
 	if (p->results == NULL) {
 		goto err;
 	}
 
+	p->max_events = max;
+
 	p->events = sc_sock_malloc(sizeof(*p->events) * 16);
 	if (p->events == NULL) {
 		goto err;
@@ -1932,12 +6126,12 @@ exit:
 
 void *sc_sock_poll_data(struct sc_sock_poll *p, int i)
 {
-	return p->results[i].data;
+	return sc_sock_poll_data_inline(p, i);
 }
 
 uint32_t sc_sock_poll_event(struct sc_sock_poll *p, int i)
 {
-	return p->results[i].events;
+	return sc_sock_poll_event_inline(p, i);
 }
 
 static uint32_t sc_sock_poll_event_inner(struct sc_sock_poll *p, int i)
@@ -1999,7 +6193,7 @@ static int sc_sock_poll_fill_results(struct sc_sock_poll *p)
 				.data = sc_sock_poll_data_inner(p, i)->data,
 			};
 
-			if (found == SC_SOCK_POLL_MAX_EVENTS) {
+			if (found == p->max_events) {
 				p->results_offset = i + 1;
 				return found;
 			}
@@ -2135,9 +6329,65 @@ retry:
 		rc = sc_sock_poll_fill_results(p);
 	}
 
+	sc_sock_poll_stat(p, rc);
+
 exit:
 	LeaveCriticalSection(&p->lock);
 	return rc;
 }
 
+int sc_sock_poll_wait_ns(struct sc_sock_poll *p, int64_t timeout)
+{
+	int64_t ms = -1;
+
+	if (timeout >= 0) {
+		ms = (timeout + 999999) / 1000000;
+		ms = ms > INT32_MAX ? INT32_MAX : ms;
+	}
+
+	return sc_sock_poll_wait(p, (int) ms);
+}
+
+#endif
+
+#if !defined(__linux__)
+
+int sc_sock_poll_recv_add(struct sc_sock_poll *p, struct sc_sock_fd *fdt,
+			  void *data)
+{
+	(void) fdt;
+	(void) data;
+
+	sc_sock_poll_set_err(p, "poll : receive buffers are not configured");
+	return -1;
+}
+
+int sc_sock_poll_recv_del(struct sc_sock_poll *p, struct sc_sock_fd *fdt)
+{
+	(void) p;
+	(void) fdt;
+
+	return 0;
+}
+
+int sc_sock_poll_send(struct sc_sock_poll *p, struct sc_sock_fd *fdt,
+		      char *buf, int len, void *data)
+{
+	(void) fdt;
+	(void) buf;
+	(void) len;
+	(void) data;
+
+	sc_sock_poll_set_err(p, "poll : send requires io_uring backend");
+	return -1;
+}
+
+struct sc_sock_io *sc_sock_poll_io(struct sc_sock_poll *p, int i)
+{
+	(void) p;
+	(void) i;
+
+	return NULL;
+}
+
 #endif
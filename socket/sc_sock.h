@@ -68,6 +68,7 @@ enum sc_sock_ev
 	SC_SOCK_READ = 1u,
 	SC_SOCK_WRITE = 2u,
 	SC_SOCK_EDGE = 4u,
+	SC_SOCK_ERRQUEUE = 8u, // Poll output only, see sc_sock_poll_event().
 };
 
 enum sc_sock_family
@@ -95,10 +96,77 @@ struct sc_sock_fd {
 #endif
 };
 
+enum sc_sock_opt
+{
+	SC_SOCK_SNDBUF,          // SO_SNDBUF, bytes
+	SC_SOCK_RCVBUF,          // SO_RCVBUF, bytes
+	SC_SOCK_NODELAY,         // TCP_NODELAY, enabled by default
+	SC_SOCK_CORK,            // TCP_CORK on Linux, TCP_NOPUSH on BSDs/macOS
+	SC_SOCK_QUICKACK,        // TCP_QUICKACK, Linux only, not permanent
+	SC_SOCK_DEFER_ACCEPT,    // TCP_DEFER_ACCEPT, seconds, Linux only
+	SC_SOCK_FASTOPEN,        // TCP_FASTOPEN, server side queue length
+	SC_SOCK_FASTOPEN_CONNECT,// TCP_FASTOPEN_CONNECT, client side, Linux only
+	SC_SOCK_BUSY_POLL,       // SO_BUSY_POLL, microseconds, Linux only
+	SC_SOCK_INCOMING_CPU,    // SO_INCOMING_CPU, Linux only
+	SC_SOCK_NOTSENT_LOWAT,   // TCP_NOTSENT_LOWAT, bytes, Linux and macOS
+};
+
+#define SC_SOCK_OPT_PENDING 4
+
+/**
+ * I/O statistics, compile sc_sock.c with -DSC_SOCK_STATS to enable. Counters
+ * are always part of the structs, so the layout does not depend on the flag.
+ * Otherwise, they are not updated and snapshots are always zero.
+ */
+enum sc_sock_call
+{
+	SC_SOCK_CALL_SEND,
+	SC_SOCK_CALL_RECV,
+	SC_SOCK_CALL_WRITEV,
+	SC_SOCK_CALL_SENDMMSG,
+	SC_SOCK_CALL_RECVMMSG,
+	SC_SOCK_CALL_SENDFILE,
+	SC_SOCK_CALL_ACCEPT,
+	SC_SOCK_CALL_CONNECT,
+	SC_SOCK_CALL_MAX,
+};
+
+struct sc_sock_stats {
+	uint64_t calls[SC_SOCK_CALL_MAX]; // Syscalls by type
+	uint64_t eagain;                  // Calls failed with EAGAIN
+	uint64_t short_reads;             // Reads less than the buffer size
+	uint64_t partial_writes;          // Writes less than the requested size
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+};
+
+// Events per wakeup histogram, bucket 'i' is [2^i, 2^(i+1)) events.
+#define SC_SOCK_POLL_HIST 16
+
+struct sc_sock_poll_stats {
+	uint64_t waits;    // Wait calls
+	uint64_t wakeups;  // Waits returned with events
+	uint64_t timeouts; // Waits returned without events
+	uint64_t errors;
+	uint64_t events;
+	uint64_t hist[SC_SOCK_POLL_HIST];
+	uint64_t spins;     // Waits started with busy polling
+	uint64_t spin_hits; // Busy polling found events, no blocking wait
+};
+
+struct sc_sock_opt_value {
+	enum sc_sock_opt opt;
+	int value;
+};
+
 struct sc_sock {
 	struct sc_sock_fd fdt;
 	bool blocking;
 	int family;
+	// Options set before the socket is created, applied on listen/connect.
+	int opt_count;
+	struct sc_sock_opt_value opts[SC_SOCK_OPT_PENDING];
+	struct sc_sock_stats stats;
 	char err[128];
 };
 
@@ -142,6 +210,129 @@ int sc_sock_term(struct sc_sock *s);
  */
 int sc_sock_listen(struct sc_sock *s, const char *host, const char *port);
 
+struct sc_sock_addr {
+	int family;
+	socklen_t len;
+	struct sockaddr_storage addr;
+};
+
+/**
+ * Connect to a resolved address, e.g., a result of sc_sock_resolve().
+ * Same as sc_sock_connect() without name resolution, so it never blocks on
+ * DNS.
+ *
+ * @param s        sock
+ * @param addr     destination address, AF_INET or AF_INET6
+ * @param src_addr source addr (outgoing addr)
+ * @param src_port source port (outgoing port)
+ * @return         '0' on success
+ *                 negative value if it is non-blocking, errno will be EAGAIN
+ *                 negative value on error, call sc_sock_error() for error
+ *                 string.
+ */
+int sc_sock_connect_addr(struct sc_sock *s, const struct sc_sock_addr *addr,
+			 const char *src_addr, const char *src_port);
+
+#define SC_SOCK_RESOLVE_MAX 8
+
+/**
+ * Happy eyeballs (RFC 8305) connect. Non-blocking connection attempts to the
+ * addresses are started with 'delay' milliseconds apart, address families are
+ * interleaved. A failed attempt starts the next one without waiting. The
+ * first connected socket wins, others are closed. An optional total timeout
+ * bounds the whole operation.
+ *
+ * Sockets are registered to the poll with SC_SOCK_WRITE and the struct
+ * pointer as user data.
+ *
+ * e.g.,
+ *  struct sc_sock sock;
+ *  struct sc_sock_eyeballs e;
+ *
+ *  sc_sock_eyeballs_start(&e, &poll, req->addrs, req->count, 250, 10000);
+ *
+ *  while (true) {
+ *      int n = sc_sock_poll_wait(&poll, sc_sock_eyeballs_timeout(&e));
+ *      // Call on events with 'e' as user data and on timeout.
+ *      int rc = sc_sock_eyeballs_poll(&e, &sock);
+ *      if (rc == 0) {
+ *          // Connected, 'sock' is non-blocking and not in the poll.
+ *          break;
+ *      } else if (errno != EAGAIN) {
+ *          // All attempts failed, see sc_sock_eyeballs_err().
+ *          break;
+ *      }
+ *  }
+ */
+struct sc_sock_poll;
+
+struct sc_sock_eyeballs {
+	struct sc_sock_poll *poll;
+	struct sc_sock socks[SC_SOCK_RESOLVE_MAX];
+	struct sc_sock_addr addrs[SC_SOCK_RESOLVE_MAX];
+	int count;
+	int started;
+	int failed;
+	uint64_t delay;
+	uint64_t next;
+	uint64_t deadline;
+	char err[128];
+};
+
+/**
+ * Start connecting, at most SC_SOCK_RESOLVE_MAX addresses are used.
+ *
+ * @param e     eyeballs
+ * @param p     poll
+ * @param addrs addresses in preference order, e.g., getaddrinfo() order.
+ * @param count address count
+ * @param delay   delay between attempts in milliseconds, RFC 8305
+ *                recommends 250.
+ * @param timeout total timeout in milliseconds, '-1' for no limit.
+ * @return        '0' on success, negative number if no attempt could be
+ *                started, call sc_sock_eyeballs_err() for error string.
+ */
+int sc_sock_eyeballs_start(struct sc_sock_eyeballs *e, struct sc_sock_poll *p,
+			   const struct sc_sock_addr *addrs, int count,
+			   int delay, int timeout);
+
+/**
+ * @param e eyeballs
+ * @return  milliseconds until the next attempt or the total timeout, '-1' if
+ *          there is none. Can be used as sc_sock_poll_wait() timeout.
+ */
+int sc_sock_eyeballs_timeout(struct sc_sock_eyeballs *e);
+
+/**
+ * Check attempts and start the next one if it is due. Only the attempts that
+ * became writable are inspected.
+ *
+ * @param e   eyeballs
+ * @param out connected sock
+ * @return    - '0' on success, 'out' is the connected sock.
+ *            - negative value with errno = EAGAIN if attempts are in
+ *              progress.
+ *            - negative value with errno = ETIMEDOUT if the total timeout
+ *              expired, attempts are closed.
+ *            - negative value if all attempts failed, call
+ *              sc_sock_eyeballs_err() for error string.
+ */
+int sc_sock_eyeballs_poll(struct sc_sock_eyeballs *e, struct sc_sock *out);
+
+/**
+ * Cancel, in progress attempts are closed.
+ *
+ * @param e eyeballs
+ * @return  '0' on success.
+ */
+int sc_sock_eyeballs_term(struct sc_sock_eyeballs *e);
+
+/**
+ * @param e eyeballs
+ * @return  last error string
+ */
+const char *sc_sock_eyeballs_err(struct sc_sock_eyeballs *e);
+
 /**
  * @param s    sock
  * @param in   sock struct pointer the incoming connection
@@ -150,6 +341,57 @@ int sc_sock_listen(struct sc_sock *s, const char *host, const char *port);
  */
 int sc_sock_accept(struct sc_sock *s, struct sc_sock *in);
 
+/**
+ * Accept pending connections until there is none left or 'count' is reached.
+ * Uses accept4() on Linux, so accepted sockets inherit non-blocking mode
+ * without extra syscalls. Blocking sockets accept a single connection.
+ *
+ * @param s     sock
+ * @param in    sock array, at least 'count' elements.
+ * @param count max connections to accept
+ * @return      - on success, returns accepted connection count.
+ *              - negative value if it fails with errno = EAGAIN.
+ *              - negative value on error, call sc_sock_error() for error
+ *                string.
+ */
+int sc_sock_accept_batch(struct sc_sock *s, struct sc_sock *in, int count);
+
+#define SC_SOCK_HANDOFF_MAX 64
+
+/**
+ * POSIX only. Pass sockets to another process over a connected AF_UNIX
+ * socket with SCM_RIGHTS, e.g., listening sockets and optionally established
+ * connections for a restart without rebinding or dropping connections.
+ * Socket type, family and blocking mode are sent along with the descriptors.
+ * Sent sockets are still open in this process, caller should close them once
+ * the other side has adopted them.
+ *
+ * @param s     AF_UNIX sock
+ * @param socks sockets to pass
+ * @param count socket count, max SC_SOCK_HANDOFF_MAX
+ * @return      - on success, returns socket count.
+ *              - negative value if it fails with errno = EAGAIN.
+ *              - negative value on error, call sc_sock_error() for error
+ *                string.
+ */
+int sc_sock_handoff_send(struct sc_sock *s, struct sc_sock **socks, int count);
+
+/**
+ * POSIX only. Receive sockets sent with sc_sock_handoff_send(). Received
+ * sockets are initialized as if with sc_sock_init() and they are ready to
+ * use, e.g., sc_sock_accept() on a listening socket.
+ *
+ * @param s     AF_UNIX sock
+ * @param socks sock array, at least 'count' elements
+ * @param count max socket count
+ * @return      - on success, returns received socket count.
+ *              - negative value if it fails with errno = EAGAIN.
+ *              - negative value with errno = EOF if peer closed the socket.
+ *              - negative value on error, call sc_sock_error() for error
+ *                string.
+ */
+int sc_sock_handoff_recv(struct sc_sock *s, struct sc_sock *socks, int count);
+
 /**
  * @param s            sock
  * @param dst_addr    destination addr
@@ -192,37 +434,598 @@ int sc_sock_set_rcvtimeo(struct sc_sock *s, int ms);
  */
 int sc_sock_set_sndtimeo(struct sc_sock *s, int ms);
 
+/**
+ * Set a socket option. If the socket is not created yet, option is applied
+ * on sc_sock_listen()/sc_sock_connect() just before bind()/connect(), e.g.,
+ * SC_SOCK_FASTOPEN_CONNECT, or buffer sizes which affect TCP window scaling.
+ * At most SC_SOCK_OPT_PENDING options can be pending.
+ *
+ * To batch small writes, either set SC_SOCK_CORK and clear it to flush or
+ * pass MSG_MORE to sc_sock_send() on Linux.
+ *
+ * @param s     sock
+ * @param opt   option
+ * @param value option value, '0' or '1' for boolean options.
+ * @return      '0' on success, '-2' if option is not supported on the
+ *              platform, '-1' on other failures. call sc_sock_error() for
+ *              error string.
+ */
+int sc_sock_set_opt(struct sc_sock *s, enum sc_sock_opt opt, int value);
+
+/**
+ * @param s     sock
+ * @param opt   option
+ * @param value option value
+ * @return      '0' on success, '-2' if option is not supported on the
+ *              platform, '-1' on other failures. call sc_sock_error() for
+ *              error string.
+ */
+int sc_sock_get_opt(struct sc_sock *s, enum sc_sock_opt opt, int *value);
+
+struct sc_sock_tcp_info {
+	uint32_t state;
+	// Smoothed round trip time and its variance in microseconds.
+	uint32_t rtt;
+	uint32_t rttvar;
+	uint32_t snd_cwnd;
+	uint32_t snd_mss;
+	uint32_t rcv_mss;
+	// Unacknowledged, lost and retransmitted segments in flight.
+	uint32_t unacked;
+	uint32_t lost;
+	uint32_t retrans;
+	// Total retransmitted segments over the connection lifetime.
+	uint32_t total_retrans;
+};
+
+/**
+ * Linux only, read TCP_INFO.
+ *
+ * @param s    sock
+ * @param info info
+ * @return     '0' on success, negative number on failure.
+ *             call sc_sock_error() for error string.
+ */
+int sc_sock_tcp_info(struct sc_sock *s, struct sc_sock_tcp_info *info);
+
+/**
+ * Get a snapshot of the I/O counters, zero unless SC_SOCK_STATS is defined.
+ * Counters are not atomic, call it from the thread that does the I/O.
+ *
+ * @param s     sock
+ * @param stats stats
+ * @param reset reset counters after the snapshot
+ */
+void sc_sock_stats(struct sc_sock *s, struct sc_sock_stats *stats, bool reset);
+
 /**
  * Finish connect for nonblocking connections. This function must be called
  * after sc_sock_poll() indicates socket is writable.
  *
  * @param s sock
  * @return  '0' on success, negative number on failure.
- *          call sc_sock_error() for error string.
+ *          call sc_sock_error() for error string.
+ */
+int sc_sock_finish_connect(struct sc_sock *s);
+
+/**
+ * @param s     sock
+ * @param buf   buf
+ * @param len   len
+ * @param flags normally should be zero, otherwise flags are passed to send().
+ * @return      - on success, returns sent byte count.
+ *              - negative value if it fails with errno = EAGAIN.
+ *              - negative value on error
+ */
+int sc_sock_send(struct sc_sock *s, char *buf, int len, int flags);
+
+/**
+ * @param s     sock
+ * @param buf   buf
+ * @param len   len
+ * @param flags normally should be zero, otherwise flags are passed to recv().
+ * @return      - on success, returns bytes received.
+ *              - negative value if it fails with errno = EAGAIN.
+ *              - negative value on error
+ */
+int sc_sock_recv(struct sc_sock *s, char *buf, int len, int flags);
+
+/**
+ * Growable buffer for sc_sock_recv_all() and sc_sock_send_all(). Unread data
+ * is between 'rpos' and 'wpos'. Buffer grows up to 'limit' bytes.
+ *
+ * 'hint' is the next read size, it follows the size of previous reads and
+ * pending byte count (FIONREAD) of the socket.
+ */
+struct sc_sock_buf {
+	char *mem;
+	size_t cap;
+	size_t limit;
+	size_t rpos;
+	size_t wpos;
+	size_t hint;
+};
+
+/**
+ * @param b     buf
+ * @param limit max capacity of the buffer
+ */
+void sc_sock_buf_init(struct sc_sock_buf *b, size_t limit);
+
+/**
+ * @param b buf
+ */
+void sc_sock_buf_term(struct sc_sock_buf *b);
+
+/**
+ * Append data to the buffer, e.g., to send with sc_sock_send_all().
+ *
+ * @param b   buf
+ * @param buf data
+ * @param len len
+ * @return    '0' on success, negative value if buffer limit is exceeded or
+ *            out of memory.
+ */
+int sc_sock_buf_put(struct sc_sock_buf *b, const void *buf, size_t len);
+
+/**
+ * Mark 'len' bytes as read.
+ *
+ * @param b   buf
+ * @param len len
+ */
+void sc_sock_buf_consume(struct sc_sock_buf *b, size_t len);
+
+/**
+ * Edge triggered mode helper. Reads until recv() fails with EAGAIN, the buffer
+ * reaches its limit or 'max' bytes are read. 'max' is the read budget, it
+ * keeps a busy socket from starving the others.
+ *
+ * 'drained' is set to true if socket has no more data, e.g., EAGAIN is
+ * returned. Otherwise, caller should call again later as there won't be
+ * another read event for the remaining data.
+ *
+ * @param s       sock
+ * @param b       buf
+ * @param max     max bytes to read in this call, read budget
+ * @param drained set to true if socket is drained
+ * @return        - on success, bytes read, might be zero.
+ *                - negative value with errno = EOF on EOF.
+ *                - negative value on error
+ *                Data read before EOF or error is in the buffer.
+ */
+int64_t sc_sock_recv_all(struct sc_sock *s, struct sc_sock_buf *b, size_t max,
+			 bool *drained);
+
+/**
+ * Edge triggered mode helper. Sends buffered data until it is all sent,
+ * send() fails with EAGAIN or 'max' bytes are sent. Sent data is consumed
+ * from the buffer.
+ *
+ * 'drained' is set to true if there is nothing to do until the next write
+ * event, e.g., the buffer is empty or the socket buffer is full.
+ *
+ * @param s       sock
+ * @param b       buf
+ * @param max     max bytes to send in this call
+ * @param drained set to true if buffer is empty or EAGAIN is returned
+ * @return        - on success, bytes sent, might be zero.
+ *                - negative value on error
+ */
+int64_t sc_sock_send_all(struct sc_sock *s, struct sc_sock_buf *b, size_t max,
+			 bool *drained);
+
+/**
+ * Write queue with watermarks. Data that cannot be sent immediately is copied
+ * into the queue and SC_SOCK_WRITE is added to the poll, it is removed once
+ * the queue is flushed. Queued data is sent with vectored writes.
+ *
+ * 'on_high' is called when queued bytes reach the high watermark, then
+ * 'on_low' is called when it drops to the low watermark, producers may stop
+ * writing in between.
+ *
+ * e.g.,
+ *  sc_sock_wq_init(&q, &sock, &poll, &sock, 64 * 1024, 1024 * 1024);
+ *  q.on_high = pause_producer;
+ *  q.on_low = resume_producer;
+ *
+ *  sc_sock_wq_write(&q, data, len);
+ *
+ *  // On SC_SOCK_WRITE event of 'sock'
+ *  sc_sock_wq_flush(&q);
+ */
+struct sc_sock_wq_chunk {
+	struct sc_sock_wq_chunk *next;
+	size_t cap;
+	size_t len;
+	size_t pos;
+	char buf[];
+};
+
+struct sc_sock_wq {
+	struct sc_sock *sock;
+	struct sc_sock_poll *poll;
+	// Poll user data of 'sock'
+	void *data;
+
+	struct sc_sock_wq_chunk *head;
+	struct sc_sock_wq_chunk *tail;
+	// Queued bytes
+	size_t size;
+	size_t low;
+	size_t high;
+	bool armed;
+	bool paused;
+
+	void (*on_high)(struct sc_sock_wq *q);
+	void (*on_low)(struct sc_sock_wq *q);
+	// User data
+	void *arg;
+};
+
+/**
+ * @param q    write queue
+ * @param s    sock
+ * @param p    poll which 's' is registered to, or will be.
+ * @param data poll user data of 's'
+ * @param low  low watermark in bytes
+ * @param high high watermark in bytes, '0' to disable watermark callbacks.
+ * @return     '0' on success.
+ */
+int sc_sock_wq_init(struct sc_sock_wq *q, struct sc_sock *s,
+		   struct sc_sock_poll *p, void *data, size_t low, size_t high);
+
+/**
+ * Release queued data, it does not touch poll registration.
+ *
+ * @param q write queue
+ */
+void sc_sock_wq_term(struct sc_sock_wq *q);
+
+/**
+ * If the queue is empty, data is sent directly and only the remaining part is
+ * queued.
+ *
+ * @param q   write queue
+ * @param buf buf
+ * @param len len
+ * @return    '0' on success, 'buf' is sent or queued.
+ *            negative number on failure, call sc_sock_error() for error
+ *            string.
+ */
+int sc_sock_wq_write(struct sc_sock_wq *q, const void *buf, size_t len);
+
+/**
+ * Send queued data until the socket buffer is full, call on SC_SOCK_WRITE.
+ *
+ * @param q write queue
+ * @return  - '0' if the queue is empty, SC_SOCK_WRITE is removed from poll.
+ *          - negative value with errno = EAGAIN if data is left in the queue.
+ *          - negative value on error, call sc_sock_error() for error string.
+ */
+int sc_sock_wq_flush(struct sc_sock_wq *q);
+
+/**
+ * Idle connection tracking. Recording activity is a single store of a cached
+ * timestamp, there is no timer update per read or write. Entries are kept in
+ * coarse buckets of 'tick' milliseconds, a bucket is checked once its time
+ * passes : entries with recent activity are moved to the bucket of their new
+ * deadline, the others are returned as expired in batches.
+ *
+ * Connections expire between 'timeout' and 'timeout + tick' milliseconds
+ * after their last activity.
+ *
+ * e.g.,
+ *  sc_sock_idle_init(&idle, 30000, 1000);
+ *  sc_sock_idle_add(&idle, &conn->idle, conn);
+ *
+ *  // On each read/write
+ *  sc_sock_idle_touch(&idle, &conn->idle);
+ *
+ *  // On each loop iteration
+ *  while ((n = sc_sock_idle_expired(&idle, batch, 64)) > 0) {
+ *       for (int i = 0; i < n; i++) {
+ *           close_conn(batch[i]->data);
+ *       }
+ *  }
+ */
+struct sc_sock_idle_entry {
+	struct sc_sock_idle_entry *next;
+	struct sc_sock_idle_entry *prev;
+	uint64_t last;
+	void *data;
+};
+
+struct sc_sock_idle {
+	uint64_t timeout;
+	uint64_t tick;
+	uint64_t now;
+	uint64_t pos;
+	uint64_t count;
+	size_t size;
+	struct sc_sock_idle_entry *slots;
+	char err[128];
+};
+
+/**
+ * @param i       idle
+ * @param timeout idle timeout in milliseconds
+ * @param tick    bucket granularity in milliseconds
+ * @return        '0' on success, negative value on out of memory.
+ *                call sc_sock_idle_err() for error string.
+ */
+int sc_sock_idle_init(struct sc_sock_idle *i, uint64_t timeout, uint64_t tick);
+
+/**
+ * @param i idle
+ * @return  '0' on success.
+ */
+int sc_sock_idle_term(struct sc_sock_idle *i);
+
+/**
+ * Start tracking, activity time is set to now.
+ *
+ * @param i    idle
+ * @param e    entry, must stay valid until it is deleted or expired.
+ * @param data user data
+ */
+void sc_sock_idle_add(struct sc_sock_idle *i, struct sc_sock_idle_entry *e,
+		      void *data);
+
+/**
+ * Stop tracking. No-op if entry is not tracked.
+ *
+ * @param i idle
+ * @param e entry
+ */
+void sc_sock_idle_del(struct sc_sock_idle *i, struct sc_sock_idle_entry *e);
+
+/**
+ * Record activity. Uses the time cached by the last sc_sock_idle_expired()
+ * call.
+ *
+ * @param i idle
+ * @param e entry
+ */
+static inline void sc_sock_idle_touch(struct sc_sock_idle *i,
+				      struct sc_sock_idle_entry *e)
+{
+	e->last = i->now;
+}
+
+/**
+ * Check buckets whose time has passed. Expired entries are removed and
+ * written to 'out'. If return value is 'max', there might be more, call again.
+ *
+ * @param i   idle
+ * @param out expired entries
+ * @param max 'out' capacity
+ * @return    expired entry count
+ */
+int sc_sock_idle_expired(struct sc_sock_idle *i, struct sc_sock_idle_entry **out,
+			 int max);
+
+/**
+ * @param i idle
+ * @return  milliseconds until the next bucket is due, '-1' if there is no
+ *          entry. Can be used as poll timeout.
+ */
+int64_t sc_sock_idle_timeout(struct sc_sock_idle *i);
+
+/**
+ * @param i idle
+ * @return  last error string
+ */
+const char *sc_sock_idle_err(struct sc_sock_idle *i);
+
+/**
+ * Create a UDP socket and bind it to host:port.
+ *
+ * @param s    sock
+ * @param host host
+ * @param port port
+ * @return    '0' on success, negative number on failure.
+ *             call sc_sock_error() for error string.
+ */
+int sc_sock_udp_bind(struct sc_sock *s, const char *host, const char *port);
+
+struct sc_sock_msg {
+	char *buf;
+	// send : data length. recv : buf capacity as input, received bytes
+	// as output.
+	int len;
+	// send : UDP GSO segment size, buf will be split into datagrams of
+	//        this size by the kernel, '0' to disable.
+	// recv : UDP GRO segment size if datagrams are coalesced, otherwise '0'.
+	int segment_size;
+	// send : destination address, set 'addr_len' to '0' for connected
+	//        sockets.
+	// recv : source address.
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+};
+
+/**
+ * Receive datagrams with a single syscall (recvmmsg() on Linux). Blocking
+ * sockets block for the first datagram only.
+ *
+ * @param s     sock
+ * @param msgs  messages, 'buf' and 'len' must be set for each.
+ * @param count message count
+ * @param flags normally should be zero, otherwise flags are passed to recv.
+ * @return      - on success, returns received message count.
+ *              - negative value if it fails with errno = EAGAIN.
+ *              - negative value on error
+ */
+int sc_sock_recv_batch(struct sc_sock *s, struct sc_sock_msg *msgs, int count,
+		       int flags);
+
+/**
+ * Send datagrams with a single syscall (sendmmsg() on Linux).
+ *
+ * @param s     sock
+ * @param msgs  messages
+ * @param count message count
+ * @param flags normally should be zero, otherwise flags are passed to send.
+ * @return      - on success, returns sent message count, might be less than
+ *                'count'.
+ *              - negative value if it fails with errno = EAGAIN.
+ *              - negative value on error
+ */
+int sc_sock_send_batch(struct sc_sock *s, struct sc_sock_msg *msgs, int count,
+		       int flags);
+
+/**
+ * Linux only. Enable UDP GRO, kernel may coalesce datagrams of the same flow
+ * into a single buffer, see 'segment_size' of struct sc_sock_msg.
+ *
+ * @param s      sock
+ * @param enable enable
+ * @return       '0' on success, negative number on failure.
+ *               call sc_sock_error() for error string.
+ */
+int sc_sock_set_udp_gro(struct sc_sock *s, bool enable);
+
+/**
+ * Send file data without copying it to user space. Uses sendfile() on Linux,
+ * BSDs and macOS, other POSIX platforms fall back to pread() + send(). Not
+ * supported on Windows. Counted as SC_SOCK_CALL_SENDFILE in the statistics
+ * on all platforms.
+ *
+ * @param s      sock
+ * @param fd     file descriptor
+ * @param offset file offset, advanced by the sent byte count.
+ * @param len    max bytes to send
+ * @return       - on success, returns sent bytes, might be less than 'len'.
+ *               - '0' if 'offset' is at or beyond the end of the file, on all
+ *                 platforms. errno is not set.
+ *               - negative value if it fails with errno = EAGAIN.
+ *               - negative value on error, call sc_sock_error() for error
+ *                 string.
+ */
+int64_t sc_sock_sendfile(struct sc_sock *s, int fd, int64_t *offset,
+			 int64_t len);
+
+/**
+ * Linux only. Enable MSG_ZEROCOPY sends on the socket.
+ *
+ * @param s      sock
+ * @param enable enable
+ * @return       '0' on success, negative number on failure.
+ *               call sc_sock_error() for error string.
+ */
+int sc_sock_set_zerocopy(struct sc_sock *s, bool enable);
+
+/**
+ * Linux only. Send with MSG_ZEROCOPY, kernel sends pages of 'buf' directly,
+ * so 'buf' must not be modified or freed until the send is reported as
+ * completed by sc_sock_zerocopy_done(). Each successful call is assigned a
+ * sequence number per socket, starting from zero. Small sends are not worth
+ * it, page pinning and the notification cost more than a copy.
+ *
+ * @param s     sock
+ * @param buf   buf
+ * @param len   len
+ * @param flags normally should be zero, otherwise flags are passed to send.
+ * @return      - on success, returns sent bytes.
+ *              - negative value if it fails with errno = EAGAIN.
+ *              - negative value on error
+ */
+int sc_sock_send_zerocopy(struct sc_sock *s, char *buf, int len, int flags);
+
+/**
+ * Linux only. Read a completion from the socket error queue. Pending
+ * completions are reported as a poll event with SC_SOCK_ERRQUEUE set, call
+ * this function until it fails when such an event is received.
+ *
+ * e.g.,
+ *  uint32_t lo, hi;
+ *  bool copied;
+ *
+ *  while (sc_sock_zerocopy_done(sock, &lo, &hi, &copied) == 0) {
+ *      // Sends with sequence numbers [lo, hi] are completed. Buffers can
+ *      // be released.
+ *  }
+ *
+ * @param s      sock
+ * @param lo     first completed sequence number
+ * @param hi     last completed sequence number, inclusive.
+ * @param copied kernel copied the data instead, e.g., loopback. If it is
+ *               always set, disabling zerocopy for the socket is better.
+ * @return       - '0' on success.
+ *               - negative value if it fails with errno = EAGAIN, queue is
+ *                 empty.
+ *               - negative value on error, errno is set to the queued error,
+ *                 e.g., an ICMP error, or to the pending socket error. Call
+ *                 sc_sock_error() for error string.
+ */
+int sc_sock_zerocopy_done(struct sc_sock *s, uint32_t *lo, uint32_t *hi,
+			  bool *copied);
+
+/**
+ * Relay data between two sockets, e.g., proxying. On Linux, data is moved
+ * with splice() through a pipe without copying to user space. Other platforms
+ * use a user space buffer.
+ *
+ * e.g.,
+ *  int64_t n = sc_sock_relay(&relay, src, dst, 1024 * 1024);
+ *  if (n < 0 && errno == EAGAIN) {
+ *      if (relay.pending > 0) {
+ *          // 'dst' is not writable, wait for SC_SOCK_WRITE on 'dst'.
+ *      } else {
+ *          // 'src' has no data, wait for SC_SOCK_READ on 'src'.
+ *      }
+ *  }
+ */
+struct sc_sock_relay {
+#if defined(__linux__)
+	int fds[2];
+#else
+	char *buf;
+	int64_t pos;
+#endif
+	// Bytes read from 'src' but not written to 'dst' yet.
+	int64_t pending;
+	char err[128];
+};
+
+/**
+ * @param r relay
+ * @return  '0' on success, negative number on failure.
+ *          call sc_sock_relay_err() for error string.
+ */
+int sc_sock_relay_init(struct sc_sock_relay *r);
+
+/**
+ * @param r relay
+ * @return  '0' on success, negative number on failure.
+ *          call sc_sock_relay_err() for error string.
  */
-int sc_sock_finish_connect(struct sc_sock *s);
+int sc_sock_relay_term(struct sc_sock_relay *r);
 
 /**
- * @param s     sock
- * @param buf   buf
- * @param len   len
- * @param flags normally should be zero, otherwise flags are passed to send().
- * @return      - on success, returns sent byte count.
- *              - negative value if it fails with errno = EAGAIN.
- *              - negative value on error
+ * Move up to 'len' bytes from 'src' to 'dst'. Pending bytes from the previous
+ * call are written first.
+ *
+ * @param r   relay
+ * @param src source sock
+ * @param dst destination sock
+ * @param len max bytes to move
+ * @return    - on success, returns bytes written to 'dst'.
+ *            - negative value if it fails with errno = EAGAIN.
+ *            - negative value with errno = EOF if 'src' is closed and there
+ *              is no pending data.
+ *            - negative value on error, call sc_sock_relay_err() for error
+ *              string.
  */
-int sc_sock_send(struct sc_sock *s, char *buf, int len, int flags);
+int64_t sc_sock_relay(struct sc_sock_relay *r, struct sc_sock *src,
+		      struct sc_sock *dst, int64_t len);
 
 /**
- * @param s     sock
- * @param buf   buf
- * @param len   len
- * @param flags normally should be zero, otherwise flags are passed to recv().
- * @return      - on success, returns bytes received.
- *              - negative value if it fails with errno = EAGAIN.
- *              - negative value on error
+ * @param r relay
+ * @return  last error string
  */
-int sc_sock_recv(struct sc_sock *s, char *buf, int len, int flags);
+const char *sc_sock_relay_err(struct sc_sock_relay *r);
 
 /**
  * @param s sock
@@ -321,22 +1124,217 @@ int sc_sock_pipe_read(struct sc_sock_pipe *p, void *data, unsigned int len);
  */
 const char *sc_sock_pipe_err(struct sc_sock_pipe *p);
 
+/**
+ * Notification primitive for waking up a poll from other threads. On Linux,
+ * it is an eventfd, a single fd with a counter, posts add to the counter and
+ * a read returns the sum and resets it. Other platforms use a non-blocking
+ * pipe, each post writes a byte.
+ *
+ * e.g.,
+ *  sc_sock_notify_init(&n, 0);
+ *  sc_sock_poll_add(&poll, &n.fdt, SC_SOCK_READ, &n);
+ *
+ *  // Any thread
+ *  sc_sock_notify_post(&n, 1);
+ *
+ *  // On SC_SOCK_READ event of 'n'
+ *  uint64_t count;
+ *  sc_sock_notify_read(&n, &count);
+ */
+struct sc_sock_notify {
+	struct sc_sock_fd fdt;
+#if !defined(__linux__)
+	struct sc_sock_pipe pipe;
+#endif
+	char err[128];
+};
+
+/**
+ * @param n    notify
+ * @param type user data into struct sc_sock_fdt
+ * @return     '0' on success, negative number on failure.
+ *             call sc_sock_notify_err() for error string.
+ */
+int sc_sock_notify_init(struct sc_sock_notify *n, int type);
+
+/**
+ * @param n notify
+ * @return  '0' on success, negative number on failure.
+ *          call sc_sock_notify_err() for error string.
+ */
+int sc_sock_notify_term(struct sc_sock_notify *n);
+
+/**
+ * Thread-safe, never blocks.
+ *
+ * @param n     notify
+ * @param count value to add to the counter, ignored on platforms other than
+ *              Linux.
+ * @return      '0' on success, negative number on failure.
+ *              call sc_sock_notify_err() for error string.
+ */
+int sc_sock_notify_post(struct sc_sock_notify *n, uint64_t count);
+
+/**
+ * Read and reset the counter, coalesced posts are consumed with a single
+ * call. Never blocks.
+ *
+ * @param n     notify
+ * @param count sum of posted values on Linux, post count on other platforms.
+ * @return      - '0' on success.
+ *              - negative value if it fails with errno = EAGAIN, nothing
+ *                was posted.
+ *              - negative value on error, call sc_sock_notify_err() for
+ *                error string.
+ */
+int sc_sock_notify_read(struct sc_sock_notify *n, uint64_t *count);
+
+/**
+ * @param n notify
+ * @return  last error string
+ */
+const char *sc_sock_notify_err(struct sc_sock_notify *n);
+
+/**
+ * High resolution timer fd, becomes readable when the deadline passes. Can be
+ * registered in sc_sock_poll like any other fd. Deadlines are absolute
+ * CLOCK_MONOTONIC nanoseconds, not rounded to milliseconds unlike poll
+ * timeouts. Many timers can share one fd : keep them in a timer wheel and arm
+ * the fd to the earliest deadline. Backed by timerfd on Linux, init fails on
+ * other platforms.
+ *
+ * e.g.,
+ *  sc_sock_timer_init(&t, 0);
+ *  sc_sock_poll_add(&poll, &t.fdt, SC_SOCK_READ, &t);
+ *  sc_sock_timer_arm(&t, now_ns + 250000); // 250 microseconds later
+ *
+ *  // On SC_SOCK_READ event of 't'
+ *  uint64_t count;
+ *  sc_sock_timer_read(&t, &count);
+ */
+struct sc_sock_timer {
+	struct sc_sock_fd fdt;
+	uint64_t deadline; // Armed deadline, '0' if disarmed.
+	char err[128];
+};
+
+/**
+ * @param t    timer
+ * @param type user data into struct sc_sock_fdt
+ * @return     '0' on success, negative number on failure.
+ *             call sc_sock_timer_err() for error string.
+ */
+int sc_sock_timer_init(struct sc_sock_timer *t, int type);
+
+/**
+ * @param t timer
+ * @return  '0' on success, negative number on failure.
+ *          call sc_sock_timer_err() for error string.
+ */
+int sc_sock_timer_term(struct sc_sock_timer *t);
+
+/**
+ * Arm the timer, replaces the previous deadline. A deadline in the past
+ * expires immediately.
+ *
+ * @param t        timer
+ * @param deadline absolute CLOCK_MONOTONIC nanoseconds, '0' to disarm.
+ * @return         '0' on success, negative number on failure.
+ *                 call sc_sock_timer_err() for error string.
+ */
+int sc_sock_timer_arm(struct sc_sock_timer *t, uint64_t deadline);
+
+/**
+ * Consume the expiration, timer is disarmed after this call. Never blocks.
+ *
+ * @param t     timer
+ * @param count expiration count, '1' for an expired timer.
+ * @return      - '0' on success.
+ *              - negative value if it fails with errno = EAGAIN, timer has
+ *                not expired yet.
+ *              - negative value on error, call sc_sock_timer_err() for
+ *                error string.
+ */
+int sc_sock_timer_read(struct sc_sock_timer *t, uint64_t *count);
+
+/**
+ * @param t timer
+ * @return  last error string
+ */
+const char *sc_sock_timer_err(struct sc_sock_timer *t);
+
 #if defined(__linux__)
 
 #include <sys/epoll.h>
 
+struct sc_sock_uring;
+
 struct sc_sock_poll {
 	int fds;
+	int max_events;
 	struct epoll_event *events;
+	struct sc_sock_uring *uring;
+	int64_t spin_ns;
+	struct sc_sock_poll_stats stats;
 };
 
+static inline void *sc_sock_poll_data_inline(struct sc_sock_poll *p, int i)
+{
+	return p->events[i].data.ptr;
+}
+
+static inline uint32_t sc_sock_poll_event_inline(struct sc_sock_poll *p, int i)
+{
+	uint32_t ev = 0;
+	uint32_t epoll_ev = p->events[i].events;
+
+	if (epoll_ev & EPOLLIN) {
+		ev |= SC_SOCK_READ;
+	}
+
+	if (epoll_ev & EPOLLOUT) {
+		ev |= SC_SOCK_WRITE;
+	}
+
+	if (epoll_ev & (EPOLLHUP | EPOLLRDHUP)) {
+		ev = (SC_SOCK_READ | SC_SOCK_WRITE);
+	} else if (epoll_ev & EPOLLERR) {
+		ev |= SC_SOCK_ERRQUEUE;
+	}
+
+	return ev;
+}
+
 #elif defined(__FreeBSD__) || defined(__APPLE__)
 #include <sys/event.h>
 
 struct sc_sock_poll {
 	int fds;
+	int max_events;
 	struct kevent *events;
+	int64_t spin_ns;
+	struct sc_sock_poll_stats stats;
 };
+
+static inline void *sc_sock_poll_data_inline(struct sc_sock_poll *p, int i)
+{
+	return p->events[i].udata;
+}
+
+static inline uint32_t sc_sock_poll_event_inline(struct sc_sock_poll *p, int i)
+{
+	uint32_t events = 0;
+
+	if (p->events[i].flags & EV_EOF) {
+		events = (SC_SOCK_READ | SC_SOCK_WRITE);
+	} else if (p->events[i].filter == EVFILT_READ) {
+		events |= SC_SOCK_READ;
+	} else if (p->events[i].filter == EVFILT_WRITE) {
+		events |= SC_SOCK_WRITE;
+	}
+
+	return events;
+}
 #else
 
 #if !defined(_WIN32)
@@ -372,13 +1370,47 @@ struct sc_sock_poll {
 	bool polling;
 	struct sc_sock_pipe wakeup_pipe;
 
+	int max_events;
 	int results_remaining;
 	int results_offset;
 	struct sc_sock_poll_result *results;
+	struct sc_sock_poll_stats stats;
 };
 
+static inline void *sc_sock_poll_data_inline(struct sc_sock_poll *p, int i)
+{
+	return p->results[i].data;
+}
+
+static inline uint32_t sc_sock_poll_event_inline(struct sc_sock_poll *p, int i)
+{
+	return p->results[i].events;
+}
+
 #endif
 
+enum sc_sock_poll_backend
+{
+	SC_SOCK_POLL_DEFAULT = 0, // Epoll, Kqueue or WSAPoll
+	SC_SOCK_POLL_URING = 1,   // io_uring, Linux only
+};
+
+struct sc_sock_poll_conf {
+	enum sc_sock_poll_backend backend;
+	int max_events; // Max events per wait, '0' for the default(1024).
+	// Busy polling budget in nanoseconds, '0' to disable. Linux and BSDs.
+	// Wait calls poll without blocking until there is an event or the
+	// budget is spent, then block for the remaining timeout. This saves
+	// the wakeup latency at the cost of a busy CPU.
+	int64_t spin_ns;
+	// io_uring only, buffer count of the ring used by
+	// sc_sock_poll_recv_add(), rounded up to a power of two, max 32768.
+	// '0' disables completion-based receive.
+	int recv_buf_count;
+	// io_uring only, size of each receive buffer, '0' for the default(4096).
+	int recv_buf_size;
+};
+
 /**
  * Create poll
  *
@@ -388,6 +1420,27 @@ struct sc_sock_poll {
  */
 int sc_sock_poll_init(struct sc_sock_poll *p);
 
+/**
+ * Create poll with a configuration. sc_sock_poll_init() is equivalent to
+ * passing NULL as 'conf'.
+ *
+ * SC_SOCK_POLL_URING backend uses multishot poll requests for
+ * edge-triggered fds and one-shot requests for level-triggered fds, requires
+ * Linux 5.13+. One-shot requests are re-armed by the next wait, within the
+ * same syscall that waits for events. sc_sock_poll_add(), sc_sock_poll_del() and the completion-based
+ * receive and send calls are queued and submitted to the kernel in a batch by
+ * the next sc_sock_poll_wait() call. An fd must be removed via
+ * sc_sock_poll_del() and sc_sock_poll_recv_del() before it is closed, the
+ * kernel keeps a reference to it otherwise.
+ *
+ * @param p    poll
+ * @param conf configuration, might be NULL
+ * @return     '0' on success, negative number on failure,
+ *             call sc_sock_poll_err() to get error string
+ */
+int sc_sock_poll_init_conf(struct sc_sock_poll *p,
+			   struct sc_sock_poll_conf *conf);
+
 /**
  * Destroy poll
  *
@@ -446,6 +1499,49 @@ int sc_sock_poll_del(struct sc_sock_poll *p, struct sc_sock_fd *fdt,
  */
 int sc_sock_poll_wait(struct sc_sock_poll *p, int timeout);
 
+/**
+ * Same as sc_sock_poll_wait() with a nanosecond resolution timeout. Uses
+ * epoll_pwait2() on Linux 5.11+, kevent() on BSDs. Other platforms round the
+ * timeout up to milliseconds.
+ *
+ * @param poll    poll
+ * @param timeout timeout in nanoseconds or -1 to wait infinitely
+ * @return number of events to handle or negative value on failure
+ */
+int sc_sock_poll_wait_ns(struct sc_sock_poll *p, int64_t timeout);
+
+/**
+ * Get a snapshot of the wait counters, zero unless SC_SOCK_STATS is defined.
+ * Call it from the poller thread.
+ *
+ * @param p     poll
+ * @param stats stats
+ * @param reset reset counters after the snapshot
+ */
+void sc_sock_poll_stats(struct sc_sock_poll *p, struct sc_sock_poll_stats *stats,
+			bool reset);
+
+/**
+ * Iterate over events without a function call per event, the event array is
+ * read directly.
+ *
+ * e.g.,
+ *  void *data;
+ *  uint32_t events;
+ *
+ *  int n = sc_sock_poll_wait(poll, 100);
+ *  sc_sock_poll_foreach (poll, n, data, events) {
+ *      if (events & SC_SOCK_READ)  {
+ *          // Handle read event
+ *      }
+ *  }
+ */
+#define sc_sock_poll_foreach(p, n, data, events)                               \
+	for (int _k = 1, _i = 0; _k && _i < (n); _k = !_k, _i++)               \
+		for ((data) = sc_sock_poll_data_inline((p), _i),                \
+		    (events) = sc_sock_poll_event_inline((p), _i);             \
+		     _k; _k = !_k)
+
 /**
  *
  * @param p poll
@@ -462,12 +1558,108 @@ void *sc_sock_poll_data(struct sc_sock_poll *p, int i);
  *          - SC_SOCK_READ
  *          - SC_SOCK_WRITE
  *          - SC_SOCK_READ | SC_SOCK_WRITE
+ *          - SC_SOCK_ERRQUEUE, Linux only, may be combined with the above.
  *
  *          Closed fd will set SC_SOCK_READ | SC_SOCK_WRITE together. So,
  *          any attempt to read or write will indicate socket is closed.
+ *
+ *          SC_SOCK_ERRQUEUE is set if the socket error queue has entries,
+ *          e.g., MSG_ZEROCOPY completions, or an error is pending without
+ *          the connection being closed. Drain it with
+ *          sc_sock_zerocopy_done(), a level triggered fd is reported again
+ *          until then.
  */
 uint32_t sc_sock_poll_event(struct sc_sock_poll *p, int i);
 
+/**
+ * Completion-based I/O, SC_SOCK_POLL_URING backend only. Data is transferred
+ * by the kernel, so an event doesn't need a recv() or send() call.
+ *
+ * sc_sock_poll_recv_add() starts a multishot receive, requires Linux 6.0+ and
+ * 'recv_buf_count' in sc_sock_poll_conf. Data is received into buffers of a
+ * ring registered to the kernel. Each completion is reported as an
+ * SC_SOCK_READ event with the given user data. The buffer is valid until the
+ * next sc_sock_poll_wait() call, it is returned to the ring then.
+ *
+ * sc_sock_poll_send() queues a send, it is submitted by the next
+ * sc_sock_poll_wait() call together with the other queued requests in a
+ * single syscall. Completion is reported as an SC_SOCK_WRITE event, 'buf'
+ * must stay valid until then. A send may be partial, one send per fd can be
+ * in flight. sc_sock_poll_del() of the fd cancels the send, its completion is
+ * not reported.
+ *
+ * e.g.,
+ *  sc_sock_poll_recv_add(&poll, &sock.fdt, &sock);
+ *
+ *  int n = sc_sock_poll_wait(&poll, 100);
+ *  for (int i = 0; i < n; i++) {
+ *      struct sc_sock_io *io = sc_sock_poll_io(&poll, i);
+ *      if (io == NULL) {
+ *          // Readiness event, see sc_sock_poll_event().
+ *      } else if (io->op == SC_SOCK_IO_RECV && io->len > 0) {
+ *          // 'io->len' bytes at 'io->buf'.
+ *      }
+ *  }
+ */
+enum sc_sock_io_op
+{
+	SC_SOCK_IO_NONE = 0,
+	SC_SOCK_IO_RECV = 1,
+	SC_SOCK_IO_SEND = 2,
+};
+
+struct sc_sock_io {
+	enum sc_sock_io_op op;
+	char *buf;
+	// Transferred bytes, '0' on end of stream for receive, negative errno
+	// on failure. Receive is stopped on end of stream or failure.
+	int len;
+};
+
+/**
+ * Start receiving, no-op if it is already started except updating 'data'.
+ *
+ * @param p    poll
+ * @param fdt  fdt
+ * @param data user data
+ * @return     '0' on success, negative number on failure,
+ *             call sc_sock_poll_err() to get error string
+ */
+int sc_sock_poll_recv_add(struct sc_sock_poll *p, struct sc_sock_fd *fdt,
+			  void *data);
+
+/**
+ * Stop receiving, no-op if it is not started.
+ *
+ * @param p   poll
+ * @param fdt fdt
+ * @return    '0' on success, negative number on failure,
+ *            call sc_sock_poll_err() to get error string
+ */
+int sc_sock_poll_recv_del(struct sc_sock_poll *p, struct sc_sock_fd *fdt);
+
+/**
+ * Queue a send.
+ *
+ * @param p    poll
+ * @param fdt  fdt
+ * @param buf  buf, must stay valid until the completion.
+ * @param len  len
+ * @param data user data
+ * @return     '0' on success, negative number on failure, errno is EBUSY if
+ *             a send is in flight. call sc_sock_poll_err() to get error
+ *             string
+ */
+int sc_sock_poll_send(struct sc_sock_poll *p, struct sc_sock_fd *fdt,
+		      char *buf, int len, void *data);
+
+/**
+ * @param p poll
+ * @param i event index
+ * @return  completion of the event at index 'i', NULL for readiness events.
+ */
+struct sc_sock_io *sc_sock_poll_io(struct sc_sock_poll *p, int i);
+
 /**
  * Get error string
  *
@@ -476,4 +1668,240 @@ uint32_t sc_sock_poll_event(struct sc_sock_poll *p, int i);
  */
 const char *sc_sock_poll_err(struct sc_sock_poll *p);
 
+#if !defined(_WIN32) && !defined(_WIN64)
+
+#include <pthread.h>
+
+/**
+ * SO_REUSEPORT listener group. Each reactor owns a listening socket bound to
+ * the same address and a sc_sock_poll, kernel distributes new connections
+ * between sockets, so reactors never share an accept queue.
+ *
+ * e.g.,
+ *  void reactor(struct sc_sock_reactor *r) {
+ *      struct sc_sock in[32];
+ *      void *data;
+ *      uint32_t events;
+ *
+ *      while (running) {
+ *          int n = sc_sock_poll_wait(&r->poll, 100);
+ *          sc_sock_poll_foreach (&r->poll, n, data, events) {
+ *              if (data == &r->sock) {
+ *                  int count = sc_sock_accept_batch(&r->sock, in, 32);
+ *                  // Handle new connections.
+ *              }
+ *          }
+ *      }
+ *  }
+ *
+ *  struct sc_sock_listener l;
+ *  sc_sock_listener_init(&l, 4, AF_INET, "0.0.0.0", "8080", false);
+ *  sc_sock_listener_start(&l, reactor, NULL);
+ *  ...
+ *  running = false;
+ *  sc_sock_listener_term(&l);
+ */
+struct sc_sock_listener;
+
+struct sc_sock_reactor {
+	int index;
+	// CPU the reactor thread is pinned to if steering, otherwise '-1'.
+	int cpu;
+	// Listening socket, registered to 'poll' with SC_SOCK_READ and 'sock'
+	// as user data.
+	struct sc_sock sock;
+	struct sc_sock_poll poll;
+	// User data passed to sc_sock_listener_start().
+	void *arg;
+
+	struct sc_sock_listener *listener;
+	pthread_t thread;
+	bool started;
+};
+
+struct sc_sock_listener {
+	int count;
+	bool steer;
+	struct sc_sock_reactor *reactors;
+	void (*fn)(struct sc_sock_reactor *r);
+	char err[128];
+};
+
+/**
+ * Create 'count' listening sockets with SO_REUSEPORT. If 'port' is "0", the
+ * port picked for the first socket is used for the rest.
+ *
+ * 'steer' is Linux only, 'count' must be equal to the CPU count in the
+ * process affinity mask. Reactor 'i' is pinned to the i'th CPU of the mask and
+ * a BPF program attached to the group selects the socket by the CPU the
+ * connection is received on. Combined with RSS / RPS, a connection is handled
+ * by the CPU that processed its packets.
+ *
+ * @param l      listener
+ * @param count  reactor count
+ * @param family AF_INET or AF_INET6
+ * @param host   host
+ * @param port   port
+ * @param steer  steer connections by CPU
+ * @return       '0' on success, negative number on failure.
+ *               call sc_sock_listener_err() for error string.
+ */
+int sc_sock_listener_init(struct sc_sock_listener *l, int count, int family,
+			  const char *host, const char *port, bool steer);
+
+/**
+ * Start a thread per reactor, each thread calls 'fn' with its reactor.
+ *
+ * @param l   listener
+ * @param fn  reactor function, thread exits when it returns.
+ * @param arg user data, accessible as 'r->arg'
+ * @return    '0' on success, negative number on failure.
+ *            call sc_sock_listener_err() for error string.
+ */
+int sc_sock_listener_start(struct sc_sock_listener *l,
+			   void (*fn)(struct sc_sock_reactor *r), void *arg);
+
+/**
+ * Join reactor threads, reactor functions must return before this call can
+ * complete. Closes listening sockets and polls.
+ *
+ * @param l listener
+ * @return  '0' on success, negative number on failure.
+ *          call sc_sock_listener_err() for error string.
+ */
+int sc_sock_listener_term(struct sc_sock_listener *l);
+
+/**
+ * @param l listener
+ * @return  last error string
+ */
+const char *sc_sock_listener_err(struct sc_sock_listener *l);
+
+/**
+ * Asynchronous name resolution. getaddrinfo() calls run on a thread pool and
+ * completions are signalled through a pipe, which can be registered to a
+ * sc_sock_poll. Successful results are cached for 'ttl' milliseconds.
+ *
+ * e.g.,
+ *  struct sc_sock_resolver r;
+ *  struct sc_sock_resolve req, *done;
+ *
+ *  sc_sock_resolver_init(&r, 2, 30000);
+ *  sc_sock_poll_add(&poll, &r.pipe.fdt, SC_SOCK_READ, &r);
+ *
+ *  if (sc_sock_resolve(&r, &req, "example.com", "80", NULL) == 1) {
+ *      // Resolved from the cache.
+ *  }
+ *
+ *  // On SC_SOCK_READ event of 'r'
+ *  while ((done = sc_sock_resolver_next(&r)) != NULL) {
+ *      if (done->rc == 0) {
+ *          sc_sock_connect_addr(&sock, &done->addrs[0], NULL, NULL);
+ *      }
+ *  }
+ */
+struct sc_sock_resolve {
+	char host[256];
+	char port[32];
+	// User data
+	void *data;
+	// '0' on success, otherwise getaddrinfo() error code, see
+	// sc_sock_resolve_err().
+	int rc;
+	// Addresses in getaddrinfo() order.
+	int count;
+	struct sc_sock_addr addrs[SC_SOCK_RESOLVE_MAX];
+
+	struct sc_sock_resolve *next;
+};
+
+struct sc_sock_resolver_entry {
+	char host[256];
+	char port[32];
+	uint64_t expiry;
+	int count;
+	struct sc_sock_addr addrs[SC_SOCK_RESOLVE_MAX];
+};
+
+struct sc_sock_resolver {
+	pthread_mutex_t mtx;
+	pthread_cond_t cond;
+	pthread_t *threads;
+	int count;
+	bool stop;
+	bool signalled;
+
+	struct sc_sock_resolve *pending;
+	struct sc_sock_resolve *pending_tail;
+	struct sc_sock_resolve *done;
+	struct sc_sock_resolve *done_tail;
+
+	uint64_t ttl;
+	int cache_size;
+	struct sc_sock_resolver_entry *cache;
+
+	// Readable when there are completed requests.
+	struct sc_sock_pipe pipe;
+	char err[128];
+};
+
+/**
+ * @param r       resolver
+ * @param threads thread count
+ * @param ttl     cache ttl in milliseconds, '0' to disable caching.
+ * @return        '0' on success, negative number on failure.
+ *                call sc_sock_resolver_err() for error string.
+ */
+int sc_sock_resolver_init(struct sc_sock_resolver *r, int threads,
+			  uint64_t ttl);
+
+/**
+ * Stop threads, in-flight requests are completed but not reported.
+ *
+ * @param r resolver
+ * @return  '0' on success, negative number on failure.
+ *          call sc_sock_resolver_err() for error string.
+ */
+int sc_sock_resolver_term(struct sc_sock_resolver *r);
+
+/**
+ * Start resolving 'host' and 'port'. 'req' must be valid until it is
+ * returned from sc_sock_resolver_next().
+ *
+ * @param r    resolver
+ * @param req  request
+ * @param host host
+ * @param port port
+ * @param data user data
+ * @return     - '1' if resolved from the cache, 'req' holds the result.
+ *             - '0' if request is queued.
+ *             - negative number on failure, call sc_sock_resolver_err()
+ *               for error string.
+ */
+int sc_sock_resolve(struct sc_sock_resolver *r, struct sc_sock_resolve *req,
+		    const char *host, const char *port, void *data);
+
+/**
+ * Pop a completed request. Call until it returns NULL when the pipe is
+ * readable.
+ *
+ * @param r resolver
+ * @return  completed request or NULL if there is none.
+ */
+struct sc_sock_resolve *sc_sock_resolver_next(struct sc_sock_resolver *r);
+
+/**
+ * @param req request
+ * @return    error string of a failed request
+ */
+const char *sc_sock_resolve_err(struct sc_sock_resolve *req);
+
+/**
+ * @param r resolver
+ * @return  last error string
+ */
+const char *sc_sock_resolver_err(struct sc_sock_resolver *r);
+
+#endif
+
 #endif
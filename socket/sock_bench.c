@@ -0,0 +1,1145 @@
+/**
+ * Loopback benchmark for sc_sock and sc_sock_poll.
+ *
+ * Server and client threads run in the same process, each thread has its own
+ * poll. Modes :
+ *  - echo   : client sends 'size' bytes, server replies with 'size' bytes.
+ *  - rr     : client sends 'size' bytes, server replies with 'resp' bytes.
+ *  - stream : client sends continuously, server only reads.
+ *
+ * Each connection keeps 'depth' requests in flight. Reports messages per
+ * second, latency percentiles and syscalls per message. Syscall counts are
+ * available only if sc_sock.c is compiled with -DSC_SOCK_STATS, bench target
+ * is built that way.
+ *
+ * e.g.,
+ *  sc_sock_bench -t tcp -m echo -s 64 -c 100 -p 4 -S 2 -C 2 -d 5
+ *  sc_sock_bench -t udp -m rr -s 32 -r 512 -c 1000
+ *  sc_sock_bench -t unix -m stream -s 4096 -b uring
+ */
+
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 700
+#endif
+
+#include "sc_sock.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_BUF       (64 * 1024)
+#define BENCH_UDP_MAX   65507
+#define BENCH_UDP_BATCH 32
+#define BENCH_UNIX_PATH "/tmp/sc_sock_bench.sock"
+#define BENCH_PORT      9400
+
+// Latency histogram, exact below 64 ns, then 32 sub-buckets per power of two.
+#define HIST_SUB  32
+#define HIST_SIZE (64 + 58 * HIST_SUB)
+
+enum bench_transport
+{
+	BENCH_TCP,
+	BENCH_UNIX,
+	BENCH_UDP,
+};
+
+enum bench_mode
+{
+	BENCH_ECHO,
+	BENCH_RR,
+	BENCH_STREAM,
+};
+
+struct bench_conf {
+	enum bench_transport transport;
+	enum bench_mode mode;
+	int size;
+	int resp;
+	int conns;
+	int depth;
+	int server_threads;
+	int client_threads;
+	int duration;
+	enum sc_sock_poll_backend backend;
+	int64_t spin_ns;
+};
+
+struct hist {
+	uint64_t total;
+	uint64_t count[HIST_SIZE];
+};
+
+struct bench_worker;
+
+struct bench_conn {
+	struct sc_sock sock;
+	struct bench_worker *w;
+	bool listener;
+	bool closed;
+	bool writing;
+
+	// Bytes received towards the next request or response.
+	int64_t partial;
+	// Bytes to send.
+	int64_t out;
+
+	// Client only, send timestamps of in flight requests.
+	uint64_t *sent;
+	int head;
+	int inflight;
+	uint64_t last;
+	struct sockaddr_storage dst;
+	socklen_t dst_len;
+};
+
+struct bench_worker {
+	struct bench *b;
+	pthread_t thread;
+	int index;
+	bool client;
+	struct sc_sock_poll poll;
+
+	// Client connections of this thread or the UDP socket of the server.
+	struct bench_conn *conns;
+	int count;
+
+	char *buf;
+	struct sc_sock_msg *msgs;
+
+	uint64_t msgs_done;
+	uint64_t lost;
+	uint64_t errors;
+	struct hist hist;
+};
+
+struct bench {
+	struct bench_conf conf;
+	int family;
+	const char *host;
+	char port[16];
+
+	struct bench_conn listener;
+	struct bench_conn *accepted;
+	int accepted_count;
+	int next_worker;
+
+	struct bench_worker *servers;
+	struct bench_worker *clients;
+
+	int go;
+	int stop;
+};
+
+static char zeros[BENCH_BUF];
+
+static uint64_t time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static int flag_get(int *flag)
+{
+	return __atomic_load_n(flag, __ATOMIC_ACQUIRE);
+}
+
+static void flag_set(int *flag, int val)
+{
+	__atomic_store_n(flag, val, __ATOMIC_RELEASE);
+}
+
+static int hist_index(uint64_t ns)
+{
+	int msb = 0, shift;
+
+	if (ns < 64) {
+		return (int) ns;
+	}
+
+	while (ns >> (msb + 1)) {
+		msb++;
+	}
+
+	shift = msb - 5;
+	return 64 + (shift - 1) * HIST_SUB + (int) ((ns >> shift) - HIST_SUB);
+}
+
+static uint64_t hist_value(int index)
+{
+	int i = index - 64;
+
+	if (index < 64) {
+		return (uint64_t) index;
+	}
+
+	return (uint64_t) (i % HIST_SUB + HIST_SUB) << (i / HIST_SUB + 1);
+}
+
+static void hist_add(struct hist *h, uint64_t ns)
+{
+	h->count[hist_index(ns)]++;
+	h->total++;
+}
+
+static void hist_merge(struct hist *dst, struct hist *src)
+{
+	for (int i = 0; i < HIST_SIZE; i++) {
+		dst->count[i] += src->count[i];
+	}
+
+	dst->total += src->total;
+}
+
+static double hist_percentile(struct hist *h, double q)
+{
+	uint64_t sum = 0;
+	uint64_t target = (uint64_t) (q * (double) h->total);
+
+	target = target == 0 ? 1 : target;
+
+	for (int i = 0; i < HIST_SIZE; i++) {
+		sum += h->count[i];
+		if (sum >= target) {
+			return (double) hist_value(i) / 1000.0;
+		}
+	}
+
+	return 0;
+}
+
+static void conn_close(struct bench_conn *c)
+{
+	if (c->closed) {
+		return;
+	}
+
+	sc_sock_poll_del(&c->w->poll, &c->sock.fdt,
+			 SC_SOCK_READ | SC_SOCK_WRITE, c);
+	sc_sock_term(&c->sock);
+	c->closed = true;
+	c->w->errors++;
+}
+
+// Sends pending bytes, enables write events if the socket buffer is full.
+static int conn_flush(struct bench_conn *c)
+{
+	int n, len;
+
+	while (c->out > 0) {
+		len = c->out < BENCH_BUF ? (int) c->out : BENCH_BUF;
+
+		n = sc_sock_send(&c->sock, zeros, len, 0);
+		if (n < 0) {
+			if (errno != EAGAIN) {
+				return -1;
+			}
+
+			if (!c->writing) {
+				c->writing = true;
+				return sc_sock_poll_add(&c->w->poll, &c->sock.fdt,
+							SC_SOCK_WRITE, c);
+			}
+
+			return 0;
+		}
+
+		c->out -= n;
+	}
+
+	if (c->writing) {
+		c->writing = false;
+		return sc_sock_poll_del(&c->w->poll, &c->sock.fdt,
+					SC_SOCK_WRITE, c);
+	}
+
+	return 0;
+}
+
+static void server_accept(struct bench *b)
+{
+	int n;
+	struct bench_conn *c;
+	struct bench_worker *w;
+	struct sc_sock in[64];
+
+	n = sc_sock_accept_batch(&b->listener.sock, in, 64);
+
+	for (int i = 0; i < n; i++) {
+		if (b->accepted_count == b->conf.conns) {
+			sc_sock_term(&in[i]);
+			continue;
+		}
+
+		w = &b->servers[b->next_worker++ % b->conf.server_threads];
+
+		c = &b->accepted[b->accepted_count++];
+		*c = (struct bench_conn){.sock = in[i], .w = w};
+
+		// epoll and kqueue allow adding fds from another thread.
+		if (sc_sock_poll_add(&w->poll, &c->sock.fdt, SC_SOCK_READ, c)) {
+			fprintf(stderr, "poll_add : %s \n",
+				sc_sock_poll_err(&w->poll));
+			conn_close(c);
+		}
+	}
+}
+
+static void server_read(struct bench_worker *w, struct bench_conn *c)
+{
+	int n;
+	int64_t reqs;
+	struct bench_conf *conf = &w->b->conf;
+
+	n = sc_sock_recv(&c->sock, w->buf, BENCH_BUF, 0);
+	if (n < 0) {
+		if (errno != EAGAIN) {
+			conn_close(c);
+		}
+		return;
+	}
+
+	c->partial += n;
+	reqs = c->partial / conf->size;
+	c->partial %= conf->size;
+
+	if (conf->mode == BENCH_STREAM) {
+		w->msgs_done += (uint64_t) reqs;
+		return;
+	}
+
+	c->out += reqs * conf->resp;
+
+	if (conn_flush(c) != 0) {
+		conn_close(c);
+	}
+}
+
+static void server_udp(struct bench_worker *w, struct bench_conn *c)
+{
+	int n;
+	struct bench_conf *conf = &w->b->conf;
+
+	for (int i = 0; i < BENCH_UDP_BATCH; i++) {
+		w->msgs[i] = (struct sc_sock_msg){
+			.buf = w->buf + i * (BENCH_UDP_MAX + 1),
+			.len = BENCH_UDP_MAX + 1,
+		};
+	}
+
+	n = sc_sock_recv_batch(&c->sock, w->msgs, BENCH_UDP_BATCH, 0);
+	if (n <= 0) {
+		return;
+	}
+
+	if (conf->mode == BENCH_STREAM) {
+		w->msgs_done += (uint64_t) n;
+		return;
+	}
+
+	for (int i = 0; i < n; i++) {
+		w->msgs[i].buf = zeros;
+		w->msgs[i].len = conf->resp;
+		w->msgs[i].segment_size = 0;
+	}
+
+	// Responses that don't fit into the socket buffer are dropped, clients
+	// send them again.
+	sc_sock_send_batch(&c->sock, w->msgs, n, 0);
+}
+
+static void *server_run(void *arg)
+{
+	int n;
+	uint32_t ev;
+	struct bench_conn *c;
+	struct bench_worker *w = arg;
+
+	while (!flag_get(&w->b->stop)) {
+		n = sc_sock_poll_wait(&w->poll, 10);
+		if (n < 0) {
+			fprintf(stderr, "poll : %s \n", sc_sock_poll_err(&w->poll));
+			break;
+		}
+
+		for (int i = 0; i < n; i++) {
+			c = sc_sock_poll_data(&w->poll, i);
+			ev = sc_sock_poll_event(&w->poll, i);
+
+			if (c->listener) {
+				server_accept(w->b);
+			} else if (w->b->conf.transport == BENCH_UDP) {
+				server_udp(w, c);
+			} else {
+				if ((ev & SC_SOCK_WRITE) && !c->closed &&
+				    conn_flush(c) != 0) {
+					conn_close(c);
+				}
+
+				if ((ev & SC_SOCK_READ) && !c->closed) {
+					server_read(w, c);
+				}
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static void client_push(struct bench_conn *c, uint64_t now)
+{
+	int depth = c->w->b->conf.depth;
+
+	c->sent[(c->head + c->inflight) % depth] = now;
+	c->inflight++;
+	c->last = now;
+}
+
+static int client_send_udp(struct bench_conn *c, int count)
+{
+	struct sc_sock_msg msgs[BENCH_UDP_BATCH];
+	struct bench_conf *conf = &c->w->b->conf;
+
+	count = count < BENCH_UDP_BATCH ? count : BENCH_UDP_BATCH;
+
+	for (int i = 0; i < count; i++) {
+		msgs[i] = (struct sc_sock_msg){
+			.buf = zeros,
+			.len = conf->size,
+			.addr = c->dst,
+			.addr_len = c->dst_len,
+		};
+	}
+
+	return sc_sock_send_batch(&c->sock, msgs, count, 0);
+}
+
+static void client_start(struct bench_conn *c)
+{
+	uint64_t now = time_ns();
+	struct bench_conf *conf = &c->w->b->conf;
+
+	if (conf->mode == BENCH_STREAM) {
+		c->out = INT64_MAX;
+		if (conf->transport == BENCH_UDP) {
+			sc_sock_poll_add(&c->w->poll, &c->sock.fdt,
+					 SC_SOCK_WRITE, c);
+		} else if (conn_flush(c) != 0) {
+			conn_close(c);
+		}
+		return;
+	}
+
+	c->inflight = 0;
+	for (int i = 0; i < conf->depth; i++) {
+		client_push(c, now);
+	}
+
+	if (conf->transport == BENCH_UDP) {
+		client_send_udp(c, conf->depth);
+		return;
+	}
+
+	c->out += (int64_t) conf->depth * conf->size;
+	if (conn_flush(c) != 0) {
+		conn_close(c);
+	}
+}
+
+static void client_done(struct bench_worker *w, struct bench_conn *c,
+			int64_t count)
+{
+	uint64_t now = time_ns();
+	int depth = w->b->conf.depth;
+
+	for (int64_t i = 0; i < count && c->inflight > 0; i++) {
+		hist_add(&w->hist, now - c->sent[c->head]);
+		c->head = (c->head + 1) % depth;
+		c->inflight--;
+		w->msgs_done++;
+
+		client_push(c, now);
+	}
+}
+
+static void client_read(struct bench_worker *w, struct bench_conn *c)
+{
+	int n;
+	int64_t resps;
+	struct bench_conf *conf = &w->b->conf;
+
+	n = sc_sock_recv(&c->sock, w->buf, BENCH_BUF, 0);
+	if (n < 0) {
+		if (errno != EAGAIN) {
+			conn_close(c);
+		}
+		return;
+	}
+
+	c->partial += n;
+	resps = c->partial / conf->resp;
+	c->partial %= conf->resp;
+
+	client_done(w, c, resps);
+
+	c->out += resps * conf->size;
+	if (conn_flush(c) != 0) {
+		conn_close(c);
+	}
+}
+
+static void client_udp(struct bench_worker *w, struct bench_conn *c,
+		       uint32_t ev)
+{
+	int n;
+
+	if (w->b->conf.mode == BENCH_STREAM) {
+		if (ev & SC_SOCK_WRITE) {
+			client_send_udp(c, BENCH_UDP_BATCH);
+		}
+		return;
+	}
+
+	for (int i = 0; i < BENCH_UDP_BATCH; i++) {
+		w->msgs[i] = (struct sc_sock_msg){
+			.buf = w->buf + i * (BENCH_UDP_MAX + 1),
+			.len = BENCH_UDP_MAX + 1,
+		};
+	}
+
+	n = sc_sock_recv_batch(&c->sock, w->msgs, BENCH_UDP_BATCH, 0);
+	if (n <= 0) {
+		return;
+	}
+
+	client_done(w, c, n);
+	client_send_udp(c, n);
+}
+
+// Lost datagrams leave requests in flight forever, send them again.
+static void client_udp_check(struct bench_worker *w, uint64_t now)
+{
+	struct bench_conn *c;
+
+	for (int i = 0; i < w->count; i++) {
+		c = &w->conns[i];
+		if (c->inflight > 0 && now - c->last > 200 * 1000000ull) {
+			w->lost += (uint64_t) c->inflight;
+			client_start(c);
+		}
+	}
+}
+
+static void *client_run(void *arg)
+{
+	int n;
+	uint32_t ev;
+	uint64_t now, check = 0;
+	struct bench_conn *c;
+	struct bench_worker *w = arg;
+	struct bench *b = w->b;
+
+	struct timespec ts = {.tv_nsec = 1000000};
+
+	while (!flag_get(&b->go)) {
+		nanosleep(&ts, NULL);
+	}
+
+	for (int i = 0; i < w->count; i++) {
+		client_start(&w->conns[i]);
+	}
+
+	while (!flag_get(&b->stop)) {
+		n = sc_sock_poll_wait(&w->poll, 10);
+		if (n < 0) {
+			fprintf(stderr, "poll : %s \n", sc_sock_poll_err(&w->poll));
+			break;
+		}
+
+		for (int i = 0; i < n; i++) {
+			c = sc_sock_poll_data(&w->poll, i);
+			ev = sc_sock_poll_event(&w->poll, i);
+
+			if (c->closed) {
+				continue;
+			}
+
+			if (b->conf.transport == BENCH_UDP) {
+				client_udp(w, c, ev);
+				continue;
+			}
+
+			if ((ev & SC_SOCK_WRITE) && conn_flush(c) != 0) {
+				conn_close(c);
+			}
+
+			if ((ev & SC_SOCK_READ) && !c->closed) {
+				client_read(w, c);
+			}
+		}
+
+		if (b->conf.transport == BENCH_UDP &&
+		    b->conf.mode != BENCH_STREAM) {
+			now = time_ns();
+			if (now - check > 100 * 1000000ull) {
+				client_udp_check(w, now);
+				check = now;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static int worker_init(struct bench *b, struct bench_worker *w, int index,
+		       bool client)
+{
+	size_t size = b->conf.transport == BENCH_UDP ?
+			      (size_t) BENCH_UDP_BATCH * (BENCH_UDP_MAX + 1) :
+			      BENCH_BUF;
+
+	struct sc_sock_poll_conf conf = {
+		.backend = b->conf.backend,
+		.spin_ns = b->conf.spin_ns,
+	};
+
+	*w = (struct bench_worker){.b = b, .index = index, .client = client};
+
+	w->buf = malloc(size);
+	w->msgs = calloc(BENCH_UDP_BATCH, sizeof(*w->msgs));
+	if (w->buf == NULL || w->msgs == NULL) {
+		fprintf(stderr, "Out of memory \n");
+		return -1;
+	}
+
+	if (sc_sock_poll_init_conf(&w->poll, &conf) != 0) {
+		fprintf(stderr, "poll_init : %s \n", sc_sock_poll_err(&w->poll));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int server_init(struct bench *b)
+{
+	int rc;
+	char port[16];
+	struct bench_worker *w;
+	struct bench_conn *l = &b->listener;
+
+	for (int i = 0; i < b->conf.server_threads; i++) {
+		w = &b->servers[i];
+		if (worker_init(b, w, i, false) != 0) {
+			return -1;
+		}
+
+		if (b->conf.transport != BENCH_UDP) {
+			continue;
+		}
+
+		// A UDP socket per thread on consecutive ports.
+		w->conns = calloc(1, sizeof(*w->conns));
+		if (w->conns == NULL) {
+			return -1;
+		}
+
+		w->count = 1;
+		w->conns[0].w = w;
+		snprintf(port, sizeof(port), "%d", BENCH_PORT + i);
+
+		sc_sock_init(&w->conns[0].sock, 0, false, SC_SOCK_INET);
+		rc = sc_sock_udp_bind(&w->conns[0].sock, b->host, port);
+		if (rc != 0) {
+			fprintf(stderr, "udp_bind : %s \n",
+				sc_sock_error(&w->conns[0].sock));
+			return -1;
+		}
+
+		rc = sc_sock_poll_add(&w->poll, &w->conns[0].sock.fdt,
+				      SC_SOCK_READ, &w->conns[0]);
+		if (rc != 0) {
+			return -1;
+		}
+	}
+
+	if (b->conf.transport == BENCH_UDP) {
+		return 0;
+	}
+
+	b->accepted = calloc((size_t) b->conf.conns, sizeof(*b->accepted));
+	if (b->accepted == NULL) {
+		fprintf(stderr, "Out of memory \n");
+		return -1;
+	}
+
+	*l = (struct bench_conn){.listener = true, .w = &b->servers[0]};
+	sc_sock_init(&l->sock, 0, false, b->family);
+
+	rc = sc_sock_listen(&l->sock, b->host,
+			    b->family == SC_SOCK_UNIX ? NULL : b->port);
+	if (rc != 0) {
+		fprintf(stderr, "listen : %s \n", sc_sock_error(&l->sock));
+		return -1;
+	}
+
+	// Unix domain sockets are created in blocking mode.
+	rc = sc_sock_set_blocking(&l->sock, false);
+	if (rc != 0) {
+		return -1;
+	}
+
+	return sc_sock_poll_add(&b->servers[0].poll, &l->sock.fdt, SC_SOCK_READ,
+				l);
+}
+
+static int client_connect(struct bench *b, struct bench_conn *c, int index)
+{
+	int rc;
+	char src[32];
+	const char *src_addr = NULL;
+	struct bench_conn *srv;
+
+	if (b->conf.transport == BENCH_UDP) {
+		srv = &b->servers[index % b->conf.server_threads].conns[0];
+		c->dst_len = sizeof(c->dst);
+
+		sc_sock_init(&c->sock, 0, false, SC_SOCK_INET);
+		rc = getsockname(srv->sock.fdt.fd, (struct sockaddr *) &c->dst,
+				 &c->dst_len);
+		if (rc != 0) {
+			return -1;
+		}
+
+		return sc_sock_udp_bind(&c->sock, b->host, "0");
+	}
+
+	// Spread source addresses to avoid running out of ephemeral ports.
+	if (b->family == SC_SOCK_INET && b->conf.conns > 20000) {
+		snprintf(src, sizeof(src), "127.0.%d.%d", (index / 20000) / 250,
+			 (index / 20000) % 250 + 1);
+		src_addr = src;
+	}
+
+	sc_sock_init(&c->sock, 0, true, b->family);
+	rc = sc_sock_connect(&c->sock, b->host,
+			     b->family == SC_SOCK_UNIX ? NULL : b->port,
+			     src_addr, NULL);
+	if (rc != 0) {
+		return -1;
+	}
+
+	rc = sc_sock_set_blocking(&c->sock, false);
+	if (rc != 0) {
+		return -1;
+	}
+	c->sock.blocking = false;
+
+	return 0;
+}
+
+static int client_init(struct bench *b)
+{
+	int rc, count, index = 0;
+	struct bench_worker *w;
+	struct bench_conn *c;
+
+	for (int i = 0; i < b->conf.client_threads; i++) {
+		w = &b->clients[i];
+		if (worker_init(b, w, i, true) != 0) {
+			return -1;
+		}
+
+		count = b->conf.conns / b->conf.client_threads;
+		count += i < b->conf.conns % b->conf.client_threads;
+
+		w->conns = calloc((size_t) count, sizeof(*w->conns));
+		if (w->conns == NULL) {
+			fprintf(stderr, "Out of memory \n");
+			return -1;
+		}
+
+		for (int j = 0; j < count; j++) {
+			c = &w->conns[j];
+			c->w = w;
+			w->count++;
+
+			c->sent = calloc((size_t) b->conf.depth, sizeof(uint64_t));
+			if (c->sent == NULL) {
+				fprintf(stderr, "Out of memory \n");
+				return -1;
+			}
+
+			rc = client_connect(b, c, index++);
+			if (rc != 0) {
+				fprintf(stderr, "connect (%d) : %s \n", index,
+					sc_sock_error(&c->sock));
+				return -1;
+			}
+
+			rc = sc_sock_poll_add(&w->poll, &c->sock.fdt,
+					      SC_SOCK_READ, c);
+			if (rc != 0) {
+				fprintf(stderr, "poll_add : %s \n",
+					sc_sock_poll_err(&w->poll));
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static void worker_term(struct bench_worker *w)
+{
+	for (int i = 0; i < w->count; i++) {
+		if (!w->conns[i].closed) {
+			sc_sock_term(&w->conns[i].sock);
+		}
+		free(w->conns[i].sent);
+	}
+
+	sc_sock_poll_term(&w->poll);
+	free(w->conns);
+	free(w->buf);
+	free(w->msgs);
+}
+
+static uint64_t sock_calls(struct sc_sock *s)
+{
+	uint64_t calls = 0;
+	struct sc_sock_stats st;
+
+	sc_sock_stats(s, &st, false);
+	for (int i = 0; i < SC_SOCK_CALL_MAX; i++) {
+		calls += st.calls[i];
+	}
+
+	return calls;
+}
+
+static uint64_t worker_calls(struct bench_worker *w)
+{
+	uint64_t calls = 0;
+	struct sc_sock_poll_stats ps;
+
+	sc_sock_poll_stats(&w->poll, &ps, false);
+	calls += ps.waits;
+
+	for (int i = 0; i < w->count; i++) {
+		calls += sock_calls(&w->conns[i].sock);
+	}
+
+	return calls;
+}
+
+static void report(struct bench *b, double secs)
+{
+	uint64_t msgs = 0, lost = 0, errors = 0;
+	uint64_t client_calls = 0, server_calls = 0;
+	double per_msg;
+	struct hist *h;
+	struct bench_conf *conf = &b->conf;
+	const char *transports[] = {"tcp", "unix", "udp"};
+	const char *modes[] = {"echo", "rr", "stream"};
+
+	h = calloc(1, sizeof(*h));
+	if (h == NULL) {
+		return;
+	}
+
+	for (int i = 0; i < conf->client_threads; i++) {
+		hist_merge(h, &b->clients[i].hist);
+		client_calls += worker_calls(&b->clients[i]);
+		lost += b->clients[i].lost;
+		errors += b->clients[i].errors;
+		msgs += b->clients[i].msgs_done;
+	}
+
+	for (int i = 0; i < conf->server_threads; i++) {
+		server_calls += worker_calls(&b->servers[i]);
+		errors += b->servers[i].errors;
+		if (conf->mode == BENCH_STREAM) {
+			msgs += b->servers[i].msgs_done;
+		}
+	}
+
+	for (int i = 0; i < b->accepted_count; i++) {
+		server_calls += sock_calls(&b->accepted[i].sock);
+	}
+
+	server_calls += sock_calls(&b->listener.sock);
+	per_msg = msgs ? 1.0 / (double) msgs : 0;
+
+	printf("transport=%s mode=%s size=%d resp=%d conns=%d depth=%d "
+	       "threads=%d/%d duration=%.2fs\n",
+	       transports[conf->transport], modes[conf->mode], conf->size,
+	       conf->mode == BENCH_STREAM ? 0 : conf->resp, conf->conns,
+	       conf->depth, conf->server_threads, conf->client_threads, secs);
+	printf("msgs/sec     : %.0f\n", (double) msgs / secs);
+	printf("MB/sec       : %.2f\n",
+	       (double) msgs * conf->size / secs / (1024 * 1024));
+
+	if (conf->mode != BENCH_STREAM) {
+		printf("latency (us) : p50 %.2f, p99 %.2f, p999 %.2f\n",
+		       hist_percentile(h, 0.50), hist_percentile(h, 0.99),
+		       hist_percentile(h, 0.999));
+	}
+
+#ifdef SC_SOCK_STATS
+	printf("syscalls/msg : client %.3f, server %.3f\n",
+	       (double) client_calls * per_msg,
+	       (double) server_calls * per_msg);
+#else
+	(void) per_msg;
+	printf("syscalls/msg : not available, build with -DSC_SOCK_STATS\n");
+#endif
+
+	if (lost || errors) {
+		printf("lost         : %llu, errors : %llu\n",
+		       (unsigned long long) lost, (unsigned long long) errors);
+	}
+
+	free(h);
+}
+
+static void usage(void)
+{
+	printf("usage : sc_sock_bench [options]\n"
+	       "  -t tcp|unix|udp   transport (tcp)\n"
+	       "  -m echo|rr|stream mode (echo)\n"
+	       "  -s bytes          request size (64)\n"
+	       "  -r bytes          response size for rr mode (64)\n"
+	       "  -c count          connections (1)\n"
+	       "  -p depth          requests in flight per connection (1)\n"
+	       "  -S threads        server threads (1)\n"
+	       "  -C threads        client threads (1)\n"
+	       "  -d seconds        duration (5)\n"
+	       "  -b epoll|uring    poll backend (epoll/kqueue)\n"
+	       "  -y ns             busy poll budget (0)\n");
+}
+
+static int parse(struct bench_conf *conf, int argc, char *argv[])
+{
+	int c;
+
+	*conf = (struct bench_conf){
+		.size = 64,
+		.resp = -1,
+		.conns = 1,
+		.depth = 1,
+		.server_threads = 1,
+		.client_threads = 1,
+		.duration = 5,
+	};
+
+	while ((c = getopt(argc, argv, "t:m:s:r:c:p:S:C:d:b:y:h")) != -1) {
+		switch (c) {
+		case 't':
+			if (strcmp(optarg, "tcp") == 0) {
+				conf->transport = BENCH_TCP;
+			} else if (strcmp(optarg, "unix") == 0) {
+				conf->transport = BENCH_UNIX;
+			} else if (strcmp(optarg, "udp") == 0) {
+				conf->transport = BENCH_UDP;
+			} else {
+				return -1;
+			}
+			break;
+		case 'm':
+			if (strcmp(optarg, "echo") == 0) {
+				conf->mode = BENCH_ECHO;
+			} else if (strcmp(optarg, "rr") == 0) {
+				conf->mode = BENCH_RR;
+			} else if (strcmp(optarg, "stream") == 0) {
+				conf->mode = BENCH_STREAM;
+			} else {
+				return -1;
+			}
+			break;
+		case 's':
+			conf->size = atoi(optarg);
+			break;
+		case 'r':
+			conf->resp = atoi(optarg);
+			break;
+		case 'c':
+			conf->conns = atoi(optarg);
+			break;
+		case 'p':
+			conf->depth = atoi(optarg);
+			break;
+		case 'S':
+			conf->server_threads = atoi(optarg);
+			break;
+		case 'C':
+			conf->client_threads = atoi(optarg);
+			break;
+		case 'd':
+			conf->duration = atoi(optarg);
+			break;
+		case 'b':
+			if (strcmp(optarg, "uring") == 0) {
+				conf->backend = SC_SOCK_POLL_URING;
+			} else if (strcmp(optarg, "epoll") != 0) {
+				return -1;
+			}
+			break;
+		case 'y':
+			conf->spin_ns = atoll(optarg);
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	if (conf->resp < 0 || conf->mode == BENCH_ECHO) {
+		conf->resp = conf->size;
+	}
+
+	if (conf->size <= 0 || conf->resp <= 0 || conf->conns <= 0 ||
+	    conf->depth <= 0 || conf->server_threads <= 0 ||
+	    conf->client_threads <= 0 || conf->duration <= 0) {
+		return -1;
+	}
+
+	if (conf->transport == BENCH_UDP &&
+	    (conf->size > BENCH_UDP_MAX || conf->resp > BENCH_UDP_MAX)) {
+		fprintf(stderr, "UDP message size must be <= %d \n",
+			BENCH_UDP_MAX);
+		return -1;
+	}
+
+	return 0;
+}
+
+// Each connection needs two descriptors as both sides are in this process.
+static int raise_fd_limit(int conns)
+{
+	struct rlimit lim;
+	rlim_t need = (rlim_t) conns * 2 + 256;
+
+	if (getrlimit(RLIMIT_NOFILE, &lim) != 0) {
+		return -1;
+	}
+
+	if (lim.rlim_cur < need) {
+		lim.rlim_cur = lim.rlim_max < need ? lim.rlim_max : need;
+		setrlimit(RLIMIT_NOFILE, &lim);
+	}
+
+	if (lim.rlim_cur < need) {
+		fprintf(stderr, "Need %llu file descriptors, raise 'ulimit -n' \n",
+			(unsigned long long) need);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int rc = 1;
+	uint64_t start;
+	double secs;
+	struct bench *b;
+
+	b = calloc(1, sizeof(*b));
+	if (b == NULL) {
+		return 1;
+	}
+
+	sc_sock_init(&b->listener.sock, 0, false, SC_SOCK_INET);
+
+	if (parse(&b->conf, argc, argv) != 0) {
+		usage();
+		goto out;
+	}
+
+	if (raise_fd_limit(b->conf.conns) != 0) {
+		goto out;
+	}
+
+	b->family = SC_SOCK_INET;
+	b->host = "127.0.0.1";
+	snprintf(b->port, sizeof(b->port), "%d", BENCH_PORT);
+
+	if (b->conf.transport == BENCH_UNIX) {
+		b->family = SC_SOCK_UNIX;
+		b->host = BENCH_UNIX_PATH;
+	}
+
+	b->servers = calloc((size_t) b->conf.server_threads, sizeof(*b->servers));
+	b->clients = calloc((size_t) b->conf.client_threads, sizeof(*b->clients));
+	if (b->servers == NULL || b->clients == NULL) {
+		goto out;
+	}
+
+	if (server_init(b) != 0) {
+		goto out;
+	}
+
+	for (int i = 0; i < b->conf.server_threads; i++) {
+		pthread_create(&b->servers[i].thread, NULL, server_run,
+			       &b->servers[i]);
+	}
+
+	if (client_init(b) == 0) {
+		for (int i = 0; i < b->conf.client_threads; i++) {
+			pthread_create(&b->clients[i].thread, NULL, client_run,
+				       &b->clients[i]);
+		}
+
+		start = time_ns();
+		flag_set(&b->go, 1);
+		sleep((unsigned int) b->conf.duration);
+		flag_set(&b->stop, 1);
+		secs = (double) (time_ns() - start) / 1e9;
+
+		for (int i = 0; i < b->conf.client_threads; i++) {
+			pthread_join(b->clients[i].thread, NULL);
+		}
+
+		for (int i = 0; i < b->conf.server_threads; i++) {
+			pthread_join(b->servers[i].thread, NULL);
+		}
+
+		report(b, secs);
+		rc = 0;
+	} else {
+		flag_set(&b->stop, 1);
+		for (int i = 0; i < b->conf.server_threads; i++) {
+			pthread_join(b->servers[i].thread, NULL);
+		}
+	}
+
+out:
+	for (int i = 0; b->clients && i < b->conf.client_threads; i++) {
+		worker_term(&b->clients[i]);
+	}
+
+	for (int i = 0; i < b->accepted_count; i++) {
+		if (!b->accepted[i].closed) {
+			sc_sock_term(&b->accepted[i].sock);
+		}
+	}
+
+	for (int i = 0; b->servers && i < b->conf.server_threads; i++) {
+		worker_term(&b->servers[i]);
+	}
+
+	sc_sock_term(&b->listener.sock);
+	free(b->accepted);
+	free(b->servers);
+	free(b->clients);
+	free(b);
+
+	return rc;
+}
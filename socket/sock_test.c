@@ -1,3 +1,7 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #ifndef _XOPEN_SOURCE
 #define _XOPEN_SOURCE 700
 #endif
@@ -26,6 +30,7 @@ struct sc_thread {
 
 #else
 
+#include <arpa/inet.h>
 #include <fcntl.h>
 #include <pthread.h>
 #include <stdarg.h>
@@ -1979,6 +1984,1673 @@ void test_poll_multithreaded_accept(void)
 	assert(rc == 0);
 }
 
+void test_poll_uring(void)
+{
+	char c;
+	int n, data[100];
+	struct sc_sock_poll p;
+	struct sc_sock_pipe pipe[100];
+	struct sc_sock_poll_conf conf = {.backend = SC_SOCK_POLL_URING};
+
+	if (sc_sock_poll_init_conf(&p, &conf) != 0) {
+#if defined(__linux__)
+		printf("io_uring is not available : %s \n", sc_sock_poll_err(&p));
+#endif
+		return;
+	}
+
+	for (int i = 0; i < 100; i++) {
+		data[i] = i;
+		assert(sc_sock_pipe_init(&pipe[i], 0) == 0);
+		assert(sc_sock_poll_add(&p, &pipe[i].fdt, SC_SOCK_READ,
+					&data[i]) == 0);
+	}
+
+	assert(sc_sock_poll_wait(&p, 0) == 0);
+	assert(sc_sock_poll_wait(&p, 10) == 0);
+	assert(sc_sock_poll_wait_ns(&p, 100000) == 0);
+
+	// Level-triggered, event must be reported until data is consumed.
+	assert(sc_sock_pipe_write(&pipe[7], "x", 1) == 1);
+	for (int i = 0; i < 3; i++) {
+		assert(sc_sock_poll_wait(&p, -1) == 1);
+		assert(sc_sock_poll_data(&p, 0) == &data[7]);
+		assert(sc_sock_poll_event(&p, 0) == SC_SOCK_READ);
+	}
+
+	assert(sc_sock_pipe_read(&pipe[7], &c, 1) == 1);
+	assert(sc_sock_poll_wait(&p, 10) == 0);
+
+	// Removed fds must not report events.
+	assert(sc_sock_poll_del(&p, &pipe[7].fdt, SC_SOCK_READ, &data[7]) == 0);
+	assert(sc_sock_poll_del(&p, &pipe[7].fdt, SC_SOCK_READ, &data[7]) == 0);
+	assert(sc_sock_pipe_write(&pipe[7], "x", 1) == 1);
+	assert(sc_sock_poll_wait(&p, 10) == 0);
+	assert(sc_sock_pipe_read(&pipe[7], &c, 1) == 1);
+
+	// Edge-triggered, event must be reported once per new data.
+	assert(sc_sock_poll_add(&p, &pipe[7].fdt, SC_SOCK_READ | SC_SOCK_EDGE,
+				&data[7]) == 0);
+	assert(sc_sock_pipe_write(&pipe[7], "x", 1) == 1);
+	assert(sc_sock_poll_wait(&p, -1) == 1);
+	assert(sc_sock_poll_data(&p, 0) == &data[7]);
+	assert(sc_sock_poll_wait(&p, 10) == 0);
+	assert(sc_sock_pipe_write(&pipe[7], "x", 1) == 1);
+	assert(sc_sock_poll_wait(&p, -1) == 1);
+	assert(sc_sock_poll_data(&p, 0) == &data[7]);
+
+	// Back to level-triggered mode.
+	assert(sc_sock_poll_del(&p, &pipe[7].fdt, SC_SOCK_EDGE, &data[7]) == 0);
+	assert(sc_sock_poll_wait(&p, -1) == 1);
+	assert(sc_sock_poll_wait(&p, -1) == 1);
+	assert(sc_sock_pipe_read(&pipe[7], &c, 1) == 1);
+	assert(sc_sock_pipe_read(&pipe[7], &c, 1) == 1);
+
+	for (int i = 0; i < 100; i++) {
+		assert(sc_sock_pipe_write(&pipe[i], "x", 1) == 1);
+	}
+
+	n = 0;
+	while (n < 100) {
+		int count = sc_sock_poll_wait(&p, -1);
+		assert(count > 0);
+
+		for (int i = 0; i < count; i++) {
+			int *d = sc_sock_poll_data(&p, i);
+			assert(sc_sock_poll_event(&p, i) == SC_SOCK_READ);
+			assert(sc_sock_pipe_read(&pipe[*d], &c, 1) == 1);
+			n++;
+		}
+	}
+	assert(sc_sock_poll_wait(&p, 10) == 0);
+
+	for (int i = 0; i < 100; i++) {
+		assert(sc_sock_poll_del(&p, &pipe[i].fdt, SC_SOCK_READ,
+					&data[i]) == 0);
+		assert(sc_sock_pipe_term(&pipe[i]) == 0);
+	}
+
+	assert(sc_sock_poll_term(&p) == 0);
+	assert(sc_sock_poll_term(&p) == 0);
+
+	conf.backend = SC_SOCK_POLL_DEFAULT;
+	assert(sc_sock_poll_init_conf(&p, &conf) == 0);
+	assert(sc_sock_poll_term(&p) == 0);
+}
+
+void test_poll_conf(void)
+{
+	char c;
+	int n, found, data[5];
+	uint32_t events;
+	void *ptr;
+	uint64_t mask = 0;
+	struct sc_sock_poll p;
+	struct sc_sock_pipe pipe[5];
+	struct sc_sock_poll_conf conf = {.max_events = 2};
+
+	assert(sc_sock_poll_init_conf(&p, &conf) == 0);
+
+	for (int i = 0; i < 5; i++) {
+		data[i] = i;
+		assert(sc_sock_pipe_init(&pipe[i], 0) == 0);
+		assert(sc_sock_poll_add(&p, &pipe[i].fdt, SC_SOCK_READ,
+					&data[i]) == 0);
+	}
+
+	assert(sc_sock_poll_wait_ns(&p, 0) == 0);
+	assert(sc_sock_poll_wait_ns(&p, 100000) == 0);
+
+	for (int i = 0; i < 5; i++) {
+		assert(sc_sock_pipe_write(&pipe[i], "x", 1) == 1);
+	}
+
+	found = 0;
+	while (found < 5) {
+		n = sc_sock_poll_wait_ns(&p, -1);
+		assert(n > 0 && n <= 2);
+
+		sc_sock_poll_foreach (&p, n, ptr, events) {
+			int *d = ptr;
+
+			assert(events == SC_SOCK_READ);
+			assert(sc_sock_pipe_read(&pipe[*d], &c, 1) == 1);
+			mask |= 1u << *d;
+			found++;
+		}
+	}
+
+	assert(mask == 0x1f);
+	assert(sc_sock_poll_wait(&p, 0) == 0);
+
+	// 'break' must stop the iteration.
+	assert(sc_sock_pipe_write(&pipe[0], "x", 1) == 1);
+	assert(sc_sock_pipe_write(&pipe[1], "x", 1) == 1);
+	n = sc_sock_poll_wait(&p, -1);
+	found = 0;
+	sc_sock_poll_foreach (&p, n, ptr, events) {
+		found++;
+		break;
+	}
+	assert(found == 1);
+
+	for (int i = 0; i < 5; i++) {
+		assert(sc_sock_poll_del(&p, &pipe[i].fdt, SC_SOCK_READ,
+					&data[i]) == 0);
+		assert(sc_sock_pipe_term(&pipe[i]) == 0);
+	}
+
+	assert(sc_sock_poll_term(&p) == 0);
+	assert(sc_sock_poll_wait_ns(&p, 0) == -1);
+}
+
+void test_udp_batch(void)
+{
+	int n, total;
+	char bufs[32][64];
+	char big[3000];
+	struct sockaddr_storage dst;
+	socklen_t dst_len = sizeof(dst);
+	struct sc_sock rcv, snd;
+	struct sc_sock_msg msgs[100];
+#if defined(__linux__)
+	struct sc_sock_poll p;
+#endif
+
+	sc_sock_init(&rcv, 0, false, SC_SOCK_INET);
+	sc_sock_init(&snd, 0, false, SC_SOCK_INET);
+	assert(sc_sock_udp_bind(&rcv, "127.0.0.1", "8010") == 0);
+	assert(sc_sock_udp_bind(&snd, "127.0.0.1", "8011") == 0);
+	assert(getsockname(rcv.fdt.fd, (struct sockaddr *) &dst, &dst_len) == 0);
+
+	for (int i = 0; i < 32; i++) {
+		msgs[i] = (struct sc_sock_msg){.buf = bufs[i], .len = 64};
+	}
+
+	assert(sc_sock_recv_batch(&rcv, msgs, 32, 0) == -1);
+	assert(errno == EAGAIN);
+
+	for (int i = 0; i < 100; i++) {
+		msgs[i] = (struct sc_sock_msg){
+			.buf = big,
+			.len = 10,
+			.addr = dst,
+			.addr_len = dst_len,
+		};
+		snprintf(big + (i % 10) * 10, 10, "msg");
+	}
+	assert(sc_sock_send_batch(&snd, msgs, 100, 0) == 100);
+
+	total = 0;
+	while (total < 100) {
+		for (int i = 0; i < 32; i++) {
+			msgs[i] = (struct sc_sock_msg){.buf = bufs[i], .len = 64};
+		}
+
+		n = sc_sock_recv_batch(&rcv, msgs, 32, 0);
+		assert(n > 0 && n <= 32);
+
+		for (int i = 0; i < n; i++) {
+			struct sockaddr_in *src = (void *) &msgs[i].addr;
+
+			assert(msgs[i].len == 10);
+			assert(msgs[i].segment_size == 0);
+			assert(strcmp(msgs[i].buf, "msg") == 0);
+			assert(ntohs(src->sin_port) == 8011);
+		}
+
+		total += n;
+	}
+	assert(total == 100);
+	assert(sc_sock_recv_batch(&rcv, msgs, 32, 0) == -1);
+
+#if defined(__linux__)
+	// Datagrams might not be queued yet, wait for them with a timeout.
+	assert(sc_sock_poll_init(&p) == 0);
+	assert(sc_sock_poll_add(&p, &rcv.fdt, SC_SOCK_READ, &rcv) == 0);
+
+	// GSO, one buffer is sent as three datagrams.
+	memset(big, 'x', sizeof(big));
+	msgs[0] = (struct sc_sock_msg){
+		.buf = big,
+		.len = 3000,
+		.segment_size = 1000,
+		.addr = dst,
+		.addr_len = dst_len,
+	};
+
+	if (sc_sock_send_batch(&snd, msgs, 1, 0) == 1) {
+		total = 0;
+		while (total < 3000) {
+			for (int i = 0; i < 32; i++) {
+				msgs[i] = (struct sc_sock_msg){
+					.buf = big,
+					.len = sizeof(big),
+				};
+			}
+
+			n = sc_sock_recv_batch(&rcv, msgs, 32, 0);
+			if (n == -1) {
+				assert(errno == EAGAIN);
+				assert(sc_sock_poll_wait(&p, 1000) == 1);
+				continue;
+			}
+
+			for (int i = 0; i < n; i++) {
+				assert(msgs[i].len == 1000);
+				total += msgs[i].len;
+			}
+		}
+	} else {
+		printf("UDP GSO is not available : %s \n", sc_sock_error(&snd));
+	}
+
+	// GRO, datagrams may be received in a single buffer.
+	if (sc_sock_set_udp_gro(&rcv, true) == 0) {
+		msgs[0] = (struct sc_sock_msg){
+			.buf = big,
+			.len = 3000,
+			.segment_size = 1000,
+			.addr = dst,
+			.addr_len = dst_len,
+		};
+		assert(sc_sock_send_batch(&snd, msgs, 1, 0) == 1);
+
+		total = 0;
+		while (total < 3000) {
+			msgs[0] = (struct sc_sock_msg){
+				.buf = big,
+				.len = sizeof(big),
+			};
+
+			n = sc_sock_recv_batch(&rcv, msgs, 1, 0);
+			if (n == -1) {
+				assert(errno == EAGAIN);
+				assert(sc_sock_poll_wait(&p, 1000) == 1);
+				continue;
+			}
+
+			assert(msgs[0].segment_size == 0 ||
+			       msgs[0].segment_size == 1000);
+			total += msgs[0].len;
+		}
+		assert(total == 3000);
+	}
+
+	assert(sc_sock_poll_term(&p) == 0);
+#endif
+
+	assert(sc_sock_term(&rcv) == 0);
+	assert(sc_sock_term(&snd) == 0);
+
+	sc_sock_init(&rcv, 0, false, SC_SOCK_INET);
+	assert(sc_sock_udp_bind(&rcv, "127.0.0.1x", "8010") != 0);
+	assert(sc_sock_send_batch(&rcv, msgs, 1, 0) == -1);
+	assert(sc_sock_recv_batch(&rcv, msgs, 1, 0) == -1);
+	assert(*sc_sock_error(&rcv) != '\0');
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+
+struct listener_state {
+	pthread_mutex_t mtx;
+	bool stop;
+	int accepted[4];
+};
+
+static void listener_reactor(struct sc_sock_reactor *r)
+{
+	int n, count;
+	bool stop = false;
+	void *data;
+	uint32_t events;
+	struct sc_sock in[8];
+	struct listener_state *st = r->arg;
+
+	while (!stop) {
+		n = sc_sock_poll_wait(&r->poll, 10);
+		assert(n >= 0);
+
+		sc_sock_poll_foreach (&r->poll, n, data, events) {
+			assert(data == &r->sock);
+			assert(events == SC_SOCK_READ);
+
+			count = sc_sock_accept_batch(&r->sock, in, 8);
+			if (count < 0) {
+				assert(errno == EAGAIN);
+				continue;
+			}
+
+			for (int i = 0; i < count; i++) {
+				assert(sc_sock_term(&in[i]) == 0);
+			}
+
+			pthread_mutex_lock(&st->mtx);
+			st->accepted[r->index] += count;
+			pthread_mutex_unlock(&st->mtx);
+		}
+
+		pthread_mutex_lock(&st->mtx);
+		stop = st->stop;
+		pthread_mutex_unlock(&st->mtx);
+	}
+}
+
+void test_listener(void)
+{
+	int rc, total;
+	struct sc_sock clt[16];
+	struct sc_sock_listener l;
+	struct listener_state st = {.stop = false};
+
+	pthread_mutex_init(&st.mtx, NULL);
+
+	assert(sc_sock_listener_init(&l, 0, SC_SOCK_INET, "127.0.0.1", "8020",
+				     false) != 0);
+	assert(*sc_sock_listener_err(&l) != '\0');
+	assert(sc_sock_listener_init(&l, 2, SC_SOCK_UNIX, "/tmp/x", "8020",
+				     false) != 0);
+	assert(sc_sock_listener_init(&l, 2, SC_SOCK_INET, "127.0.0.1x", "8020",
+				     false) != 0);
+	assert(sc_sock_listener_term(&l) == 0);
+
+	rc = sc_sock_listener_init(&l, 4, SC_SOCK_INET, "127.0.0.1", "8020",
+				   false);
+	assert(rc == 0);
+	assert(l.count == 4);
+
+	rc = sc_sock_listener_start(&l, listener_reactor, &st);
+	assert(rc == 0);
+
+	for (int i = 0; i < 16; i++) {
+		sc_sock_init(&clt[i], 0, true, SC_SOCK_INET);
+		rc = sc_sock_connect(&clt[i], "127.0.0.1", "8020", NULL, NULL);
+		assert(rc == 0);
+	}
+
+	do {
+		sc_time_sleep(10);
+
+		pthread_mutex_lock(&st.mtx);
+		total = 0;
+		for (int i = 0; i < 4; i++) {
+			total += st.accepted[i];
+		}
+		st.stop = (total == 16);
+		pthread_mutex_unlock(&st.mtx);
+	} while (total != 16);
+
+	assert(sc_sock_listener_term(&l) == 0);
+	assert(l.reactors == NULL);
+
+	for (int i = 0; i < 16; i++) {
+		assert(sc_sock_term(&clt[i]) == 0);
+	}
+
+	// Ephemeral port, all sockets share the port picked for the first one.
+	rc = sc_sock_listener_init(&l, 2, SC_SOCK_INET, "127.0.0.1", "0",
+				   false);
+	assert(rc == 0);
+	assert(sc_sock_listener_term(&l) == 0);
+
+#if defined(__linux__)
+	cpu_set_t set;
+
+	assert(sched_getaffinity(0, sizeof(set), &set) == 0);
+	rc = sc_sock_listener_init(&l, CPU_COUNT(&set) + 1, SC_SOCK_INET,
+				   "127.0.0.1", "8020", true);
+	assert(rc != 0);
+	assert(strstr(sc_sock_listener_err(&l), "CPU count") != NULL);
+
+	// Steering depends on the kernel, it may fail.
+	rc = sc_sock_listener_init(&l, CPU_COUNT(&set), SC_SOCK_INET,
+				   "127.0.0.1", "8020", true);
+	if (rc == 0) {
+		for (int i = 0; i < l.count; i++) {
+			assert(CPU_ISSET(l.reactors[i].cpu, &set));
+		}
+
+		st.stop = true;
+		assert(sc_sock_listener_start(&l, listener_reactor, &st) == 0);
+		assert(sc_sock_listener_term(&l) == 0);
+	} else {
+		printf("listener steer : %s \n", sc_sock_listener_err(&l));
+	}
+#endif
+
+	pthread_mutex_destroy(&st.mtx);
+}
+
+#else
+void test_listener(void)
+{
+}
+#endif
+
+#if !defined(_WIN32) && !defined(_WIN64)
+
+static void tcp_pair(struct sc_sock *a, struct sc_sock *b, const char *port)
+{
+	struct sc_sock srv;
+
+	sc_sock_init(&srv, 0, true, SC_SOCK_INET);
+	assert(sc_sock_listen(&srv, "127.0.0.1", port) == 0);
+
+	sc_sock_init(a, 0, true, SC_SOCK_INET);
+	assert(sc_sock_connect(a, "127.0.0.1", port, NULL, NULL) == 0);
+	assert(sc_sock_accept(&srv, b) == 0);
+	assert(sc_sock_term(&srv) == 0);
+
+	assert(sc_sock_set_blocking(a, false) == 0);
+	assert(sc_sock_set_blocking(b, false) == 0);
+	a->blocking = false;
+	b->blocking = false;
+}
+
+void test_sendfile(void)
+{
+	enum
+	{
+		SIZE = 4 * 1024 * 1024
+	};
+
+	int fd, n;
+	int64_t off = 0, recvd = 0, sent;
+	char tmp[] = "/tmp/sc_sock_XXXXXX";
+	char *data, *buf;
+	struct sc_sock a, b;
+	struct sc_sock_stats st;
+
+	data = malloc(SIZE);
+	buf = malloc(SIZE);
+	assert(data != NULL && buf != NULL);
+
+	for (int i = 0; i < SIZE; i++) {
+		data[i] = (char) (i * 31);
+	}
+
+	fd = mkstemp(tmp);
+	assert(fd != -1);
+	assert(write(fd, data, SIZE) == SIZE);
+	unlink(tmp);
+
+	tcp_pair(&a, &b, "8021");
+	sc_sock_stats(&a, &st, true);
+
+	// Socket buffers are smaller than the file, partial sends are
+	// expected.
+	while (recvd < SIZE) {
+		if (off < SIZE) {
+			sent = sc_sock_sendfile(&a, fd, &off, SIZE - off);
+			assert(sent > 0 || (sent == -1 && errno == EAGAIN));
+		}
+
+		n = sc_sock_recv(&b, buf + recvd, (int) (SIZE - recvd), 0);
+		if (n > 0) {
+			recvd += n;
+		} else {
+			assert(errno == EAGAIN);
+		}
+	}
+
+	assert(off == SIZE);
+	assert(memcmp(data, buf, SIZE) == 0);
+	assert(sc_sock_sendfile(&a, fd, &off, 100) == 0);
+	assert(sc_sock_sendfile(&a, fd, &off, 0) == 0);
+
+	sc_sock_stats(&a, &st, false);
+#ifdef SC_SOCK_STATS
+	assert(st.calls[SC_SOCK_CALL_SENDFILE] > 0);
+	assert(st.calls[SC_SOCK_CALL_SEND] == 0);
+	assert(st.bytes_out == SIZE);
+#else
+	assert(st.bytes_out == 0);
+#endif
+
+	close(fd);
+	assert(sc_sock_sendfile(&a, fd, &off, 100) == -1);
+	assert(*sc_sock_error(&a) != '\0');
+
+	assert(sc_sock_term(&a) == 0);
+	assert(sc_sock_term(&b) == 0);
+	free(data);
+	free(buf);
+}
+
+void test_relay(void)
+{
+	enum
+	{
+		SIZE = 4 * 1024 * 1024
+	};
+
+	int n;
+	int64_t sent = 0, recvd = 0, moved = 0, rc;
+	char *data, *buf;
+	struct sc_sock c1, s1, s2, c2;
+	struct sc_sock_relay r;
+
+	data = malloc(SIZE);
+	buf = malloc(SIZE);
+	assert(data != NULL && buf != NULL);
+
+	for (int i = 0; i < SIZE; i++) {
+		data[i] = (char) (i * 7);
+	}
+
+	// c1 -> s1 -> relay -> s2 -> c2
+	tcp_pair(&c1, &s1, "8022");
+	tcp_pair(&s2, &c2, "8023");
+
+	assert(sc_sock_relay_init(&r) == 0);
+	assert(sc_sock_relay(&r, &s1, &s2, 1000) == -1);
+	assert(errno == EAGAIN);
+
+	while (recvd < SIZE) {
+		if (sent < SIZE) {
+			n = sc_sock_send(&c1, data + sent, (int) (SIZE - sent), 0);
+			if (n > 0) {
+				sent += n;
+			}
+		}
+
+		rc = sc_sock_relay(&r, &s1, &s2, 100000);
+		if (rc > 0) {
+			moved += rc;
+		} else {
+			assert(errno == EAGAIN);
+		}
+
+		n = sc_sock_recv(&c2, buf + recvd, (int) (SIZE - recvd), 0);
+		if (n > 0) {
+			recvd += n;
+		}
+	}
+
+	assert(moved == SIZE);
+	assert(r.pending == 0);
+	assert(memcmp(data, buf, SIZE) == 0);
+
+	assert(sc_sock_term(&c1) == 0);
+	sc_time_sleep(10);
+	assert(sc_sock_relay(&r, &s1, &s2, 1000) == -1);
+	assert(errno == EOF);
+
+	assert(sc_sock_term(&s1) == 0);
+	assert(sc_sock_relay(&r, &s1, &s2, 1000) == -1);
+	assert(*sc_sock_relay_err(&r) != '\0');
+
+	assert(sc_sock_relay_term(&r) == 0);
+	assert(sc_sock_term(&s2) == 0);
+	assert(sc_sock_term(&c2) == 0);
+	free(data);
+	free(buf);
+}
+
+static int wq_high, wq_low;
+
+static void wq_on_high(struct sc_sock_wq *q)
+{
+	assert(q->arg == &wq_high);
+	assert(q->size >= q->high);
+	wq_high++;
+}
+
+static void wq_on_low(struct sc_sock_wq *q)
+{
+	assert(q->size <= q->low);
+	wq_low++;
+}
+
+void test_handoff(void)
+{
+	char buf[8];
+	struct sc_sock u, u1, u2, srv, c, c2, in, in2;
+	struct sc_sock got[4];
+	struct sc_sock *socks[2] = {&srv, &in};
+
+	sc_sock_init(&u, 0, true, SC_SOCK_UNIX);
+	assert(sc_sock_listen(&u, "/tmp/sc_handoff", NULL) == 0);
+	sc_sock_init(&u1, 0, true, SC_SOCK_UNIX);
+	assert(sc_sock_connect(&u1, "/tmp/sc_handoff", NULL, NULL, NULL) == 0);
+	assert(sc_sock_accept(&u, &u2) == 0);
+
+	sc_sock_init(&srv, 0, false, SC_SOCK_INET);
+	assert(sc_sock_listen(&srv, "127.0.0.1", "8033") == 0);
+	sc_sock_init(&c, 0, true, SC_SOCK_INET);
+	assert(sc_sock_connect(&c, "127.0.0.1", "8033", NULL, NULL) == 0);
+	while (sc_sock_accept(&srv, &in) != 0) {
+	}
+
+	assert(sc_sock_handoff_send(&u1, socks, 0) == -1);
+	assert(sc_sock_handoff_send(&u1, socks, 2) == 2);
+	assert(sc_sock_handoff_recv(&u2, got, 4) == 2);
+	assert(got[0].family == SC_SOCK_INET);
+	assert(got[0].blocking == false);
+	assert(got[1].family == SC_SOCK_INET);
+
+	// Old process closes its copies, connections stay.
+	assert(sc_sock_term(&srv) == 0);
+	assert(sc_sock_term(&in) == 0);
+
+	assert(sc_sock_send(&c, "ping", 4, 0) == 4);
+	assert(sc_sock_recv(&got[1], buf, sizeof(buf), 0) == 4);
+	assert(memcmp(buf, "ping", 4) == 0);
+
+	sc_sock_init(&c2, 0, true, SC_SOCK_INET);
+	assert(sc_sock_connect(&c2, "127.0.0.1", "8033", NULL, NULL) == 0);
+	while (sc_sock_accept(&got[0], &in2) != 0) {
+		assert(errno == EAGAIN);
+	}
+
+	// Too many sockets for the receiver
+	socks[0] = &c;
+	socks[1] = &c2;
+	assert(sc_sock_handoff_send(&u1, socks, 2) == 2);
+	assert(sc_sock_handoff_recv(&u2, got + 2, 1) == -1);
+	assert(*sc_sock_error(&u2) != '\0');
+
+	assert(sc_sock_term(&u1) == 0);
+	assert(sc_sock_handoff_recv(&u2, got + 2, 1) == -1);
+	assert(errno == EOF);
+
+	assert(sc_sock_term(&c) == 0);
+	assert(sc_sock_term(&c2) == 0);
+	assert(sc_sock_term(&in2) == 0);
+	assert(sc_sock_term(&got[0]) == 0);
+	assert(sc_sock_term(&got[1]) == 0);
+	assert(sc_sock_term(&u2) == 0);
+	assert(sc_sock_term(&u) == 0);
+}
+
+void test_spin(void)
+{
+	struct sc_sock a, b;
+	struct sc_sock_poll p;
+	struct sc_sock_poll_stats st;
+	struct sc_sock_poll_conf conf = {
+		.spin_ns = 50 * 1000 * 1000,
+	};
+
+	tcp_pair(&a, &b, "8034");
+
+	assert(sc_sock_poll_init_conf(&p, &conf) == 0);
+	assert(sc_sock_poll_add(&p, &b.fdt, SC_SOCK_READ, &b) == 0);
+
+	// Budget is limited by the timeout.
+	assert(sc_sock_poll_wait(&p, 10) == 0);
+	assert(sc_sock_poll_wait_ns(&p, 1000) == 0);
+	assert(sc_sock_poll_wait(&p, 0) == 0);
+
+	assert(sc_sock_send(&a, "x", 1, 0) == 1);
+	assert(sc_sock_poll_wait(&p, -1) == 1);
+	assert(sc_sock_poll_data(&p, 0) == &b);
+
+	sc_sock_poll_stats(&p, &st, false);
+#ifdef SC_SOCK_STATS
+	assert(st.spins == 3);
+	assert(st.spin_hits == 1);
+	assert(st.timeouts == 3);
+	assert(st.wakeups == 1);
+#endif
+
+	assert(sc_sock_poll_term(&p) == 0);
+	assert(sc_sock_term(&a) == 0);
+	assert(sc_sock_term(&b) == 0);
+}
+
+void test_drain(void)
+{
+	enum
+	{
+		SIZE = 1024 * 1024
+	};
+
+	bool drained;
+	int64_t n, sent = 0, recvd = 0;
+	char *data;
+	struct sc_sock a, b;
+	struct sc_sock_buf out, in;
+
+	data = malloc(SIZE);
+	assert(data != NULL);
+	for (int i = 0; i < SIZE; i++) {
+		data[i] = (char) (i % 251);
+	}
+
+	tcp_pair(&a, &b, "8031");
+	sc_sock_buf_init(&out, SIZE);
+	sc_sock_buf_init(&in, SIZE);
+
+	assert(sc_sock_recv_all(&b, &in, SIZE, &drained) == 0);
+	assert(drained);
+	assert(sc_sock_send_all(&a, &out, SIZE, &drained) == 0);
+	assert(drained);
+
+	assert(sc_sock_buf_put(&out, data, SIZE) == 0);
+	assert(sc_sock_buf_put(&out, data, 1) != 0);
+
+	// Read budget
+	assert(sc_sock_send_all(&a, &out, 1000, &drained) == 1000);
+	assert(!drained);
+	sent += 1000;
+	while (recvd < 1000) {
+		n = sc_sock_recv_all(&b, &in, 1000 - recvd, &drained);
+		assert(n >= 0);
+		recvd += n;
+	}
+	assert(recvd == 1000);
+	assert(!drained);
+
+	while (recvd < SIZE) {
+		n = sc_sock_send_all(&a, &out, SIZE, &drained);
+		assert(n >= 0);
+		assert(drained);
+		sent += n;
+
+		n = sc_sock_recv_all(&b, &in, SIZE, &drained);
+		assert(n >= 0);
+		recvd += n;
+	}
+
+	assert(sent == SIZE);
+	assert(out.wpos == out.rpos);
+	assert(in.wpos - in.rpos == SIZE);
+	assert(memcmp(in.mem + in.rpos, data, SIZE) == 0);
+	assert(in.hint > 4096);
+
+	// Buffer is full, it is not drained until data is consumed.
+	assert(sc_sock_send(&a, data, 100, 0) == 100);
+	assert(sc_sock_recv_all(&b, &in, SIZE, &drained) == 0);
+	assert(!drained);
+	sc_sock_buf_consume(&in, SIZE);
+	assert(in.rpos == 0 && in.wpos == 0);
+	while (in.wpos < 100) {
+		assert(sc_sock_recv_all(&b, &in, SIZE, &drained) >= 0);
+	}
+	assert(drained);
+	assert(memcmp(in.mem, data, 100) == 0);
+
+	assert(sc_sock_term(&a) == 0);
+	n = sc_sock_recv_all(&b, &in, SIZE, &drained);
+	while (n == 0 && drained) {
+		n = sc_sock_recv_all(&b, &in, SIZE, &drained);
+	}
+	assert(n == -1);
+	assert(errno == EOF);
+
+	assert(sc_sock_term(&b) == 0);
+	sc_sock_buf_term(&out);
+	sc_sock_buf_term(&in);
+	free(data);
+}
+
+void test_wq(void)
+{
+	enum
+	{
+		SIZE = 8 * 1024 * 1024
+	};
+
+	int n, rc;
+	int64_t sent = 0, recvd = 0;
+	bool writable;
+	char *data, *buf;
+	void *ev_data;
+	uint32_t events;
+	struct sc_sock a, b;
+	struct sc_sock_poll p;
+	struct sc_sock_stats st;
+	struct sc_sock_wq q;
+
+	data = malloc(SIZE);
+	buf = malloc(SIZE);
+	assert(data != NULL && buf != NULL);
+
+	for (int i = 0; i < SIZE; i++) {
+		data[i] = (char) (i * 13);
+	}
+
+	tcp_pair(&a, &b, "8029");
+	assert(sc_sock_poll_init(&p) == 0);
+	assert(sc_sock_poll_add(&p, &a.fdt, SC_SOCK_READ, &a) == 0);
+
+	assert(sc_sock_wq_init(&q, &a, &p, &a, 256 * 1024, 1024 * 1024) == 0);
+	q.on_high = wq_on_high;
+	q.on_low = wq_on_low;
+	q.arg = &wq_high;
+
+	// Small writes while the queue is empty are sent directly.
+	assert(sc_sock_wq_write(&q, data, 100) == 0);
+	assert(q.size == 0 && !q.armed);
+	sent = 100;
+
+	// Producer stops at the high watermark and continues at the low.
+	while (recvd < SIZE) {
+		while (sent < SIZE && wq_high == wq_low) {
+			n = SIZE - sent < 3000 ? (int) (SIZE - sent) : 3000;
+			assert(sc_sock_wq_write(&q, data + sent, (size_t) n) == 0);
+			sent += n;
+		}
+
+		assert(q.size < 1024 * 1024 + 3000);
+
+		writable = false;
+		n = sc_sock_poll_wait(&p, 0);
+		sc_sock_poll_foreach (&p, n, ev_data, events) {
+			assert(ev_data == &a);
+			writable = (events & SC_SOCK_WRITE) != 0;
+		}
+
+		if (writable) {
+			rc = sc_sock_wq_flush(&q);
+			assert(rc == 0 || errno == EAGAIN);
+		}
+
+		n = sc_sock_recv(&b, buf + recvd, (int) (SIZE - recvd), 0);
+		if (n > 0) {
+			recvd += n;
+		}
+	}
+
+	assert(memcmp(data, buf, SIZE) == 0);
+	assert(wq_high > 0 && wq_high == wq_low);
+	assert(q.size == 0);
+
+	// Queue is drained, write interest is removed.
+	if (q.armed) {
+		assert(sc_sock_wq_flush(&q) == 0);
+	}
+	assert(!q.armed);
+	assert(sc_sock_poll_wait(&p, 0) == 0);
+
+	// Socket buffer can't take it all, vectored send is partial.
+	assert(sc_sock_wq_write(&q, data, SIZE) == 0);
+	assert(q.size > 0);
+	assert(sc_sock_recv(&b, buf, 65536, 0) > 0);
+	sc_sock_stats(&a, &st, true);
+	assert(sc_sock_wq_flush(&q) == -1 && errno == EAGAIN);
+	sc_sock_stats(&a, &st, false);
+#ifdef SC_SOCK_STATS
+	assert(st.calls[SC_SOCK_CALL_WRITEV] > 0);
+	assert(st.partial_writes > 0);
+#else
+	assert(st.partial_writes == 0);
+#endif
+
+	// Closed peer fails the send without raising SIGPIPE.
+	assert(sc_sock_term(&b) == 0);
+	for (int i = 0; i < 100; i++) {
+		rc = sc_sock_wq_flush(&q);
+		assert(rc == -1);
+		if (errno == EPIPE) {
+			break;
+		}
+
+		assert(errno == EAGAIN || errno == ECONNRESET);
+		sc_sock_poll_wait(&p, 10);
+	}
+	assert(errno == EPIPE);
+
+	// Queued data is released on term.
+	assert(q.size > 0);
+	sc_sock_wq_term(&q);
+	assert(q.size == 0 && q.head == NULL);
+
+	assert(sc_sock_poll_term(&p) == 0);
+	assert(sc_sock_term(&a) == 0);
+	free(data);
+	free(buf);
+}
+
+void test_zerocopy(void)
+{
+	int n, count = 0;
+	uint32_t lo, hi, next = 0;
+	bool copied;
+	char buf[65536];
+	struct sc_sock a, b;
+	struct sc_sock_poll p;
+
+	tcp_pair(&a, &b, "8024");
+
+	if (sc_sock_set_zerocopy(&a, true) != 0) {
+		printf("zerocopy is not available : %s \n", sc_sock_error(&a));
+		assert(sc_sock_term(&a) == 0);
+		assert(sc_sock_term(&b) == 0);
+		return;
+	}
+
+	memset(buf, 'x', sizeof(buf));
+
+	for (int i = 0; i < 4; i++) {
+		n = sc_sock_send_zerocopy(&a, buf, sizeof(buf), 0);
+		assert(n > 0);
+		count++;
+
+		while (sc_sock_recv(&b, buf, sizeof(buf), 0) > 0) {
+		}
+	}
+
+	assert(sc_sock_poll_init(&p) == 0);
+	assert(sc_sock_poll_add(&p, &a.fdt, SC_SOCK_READ, &a) == 0);
+
+	// Completions are signalled as an error queue event, not as closed.
+	while (next != (uint32_t) count) {
+		n = sc_sock_poll_wait(&p, 1000);
+		assert(n == 1);
+		assert(sc_sock_poll_event(&p, 0) == SC_SOCK_ERRQUEUE);
+
+		while (sc_sock_zerocopy_done(&a, &lo, &hi, &copied) == 0) {
+			assert(lo == next);
+			assert(hi >= lo);
+			next = hi + 1;
+		}
+		assert(errno == EAGAIN);
+	}
+
+	assert(sc_sock_poll_del(&p, &a.fdt, SC_SOCK_READ, &a) == 0);
+	assert(sc_sock_term(&a) == 0);
+	assert(sc_sock_term(&b) == 0);
+
+	// Other error queue entries are returned as failures, e.g., ICMP port
+	// unreachable.
+	struct sockaddr_in dst = {
+		.sin_family = AF_INET,
+		.sin_port = htons(8037),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+
+	sc_sock_init(&a, 0, false, SC_SOCK_INET);
+	assert(sc_sock_udp_bind(&a, "127.0.0.1", "8036") == 0);
+	assert(setsockopt(a.fdt.fd, SOL_IP, IP_RECVERR, &(int){1},
+			  sizeof(int)) == 0);
+	assert(sendto(a.fdt.fd, "x", 1, 0, (struct sockaddr *) &dst,
+		      sizeof(dst)) == 1);
+	assert(sc_sock_poll_add(&p, &a.fdt, SC_SOCK_READ, &a) == 0);
+	assert(sc_sock_poll_wait(&p, 1000) == 1);
+	assert(sc_sock_poll_event(&p, 0) == SC_SOCK_ERRQUEUE);
+	assert(sc_sock_zerocopy_done(&a, &lo, &hi, &copied) == -1);
+	assert(errno == ECONNREFUSED);
+	assert(sc_sock_zerocopy_done(&a, &lo, &hi, &copied) == -1);
+	assert(errno == EAGAIN);
+	assert(sc_sock_poll_wait(&p, 0) == 0);
+
+	assert(sc_sock_poll_term(&p) == 0);
+	assert(sc_sock_term(&a) == 0);
+}
+
+void test_resolver(void)
+{
+	int n, done = 0;
+	struct sc_sock srv, clt, in;
+	struct sc_sock_poll p;
+	struct sc_sock_resolver r;
+	struct sc_sock_resolve reqs[3], *req;
+	struct sc_sock_addr *addr = NULL;
+
+	assert(sc_sock_resolver_init(&r, 0, 0) != 0);
+	assert(*sc_sock_resolver_err(&r) != '\0');
+	assert(sc_sock_resolver_term(&r) == 0);
+
+	assert(sc_sock_resolver_init(&r, 2, 60000) == 0);
+	assert(sc_sock_poll_init(&p) == 0);
+	assert(sc_sock_poll_add(&p, &r.pipe.fdt, SC_SOCK_READ, &r) == 0);
+
+	assert(sc_sock_resolve(&r, &reqs[0], "localhost", "8025", &reqs[0]) == 0);
+	assert(sc_sock_resolve(&r, &reqs[1], "127.0.0.1", "8025", &reqs[1]) == 0);
+	assert(sc_sock_resolve(&r, &reqs[2], "127.0.0.1x", "8025", &reqs[2]) == 0);
+
+	while (done != 3) {
+		n = sc_sock_poll_wait(&p, 5000);
+		assert(n == 1);
+		assert(sc_sock_poll_data(&p, 0) == &r);
+
+		while ((req = sc_sock_resolver_next(&r)) != NULL) {
+			assert(req->data == req);
+			done++;
+		}
+	}
+
+	// Pipe is drained.
+	assert(sc_sock_poll_wait(&p, 0) == 0);
+
+	assert(reqs[0].rc == 0 && reqs[0].count > 0);
+	assert(reqs[1].rc == 0 && reqs[1].count == 1);
+	assert(reqs[2].rc != 0 && *sc_sock_resolve_err(&reqs[2]) != '\0');
+
+	// Successful results are cached.
+	assert(sc_sock_resolve(&r, &reqs[0], "localhost", "8025", NULL) == 1);
+	assert(reqs[0].rc == 0 && reqs[0].count > 0);
+	assert(sc_sock_resolve(&r, &reqs[2], "127.0.0.1x", "8025", NULL) == 0);
+
+	for (int i = 0; i < reqs[0].count; i++) {
+		if (reqs[0].addrs[i].family == AF_INET) {
+			addr = &reqs[0].addrs[i];
+		}
+	}
+	assert(addr != NULL);
+
+	sc_sock_init(&srv, 0, true, SC_SOCK_INET);
+	assert(sc_sock_listen(&srv, "127.0.0.1", "8025") == 0);
+
+	sc_sock_init(&clt, 0, true, SC_SOCK_INET);
+	assert(sc_sock_connect_addr(&clt, addr, NULL, NULL) == 0);
+	assert(sc_sock_accept(&srv, &in) == 0);
+	assert(sc_sock_term(&in) == 0);
+	assert(sc_sock_term(&clt) == 0);
+
+	sc_sock_init(&clt, 0, false, SC_SOCK_INET);
+	n = sc_sock_connect_addr(&clt, &reqs[1].addrs[0], NULL, NULL);
+	assert(n == 0 || (n == -1 && errno == EAGAIN));
+	assert(sc_sock_term(&clt) == 0);
+	assert(sc_sock_term(&srv) == 0);
+
+	sc_sock_init(&clt, 0, true, SC_SOCK_INET);
+	assert(sc_sock_connect_addr(&clt, &reqs[1].addrs[0], NULL, NULL) != 0);
+	assert(*sc_sock_error(&clt) != '\0');
+
+	assert(sc_sock_poll_term(&p) == 0);
+	assert(sc_sock_resolver_term(&r) == 0);
+}
+
+#else
+void test_sendfile(void)
+{
+}
+void test_resolver(void)
+{
+}
+void test_relay(void)
+{
+}
+void test_handoff(void)
+{
+}
+void test_spin(void)
+{
+}
+void test_drain(void)
+{
+}
+void test_wq(void)
+{
+}
+void test_zerocopy(void)
+{
+}
+#endif
+
+static int eyeballs_connect(struct sc_sock_eyeballs *e, struct sc_sock *out)
+{
+	int rc, n;
+
+	while (true) {
+		n = sc_sock_poll_wait(e->poll, sc_sock_eyeballs_timeout(e));
+		assert(n >= 0);
+
+		for (int i = 0; i < n; i++) {
+			assert(sc_sock_poll_data(e->poll, i) == e);
+		}
+
+		rc = sc_sock_eyeballs_poll(e, out);
+		if (rc == 0 || errno != EAGAIN) {
+			return rc;
+		}
+	}
+}
+
+void test_eyeballs(void)
+{
+	int rc;
+	struct sc_sock srv, clt, in;
+	struct sc_sock_poll p;
+	struct sc_sock_eyeballs e;
+	struct sc_sock_addr addrs[4];
+	struct sockaddr_in *sin;
+
+	for (int i = 0; i < 4; i++) {
+		addrs[i] = (struct sc_sock_addr){
+			.family = AF_INET,
+			.len = sizeof(struct sockaddr_in),
+		};
+		sin = (struct sockaddr_in *) &addrs[i].addr;
+		sin->sin_family = AF_INET;
+		sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		sin->sin_port = htons(8027);
+	}
+
+	// Unreachable address, it either fails or never completes.
+	sin = (struct sockaddr_in *) &addrs[0].addr;
+	inet_pton(AF_INET, "192.0.2.1", &sin->sin_addr);
+	// Nothing listens on this port
+	sin = (struct sockaddr_in *) &addrs[1].addr;
+	sin->sin_port = htons(8028);
+
+	sc_sock_init(&srv, 0, true, SC_SOCK_INET);
+	assert(sc_sock_listen(&srv, "127.0.0.1", "8027") == 0);
+	assert(sc_sock_poll_init(&p) == 0);
+
+	assert(sc_sock_eyeballs_start(&e, &p, addrs, 0, 50, -1) == -1);
+	assert(*sc_sock_eyeballs_err(&e) != '\0');
+	assert(sc_sock_eyeballs_start(&e, &p, addrs, -1, 50, -1) == -1);
+	assert(*sc_sock_eyeballs_err(&e) != '\0');
+
+	assert(sc_sock_eyeballs_start(&e, &p, addrs, 3, 50, -1) == 0);
+	assert(eyeballs_connect(&e, &clt) == 0);
+	assert(sc_sock_eyeballs_timeout(&e) == -1);
+
+	assert(sc_sock_accept(&srv, &in) == 0);
+	assert(sc_sock_send(&clt, "x", 1, 0) == 1);
+	assert(sc_sock_recv(&in, (char[1]){0}, 1, 0) == 1);
+	assert(sc_sock_term(&in) == 0);
+	assert(sc_sock_term(&clt) == 0);
+
+	// No attempt may succeed.
+	assert(sc_sock_eyeballs_start(&e, &p, &addrs[1], 1, 50, -1) == 0);
+	assert(eyeballs_connect(&e, &clt) == -1);
+	assert(errno != EAGAIN);
+	assert(*sc_sock_eyeballs_err(&e) != '\0');
+
+	// Unreachable address only, total timeout expires.
+	assert(sc_sock_eyeballs_start(&e, &p, addrs, 1, 50, 30) == 0);
+	assert(sc_sock_eyeballs_timeout(&e) <= 30);
+	rc = eyeballs_connect(&e, &clt);
+	if (rc == -1 && errno == ETIMEDOUT) {
+		assert(sc_sock_eyeballs_timeout(&e) == -1);
+		assert(strstr(sc_sock_eyeballs_err(&e), "timed out") != NULL);
+	} else {
+		// Network reported the failure first.
+		assert(rc == -1);
+	}
+
+	// Cancel
+	assert(sc_sock_eyeballs_start(&e, &p, addrs, 3, 50, -1) == 0);
+	assert(sc_sock_eyeballs_term(&e) == 0);
+	assert(sc_sock_poll_wait(&p, 10) == 0);
+
+	assert(sc_sock_poll_term(&p) == 0);
+	assert(sc_sock_term(&srv) == 0);
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+
+static void *notify_thread(void *arg)
+{
+	struct sc_sock_notify *n = arg;
+
+	for (int i = 0; i < 1000; i++) {
+		assert(sc_sock_notify_post(n, 1) == 0);
+	}
+
+	return NULL;
+}
+
+#endif
+
+void test_notify(void)
+{
+	uint64_t count, total = 0;
+	struct sc_sock_notify n;
+	struct sc_sock_poll p;
+
+	assert(sc_sock_notify_init(&n, 0) == 0);
+	assert(sc_sock_poll_init(&p) == 0);
+	assert(sc_sock_poll_add(&p, &n.fdt, SC_SOCK_READ, &n) == 0);
+
+	assert(sc_sock_notify_read(&n, &count) == -1);
+	assert(errno == EAGAIN);
+	assert(count == 0);
+	assert(sc_sock_poll_wait(&p, 0) == 0);
+
+	// Posts are coalesced into a single read.
+	assert(sc_sock_notify_post(&n, 1) == 0);
+	assert(sc_sock_notify_post(&n, 1) == 0);
+	assert(sc_sock_notify_post(&n, 1) == 0);
+	assert(sc_sock_poll_wait(&p, 1000) == 1);
+	assert(sc_sock_poll_data(&p, 0) == &n);
+	assert(sc_sock_notify_read(&n, &count) == 0);
+	assert(count == 3);
+	assert(sc_sock_poll_wait(&p, 0) == 0);
+
+#if !defined(_WIN32) && !defined(_WIN64)
+	pthread_t threads[4];
+
+	for (int i = 0; i < 4; i++) {
+		assert(pthread_create(&threads[i], NULL, notify_thread, &n) == 0);
+	}
+
+	for (int i = 0; i < 4; i++) {
+		assert(pthread_join(threads[i], NULL) == 0);
+	}
+
+	while (sc_sock_notify_read(&n, &count) == 0) {
+		total += count;
+	}
+	assert(total == 4000);
+#endif
+
+	assert(sc_sock_poll_del(&p, &n.fdt, SC_SOCK_READ, &n) == 0);
+	assert(sc_sock_poll_term(&p) == 0);
+	assert(sc_sock_notify_term(&n) == 0);
+	assert(sc_sock_notify_term(&n) == 0);
+
+	assert(sc_sock_notify_post(&n, 1) == -1);
+	assert(sc_sock_notify_read(&n, &count) == -1);
+	assert(*sc_sock_notify_err(&n) != '\0');
+}
+
+#if defined(__linux__)
+static uint64_t test_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+void test_timerfd(void)
+{
+	uint64_t count, start, deadline;
+	struct sc_sock_timer t;
+	struct sc_sock_poll p;
+
+	assert(sc_sock_timer_init(&t, 0) == 0);
+	assert(sc_sock_poll_init(&p) == 0);
+	assert(sc_sock_poll_add(&p, &t.fdt, SC_SOCK_READ, &t) == 0);
+
+	assert(sc_sock_timer_read(&t, &count) == -1);
+	assert(errno == EAGAIN);
+	assert(sc_sock_poll_wait(&p, 0) == 0);
+
+	// Sub-millisecond deadline.
+	start = test_time_ns();
+	deadline = start + 300000;
+	assert(sc_sock_timer_arm(&t, deadline) == 0);
+	assert(t.deadline == deadline);
+	assert(sc_sock_poll_wait(&p, 1000) == 1);
+	assert(test_time_ns() >= deadline);
+	assert(sc_sock_poll_data(&p, 0) == &t);
+	assert(sc_sock_timer_read(&t, &count) == 0);
+	assert(count == 1);
+	assert(t.deadline == 0);
+
+	// Re-arming replaces the deadline, disarmed timer doesn't expire.
+	assert(sc_sock_timer_arm(&t, test_time_ns() + 1000000) == 0);
+	assert(sc_sock_timer_arm(&t, 0) == 0);
+	assert(sc_sock_poll_wait(&p, 5) == 0);
+
+	// Past deadline expires immediately.
+	assert(sc_sock_timer_arm(&t, 1) == 0);
+	assert(sc_sock_poll_wait(&p, 1000) == 1);
+	assert(sc_sock_timer_read(&t, &count) == 0);
+
+	assert(sc_sock_poll_del(&p, &t.fdt, SC_SOCK_READ, &t) == 0);
+	assert(sc_sock_poll_term(&p) == 0);
+	assert(sc_sock_timer_term(&t) == 0);
+	assert(sc_sock_timer_term(&t) == 0);
+
+	assert(sc_sock_timer_arm(&t, 1) == -1);
+	assert(*sc_sock_timer_err(&t) != '\0');
+}
+
+void test_poll_uring_io(void)
+{
+	int n, sent = 0, recvd = 0;
+	char buf[200], out[200];
+	uint64_t start;
+	struct sc_sock a, b;
+	struct sc_sock_io *io;
+	struct sc_sock_poll p;
+	struct sc_sock_pipe pipe;
+	struct sc_sock_poll_conf conf = {
+		.backend = SC_SOCK_POLL_URING,
+		.recv_buf_count = 3,
+		.recv_buf_size = 16,
+	};
+
+	tcp_pair(&a, &b, "8035");
+
+	// Completion I/O requires io_uring and receive buffers.
+	assert(sc_sock_poll_init(&p) == 0);
+	assert(sc_sock_poll_recv_add(&p, &b.fdt, &b) != 0);
+	assert(sc_sock_poll_send(&p, &a.fdt, buf, 1, &a) != 0);
+	assert(sc_sock_poll_recv_del(&p, &b.fdt) == 0);
+	assert(sc_sock_poll_term(&p) == 0);
+
+	if (sc_sock_poll_init_conf(&p, &conf) != 0) {
+		printf("io_uring receive is not available : %s \n",
+		       sc_sock_poll_err(&p));
+		assert(sc_sock_term(&a) == 0);
+		assert(sc_sock_term(&b) == 0);
+		return;
+	}
+
+	// Completion of a removed request must not end a timed wait early.
+	assert(sc_sock_pipe_init(&pipe, 0) == 0);
+	assert(sc_sock_poll_add(&p, &pipe.fdt, SC_SOCK_READ, &pipe) == 0);
+	assert(sc_sock_poll_del(&p, &pipe.fdt, SC_SOCK_READ, &pipe) == 0);
+	start = test_time_ns();
+	assert(sc_sock_poll_wait(&p, 20) == 0);
+	assert(test_time_ns() - start >= 19000000);
+	assert(sc_sock_pipe_term(&pipe) == 0);
+
+	for (int i = 0; i < 200; i++) {
+		buf[i] = (char) i;
+	}
+
+	// Data is larger than the buffer ring, receive continues as the
+	// buffers are returned by the next wait.
+	assert(sc_sock_poll_recv_add(&p, &b.fdt, &b) == 0);
+	assert(sc_sock_poll_send(&p, &a.fdt, buf, 200, &a) == 0);
+	assert(sc_sock_poll_send(&p, &a.fdt, buf, 1, &a) == -1);
+	assert(errno == EBUSY);
+
+	while (sent < 200 || recvd < 200) {
+		n = sc_sock_poll_wait(&p, -1);
+		assert(n > 0);
+
+		for (int i = 0; i < n; i++) {
+			io = sc_sock_poll_io(&p, i);
+			assert(io != NULL);
+
+			if (io->op == SC_SOCK_IO_SEND) {
+				assert(sc_sock_poll_data(&p, i) == &a);
+				assert(sc_sock_poll_event(&p, i) == SC_SOCK_WRITE);
+				assert(io->buf == buf + sent);
+				assert(io->len > 0);
+				sent += io->len;
+
+				if (sent < 200) {
+					assert(sc_sock_poll_send(&p, &a.fdt,
+								 buf + sent,
+								 200 - sent,
+								 &a) == 0);
+				}
+				continue;
+			}
+
+			assert(io->op == SC_SOCK_IO_RECV);
+			assert(sc_sock_poll_data(&p, i) == &b);
+			assert(sc_sock_poll_event(&p, i) == SC_SOCK_READ);
+			assert(io->len > 0 && io->len <= 16);
+			memcpy(out + recvd, io->buf, (size_t) io->len);
+			recvd += io->len;
+		}
+	}
+
+	assert(recvd == 200);
+	assert(memcmp(buf, out, sizeof(buf)) == 0);
+
+	// Removing the fd cancels the send, its completion is not reported with
+	// the data of the new send.
+	sent = 0;
+	assert(sc_sock_poll_add(&p, &a.fdt, SC_SOCK_READ, &a) == 0);
+	assert(sc_sock_poll_send(&p, &a.fdt, buf, 200, &a) == 0);
+	assert(sc_sock_poll_del(&p, &a.fdt, SC_SOCK_READ, &a) == 0);
+	assert(sc_sock_poll_send(&p, &a.fdt, buf, 1, &b) == 0);
+
+	while ((n = sc_sock_poll_wait(&p, sent == 0 ? -1 : 10)) > 0) {
+		for (int i = 0; i < n; i++) {
+			io = sc_sock_poll_io(&p, i);
+			assert(io != NULL);
+
+			if (io->op == SC_SOCK_IO_SEND) {
+				assert(sc_sock_poll_data(&p, i) == &b);
+				assert(io->len == 1);
+				sent++;
+			}
+		}
+	}
+	assert(n == 0);
+	assert(sent == 1);
+
+	// End of stream stops the receive.
+	assert(sc_sock_term(&a) == 0);
+	assert(sc_sock_poll_wait(&p, -1) == 1);
+	io = sc_sock_poll_io(&p, 0);
+	assert(io != NULL && io->op == SC_SOCK_IO_RECV && io->len == 0);
+	assert(sc_sock_poll_event(&p, 0) == (SC_SOCK_READ | SC_SOCK_WRITE));
+	assert(sc_sock_poll_wait(&p, 10) == 0);
+	assert(sc_sock_poll_recv_del(&p, &b.fdt) == 0);
+
+	assert(sc_sock_poll_term(&p) == 0);
+	assert(sc_sock_term(&b) == 0);
+}
+#else
+void test_timerfd(void)
+{
+	struct sc_sock_timer t;
+
+	assert(sc_sock_timer_init(&t, 0) != 0);
+	assert(sc_sock_timer_term(&t) == 0);
+}
+
+void test_poll_uring_io(void)
+{
+	struct sc_sock_poll p;
+	struct sc_sock_pipe pipe;
+
+	assert(sc_sock_poll_init(&p) == 0);
+	assert(sc_sock_pipe_init(&pipe, 0) == 0);
+	assert(sc_sock_poll_recv_add(&p, &pipe.fdt, &pipe) != 0);
+	assert(sc_sock_poll_send(&p, &pipe.fdt, "x", 1, &pipe) != 0);
+	assert(sc_sock_poll_recv_del(&p, &pipe.fdt) == 0);
+	assert(sc_sock_poll_io(&p, 0) == NULL);
+	assert(sc_sock_pipe_term(&pipe) == 0);
+	assert(sc_sock_poll_term(&p) == 0);
+}
+#endif
+
+void test_opts(void)
+{
+	int val;
+	struct sc_sock srv, c, in;
+	struct sc_sock_tcp_info info;
+
+	sc_sock_init(&srv, 0, true, SC_SOCK_INET);
+	assert(sc_sock_get_opt(&srv, SC_SOCK_RCVBUF, &val) != 0);
+
+	// Pending options are applied on listen.
+	assert(sc_sock_set_opt(&srv, SC_SOCK_RCVBUF, 1 << 16) == 0);
+	assert(sc_sock_set_opt(&srv, SC_SOCK_RCVBUF, 1 << 17) == 0);
+	assert(srv.opt_count == 1);
+	assert(sc_sock_set_opt(&srv, SC_SOCK_SNDBUF, 1 << 17) == 0);
+	assert(sc_sock_set_opt(&srv, SC_SOCK_NODELAY, 1) == 0);
+	assert(sc_sock_set_opt(&srv, SC_SOCK_CORK, 0) == 0);
+	assert(sc_sock_set_opt(&srv, SC_SOCK_QUICKACK, 1) != 0);
+	assert(sc_sock_listen(&srv, "127.0.0.1", "8030") == 0);
+	assert(sc_sock_get_opt(&srv, SC_SOCK_RCVBUF, &val) == 0);
+	assert(val >= 1 << 17);
+	assert(sc_sock_get_opt(&srv, SC_SOCK_NODELAY, &val) == 0);
+	assert(val != 0);
+
+	sc_sock_init(&c, 0, true, SC_SOCK_INET);
+	assert(sc_sock_connect(&c, "127.0.0.1", "8030", NULL, NULL) == 0);
+	assert(sc_sock_accept(&srv, &in) == 0);
+
+	// Unsupported option keeps its own error string.
+	assert(sc_sock_set_opt(&c, (enum sc_sock_opt) 1000, 1) == -2);
+	assert(strcmp(sc_sock_error(&c), "Option is not supported") == 0);
+	assert(sc_sock_get_opt(&c, (enum sc_sock_opt) 1000, &val) == -2);
+
+	assert(sc_sock_set_opt(&c, SC_SOCK_CORK, 1) == 0);
+	assert(sc_sock_get_opt(&c, SC_SOCK_CORK, &val) == 0);
+	assert(val != 0);
+	assert(sc_sock_send(&c, "ping", 4, 0) == 4);
+	assert(sc_sock_set_opt(&c, SC_SOCK_CORK, 0) == 0);
+
+#if defined(__linux__)
+	char buf[8];
+
+	assert(sc_sock_recv(&in, buf, sizeof(buf), 0) == 4);
+	assert(sc_sock_set_opt(&in, SC_SOCK_QUICKACK, 1) == 0);
+	assert(sc_sock_set_opt(&in, SC_SOCK_NOTSENT_LOWAT, 16384) == 0);
+	assert(sc_sock_get_opt(&in, SC_SOCK_NOTSENT_LOWAT, &val) == 0);
+	assert(val == 16384);
+	assert(sc_sock_set_opt(&srv, SC_SOCK_DEFER_ACCEPT, 1) == 0);
+	assert(sc_sock_get_opt(&in, SC_SOCK_INCOMING_CPU, &val) == 0);
+
+	assert(sc_sock_tcp_info(&c, &info) == 0);
+	assert(info.snd_mss > 0);
+	assert(info.total_retrans == 0);
+#else
+	assert(sc_sock_tcp_info(&c, &info) != 0);
+#endif
+
+	assert(sc_sock_term(&c) == 0);
+	assert(sc_sock_term(&in) == 0);
+	assert(sc_sock_term(&srv) == 0);
+
+	// Too many pending options
+	sc_sock_init(&c, 0, true, SC_SOCK_INET);
+	for (int i = 0; i < SC_SOCK_OPT_PENDING; i++) {
+		assert(sc_sock_set_opt(&c, (enum sc_sock_opt) i, 1) == 0);
+	}
+	assert(sc_sock_set_opt(&c, SC_SOCK_NOTSENT_LOWAT, 1) != 0);
+	assert(*sc_sock_error(&c) != '\0');
+	assert(sc_sock_tcp_info(&c, &info) != 0);
+
+#if !defined(_WIN32) && !defined(_WIN64)
+	// Pending options are applied to unix domain sockets too.
+	sc_sock_init(&srv, 0, true, SC_SOCK_UNIX);
+	assert(sc_sock_set_opt(&srv, SC_SOCK_RCVBUF, 1 << 17) == 0);
+	assert(sc_sock_listen(&srv, "opt.sock", NULL) == 0);
+	assert(sc_sock_get_opt(&srv, SC_SOCK_RCVBUF, &val) == 0);
+	assert(val >= 1 << 17);
+	assert(sc_sock_term(&srv) == 0);
+
+	sc_sock_init(&c, 0, true, SC_SOCK_UNIX);
+	assert(sc_sock_set_opt(&c, SC_SOCK_RCVBUF, 1 << 17) == 0);
+	assert(sc_sock_set_opt(&c, (enum sc_sock_opt) 1000, 1) == -2);
+	assert(sc_sock_connect(&c, "opt.sock", NULL, NULL, NULL) != 0);
+	assert(c.opt_count == 1);
+	remove("opt.sock");
+#endif
+}
+
+void test_stats(void)
+{
+	char buf[1024] = {0};
+	struct sc_sock srv, c, in;
+	struct sc_sock_poll p;
+	struct sc_sock_stats st;
+	struct sc_sock_poll_stats ps;
+
+	sc_sock_init(&srv, 0, true, SC_SOCK_INET);
+	assert(sc_sock_listen(&srv, "127.0.0.1", "8032") == 0);
+	sc_sock_init(&c, 0, true, SC_SOCK_INET);
+	assert(sc_sock_connect(&c, "127.0.0.1", "8032", NULL, NULL) == 0);
+	assert(sc_sock_accept(&srv, &in) == 0);
+	assert(sc_sock_poll_init(&p) == 0);
+	assert(sc_sock_poll_add(&p, &in.fdt, SC_SOCK_READ, &in) == 0);
+
+	assert(sc_sock_poll_wait(&p, 0) == 0);
+	assert(sc_sock_send(&c, buf, 100, 0) == 100);
+	assert(sc_sock_poll_wait(&p, -1) == 1);
+	assert(sc_sock_recv(&in, buf, sizeof(buf), 0) == 100);
+
+	sc_sock_stats(&c, &st, true);
+	sc_sock_poll_stats(&p, &ps, false);
+#ifdef SC_SOCK_STATS
+	assert(st.calls[SC_SOCK_CALL_CONNECT] == 1);
+	assert(st.calls[SC_SOCK_CALL_SEND] == 1);
+	assert(st.bytes_out == 100);
+	assert(st.partial_writes == 0);
+
+	sc_sock_stats(&in, &st, false);
+	assert(st.calls[SC_SOCK_CALL_RECV] == 1);
+	assert(st.bytes_in == 100);
+	assert(st.short_reads == 1);
+
+	assert(sc_sock_set_blocking(&in, false) == 0);
+	in.blocking = false;
+	assert(sc_sock_recv(&in, buf, sizeof(buf), 0) == -1);
+	sc_sock_stats(&in, &st, true);
+	assert(st.eagain == 1);
+	sc_sock_stats(&in, &st, false);
+	assert(st.calls[SC_SOCK_CALL_RECV] == 0);
+
+	sc_sock_stats(&srv, &st, false);
+	assert(st.calls[SC_SOCK_CALL_ACCEPT] == 1);
+
+	assert(ps.waits == 2);
+	assert(ps.timeouts == 1);
+	assert(ps.wakeups == 1);
+	assert(ps.events == 1);
+	assert(ps.hist[0] == 1);
+#else
+	assert(st.calls[SC_SOCK_CALL_SEND] == 0);
+	assert(ps.waits == 0);
+#endif
+	sc_sock_stats(&c, &st, false);
+	assert(st.bytes_out == 0);
+	sc_sock_poll_stats(&p, &ps, true);
+	sc_sock_poll_stats(&p, &ps, false);
+	assert(ps.waits == 0);
+
+	assert(sc_sock_poll_term(&p) == 0);
+	assert(sc_sock_term(&c) == 0);
+	assert(sc_sock_term(&in) == 0);
+	assert(sc_sock_term(&srv) == 0);
+}
+
+void test_idle(void)
+{
+	int n, total = 0;
+	struct sc_sock_idle idle;
+	struct sc_sock_idle_entry e[100], *out[16];
+
+	assert(sc_sock_idle_init(&idle, 100, 10) == 0);
+	assert(sc_sock_idle_timeout(&idle) == -1);
+
+	for (int i = 0; i < 100; i++) {
+		sc_sock_idle_add(&idle, &e[i], &e[i]);
+	}
+	assert(idle.size == 100);
+	assert(sc_sock_idle_timeout(&idle) <= 10);
+
+	sc_sock_idle_del(&idle, &e[99]);
+	sc_sock_idle_del(&idle, &e[99]);
+	assert(idle.size == 99);
+
+	// Keep the first entry active, the rest expire in batches.
+	for (int i = 0; i < 10; i++) {
+		sc_time_sleep(20);
+		while ((n = sc_sock_idle_expired(&idle, out, 16)) > 0) {
+			for (int j = 0; j < n; j++) {
+				assert(idle.now - out[j]->last >= 100);
+				assert(out[j]->data == out[j]);
+				if (out[j] == &e[0]) {
+					// Stalled longer than the timeout.
+					sc_sock_idle_add(&idle, &e[0], &e[0]);
+					continue;
+				}
+				total++;
+			}
+		}
+		sc_sock_idle_touch(&idle, &e[0]);
+	}
+
+	assert(total == 98);
+	assert(idle.size == 1);
+
+	sc_time_sleep(150);
+	assert(sc_sock_idle_expired(&idle, out, 16) == 1);
+	assert(out[0] == &e[0]);
+	assert(idle.size == 0);
+	assert(sc_sock_idle_timeout(&idle) == -1);
+
+	// A pause longer than the wheel walks each bucket once.
+	sc_sock_idle_add(&idle, &e[1], &e[1]);
+	idle.pos -= 1000000;
+	assert(sc_sock_idle_expired(&idle, out, 16) == 0);
+	assert(idle.pos + idle.count >= idle.now / idle.tick);
+	assert(idle.size == 1);
+	assert(sc_sock_idle_term(&idle) == 0);
+	assert(*sc_sock_idle_err(&idle) == '\0');
+}
+
 void test_err(void)
 {
 	struct sc_sock sock;
@@ -2049,6 +3721,25 @@ int main(void)
 	test_poll_edge();
 	test_poll_threadsafe();
 	test_poll_multithreaded_accept();
+	test_poll_uring();
+	test_poll_uring_io();
+	test_poll_conf();
+	test_udp_batch();
+	test_listener();
+	test_sendfile();
+	test_relay();
+	test_drain();
+	test_wq();
+	test_zerocopy();
+	test_resolver();
+	test_eyeballs();
+	test_notify();
+	test_opts();
+	test_stats();
+	test_handoff();
+	test_spin();
+	test_idle();
+	test_timerfd();
 
 	assert(sc_sock_cleanup() == 0);
 
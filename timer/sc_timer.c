@@ -32,174 +32,1036 @@
 #include "sc_timer.h"
 
 #include <assert.h>
-#include <memory.h>
+#include <string.h>
 
-#define TICK 16u
-#define WHEEL_COUNT 16u
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#endif
 
 #ifndef SC_TIMER_MAX
-#define SC_TIMER_MAX ((UINT32_MAX / sizeof(struct sc_timer_data)) / WHEEL_COUNT)
+#define SC_TIMER_MAX (UINT32_MAX / 2u)
 #endif
 
-void sc_timer_init(struct sc_timer *t, uint64_t timestamp)
+#define SC_TIMER_NIL UINT32_MAX
+#define SC_TIMER_EXPIRED (SC_TIMER_LEVELS * SC_TIMER_SLOTS)
+#define SC_TIMER_FREE (SC_TIMER_EXPIRED + 1)
+#define SC_TIMER_RESERVED (SC_TIMER_EXPIRED + 2)
+
+static uint32_t sc_timer_msb(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return 63u - (uint32_t) __builtin_clzll(x);
+#else
+	uint32_t n = 0;
+
+	while (x >>= 1) {
+		n++;
+	}
+
+	return n;
+#endif
+}
+
+static uint32_t sc_timer_lsb(uint64_t x)
 {
+#if defined(__GNUC__) || defined(__clang__)
+	return (uint32_t) __builtin_ctzll(x);
+#else
+	uint32_t n = 0;
+
+	while ((x & 1) == 0) {
+		x >>= 1;
+		n++;
+	}
+
+	return n;
+#endif
+}
+
+void sc_timer_init_tick(struct sc_timer *t, uint64_t timestamp, uint64_t tick)
+{
+	assert(tick != 0);
+
 	*t = (struct sc_timer){
 		.timestamp = timestamp,
+		.tick = tick,
+		.current = timestamp / tick,
 	};
+
+	memset(t->mins, 0xff, sizeof(t->mins));
+	memset(t->lists, 0xff, sizeof(t->lists));
+}
+
+void sc_timer_init(struct sc_timer *t, uint64_t timestamp)
+{
+	sc_timer_init_tick(t, timestamp, SC_TIMER_TICK);
 }
 
 void sc_timer_term(struct sc_timer *t)
 {
-	sc_timer_free(t->list);
+	for (uint32_t c = 0; c < t->chunk_count; c++) {
+		sc_timer_free(t->chunks[c]);
+	}
 
-	*t = (struct sc_timer){
-		.timestamp = t->timestamp,
-	};
+	sc_timer_free(t->chunks);
+	sc_timer_free(t->avail);
+	sc_timer_free(t->ring);
+	sc_timer_free(t->ids);
+	sc_timer_init_tick(t, t->timestamp, t->tick);
 }
 
-void sc_timer_clear(struct sc_timer *t)
+static struct sc_timer_node *sc_timer_at(struct sc_timer *t, uint32_t i)
+{
+	struct sc_timer_chunk *chunk = t->chunks[i >> SC_TIMER_CHUNK_BITS];
+
+	return &chunk->nodes[i & (SC_TIMER_CHUNK - 1)];
+}
+
+static void sc_timer_reset_chunk(struct sc_timer *t, uint32_t c)
 {
-	const uint32_t cap = t->wheel * WHEEL_COUNT;
+	struct sc_timer_chunk *chunk = t->chunks[c];
+	struct sc_timer_node *n;
+
+	chunk->used = 0;
+	chunk->free = SC_TIMER_NIL;
 
-	t->head = 0;
+	for (uint32_t i = SC_TIMER_CHUNK; i > 0; i--) {
+		n = &chunk->nodes[i - 1];
 
-	for (uint32_t i = 0; i < cap; i++) {
-		t->list[i].timeout = SC_TIMER_INVALID;
-		t->list[i].data = NULL;
+		// Reserved ids are already handed to producers.
+		if (n->list == SC_TIMER_RESERVED) {
+			chunk->used++;
+			continue;
+		}
+
+		// Stale ids of the active timers must not match anymore.
+		if (n->list != SC_TIMER_FREE) {
+			n->gen++;
+			n->list = SC_TIMER_FREE;
+			n->entry.data = NULL;
+		}
+
+		n->next = chunk->free;
+		chunk->free = i - 1;
 	}
+
+	t->avail[c / 64] |= 1ull << (c % 64);
 }
 
-static bool expand(struct sc_timer *t)
+static void sc_timer_free_chunk(struct sc_timer *t, uint32_t c)
 {
-	uint32_t wheel = t->wheel != 0 ? t->wheel * 2 : 4;
-	uint32_t cap = wheel * WHEEL_COUNT * 2;
-	size_t size = cap * sizeof(struct sc_timer_data);
-	struct sc_timer_data *alloc;
+	struct sc_timer_chunk *chunk = t->chunks[c];
 
-	assert(size != 0);
+	// A new chunk in this place starts after the highest generation, so the
+	// ids of the released timers never match again.
+	for (uint32_t i = 0; i < SC_TIMER_CHUNK; i++) {
+		if (chunk->nodes[i].gen >= t->gen) {
+			t->gen = chunk->nodes[i].gen + 1;
+		}
+	}
 
-	if (t->wheel >= SC_TIMER_MAX / 2) {
-		return false;
+	sc_timer_free(chunk);
+	t->chunks[c] = NULL;
+	t->avail[c / 64] &= ~(1ull << (c % 64));
+	t->cap -= SC_TIMER_CHUNK;
+	t->empty--;
+}
+
+// Releases the highest empty chunk if less than half of the capacity would be
+// in use after that. Keeps the last chunk and leaves a gap, so a chunk is not
+// allocated and released repeatedly around a boundary.
+static void sc_timer_shrink_once(struct sc_timer *t)
+{
+	if (t->empty == 0 || t->count >= (t->cap - SC_TIMER_CHUNK) / 2) {
+		return;
 	}
 
-	alloc = sc_timer_malloc(size);
-	if (alloc == NULL) {
-		return false;
+	for (uint32_t c = t->chunk_count; c > 0; c--) {
+		if (t->chunks[c - 1] != NULL && t->chunks[c - 1]->used == 0) {
+			sc_timer_free_chunk(t, c - 1);
+			return;
+		}
+	}
+}
+
+void sc_timer_shrink(struct sc_timer *t)
+{
+	uint32_t count = 0;
+
+	for (uint32_t c = 0; c < t->chunk_count; c++) {
+		if (t->chunks[c] != NULL && t->chunks[c]->used == 0) {
+			sc_timer_free_chunk(t, c);
+		}
+
+		count = t->chunks[c] != NULL ? c + 1 : count;
 	}
 
-	for (uint32_t i = 0; i < cap; i++) {
-		alloc[i].timeout = SC_TIMER_INVALID;
-		alloc[i].data = NULL;
+	if (count == 0) {
+		sc_timer_free(t->chunks);
+		sc_timer_free(t->avail);
+		t->chunks = NULL;
+		t->avail = NULL;
+		t->chunk_count = 0;
 	}
+}
+
+size_t sc_timer_memory(struct sc_timer *t)
+{
+	size_t size = 0;
+
+	size += (t->cap / SC_TIMER_CHUNK) * sizeof(struct sc_timer_chunk);
+	size += (size_t) t->chunk_count * sizeof(*t->chunks);
+	size += (size_t) ((t->chunk_count + 63) / 64) * sizeof(*t->avail);
 
-	// Copy from old list to new list
-	if (t->wheel != 0) {
-		for (uint32_t i = 0; i < WHEEL_COUNT; i++) {
-			void *dest = &alloc[(i * t->wheel * 2)];
-			void *src = &t->list[(i * t->wheel)];
-			size_t copy = sizeof(struct sc_timer_data) * t->wheel;
+	if (t->ring != NULL) {
+		size += (size_t) (t->ring_mask + 1) * sizeof(*t->ring);
+		size += (size_t) (t->ring_mask + 1) * sizeof(*t->ids);
+	}
 
-			memcpy(dest, src, copy);
+	return size;
+}
+
+static void sc_timer_release(struct sc_timer *t, uint32_t i)
+{
+	uint32_t c = i >> SC_TIMER_CHUNK_BITS;
+	struct sc_timer_chunk *chunk = t->chunks[c];
+	struct sc_timer_node *n = &chunk->nodes[i & (SC_TIMER_CHUNK - 1)];
+
+	n->gen++;
+	n->list = SC_TIMER_FREE;
+	n->entry.data = NULL;
+	n->next = chunk->free;
+	chunk->free = i & (SC_TIMER_CHUNK - 1);
+
+	t->avail[c / 64] |= 1ull << (c % 64);
+	t->count--;
+
+	if (--chunk->used == 0) {
+		t->empty++;
+	}
+
+	sc_timer_shrink_once(t);
+}
+
+void sc_timer_clear(struct sc_timer *t)
+{
+	t->count = 0;
+	t->empty = 0;
+
+	memset(t->pending, 0, sizeof(t->pending));
+	memset(t->dirty, 0, sizeof(t->dirty));
+	memset(t->mins, 0xff, sizeof(t->mins));
+	memset(t->lists, 0xff, sizeof(t->lists));
+
+	for (uint32_t c = 0; c < t->chunk_count; c++) {
+		if (t->chunks[c] != NULL) {
+			sc_timer_reset_chunk(t, c);
+			t->empty += (t->chunks[c]->used == 0);
 		}
 	}
+}
+
+static bool sc_timer_grow_table(struct sc_timer *t)
+{
+	uint32_t count = t->chunk_count != 0 ? t->chunk_count * 2 : 1;
+	size_t words = (t->chunk_count + 63) / 64;
+	struct sc_timer_chunk **chunks;
+	uint64_t *avail;
 
-	sc_timer_free(t->list);
+	chunks = sc_timer_malloc(sizeof(*chunks) * count);
+	avail = sc_timer_malloc(sizeof(*avail) * ((count + 63) / 64));
+	if (chunks == NULL || avail == NULL) {
+		sc_timer_free(chunks);
+		sc_timer_free(avail);
+		return false;
+	}
+
+	memset(chunks, 0, sizeof(*chunks) * count);
+	memset(avail, 0, sizeof(*avail) * ((count + 63) / 64));
+
+	if (t->chunk_count != 0) {
+		memcpy(chunks, t->chunks, sizeof(*chunks) * t->chunk_count);
+		memcpy(avail, t->avail, sizeof(*avail) * words);
+	}
 
-	t->list = alloc;
-	t->wheel = wheel;
+	sc_timer_free(t->chunks);
+	sc_timer_free(t->avail);
+	t->chunks = chunks;
+	t->avail = avail;
+	t->chunk_count = count;
 
 	return true;
 }
 
+// Allocates a chunk into the first gap in the table. Existing chunks never
+// move, growth doesn't copy timers.
+static uint32_t sc_timer_expand(struct sc_timer *t)
+{
+	uint32_t c;
+	struct sc_timer_chunk *chunk;
+
+	if (t->cap >= SC_TIMER_MAX) {
+		return SC_TIMER_NIL;
+	}
+
+	for (c = 0; c < t->chunk_count; c++) {
+		if (t->chunks[c] == NULL) {
+			break;
+		}
+	}
+
+	if (c == t->chunk_count && !sc_timer_grow_table(t)) {
+		return SC_TIMER_NIL;
+	}
+
+	chunk = sc_timer_malloc(sizeof(*chunk));
+	if (chunk == NULL) {
+		return SC_TIMER_NIL;
+	}
+
+	for (uint32_t i = 0; i < SC_TIMER_CHUNK; i++) {
+		chunk->nodes[i].gen = t->gen;
+		chunk->nodes[i].list = SC_TIMER_FREE;
+	}
+
+	t->chunks[c] = chunk;
+	t->cap += SC_TIMER_CHUNK;
+	t->empty++;
+	sc_timer_reset_chunk(t, c);
+
+	return c;
+}
+
+// Takes a node from the lowest chunk which has one, so the higher chunks
+// drain and get released after a burst.
+static uint32_t sc_timer_alloc(struct sc_timer *t)
+{
+	uint32_t i, c = SC_TIMER_NIL;
+	struct sc_timer_chunk *chunk;
+
+	for (uint32_t w = 0; w < (t->chunk_count + 63) / 64; w++) {
+		if (t->avail[w] != 0) {
+			c = w * 64 + sc_timer_lsb(t->avail[w]);
+			break;
+		}
+	}
+
+	if (c == SC_TIMER_NIL) {
+		c = sc_timer_expand(t);
+		if (c == SC_TIMER_NIL) {
+			return SC_TIMER_NIL;
+		}
+	}
+
+	chunk = t->chunks[c];
+	i = chunk->free;
+	chunk->free = chunk->nodes[i].next;
+
+	if (chunk->used++ == 0) {
+		t->empty--;
+	}
+
+	if (chunk->free == SC_TIMER_NIL) {
+		t->avail[c / 64] &= ~(1ull << (c % 64));
+	}
+
+	return (c << SC_TIMER_CHUNK_BITS) | i;
+}
+
+static uint64_t sc_timer_expiry(struct sc_timer *t, uint32_t i)
+{
+	uint64_t timeout = sc_timer_at(t, i)->entry.timeout;
+
+	return timeout / t->tick + (timeout % t->tick != 0);
+}
+
+static void sc_timer_link(struct sc_timer *t, uint32_t list, uint32_t i,
+			  uint64_t expiry)
+{
+	struct sc_timer_node *n = sc_timer_at(t, i);
+
+	n->list = list;
+	n->prev = SC_TIMER_NIL;
+	n->next = t->lists[list];
+
+	if (n->next != SC_TIMER_NIL) {
+		sc_timer_at(t, n->next)->prev = i;
+	}
+
+	t->lists[list] = i;
+
+	if (list != SC_TIMER_EXPIRED) {
+		t->pending[list / SC_TIMER_SLOTS] |= 1ull << (list % SC_TIMER_SLOTS);
+		t->mins[list] = expiry < t->mins[list] ? expiry : t->mins[list];
+	}
+}
+
+static void sc_timer_unlink(struct sc_timer *t, uint32_t i)
+{
+	struct sc_timer_node *n = sc_timer_at(t, i);
+	const uint32_t list = n->list;
+	const uint32_t level = list / SC_TIMER_SLOTS;
+	const uint64_t bit = 1ull << (list % SC_TIMER_SLOTS);
+
+	if (n->prev != SC_TIMER_NIL) {
+		sc_timer_at(t, n->prev)->next = n->next;
+	} else {
+		t->lists[list] = n->next;
+	}
+
+	if (n->next != SC_TIMER_NIL) {
+		sc_timer_at(t, n->next)->prev = n->prev;
+	}
+
+	if (list == SC_TIMER_EXPIRED) {
+		return;
+	}
+
+	if (t->lists[list] == SC_TIMER_NIL) {
+		t->pending[level] &= ~bit;
+		t->dirty[level] &= ~bit;
+		t->mins[list] = UINT64_MAX;
+	} else if (sc_timer_expiry(t, i) == t->mins[list]) {
+		t->dirty[level] |= bit;
+	}
+}
+
+// Timers are placed on the level of the highest tick bit that differs from
+// the current tick. So, a timer moves down at most once per level until it
+// expires and each tick touches only the slots which are due.
+static void sc_timer_place(struct sc_timer *t, uint32_t i, uint64_t expiry)
+{
+	uint32_t level, slot;
+
+	if (expiry <= t->current) {
+		sc_timer_link(t, SC_TIMER_EXPIRED, i, expiry);
+		return;
+	}
+
+	level = sc_timer_msb(expiry ^ t->current) / SC_TIMER_BITS;
+	slot = (uint32_t) (expiry >> (level * SC_TIMER_BITS)) &
+	       (SC_TIMER_SLOTS - 1);
+
+	sc_timer_link(t, level * SC_TIMER_SLOTS + slot, i, expiry);
+}
+
+// Returns the tick in [expiry, expiry + slack] with the most trailing zero
+// bits, so nearby windows meet on the same tick.
+static uint64_t sc_timer_align(struct sc_timer *t, uint64_t expiry,
+			       uint32_t slack)
+{
+	uint64_t max = (UINT64_MAX - 1) / t->tick;
+	uint64_t end = expiry < max - slack ? expiry + slack : max;
+	uint32_t bit;
+
+	if (end <= expiry) {
+		return expiry;
+	}
+
+	// Highest differing bit is zero in 'expiry', one in 'end'.
+	bit = sc_timer_msb(expiry ^ end);
+	if ((expiry & ((((uint64_t) 2) << bit) - 1)) == 0) {
+		return expiry;
+	}
+
+	return end & ~((((uint64_t) 1) << bit) - 1);
+}
+
+static void sc_timer_schedule(struct sc_timer *t, uint32_t i, uint64_t timeout)
+{
+	uint64_t expiry;
+	struct sc_timer_node *n = sc_timer_at(t, i);
+
+	n->entry.timeout = timeout < UINT64_MAX - t->timestamp ?
+				   t->timestamp + timeout :
+				   UINT64_MAX - 1;
+
+	// Never expires in the current tick, it has already been processed.
+	// Clamped expiry is stored, slot minimums are compared against it.
+	expiry = sc_timer_expiry(t, i);
+	if (expiry <= t->current) {
+		expiry = t->current + 1;
+		n->entry.timeout = expiry * t->tick;
+	}
+
+	if (n->slack != 0) {
+		expiry = sc_timer_align(t, expiry, n->slack);
+		n->entry.timeout = expiry * t->tick;
+	}
+
+	sc_timer_place(t, i, expiry);
+}
+
+// Returns node index of an active timer, SC_TIMER_NIL for stale ids.
+static uint32_t sc_timer_find(struct sc_timer *t, uint64_t id)
+{
+	uint32_t i = (uint32_t) id;
+
+	if (id == SC_TIMER_INVALID ||
+	    (i >> SC_TIMER_CHUNK_BITS) >= t->chunk_count ||
+	    t->chunks[i >> SC_TIMER_CHUNK_BITS] == NULL ||
+	    sc_timer_at(t, i)->gen != (uint32_t) (id >> 32u) ||
+	    sc_timer_at(t, i)->list >= SC_TIMER_FREE) {
+		return SC_TIMER_NIL;
+	}
+
+	return i;
+}
+
 uint64_t sc_timer_add(struct sc_timer *t, uint64_t timeout, uint64_t type,
 		      void *data)
 {
-	const uint32_t offset = (uint32_t) (timeout / TICK + t->head);
-	const uint32_t pos = offset & (WHEEL_COUNT - 1);
-	uint64_t id;
-	uint32_t seq, index, wheel_pos;
+	return sc_timer_add_slack(t, timeout, 0, type, data);
+}
+
+uint64_t sc_timer_add_slack(struct sc_timer *t, uint64_t timeout,
+			    uint64_t slack, uint64_t type, void *data)
+{
+	uint32_t i;
+	struct sc_timer_node *n;
+
+	i = sc_timer_alloc(t);
+	if (i == SC_TIMER_NIL) {
+		return SC_TIMER_INVALID;
+	}
+
+	n = sc_timer_at(t, i);
+	t->count++;
+
+	n->entry = (struct sc_timer_data){
+		.type = type,
+		.data = data,
+	};
+
+	slack /= t->tick;
+	n->slack = slack < UINT32_MAX ? (uint32_t) slack : UINT32_MAX;
+
+	sc_timer_schedule(t, i, timeout);
+
+	return ((uint64_t) n->gen << 32u) | i;
+}
+
+void sc_timer_cancel(struct sc_timer *t, uint64_t *id)
+{
+	uint32_t i = sc_timer_find(t, *id);
+
+	if (i != SC_TIMER_NIL) {
+		sc_timer_unlink(t, i);
+		sc_timer_release(t, i);
+	}
+
+	*id = SC_TIMER_INVALID;
+}
+
+void *sc_timer_data(struct sc_timer *t, uint64_t id)
+{
+	uint32_t i = sc_timer_find(t, id);
+
+	return i != SC_TIMER_NIL ? sc_timer_at(t, i)->entry.data : NULL;
+}
+
+bool sc_timer_reschedule(struct sc_timer *t, uint64_t *id, uint64_t timeout)
+{
+	uint32_t i = sc_timer_find(t, *id);
+
+	if (i == SC_TIMER_NIL) {
+		*id = SC_TIMER_INVALID;
+		return false;
+	}
+
+	sc_timer_unlink(t, i);
+	sc_timer_schedule(t, i, timeout);
+
+	return true;
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+
+static uint64_t sc_timer_load(uint64_t *p)
+{
+	return (uint64_t) InterlockedOr64((LONG64 volatile *) p, 0);
+}
+
+static void sc_timer_store(uint64_t *p, uint64_t val)
+{
+	InterlockedExchange64((LONG64 volatile *) p, (LONG64) val);
+}
+
+static bool sc_timer_cas(uint64_t *p, uint64_t *expected, uint64_t val)
+{
+	LONG64 prev;
+
+	prev = InterlockedCompareExchange64((LONG64 volatile *) p, (LONG64) val,
+					    (LONG64) *expected);
+	if ((uint64_t) prev == *expected) {
+		return true;
+	}
+
+	*expected = (uint64_t) prev;
+	return false;
+}
+
+#else
+
+static uint64_t sc_timer_load(uint64_t *p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void sc_timer_store(uint64_t *p, uint64_t val)
+{
+	__atomic_store_n(p, val, __ATOMIC_RELEASE);
+}
+
+static bool sc_timer_cas(uint64_t *p, uint64_t *expected, uint64_t val)
+{
+	return __atomic_compare_exchange_n(p, expected, val, true,
+					   __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+#endif
+
+// Reserves nodes until each ring slot can carry an add. Producers never touch
+// the nodes, they only take the ids.
+static void sc_timer_reserve(struct sc_timer *t)
+{
+	uint32_t i;
+	struct sc_timer_node *n;
+	struct sc_timer_reserved *slot;
 
-	wheel_pos = (pos * t->wheel);
-	for (seq = 0; seq < t->wheel; seq++) {
-		index = wheel_pos + seq;
-		if (t->list[index].timeout == SC_TIMER_INVALID) {
-			goto out;
+	while (t->ids_count <= t->ring_mask) {
+		slot = &t->ids[t->ids_tail & t->ring_mask];
+		if (sc_timer_load(&slot->seq) != t->ids_tail) {
+			return;
 		}
+
+		i = sc_timer_alloc(t);
+		if (i == SC_TIMER_NIL) {
+			return;
+		}
+
+		n = sc_timer_at(t, i);
+		n->list = SC_TIMER_RESERVED;
+
+		slot->id = ((uint64_t) n->gen << 32u) | i;
+		sc_timer_store(&slot->seq, t->ids_tail + 1);
+		t->ids_tail++;
+		t->ids_count++;
 	}
+}
 
-	if (!expand(t)) {
-		return SC_TIMER_INVALID;
+int sc_timer_submit_init(struct sc_timer *t, uint32_t cap)
+{
+	uint64_t size = 2;
+
+	if (t->ring != NULL) {
+		return 0;
+	}
+
+	while (size < cap) {
+		size *= 2;
 	}
 
-	index = (pos * t->wheel) + (seq);
-	assert(t->list[index].timeout == SC_TIMER_INVALID);
+	t->ring = sc_timer_malloc(sizeof(*t->ring) * size);
+	t->ids = sc_timer_malloc(sizeof(*t->ids) * size);
+	if (t->ring == NULL || t->ids == NULL) {
+		sc_timer_free(t->ring);
+		sc_timer_free(t->ids);
+		t->ring = NULL;
+		t->ids = NULL;
+		return -1;
+	}
 
-out:
-	t->list[index].timeout = timeout + t->timestamp;
-	t->list[index].type = type;
-	t->list[index].data = data;
+	// Slot 'i' is free for the producer at position 'i'. Producer sets it
+	// to 'pos + 1' when the command is ready, consumer sets it to
+	// 'pos + size' when the slot can be reused on the next lap. Reserved
+	// id queue works the same way, with roles swapped.
+	for (uint64_t i = 0; i < size; i++) {
+		t->ring[i].seq = i;
+		t->ids[i].seq = i;
+	}
 
-	id = (((uint64_t) seq) << 32u) | pos;
-	assert(id != SC_TIMER_INVALID);
+	t->ring_mask = size - 1;
+	t->ring_head = 0;
+	t->ring_tail = 0;
+	t->ids_head = 0;
+	t->ids_tail = 0;
+	t->ids_count = 0;
+
+	sc_timer_reserve(t);
+
+	return 0;
+}
+
+static struct sc_timer_cmd *sc_timer_claim(struct sc_timer *t, uint64_t *pos)
+{
+	int64_t diff;
+	uint64_t seq;
+	struct sc_timer_cmd *slot;
+
+	*pos = sc_timer_load(&t->ring_tail);
+
+	for (;;) {
+		slot = &t->ring[*pos & t->ring_mask];
+		seq = sc_timer_load(&slot->seq);
+		diff = (int64_t) (seq - *pos);
+
+		if (diff == 0) {
+			if (sc_timer_cas(&t->ring_tail, pos, *pos + 1)) {
+				return slot;
+			}
+		} else if (diff < 0) {
+			// Slot of the previous lap is not consumed yet.
+			return NULL;
+		} else {
+			*pos = sc_timer_load(&t->ring_tail);
+		}
+	}
+}
+
+// Takes a reserved id, SC_TIMER_INVALID if there is none.
+static uint64_t sc_timer_take_id(struct sc_timer *t)
+{
+	int64_t diff;
+	uint64_t id, seq, pos = sc_timer_load(&t->ids_head);
+	struct sc_timer_reserved *slot;
+
+	for (;;) {
+		slot = &t->ids[pos & t->ring_mask];
+		seq = sc_timer_load(&slot->seq);
+		diff = (int64_t) (seq - (pos + 1));
+
+		if (diff == 0) {
+			if (sc_timer_cas(&t->ids_head, &pos, pos + 1)) {
+				break;
+			}
+		} else if (diff < 0) {
+			return SC_TIMER_INVALID;
+		} else {
+			pos = sc_timer_load(&t->ids_head);
+		}
+	}
+
+	id = slot->id;
+	sc_timer_store(&slot->seq, pos + t->ring_mask + 1);
 
 	return id;
 }
 
-void sc_timer_cancel(struct sc_timer *t, uint64_t *id)
+static int sc_timer_submit(struct sc_timer *t, struct sc_timer_cmd *cmd)
 {
 	uint64_t pos;
+	struct sc_timer_cmd *slot;
 
-	if (*id == SC_TIMER_INVALID) {
-		return;
+	slot = sc_timer_claim(t, &pos);
+	if (slot == NULL) {
+		return -1;
 	}
 
-	pos = (uint64_t) (((uint32_t) *id) * t->wheel) + (*id >> 32u);
+	slot->op = cmd->op;
+	slot->id = cmd->id;
+	slot->timeout = cmd->timeout;
+	slot->type = cmd->type;
+	slot->data = cmd->data;
 
-	t->list[pos].timeout = SC_TIMER_INVALID;
-	*id = SC_TIMER_INVALID;
+	sc_timer_store(&slot->seq, pos + 1);
+
+	return 0;
 }
 
-#define sc_timer_min(a, b) (a) < (b) ? (a) : (b)
+int sc_timer_submit_add(struct sc_timer *t, uint64_t timeout, uint64_t type,
+			void *data, uint64_t *id)
+{
+	uint64_t pos, reserved;
+	struct sc_timer_cmd *slot;
 
-uint64_t sc_timer_timeout(struct sc_timer *t, uint64_t timestamp, void *arg,
-			  void (*callback)(void *, uint64_t, uint64_t, void *))
+	// Ring slot is claimed first, so a taken id always has its add
+	// command queued.
+	slot = sc_timer_claim(t, &pos);
+	if (slot == NULL) {
+		return -1;
+	}
+
+	reserved = sc_timer_take_id(t);
+
+	slot->op = reserved != SC_TIMER_INVALID ? SC_TIMER_OP_ADD :
+						  SC_TIMER_OP_NONE;
+	slot->id = reserved;
+	slot->timeout = timeout;
+	slot->type = type;
+	slot->data = data;
+
+	// Slot may be reused by others once it is published.
+	sc_timer_store(&slot->seq, pos + 1);
+
+	if (id != NULL) {
+		*id = reserved;
+	}
+
+	return reserved != SC_TIMER_INVALID ? 0 : -1;
+}
+
+int sc_timer_submit_cancel(struct sc_timer *t, uint64_t id)
+{
+	struct sc_timer_cmd cmd = {
+		.op = SC_TIMER_OP_CANCEL,
+		.id = id,
+	};
+
+	return sc_timer_submit(t, &cmd);
+}
+
+int sc_timer_submit_reschedule(struct sc_timer *t, uint64_t id,
+			       uint64_t timeout)
+{
+	struct sc_timer_cmd cmd = {
+		.op = SC_TIMER_OP_RESCHEDULE,
+		.id = id,
+		.timeout = timeout,
+	};
+
+	return sc_timer_submit(t, &cmd);
+}
+
+static bool sc_timer_ring_pending(struct sc_timer *t)
+{
+	struct sc_timer_cmd *slot = &t->ring[t->ring_head & t->ring_mask];
+
+	return sc_timer_load(&slot->seq) == t->ring_head + 1;
+}
+
+static void sc_timer_add_reserved(struct sc_timer *t, struct sc_timer_cmd *cmd)
+{
+	uint32_t i = (uint32_t) cmd->id;
+	struct sc_timer_node *n = sc_timer_at(t, i);
+
+	assert(n->list == SC_TIMER_RESERVED);
+
+	t->ids_count--;
+	t->count++;
+
+	n->entry = (struct sc_timer_data){
+		.type = cmd->type,
+		.data = cmd->data,
+	};
+	n->slack = 0;
+
+	sc_timer_schedule(t, i, cmd->timeout);
+}
+
+static void sc_timer_drain(struct sc_timer *t)
 {
-	const uint64_t time = timestamp - t->timestamp;
-	uint64_t timeout;
-	uint32_t wheel, base;
-	uint32_t head = t->head;
-	uint32_t wheels = (uint32_t) (sc_timer_min(time / TICK, WHEEL_COUNT));
-	struct sc_timer_data *item;
+	struct sc_timer_cmd cmd, *slot;
+
+	while (sc_timer_ring_pending(t)) {
+		slot = &t->ring[t->ring_head & t->ring_mask];
+		cmd = *slot;
 
-	if (wheels == 0) {
-		return sc_timer_min(TICK - time, TICK);
+		sc_timer_store(&slot->seq, t->ring_head + t->ring_mask + 1);
+		t->ring_head++;
+
+		switch (cmd.op) {
+		case SC_TIMER_OP_NONE:
+			break;
+		case SC_TIMER_OP_ADD:
+			sc_timer_add_reserved(t, &cmd);
+			break;
+		case SC_TIMER_OP_CANCEL:
+			sc_timer_cancel(t, &cmd.id);
+			break;
+		case SC_TIMER_OP_RESCHEDULE:
+			sc_timer_reschedule(t, &cmd.id, cmd.timeout);
+			break;
+		}
 	}
 
+	sc_timer_reserve(t);
+}
+
+// Returns the tick that a slot must be processed at, either to expire or to
+// move its timers to lower levels. Occupied slots are always ahead of the
+// current position on their level.
+static uint64_t sc_timer_slot_tick(struct sc_timer *t, uint32_t level,
+				   uint32_t slot)
+{
+	const uint32_t shift = level * SC_TIMER_BITS;
+	const uint32_t upper = shift + SC_TIMER_BITS;
+	uint64_t base;
+
+	base = upper >= 64 ? 0 : (t->current >> upper) << upper;
+
+	return base | ((uint64_t) slot << shift);
+}
+
+// Returns the earliest tick that a slot must be processed at, UINT64_MAX if
+// there is no timer.
+static uint64_t sc_timer_next_tick(struct sc_timer *t)
+{
+	uint64_t tick, next = UINT64_MAX;
+
+	for (uint32_t level = 0; level < SC_TIMER_LEVELS; level++) {
+		if (t->pending[level] == 0) {
+			continue;
+		}
+
+		tick = sc_timer_slot_tick(t, level,
+					  sc_timer_lsb(t->pending[level]));
+		assert(tick > t->current);
+		next = tick < next ? tick : next;
+	}
+
+	return next;
+}
+
+// Moves timers of the slots which are due at the current tick to lower levels
+// or to the expired list.
+static void sc_timer_cascade(struct sc_timer *t)
+{
+	uint32_t i, list, slot, shift;
+	uint64_t mask;
+
+	for (uint32_t level = SC_TIMER_LEVELS; level-- > 0;) {
+		shift = level * SC_TIMER_BITS;
+		mask = (1ull << shift) - 1;
+
+		if ((t->current & mask) != 0) {
+			continue;
+		}
+
+		slot = (uint32_t) (t->current >> shift) & (SC_TIMER_SLOTS - 1);
+		if ((t->pending[level] & (1ull << slot)) == 0) {
+			continue;
+		}
+
+		list = level * SC_TIMER_SLOTS + slot;
+
+		while ((i = t->lists[list]) != SC_TIMER_NIL) {
+			sc_timer_unlink(t, i);
+			sc_timer_place(t, i, sc_timer_expiry(t, i));
+		}
+	}
+}
+
+static uint64_t sc_timer_run(struct sc_timer *t, uint64_t timestamp,
+			     void *arg,
+			     void (*callback)(void *, uint64_t, uint64_t,
+					      void *),
+			     void (*batch_cb)(void *, struct sc_timer_data *,
+					      size_t))
+{
+	uint32_t i;
+	size_t n = 0;
+	uint64_t next, target = timestamp / t->tick;
+	struct sc_timer_data entry;
+	struct sc_timer_data batch[SC_TIMER_BATCH];
+
 	t->timestamp = timestamp;
-	t->head = (t->head + wheels) & (WHEEL_COUNT - 1);
 
-	while (wheels-- > 0) {
-		wheel = t->wheel;
-		base = wheel * head;
+	if (t->ring != NULL) {
+		sc_timer_drain(t);
+	}
 
-		for (uint32_t i = 0; i < wheel; i++) {
-			item = &t->list[base + i];
+	while (t->current < target) {
+		next = sc_timer_next_tick(t);
+		if (next > target) {
+			t->current = target;
+			break;
+		}
+
+		t->current = next;
+		sc_timer_cascade(t);
+
+		// Callbacks may add or cancel timers, including the ones in the
+		// expired list.
+		while ((i = t->lists[SC_TIMER_EXPIRED]) != SC_TIMER_NIL) {
+			entry = sc_timer_at(t, i)->entry;
 
-			if (item->timeout <= t->timestamp) {
-				timeout = item->timeout;
-				item->timeout = SC_TIMER_INVALID;
+			sc_timer_unlink(t, i);
+			sc_timer_release(t, i);
 
-				callback(arg, timeout, item->type, item->data);
+			if (callback != NULL) {
+				callback(arg, entry.timeout, entry.type,
+					 entry.data);
+				continue;
+			}
 
-				// Recalculates position each time because there
-				// might be newly added timers in the callback,
-				// and it might require expansion of the list.
-				base = t->wheel * head;
+			batch[n++] = entry;
+			if (n == SC_TIMER_BATCH) {
+				batch_cb(arg, batch, n);
+				n = 0;
 			}
 		}
 
-		head = (head + 1) & (WHEEL_COUNT - 1);
+		if (n != 0) {
+			batch_cb(arg, batch, n);
+			n = 0;
+		}
+	}
+
+	return (t->current + 1) * t->tick - timestamp;
+}
+
+uint64_t sc_timer_timeout(struct sc_timer *t, uint64_t timestamp, void *arg,
+			  void (*callback)(void *, uint64_t, uint64_t, void *))
+{
+	return sc_timer_run(t, timestamp, arg, callback, NULL);
+}
+
+uint64_t sc_timer_timeout_batch(struct sc_timer *t, uint64_t timestamp,
+				void *arg,
+				void (*callback)(void *, struct sc_timer_data *,
+						 size_t))
+{
+	return sc_timer_run(t, timestamp, arg, NULL, callback);
+}
+
+uint64_t sc_timer_next_deadline(struct sc_timer *t)
+{
+	uint32_t i, list, slot;
+	uint64_t expiry, min = UINT64_MAX;
+
+	// Called from a callback, there are timers to expire right now. Or
+	// there are submitted commands to apply.
+	if (t->lists[SC_TIMER_EXPIRED] != SC_TIMER_NIL ||
+	    (t->ring != NULL && sc_timer_ring_pending(t))) {
+		return t->timestamp;
+	}
+
+	for (uint32_t level = 0; level < SC_TIMER_LEVELS; level++) {
+		if (t->pending[level] == 0) {
+			continue;
+		}
+
+		// Slots of a level cover disjoint ranges in order, the lowest
+		// one has the earliest timer of the level. Its range starts at
+		// its processing tick, higher levels can be skipped once that
+		// is after the minimum found so far.
+		slot = sc_timer_lsb(t->pending[level]);
+		if (sc_timer_slot_tick(t, level, slot) >= min) {
+			break;
+		}
+
+		list = level * SC_TIMER_SLOTS + slot;
+
+		if (t->dirty[level] & (1ull << slot)) {
+			t->dirty[level] &= ~(1ull << slot);
+			t->mins[list] = UINT64_MAX;
+
+			for (i = t->lists[list]; i != SC_TIMER_NIL;
+			     i = sc_timer_at(t, i)->next) {
+				expiry = sc_timer_expiry(t, i);
+				if (expiry < t->mins[list]) {
+					t->mins[list] = expiry;
+				}
+			}
+		}
+
+		min = t->mins[list] < min ? t->mins[list] : min;
+	}
+
+	if (min == UINT64_MAX) {
+		return SC_TIMER_INVALID;
 	}
 
-	return sc_timer_min(TICK - time, TICK);
+	return min < UINT64_MAX / t->tick ? min * t->tick : UINT64_MAX - 1;
 }
@@ -32,7 +32,7 @@
 #ifndef SC_TIMER_H
 #define SC_TIMER_H
 
-#define SC_TIMER_VERSION "2.0.0"
+#define SC_TIMER_VERSION "3.0.0"
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -48,27 +48,125 @@
 
 #define SC_TIMER_INVALID UINT64_MAX
 
+// Default tick, in timestamp units.
+#define SC_TIMER_TICK 16u
+
+// Each level has 64 slots, 11 levels cover the whole 64-bit tick range.
+#define SC_TIMER_BITS 6u
+#define SC_TIMER_SLOTS (1u << SC_TIMER_BITS)
+#define SC_TIMER_LEVELS 11u
+
+// Max items per sc_timer_timeout_batch() callback.
+#define SC_TIMER_BATCH 64u
+
 struct sc_timer_data {
 	uint64_t timeout;
 	uint64_t type;
 	void *data;
 };
 
+struct sc_timer_node {
+	struct sc_timer_data entry;
+	uint32_t next;
+	uint32_t prev;
+	uint32_t list;
+	uint32_t gen; // Incremented on each release, ids carry it.
+	uint32_t slack; // In ticks, see sc_timer_add_slack().
+};
+
+// Nodes are allocated in fixed size chunks, a chunk never moves. Indexes are
+// 'chunk << SC_TIMER_CHUNK_BITS | offset'.
+#define SC_TIMER_CHUNK_BITS 10u
+#define SC_TIMER_CHUNK (1u << SC_TIMER_CHUNK_BITS)
+
+struct sc_timer_chunk {
+	uint32_t used;
+	uint32_t free; // Free list head, offset in 'nodes'.
+	struct sc_timer_node nodes[SC_TIMER_CHUNK];
+};
+
+enum sc_timer_op
+{
+	SC_TIMER_OP_NONE, // Claimed slot of a failed submission.
+	SC_TIMER_OP_ADD,
+	SC_TIMER_OP_CANCEL,
+	SC_TIMER_OP_RESCHEDULE,
+};
+
+// Command submitted from other threads, see sc_timer_submit_add().
+struct sc_timer_cmd {
+	uint64_t seq;
+	enum sc_timer_op op;
+	uint64_t id;
+	uint64_t timeout;
+	uint64_t type;
+	void *data;
+};
+
+// Node id reserved by the timer's thread for submissions.
+struct sc_timer_reserved {
+	uint64_t seq;
+	uint64_t id;
+};
+
 struct sc_timer {
 	uint64_t timestamp;
-	uint32_t head;
-	uint32_t wheel;
-	struct sc_timer_data *list;
+	uint64_t tick;
+	uint64_t current; // Current tick, 'timestamp / tick'.
+	uint32_t count;
+	uint32_t cap;   // Node count of the allocated chunks.
+	uint32_t gen;   // Initial generation for the nodes of a new chunk.
+	uint32_t empty; // Allocated chunks without an active timer.
+
+	// Chunk table, released chunks leave a NULL gap to keep indexes.
+	uint32_t chunk_count;
+	struct sc_timer_chunk **chunks;
+	uint64_t *avail; // Bitmap of the chunks which have a free node.
+
+	// Non-empty slot bitmap per level.
+	uint64_t pending[SC_TIMER_LEVELS];
+	// Slots whose 'mins' entry may be lower than the actual minimum, after
+	// the earliest timer of the slot is removed.
+	uint64_t dirty[SC_TIMER_LEVELS];
+	// Earliest expiry tick per slot.
+	uint64_t mins[SC_TIMER_LEVELS * SC_TIMER_SLOTS];
+	// Slot lists, the extra one is for the timers expiring in this call.
+	uint32_t lists[SC_TIMER_LEVELS * SC_TIMER_SLOTS + 1];
+
+	// Bounded multi-producer ring, producers claim slots by CAS on 'tail',
+	// timer's thread drains from 'head'.
+	struct sc_timer_cmd *ring;
+	uint64_t ring_mask;
+	uint64_t ring_head;
+	uint64_t ring_tail;
+
+	// Nodes reserved in advance, so producers get timer ids at submission.
+	// Timer's thread pushes to 'tail', producers claim by CAS on 'head'.
+	struct sc_timer_reserved *ids;
+	uint64_t ids_head;
+	uint64_t ids_tail;
+	uint64_t ids_count; // Reserved ids which are not added yet.
 };
 
 /**
- * Init timer
+ * Init timer with the default tick, SC_TIMER_TICK.
  *
  * @param t         timer
  * @param timestamp current timestamp. Use monotonic timer source.
  */
 void sc_timer_init(struct sc_timer *t, uint64_t timestamp);
 
+/**
+ * Init timer with a custom tick. Tick is the resolution of the timer, in the
+ * same unit as timestamps. e.g., for microsecond resolution, pass microsecond
+ * timestamps and 'tick' as '1'.
+ *
+ * @param t         timer
+ * @param timestamp current timestamp. Use monotonic timer source.
+ * @param tick      tick, must be greater than zero.
+ */
+void sc_timer_init_tick(struct sc_timer *t, uint64_t timestamp, uint64_t tick);
+
 /**
  * Destroy timer.
  * @param t timer
@@ -81,6 +179,22 @@ void sc_timer_term(struct sc_timer *t);
  */
 void sc_timer_clear(struct sc_timer *t);
 
+/**
+ * Release all empty chunks, e.g., after sc_timer_clear(). Timers are
+ * allocated from the lowest chunks, so the higher ones drain after a burst.
+ * An empty chunk is also released automatically when less than half of the
+ * remaining capacity is in use.
+ *
+ * @param t timer
+ */
+void sc_timer_shrink(struct sc_timer *t);
+
+/**
+ * @param t timer
+ * @return  bytes allocated by the timer, excluding 'struct sc_timer' itself.
+ */
+size_t sc_timer_memory(struct sc_timer *t);
+
 /**
  * Add timer
  * 'timeout' is relative to latest 'timestamp' value given to the 'timer'.
@@ -99,22 +213,124 @@ void sc_timer_clear(struct sc_timer *t);
  * @param data    user data to pass into callback on 'sc_timer_timeout' call.
  * @param type    user data to pass into callback on 'sc_timer_timeout' call.
  * @return        SC_TIMER_INVALID on out of memory. Otherwise, timer id. You
- *                can cancel this timer via this id later.
+ *                can cancel or reschedule this timer via this id later. Ids
+ *                of expired or cancelled timers never match a new timer.
  */
 uint64_t sc_timer_add(struct sc_timer *t, uint64_t timeout, uint64_t type,
 		      void *data);
 
+/**
+ * Add timer which may expire up to 'slack' later than 'timeout'. Expiry is
+ * rounded up to the coarsest tick boundary within the window, so timers with
+ * overlapping windows expire on the same tick, in a single batch. Callback
+ * gets the rounded timeout. Slack is kept on sc_timer_reschedule().
+ *
+ * e.g., idle timeouts rarely need to be precise :
+ *     sc_timer_add_slack(&timer, 30000, 1000, 0, conn);
+ *
+ * @param t       timer
+ * @param timeout timeout
+ * @param slack   allowed delay, rounded down to the tick. '0' is same as
+ *                sc_timer_add().
+ * @param type    user data to pass into callback
+ * @param data    user data to pass into callback
+ * @return        SC_TIMER_INVALID on out of memory. Otherwise, timer id.
+ */
+uint64_t sc_timer_add_slack(struct sc_timer *t, uint64_t timeout,
+			    uint64_t slack, uint64_t type, void *data);
+
 /**
  * uint64_t id = sc_timer_add(&timer, arg, 10);
  * sc_timer_cancel(&timer, &id);
  *
+ * No-op if the timer has already expired or cancelled.
+ *
  * @param t  timer
- * @param id timer id
+ * @param id timer id, set to SC_TIMER_INVALID.
  */
 void sc_timer_cancel(struct sc_timer *t, uint64_t *id);
 
 /**
- * Checks timeouts and calls 'callback' function for each timeout.
+ * @param t  timer
+ * @param id timer id
+ * @return   'data' of the timer, NULL if it has already expired or cancelled.
+ *           Safe to call with any id value.
+ */
+void *sc_timer_data(struct sc_timer *t, uint64_t id);
+
+/**
+ * Move a timer to a new timeout in place, cheaper than cancel + add and
+ * it never allocates. Timer keeps its id.
+ *
+ * uint64_t id = sc_timer_add(&timer, 1000, 0, data);
+ * sc_timer_reschedule(&timer, &id, 1000); // e.g., on each heartbeat
+ *
+ * @param t       timer
+ * @param id      timer id, set to SC_TIMER_INVALID if timer is not active.
+ * @param timeout new timeout, relative to the latest timestamp like
+ *                sc_timer_add().
+ * @return        'true' if timer is rescheduled, 'false' if it has already
+ *                expired or cancelled.
+ */
+bool sc_timer_reschedule(struct sc_timer *t, uint64_t *id, uint64_t timeout);
+
+/**
+ * Enable submissions from other threads. Commands are queued in a lock-free
+ * ring and applied at the start of the next sc_timer_timeout() call, in
+ * submission order. Call it before sharing the timer with other threads.
+ *
+ * 'cap' timer nodes are reserved in advance, so producers get the timer id
+ * right away. Timer's thread reserves again as submitted timers are added.
+ *
+ * @param t   timer
+ * @param cap ring capacity, rounded up to a power of two.
+ * @return    '0' on success, negative number on out of memory.
+ */
+int sc_timer_submit_init(struct sc_timer *t, uint32_t cap);
+
+/**
+ * Thread-safe, lock-free. Same as sc_timer_add(), applied by the timer's
+ * thread. Timeout is relative to the timestamp of the sc_timer_timeout()
+ * call that applies it. If the timer's thread may be sleeping, wake it up.
+ *
+ * @param t       timer
+ * @param timeout timeout
+ * @param type    user data to pass into callback
+ * @param data    user data to pass into callback
+ * @param id      if not NULL, timer id is written into it. It can be passed
+ *                to sc_timer_submit_cancel() or sc_timer_submit_reschedule()
+ *                right away, commands are applied after the add.
+ * @return        '0' on success, negative number if the ring is full or
+ *                there is no reserved node left.
+ */
+int sc_timer_submit_add(struct sc_timer *t, uint64_t timeout, uint64_t type,
+			void *data, uint64_t *id);
+
+/**
+ * Thread-safe, lock-free. Same as sc_timer_cancel(), applied by the timer's
+ * thread.
+ *
+ * @param t  timer
+ * @param id timer id
+ * @return   '0' on success, negative number if the ring is full.
+ */
+int sc_timer_submit_cancel(struct sc_timer *t, uint64_t id);
+
+/**
+ * Thread-safe, lock-free. Same as sc_timer_reschedule(), applied by the
+ * timer's thread.
+ *
+ * @param t       timer
+ * @param id      timer id
+ * @param timeout new timeout
+ * @return        '0' on success, negative number if the ring is full.
+ */
+int sc_timer_submit_reschedule(struct sc_timer *t, uint64_t id,
+			       uint64_t timeout);
+
+/**
+ * Checks timeouts and calls 'callback' function for each timeout. Commands
+ * submitted from other threads are applied first.
  *
  * Logical pattern is :
  *
@@ -137,9 +353,48 @@ void sc_timer_cancel(struct sc_timer *t, uint64_t *id);
  *                  'timeout' is scheduled timeout for that timer.
  *                  'type' is what user passed on 'sc_timer_add'.
  *                  'data' is what user passed on 'sc_timer_add'.
- * @return          next timeout.
+ * @return          time until the next tick. Use sc_timer_next_deadline() to
+ *                  sleep until the next timer instead.
  */
 uint64_t sc_timer_timeout(struct sc_timer *t, uint64_t timestamp, void *arg,
 			  void (*callback)(void *arg, uint64_t timeout,
 					   uint64_t type, void *data));
+
+/**
+ * Same as sc_timer_timeout() but expired timers are passed in arrays, one
+ * call per tick, at most SC_TIMER_BATCH items per call. Timers in the array
+ * are already removed, 'items' is valid only during the callback.
+ *
+ * @param t         timer
+ * @param timestamp current timestamp
+ * @param arg       user data to user callback
+ * @param callback  'arg' is user data.
+ *                  'items' is expired timers of the same tick.
+ *                  'count' is item count.
+ * @return          time until the next tick.
+ */
+uint64_t sc_timer_timeout_batch(struct sc_timer *t, uint64_t timestamp,
+				void *arg,
+				void (*callback)(void *arg,
+						 struct sc_timer_data *items,
+						 size_t count));
+
+/**
+ * Earliest timestamp that sc_timer_timeout() will expire a timer, e.g.,
+ *
+ * deadline = sc_timer_next_deadline(&timer);
+ * if (deadline == SC_TIMER_INVALID) {
+ *      epoll_wait(fd, events, count, -1);
+ * } else {
+ *      epoll_wait(fd, events, count, deadline - time_ms());
+ * }
+ *
+ * Each slot keeps its earliest expiry, only a slot which lost its earliest
+ * timer is scanned again, once.
+ *
+ * @param t timer
+ * @return  deadline, aligned to the tick. SC_TIMER_INVALID if there is no
+ *          timer.
+ */
+uint64_t sc_timer_next_deadline(struct sc_timer *t);
 #endif
@@ -13,6 +13,8 @@
 #if defined(_WIN32) || defined(_WIN64)
 #include <windows.h>
 #else
+#include <pthread.h>
+#include <sched.h>
 #include <sys/time.h>
 #include <unistd.h>
 #endif
@@ -270,6 +272,448 @@ void test4(void)
 	sc_timer_term(&timer);
 }
 
+static uint64_t wheel_now;
+static uint64_t wheel_prev;
+static int wheel_count;
+
+static void wheel_callback(void *arg, uint64_t timeout, uint64_t type,
+			   void *data)
+{
+	(void) arg;
+	(void) data;
+
+	// 'type' is the expected expiry.
+	assert(timeout == type);
+	assert(timeout <= wheel_now);
+	assert(timeout > wheel_prev);
+	wheel_count--;
+}
+
+void test_wheel(void)
+{
+	uint64_t timeout, n;
+	uint64_t wheel_ids[2000];
+	struct sc_timer timer;
+
+	sc_timer_init_tick(&timer, 0, 1);
+
+	// Timeouts from a tick up to 2^37 ticks.
+	for (int i = 0; i < 2000; i++) {
+		timeout = 1 + ((uint64_t) rand() % (1ull << (rand() % 38)));
+		wheel_ids[i] = sc_timer_add(&timer, timeout, timeout, NULL);
+		assert(wheel_ids[i] != SC_TIMER_INVALID);
+		wheel_count++;
+	}
+
+	for (int i = 0; i < 2000; i += 4) {
+		sc_timer_cancel(&timer, &wheel_ids[i]);
+		wheel_count--;
+	}
+
+	assert(timer.count == 1500);
+
+	// Tick by tick, timers expire exactly at their deadline.
+	while (wheel_now < 100000) {
+		wheel_now++;
+		wheel_prev = wheel_now - 1;
+		n = sc_timer_timeout(&timer, wheel_now, NULL, wheel_callback);
+		assert(n == 1);
+	}
+
+	// Jumps, expired ones since the last call.
+	while (wheel_count > 0) {
+		wheel_prev = wheel_now;
+		wheel_now += 1 + (uint64_t) rand() % 10000000;
+		sc_timer_timeout(&timer, wheel_now, NULL, wheel_callback);
+		assert(timer.count == (uint32_t) wheel_count);
+	}
+
+	assert(timer.count == 0);
+	sc_timer_term(&timer);
+
+	// Coarse tick, timers never expire early and at most a tick late.
+	wheel_now = wheel_prev = 1000;
+	sc_timer_init_tick(&timer, wheel_now, 16);
+
+	for (int i = 0; i < 1000; i++) {
+		timeout = (uint64_t) rand() % 5000;
+		sc_timer_add(&timer, timeout, wheel_now + timeout, NULL);
+		wheel_count++;
+	}
+
+	while (wheel_count > 0) {
+		wheel_now++;
+		sc_timer_timeout(&timer, wheel_now, NULL, wheel_callback);
+		wheel_prev = wheel_now > 32 ? wheel_now - 32 : 0;
+	}
+
+	sc_timer_term(&timer);
+}
+
+static int resched_count;
+
+static void resched_callback(void *arg, uint64_t timeout, uint64_t type,
+			     void *data)
+{
+	(void) arg;
+	(void) timeout;
+	(void) data;
+
+	resched_count += (int) type;
+}
+
+void test_reschedule(void)
+{
+	uint64_t id, stale, copy;
+	struct sc_timer timer;
+
+	sc_timer_init_tick(&timer, 0, 1);
+
+	// Stale id doesn't cancel the timer which reuses the slot.
+	stale = sc_timer_add(&timer, 100, 1, NULL);
+	copy = stale;
+	sc_timer_cancel(&timer, &stale);
+	assert(stale == SC_TIMER_INVALID);
+
+	id = sc_timer_add(&timer, 100, 1, NULL);
+	assert((uint32_t) id == (uint32_t) copy && id != copy);
+	sc_timer_cancel(&timer, &copy);
+	assert(copy == SC_TIMER_INVALID);
+	assert(timer.count == 1);
+	assert(!sc_timer_reschedule(&timer, &stale, 10));
+
+	// Heartbeat, pushed back before each expiry.
+	for (uint64_t now = 50; now <= 1000; now += 50) {
+		sc_timer_timeout(&timer, now, NULL, resched_callback);
+		assert(sc_timer_reschedule(&timer, &id, 100));
+	}
+
+	assert(resched_count == 0);
+	sc_timer_timeout(&timer, 1099, NULL, resched_callback);
+	assert(resched_count == 0);
+	sc_timer_timeout(&timer, 1100, NULL, resched_callback);
+	assert(resched_count == 1);
+
+	// Expired one can't be rescheduled or cancelled.
+	copy = id;
+	assert(!sc_timer_reschedule(&timer, &id, 100));
+	assert(id == SC_TIMER_INVALID);
+	sc_timer_cancel(&timer, &copy);
+
+	// Pull in a far timer.
+	id = sc_timer_add(&timer, 1000000000, 1, NULL);
+	assert(sc_timer_reschedule(&timer, &id, 5));
+	sc_timer_timeout(&timer, 1105, NULL, resched_callback);
+	assert(resched_count == 2);
+	assert(timer.count == 0);
+
+	sc_timer_term(&timer);
+}
+
+void test_deadline(void)
+{
+	uint64_t ids[100], id;
+	struct sc_timer timer;
+
+	sc_timer_init(&timer, 1000);
+	assert(sc_timer_next_deadline(&timer) == SC_TIMER_INVALID);
+
+	// Aligned to the 16ms tick.
+	id = sc_timer_add(&timer, 10, 0, NULL);
+	assert(sc_timer_next_deadline(&timer) == 1024);
+	sc_timer_cancel(&timer, &id);
+	assert(sc_timer_next_deadline(&timer) == SC_TIMER_INVALID);
+	sc_timer_term(&timer);
+
+	// Clamped to the next tick, level 1 slot. Cancelling it must not leave
+	// its expiry as the slot minimum.
+	sc_timer_init_tick(&timer, 63, 1);
+	id = sc_timer_add(&timer, 0, 0, NULL);
+	sc_timer_add(&timer, 37, 0, NULL);
+	assert(sc_timer_next_deadline(&timer) == 64);
+	sc_timer_cancel(&timer, &id);
+	assert(sc_timer_next_deadline(&timer) == 100);
+	sc_timer_term(&timer);
+
+	sc_timer_init_tick(&timer, 0, 1);
+
+	// Same high level slot, deadline follows the earliest one as they are
+	// cancelled.
+	for (int i = 0; i < 100; i++) {
+		ids[i] = sc_timer_add(&timer, 600000 + (uint64_t) i * 10, 0,
+				      NULL);
+	}
+
+	for (int i = 0; i < 99; i++) {
+		assert(sc_timer_next_deadline(&timer) ==
+		       600000 + (uint64_t) i * 10);
+		sc_timer_cancel(&timer, &ids[i]);
+	}
+
+	assert(sc_timer_next_deadline(&timer) == 600990);
+
+	id = sc_timer_add(&timer, 7, 0, NULL);
+	assert(sc_timer_next_deadline(&timer) == 7);
+	assert(sc_timer_reschedule(&timer, &id, 700000));
+	assert(sc_timer_next_deadline(&timer) == 600990);
+
+	// Timers cascade down, deadline stays the same.
+	sc_timer_timeout(&timer, 600000, NULL, resched_callback);
+	assert(sc_timer_next_deadline(&timer) == 600990);
+	sc_timer_timeout(&timer, 600990, NULL, resched_callback);
+	assert(sc_timer_next_deadline(&timer) == 700000);
+
+	sc_timer_term(&timer);
+}
+
+static uint64_t slack_now;
+static uint64_t slack_tick;
+static int slack_ticks;
+static int slack_count;
+
+static void slack_callback(void *arg, struct sc_timer_data *items,
+			   size_t count)
+{
+	uint64_t timeout;
+
+	(void) arg;
+
+	assert(count > 0 && count <= SC_TIMER_BATCH);
+
+	if (slack_tick != slack_now) {
+		slack_tick = slack_now;
+		slack_ticks++;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		timeout = (uint64_t) (uintptr_t) items[i].data;
+		assert(items[i].timeout == slack_now);
+		assert(slack_now >= timeout && slack_now <= timeout + 200);
+		slack_count++;
+	}
+}
+
+void test_slack(void)
+{
+	uint64_t id, timeout;
+	struct sc_timer timer;
+
+	sc_timer_init_tick(&timer, 0, 1);
+
+	// Windows overlap, 1000 timers expire on a few ticks.
+	for (int i = 0; i < 1000; i++) {
+		timeout = 1000 + (uint64_t) (i % 100);
+		id = sc_timer_add_slack(&timer, timeout, 200, 0,
+					(void *) (uintptr_t) timeout);
+		assert(id != SC_TIMER_INVALID);
+	}
+
+	// Slack is kept on reschedule.
+	id = sc_timer_add_slack(&timer, 10, 200, 0, (void *) (uintptr_t) 1050);
+	assert(sc_timer_reschedule(&timer, &id, 1050));
+	assert(sc_timer_next_deadline(&timer) == 1024);
+
+	for (slack_now = 1; slack_now < 1400; slack_now++) {
+		sc_timer_timeout_batch(&timer, slack_now, NULL, slack_callback);
+	}
+
+	assert(slack_count == 1001);
+	assert(slack_ticks <= 3);
+	assert(timer.count == 0);
+
+	// Released nodes don't keep slack.
+	id = sc_timer_add(&timer, 77, 0, NULL);
+	assert(sc_timer_next_deadline(&timer) == 1399 + 77);
+	sc_timer_term(&timer);
+}
+
+static uint64_t memory_ids[3000];
+
+void test_memory(void)
+{
+	uint64_t id, stale;
+	size_t chunk = sizeof(struct sc_timer_chunk);
+	struct sc_timer timer;
+
+	sc_timer_init_tick(&timer, 0, 1);
+	assert(sc_timer_memory(&timer) == 0);
+
+	for (int i = 0; i < 3000; i++) {
+		memory_ids[i] = sc_timer_add(&timer, 100, 0, NULL);
+		assert(memory_ids[i] != SC_TIMER_INVALID);
+	}
+
+	assert(timer.cap == 3 * SC_TIMER_CHUNK);
+	assert(sc_timer_memory(&timer) >= 3 * chunk);
+
+	// Burst is over, empty chunks are released as timers go away.
+	stale = memory_ids[2999];
+	for (int i = 10; i < 3000; i++) {
+		sc_timer_cancel(&timer, &memory_ids[i]);
+	}
+
+	assert(timer.count == 10);
+	assert(timer.cap == SC_TIMER_CHUNK);
+	assert(sc_timer_memory(&timer) < 2 * chunk);
+
+	// Ids of the released chunks don't match the new timers in their place.
+	for (int i = 0; i < 3000; i++) {
+		id = sc_timer_add(&timer, 100, 0, NULL);
+		assert(id != SC_TIMER_INVALID && id != stale);
+	}
+
+	assert(!sc_timer_reschedule(&timer, &stale, 10));
+
+	sc_timer_timeout(&timer, 10000, NULL, resched_callback);
+	assert(timer.count == 0);
+	assert(timer.cap == SC_TIMER_CHUNK);
+
+	sc_timer_shrink(&timer);
+	assert(sc_timer_memory(&timer) == 0);
+
+	// Clear keeps memory until shrink.
+	for (int i = 0; i < 2000; i++) {
+		assert(sc_timer_add(&timer, 100, 0, NULL) != SC_TIMER_INVALID);
+	}
+
+	sc_timer_clear(&timer);
+	assert(sc_timer_memory(&timer) >= 2 * chunk);
+	sc_timer_shrink(&timer);
+	assert(sc_timer_memory(&timer) == 0);
+
+	id = sc_timer_add(&timer, 100, 0, NULL);
+	assert(id != SC_TIMER_INVALID);
+	assert(sc_timer_next_deadline(&timer) == 10100);
+
+	sc_timer_term(&timer);
+}
+
+static int submit_count;
+
+static void submit_callback(void *arg, uint64_t timeout, uint64_t type,
+			    void *data)
+{
+	(void) arg;
+	(void) timeout;
+	(void) data;
+
+	assert(type == 7);
+	submit_count++;
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+
+static struct sc_timer submit_timer;
+
+static void *submit_thread(void *arg)
+{
+	uint64_t id, timeout;
+
+	(void) arg;
+
+	// Every other timer is cancelled by the thread that added it, before
+	// it can expire.
+	for (int i = 0; i < 2500; i++) {
+		timeout = i % 2 == 1 ? 1000000000 : (uint64_t) i % 100;
+
+		while (sc_timer_submit_add(&submit_timer, timeout, 7, NULL,
+					   &id) != 0) {
+			sched_yield();
+		}
+
+		while (i % 2 == 1 &&
+		       sc_timer_submit_cancel(&submit_timer, id) != 0) {
+			sched_yield();
+		}
+	}
+
+	return NULL;
+}
+
+static void test_submit_threads(void)
+{
+	uint64_t now = 0;
+	pthread_t threads[4];
+
+	sc_timer_init_tick(&submit_timer, now, 1);
+	assert(sc_timer_submit_init(&submit_timer, 64) == 0);
+
+	for (int i = 0; i < 4; i++) {
+		assert(pthread_create(&threads[i], NULL, submit_thread, NULL) ==
+		       0);
+	}
+
+	while (submit_count < 5000) {
+		sc_timer_timeout(&submit_timer, ++now, NULL, submit_callback);
+		sched_yield();
+	}
+
+	for (int i = 0; i < 4; i++) {
+		assert(pthread_join(threads[i], NULL) == 0);
+	}
+
+	sc_timer_timeout(&submit_timer, now + 1000, NULL, submit_callback);
+	assert(submit_count == 5000);
+	assert(submit_timer.count == 0);
+	sc_timer_term(&submit_timer);
+}
+#else
+static void test_submit_threads(void)
+{
+	submit_count = 5000;
+}
+#endif
+
+void test_submit(void)
+{
+	uint64_t id, id2;
+	struct sc_timer timer;
+
+	test_submit_threads();
+	submit_count = 0;
+
+	sc_timer_init_tick(&timer, 0, 1);
+	assert(sc_timer_submit_init(&timer, 3) == 0);
+	assert(timer.ring_mask == 3);
+
+	// Ring is full.
+	for (int i = 0; i < 4; i++) {
+		assert(sc_timer_submit_add(&timer, 10, 7, NULL, NULL) == 0);
+	}
+	assert(sc_timer_submit_add(&timer, 10, 7, NULL, NULL) != 0);
+	assert(sc_timer_next_deadline(&timer) == 0);
+
+	sc_timer_timeout(&timer, 5, NULL, submit_callback);
+	assert(timer.count == 4);
+	sc_timer_timeout(&timer, 15, NULL, submit_callback);
+	assert(submit_count == 4);
+
+	// Ids are returned on submit, commands naming them are applied after
+	// the add.
+	assert(sc_timer_submit_add(&timer, 10, 7, NULL, &id) == 0);
+	assert(sc_timer_submit_add(&timer, 10, 7, NULL, &id2) == 0);
+	assert(id != SC_TIMER_INVALID && id2 != SC_TIMER_INVALID);
+	assert(id != id2);
+
+	// Not applied yet, owner's cancel is a no-op.
+	sc_timer_cancel(&timer, &(uint64_t){id});
+	sc_timer_timeout(&timer, 16, NULL, submit_callback);
+	assert(timer.count == 2);
+
+	assert(sc_timer_submit_reschedule(&timer, id, 100) == 0);
+	assert(sc_timer_submit_cancel(&timer, id2) == 0);
+	assert(sc_timer_submit_cancel(&timer, id2) == 0);
+	sc_timer_timeout(&timer, 30, NULL, submit_callback);
+	assert(submit_count == 4);
+	assert(timer.count == 1);
+	assert(sc_timer_next_deadline(&timer) == 130);
+
+	sc_timer_timeout(&timer, 130, NULL, submit_callback);
+	assert(submit_count == 5);
+
+	sc_timer_term(&timer);
+}
+
 #ifdef SC_HAVE_WRAP
 
 bool fail_malloc = false;
@@ -330,6 +774,12 @@ int main(void)
 	test2();
 	test3();
 	test4();
+	test_wheel();
+	test_reschedule();
+	test_deadline();
+	test_slack();
+	test_memory();
+	test_submit();
 
 	return 0;
 }